@@ -0,0 +1,613 @@
+/*
+ * CARBON Librarian - SYSEX Bulk Transfer of the External Flash
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Reads and writes the CARBON external flash (songs and config) over the
+ * SYSEX bulk transfer protocol described in src/seq/sysex.c.
+ *
+ * The MIDI port can be an ALSA raw MIDI device (hw:1,0 or a /dev/snd
+ * path), any other character device, or a pair of files or pipes. The
+ * -x option runs a command and talks to it over its stdin and stdout,
+ * which is used with sim/sim_sysex_dev to test without hardware.
+ *
+ * Usage: carbon_librarian [options] command
+ *   -d device - MIDI device - hw:card,device or a path
+ *   -i file - read MIDI from a file or pipe
+ *   -o file - write MIDI to a file or pipe
+ *   -x command - run a command and use its stdin and stdout
+ *   -w window - read window in blocks (default 16)
+ *
+ * Commands:
+ *   read addr len file - read flash to a file
+ *   write addr file - write a file to flash - addr must be sector aligned
+ *   backup file - read the whole flash to a file
+ *   restore file - write a whole flash file back
+ *
+ */
+#include "config.h"
+#include "midi/midi_protocol.h"
+#include "seq/sysex.h"
+#include "seq/sysex_bulk.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// settings
+#define LIB_FLASH_SIZE 0x200000  // size of the external flash
+#define LIB_SECTOR_SIZE 0x1000  // erase sector size of the external flash
+#define LIB_MAX_MSG 512  // max SYSEX message length
+#define LIB_DEFAULT_WINDOW 16  // default read window in blocks
+#define LIB_RESEND_MS 150  // time without progress before resending
+#define LIB_TIMEOUT_MS 5000  // time without progress before giving up
+#define LIB_START_RETRIES 20  // times to retry a start if the device is busy
+
+// state
+struct lib_state {
+    int in_fd;  // MIDI input
+    int out_fd;  // MIDI output
+    pid_t child;  // command being run - 0 = none
+    int window;  // read window in blocks
+    uint8_t rx_buf[LIB_MAX_MSG];  // SYSEX message being received
+    int rx_len;  // bytes received - 0 = not in a message
+    int retransmits;  // number of times the transfer went back
+};
+struct lib_state libs;
+
+// local functions
+int lib_open_device(char *dev);
+int lib_run_command(char *cmd);
+void lib_close(void);
+int lib_read(uint32_t addr, uint32_t len, char *filename);
+int lib_write(uint32_t addr, char *filename);
+int lib_send(uint8_t *buf, int len);
+int lib_send_start(int cmd, uint32_t addr, uint32_t len, int window);
+int lib_send_ack(uint32_t next, uint32_t window_end, int flags);
+int lib_recv_msg(int timeout);
+int lib_check_error(int cmd);
+uint64_t lib_time_ms(void);
+void lib_usage(char *prog);
+
+int main(int argc, char **argv) {
+    char *dev = NULL;
+    char *in_file = NULL;
+    char *out_file = NULL;
+    char *cmd = NULL;
+    int opt, ret = -1;
+
+    libs.window = LIB_DEFAULT_WINDOW;
+    libs.in_fd = -1;
+    libs.out_fd = -1;
+    while((opt = getopt(argc, argv, "d:i:o:x:w:")) != -1) {
+        switch(opt) {
+            case 'd':
+                dev = optarg;
+                break;
+            case 'i':
+                in_file = optarg;
+                break;
+            case 'o':
+                out_file = optarg;
+                break;
+            case 'x':
+                cmd = optarg;
+                break;
+            case 'w':
+                libs.window = atoi(optarg);
+                if(libs.window < 1 || libs.window > 127) {
+                    fprintf(stderr, "window must be 1-127\n");
+                    return 1;
+                }
+                break;
+            default:
+                lib_usage(argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc) {
+        lib_usage(argv[0]);
+        return 1;
+    }
+
+    // open the MIDI port
+    if(cmd != NULL) {
+        if(lib_run_command(cmd) == -1) {
+            return 1;
+        }
+    }
+    else if(in_file != NULL && out_file != NULL) {
+        libs.in_fd = open(in_file, O_RDONLY);
+        libs.out_fd = open(out_file, O_WRONLY);
+        if(libs.in_fd == -1 || libs.out_fd == -1) {
+            perror("error opening MIDI files");
+            return 1;
+        }
+    }
+    else if(dev != NULL) {
+        if(lib_open_device(dev) == -1) {
+            return 1;
+        }
+    }
+    else {
+        fprintf(stderr, "no MIDI port given\n");
+        lib_usage(argv[0]);
+        return 1;
+    }
+
+    // run the command
+    if(strcmp(argv[optind], "read") == 0 && (argc - optind) == 4) {
+        ret = lib_read(strtoul(argv[optind + 1], NULL, 0),
+            strtoul(argv[optind + 2], NULL, 0), argv[optind + 3]);
+    }
+    else if(strcmp(argv[optind], "write") == 0 && (argc - optind) == 3) {
+        ret = lib_write(strtoul(argv[optind + 1], NULL, 0), argv[optind + 2]);
+    }
+    else if(strcmp(argv[optind], "backup") == 0 && (argc - optind) == 2) {
+        ret = lib_read(0, LIB_FLASH_SIZE, argv[optind + 1]);
+    }
+    else if(strcmp(argv[optind], "restore") == 0 && (argc - optind) == 2) {
+        ret = lib_write(0, argv[optind + 1]);
+    }
+    else {
+        lib_usage(argv[0]);
+    }
+    lib_close();
+    return (ret == -1) ? 1 : 0;
+}
+
+//
+// local functions
+//
+// open a MIDI device - hw:card,device is an ALSA raw MIDI device
+// returns -1 on error
+int lib_open_device(char *dev) {
+    char path[64];
+    int card, device = 0;
+    if(sscanf(dev, "hw:%d,%d", &card, &device) >= 1) {
+        snprintf(path, sizeof(path), "/dev/snd/midiC%dD%d", card, device);
+        dev = path;
+    }
+    libs.in_fd = open(dev, O_RDWR);
+    if(libs.in_fd == -1) {
+        perror(dev);
+        return -1;
+    }
+    libs.out_fd = libs.in_fd;
+    return 0;
+}
+
+// run a command and connect to its stdin and stdout
+// returns -1 on error
+int lib_run_command(char *cmd) {
+    int to_child[2], from_child[2];
+    if(pipe(to_child) == -1 || pipe(from_child) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    libs.child = fork();
+    if(libs.child == -1) {
+        perror("fork");
+        return -1;
+    }
+    if(libs.child == 0) {
+        dup2(to_child[0], STDIN_FILENO);
+        dup2(from_child[1], STDOUT_FILENO);
+        close(to_child[0]);
+        close(to_child[1]);
+        close(from_child[0]);
+        close(from_child[1]);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        perror("exec");
+        _exit(1);
+    }
+    close(to_child[0]);
+    close(from_child[1]);
+    libs.out_fd = to_child[1];
+    libs.in_fd = from_child[0];
+    return 0;
+}
+
+// close the MIDI port and wait for the command to finish
+void lib_close(void) {
+    if(libs.out_fd != libs.in_fd) {
+        close(libs.out_fd);
+    }
+    close(libs.in_fd);
+    if(libs.child > 0) {
+        waitpid(libs.child, NULL, 0);
+    }
+}
+
+// read flash to a file
+// returns -1 on error
+int lib_read(uint32_t addr, uint32_t len, char *filename) {
+    uint8_t block[SYSEX_BULK_BLOCK_SIZE];
+    uint8_t *data;
+    uint32_t seq, next = 0, blocks;
+    uint64_t start_time, progress_time, nak_time = 0;
+    int ret, tries = 0;
+    FILE *fp;
+    if(len < 1 || (addr + len) > LIB_FLASH_SIZE) {
+        fprintf(stderr, "read range is outside the flash\n");
+        return -1;
+    }
+    blocks = SYSEX_BULK_NUM_BLOCKS(len);
+    data = malloc(len);
+    if(data == NULL) {
+        return -1;
+    }
+    start_time = lib_time_ms();
+    progress_time = start_time;
+    if(lib_send_start(SYSEX_CMD_BULK_READ_START, addr, len, libs.window) == -1) {
+        free(data);
+        return -1;
+    }
+    while(next < blocks) {
+        ret = lib_recv_msg(LIB_RESEND_MS);
+        if((lib_time_ms() - progress_time) > LIB_TIMEOUT_MS) {
+            fprintf(stderr, "read timed out at block: %d\n", next);
+            free(data);
+            return -1;
+        }
+        // no progress - the start or acks might have been lost
+        if((lib_time_ms() - progress_time) > LIB_RESEND_MS &&
+                (lib_time_ms() - nak_time) > LIB_RESEND_MS) {
+            nak_time = lib_time_ms();
+            if(next == 0 && tries < LIB_START_RETRIES) {
+                tries ++;
+                lib_send_start(SYSEX_CMD_BULK_READ_START, addr, len,
+                    libs.window);
+            }
+            else {
+                lib_send_ack(next, next + libs.window, SYSEX_BULK_FLAG_NAK);
+            }
+            libs.retransmits ++;
+        }
+        if(ret == 0) {
+            continue;
+        }
+        if(lib_check_error(SYSEX_CMD_BULK_READ_START) == -1) {
+            free(data);
+            return -1;
+        }
+        if(libs.rx_buf[5] != SYSEX_CMD_BULK_DATA) {
+            continue;
+        }
+        ret = sysex_bulk_decode_data(libs.rx_buf, libs.rx_len, &seq, block);
+        // bad, repeated or out of order block - ack again at most once
+        // per resend time in case our acks were lost
+        if(ret < 1 || seq != next || (seq * SYSEX_BULK_BLOCK_SIZE + ret) > len) {
+            if((lib_time_ms() - nak_time) > LIB_RESEND_MS) {
+                nak_time = lib_time_ms();
+                lib_send_ack(next, next + libs.window, SYSEX_BULK_FLAG_NAK);
+                libs.retransmits ++;
+            }
+            continue;
+        }
+        memcpy(data + (seq * SYSEX_BULK_BLOCK_SIZE), block, ret);
+        next ++;
+        progress_time = lib_time_ms();
+        lib_send_ack(next, next + libs.window, 0);
+    }
+    fp = fopen(filename, "wb");
+    if(fp == NULL) {
+        perror(filename);
+        free(data);
+        return -1;
+    }
+    if(fwrite(data, 1, len, fp) != len) {
+        perror(filename);
+        fclose(fp);
+        free(data);
+        return -1;
+    }
+    fclose(fp);
+    free(data);
+    fprintf(stderr, "read %d bytes in %.2f s - %.1f KB/s - %d retransmits\n",
+        len, (lib_time_ms() - start_time) / 1000.0,
+        len / 1.024 / (lib_time_ms() - start_time + 1), libs.retransmits);
+    return 0;
+}
+
+// write a file to flash
+// returns -1 on error
+int lib_write(uint32_t addr, char *filename) {
+    uint8_t msg[SYSEX_BULK_DATA_MSG_MAXLEN];
+    uint8_t *data;
+    uint32_t len, blocks, next = 0, acked = 0, window_end = 0;
+    uint32_t ack_next, ack_end, block_len;
+    uint64_t start_time, progress_time, resend_time = 0;
+    int ret, flags, started = 0, tries = 0;
+    long file_len;
+    FILE *fp;
+    if(addr & (LIB_SECTOR_SIZE - 1)) {
+        fprintf(stderr, "write address must be sector aligned\n");
+        return -1;
+    }
+    fp = fopen(filename, "rb");
+    if(fp == NULL) {
+        perror(filename);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    file_len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if(file_len < 1 || (addr + file_len) > LIB_FLASH_SIZE) {
+        fprintf(stderr, "file does not fit in the flash\n");
+        fclose(fp);
+        return -1;
+    }
+    len = file_len;
+    data = malloc(len);
+    if(data == NULL || fread(data, 1, len, fp) != len) {
+        perror(filename);
+        fclose(fp);
+        free(data);
+        return -1;
+    }
+    fclose(fp);
+    blocks = SYSEX_BULK_NUM_BLOCKS(len);
+
+    start_time = lib_time_ms();
+    progress_time = start_time;
+    lib_send_start(SYSEX_CMD_BULK_WRITE_START, addr, len, 0);
+    while(1) {
+        // send blocks inside the window
+        while(started && next < window_end) {
+            block_len = len - (next * SYSEX_BULK_BLOCK_SIZE);
+            if(block_len > SYSEX_BULK_BLOCK_SIZE) {
+                block_len = SYSEX_BULK_BLOCK_SIZE;
+            }
+            lib_send(msg, sysex_bulk_encode_data(next,
+                data + (next * SYSEX_BULK_BLOCK_SIZE), block_len, msg));
+            next ++;
+        }
+        ret = lib_recv_msg(LIB_RESEND_MS);
+        if((lib_time_ms() - progress_time) > LIB_TIMEOUT_MS) {
+            fprintf(stderr, "write timed out at block: %d\n", acked);
+            free(data);
+            return -1;
+        }
+        // no progress - go back to the acked point
+        if((lib_time_ms() - progress_time) > LIB_RESEND_MS &&
+                (lib_time_ms() - resend_time) > LIB_RESEND_MS) {
+            resend_time = lib_time_ms();
+            if(!started) {
+                lib_send_start(SYSEX_CMD_BULK_WRITE_START, addr, len, 0);
+            }
+            if(next > acked) {
+                next = acked;
+                libs.retransmits ++;
+            }
+            // the done ack might be lost - the last block gets it resent
+            else if(started && acked == blocks) {
+                next = blocks - 1;
+            }
+        }
+        if(ret == 0) {
+            continue;
+        }
+        ret = lib_check_error(SYSEX_CMD_BULK_WRITE_START);
+        // the device is still finishing a transfer that was stopped
+        if(ret == -2 && !started && tries < LIB_START_RETRIES) {
+            tries ++;
+            usleep(LIB_RESEND_MS * 1000);
+            lib_send_start(SYSEX_CMD_BULK_WRITE_START, addr, len, 0);
+            continue;
+        }
+        if(ret < 0) {
+            free(data);
+            return -1;
+        }
+        if(sysex_bulk_decode_ack(libs.rx_buf, libs.rx_len, &ack_next,
+                &ack_end, &flags) == -1) {
+            continue;
+        }
+        if(flags & SYSEX_BULK_FLAG_DONE) {
+            if(started && ack_next == blocks) {
+                break;
+            }
+            continue;
+        }
+        // a stale ack or one for blocks that were never sent
+        if(ack_next < acked || ack_next > next) {
+            continue;
+        }
+        started = 1;
+        if(ack_next > acked) {
+            acked = ack_next;
+            progress_time = lib_time_ms();
+        }
+        window_end = ack_end;
+        if(window_end > blocks) {
+            window_end = blocks;
+        }
+        if(flags & SYSEX_BULK_FLAG_NAK) {
+            next = ack_next;
+            libs.retransmits ++;
+        }
+    }
+    free(data);
+    fprintf(stderr, "wrote %d bytes in %.2f s - %.1f KB/s - %d retransmits\n",
+        len, (lib_time_ms() - start_time) / 1000.0,
+        len / 1.024 / (lib_time_ms() - start_time + 1), libs.retransmits);
+    return 0;
+}
+
+// send bytes to the MIDI port
+// returns -1 on error
+int lib_send(uint8_t *buf, int len) {
+    if(write(libs.out_fd, buf, len) != len) {
+        perror("MIDI write");
+        return -1;
+    }
+    return 0;
+}
+
+// send a bulk read or write start - the window is only used for reads
+// returns -1 on error
+int lib_send_start(int cmd, uint32_t addr, uint32_t len, int window) {
+    uint8_t msg[SYSEX_BULK_READ_START_MSG_LEN];
+    int count = 0;
+    msg[count++] = MIDI_SYSEX_START;
+    msg[count++] = SYSEX_MMA_ID0;
+    msg[count++] = SYSEX_MMA_ID1;
+    msg[count++] = SYSEX_MMA_ID2;
+    msg[count++] = MIDI_DEV_TYPE;
+    msg[count++] = cmd;
+    count += sysex_bulk_val_to_7bit(addr, msg + count, SYSEX_BULK_VAL_LEN);
+    count += sysex_bulk_val_to_7bit(len, msg + count, SYSEX_BULK_VAL_LEN);
+    if(cmd == SYSEX_CMD_BULK_READ_START) {
+        msg[count++] = window & 0x7f;
+    }
+    msg[count++] = MIDI_SYSEX_END;
+    return lib_send(msg, count);
+}
+
+// send a bulk ack
+// returns -1 on error
+int lib_send_ack(uint32_t next, uint32_t window_end, int flags) {
+    uint8_t msg[SYSEX_BULK_ACK_MSG_LEN];
+    return lib_send(msg, sysex_bulk_encode_ack(next, window_end, flags, msg));
+}
+
+// receive a SYSEX message for CARBON into rx_buf
+// returns the message length or 0 on timeout
+int lib_recv_msg(int timeout) {
+    static uint8_t buf[1024];
+    static int buf_len = 0, buf_pos = 0;
+    struct pollfd pfd;
+    uint64_t end_time = lib_time_ms() + timeout;
+    uint8_t data;
+    int wait;
+    pfd.fd = libs.in_fd;
+    pfd.events = POLLIN;
+    while(1) {
+        // get more bytes
+        if(buf_pos == buf_len) {
+            wait = end_time - lib_time_ms();
+            if(wait < 0 || poll(&pfd, 1, wait) < 1) {
+                return 0;
+            }
+            buf_len = read(libs.in_fd, buf, sizeof(buf));
+            buf_pos = 0;
+            if(buf_len < 1) {
+                // the other end has closed - wait out the timeout
+                buf_len = 0;
+                wait = end_time - lib_time_ms();
+                if(wait > 0) {
+                    usleep(wait * 1000);
+                }
+                return 0;
+            }
+        }
+        data = buf[buf_pos++];
+        // realtime messages can be mixed in
+        if(data >= MIDI_TIMING_TICK) {
+            continue;
+        }
+        if(data == MIDI_SYSEX_START) {
+            libs.rx_len = 0;
+            libs.rx_buf[libs.rx_len++] = data;
+            continue;
+        }
+        // other status bytes end a message with no end
+        if(data & 0x80 && data != MIDI_SYSEX_END) {
+            libs.rx_len = 0;
+            continue;
+        }
+        if(libs.rx_len == 0) {
+            continue;
+        }
+        if(libs.rx_len == LIB_MAX_MSG) {
+            libs.rx_len = 0;
+            continue;
+        }
+        libs.rx_buf[libs.rx_len++] = data;
+        if(data != MIDI_SYSEX_END) {
+            continue;
+        }
+        // check the header
+        if(libs.rx_len >= (SYSEX_BULK_HEADER_LEN + 1) &&
+                libs.rx_buf[1] == SYSEX_MMA_ID0 &&
+                libs.rx_buf[2] == SYSEX_MMA_ID1 &&
+                libs.rx_buf[3] == SYSEX_MMA_ID2 &&
+                libs.rx_buf[4] == MIDI_DEV_TYPE) {
+            return libs.rx_len;
+        }
+        libs.rx_len = 0;
+    }
+}
+
+// check if the received message is an error response for a command
+// returns 0 if not, -2 if the device is busy or -1 for other errors
+int lib_check_error(int cmd) {
+    if(libs.rx_buf[5] != SYSEX_CMD_ERROR_CODE || libs.rx_len != 9 ||
+            libs.rx_buf[6] != cmd) {
+        return 0;
+    }
+    switch(libs.rx_buf[7]) {
+        case SYSEX_ERROR_OK:
+            return 0;
+        case SYSEX_ERROR_BUSY:
+            return -2;
+        case SYSEX_ERROR_BAD_ADDRESS:
+            fprintf(stderr, "device error: bad address\n");
+            break;
+        case SYSEX_ERROR_EXT_FLASH_ERROR:
+            fprintf(stderr, "device error: flash error\n");
+            break;
+        case SYSEX_ERROR_TIMEOUT:
+            fprintf(stderr, "device error: transfer timed out\n");
+            break;
+        default:
+            fprintf(stderr, "device error: %d\n", libs.rx_buf[7]);
+            break;
+    }
+    return -1;
+}
+
+// get the time in ms
+uint64_t lib_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+// print the usage
+void lib_usage(char *prog) {
+    fprintf(stderr, "usage: %s [-d device | -i file -o file | -x command] "
+        "[-w window] command\n", prog);
+    fprintf(stderr, "  -d device - MIDI device - hw:card,device or a path\n");
+    fprintf(stderr, "  -i file - read MIDI from a file or pipe\n");
+    fprintf(stderr, "  -o file - write MIDI to a file or pipe\n");
+    fprintf(stderr, "  -x command - run a command and use its stdin and stdout\n");
+    fprintf(stderr, "  -w window - read window in blocks (default %d)\n",
+        LIB_DEFAULT_WINDOW);
+    fprintf(stderr, "commands:\n");
+    fprintf(stderr, "  read addr len file - read flash to a file\n");
+    fprintf(stderr, "  write addr file - write a file to flash\n");
+    fprintf(stderr, "  backup file - read the whole flash to a file\n");
+    fprintf(stderr, "  restore file - write a whole flash file back\n");
+}
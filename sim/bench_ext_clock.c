@@ -0,0 +1,274 @@
+/*
+ * CARBON Host Simulator - External Clock Recovery Test Bench
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Feeds synthetic 24PPQ clock streams into the MIDI clock in external
+ * sync mode and measures how well the internal clock follows. Each stream
+ * starts with a MIDI start and then has clock ticks on an ideal schedule
+ * with jitter added to the arrival times. Ticks arriving are handed to the
+ * clock on the next 1ms task like the sequencer does.
+ *
+ * Phase error is the time the internal clock ran each 4th 96PPQ tick
+ * minus the ideal time of the external tick it should line up with. The
+ * steady state error is measured over the last MEASURE_MS of each stream.
+ * Streams with a tempo step also report the time to lock again and the
+ * peak error after the step.
+ *
+ * The locked loop bandwidth is fixed at build time. To try another one
+ * rebuild with CFLAGS including -DMIDI_CLOCK_EXT_PLL_BW_LOCKED=<Hz>.
+ *
+ */
+#include "config.h"
+#include "midi/midi_clock.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// settings
+#define BENCH_TASK_INTERVAL_US 1000  // RT task interval
+#define BENCH_MEASURE_MS 10000  // steady state window at the end of each stream
+#define BENCH_MAX_TICKS 8192  // max external ticks per stream
+
+// a test stream
+struct bench_stream {
+    const char *name;
+    int run_ms;  // length of the stream
+    float tempo;  // start tempo
+    float tempo_end;  // tempo at the end for drift or after the step
+    int step_ms;  // time of the tempo step - 0 for a linear drift to tempo_end
+    int jitter_us;  // max arrival jitter - uniform +/-
+};
+
+static const struct bench_stream bench_streams[] = {
+    {"120 BPM steady", 30000, 120.0, 120.0, 0, 0},
+    {"120 BPM +/-1ms jitter", 30000, 120.0, 120.0, 0, 1000},
+    {"120 BPM +/-3ms jitter", 30000, 120.0, 120.0, 0, 3000},
+    {"60 BPM +/-2ms jitter", 30000, 60.0, 60.0, 0, 2000},
+    {"240 BPM +/-2ms jitter", 30000, 240.0, 240.0, 0, 2000},
+    {"120-126 BPM drift", 30000, 120.0, 126.0, 0, 1000},
+    {"120-140 BPM step", 30000, 120.0, 140.0, 10000, 1000},
+    {"140-100 BPM step", 30000, 140.0, 100.0, 10000, 1000}
+};
+#define BENCH_NUM_STREAMS (sizeof(bench_streams) / sizeof(struct bench_stream))
+
+// bench state
+struct bench_state {
+    int64_t time_us;  // virtual time
+    int64_t clock_timer_us;  // virtual clock timer compare time
+    int64_t ideal[BENCH_MAX_TICKS];  // ideal external tick times
+    int64_t arrive[BENCH_MAX_TICKS];  // jittered external tick arrival times
+    int num_ticks;  // number of external ticks in the stream
+    int64_t measure_start;  // start of the steady state window
+    int64_t step_time;  // time of the tempo step
+    // results
+    int64_t err_count;  // steady state error samples
+    double err_sum;  // sum of error
+    double err_sq_sum;  // sum of error squared
+    int err_max;  // max steady state error magnitude
+    int step_peak;  // max error magnitude after the step
+    uint32_t rand;  // jitter random state
+};
+struct bench_state bstate;
+
+// local functions
+void bench_make_stream(const struct bench_stream *bs);
+void bench_run_stream(const struct bench_stream *bs);
+void bench_timer_task(void);
+int bench_rand(int range);
+
+// main!
+int main(int argc, char **argv) {
+    int i;
+
+    printf("%-24s %8s %8s %8s %8s %8s %8s\n", "stream", "lock ms", "mean us",
+        "rms us", "max us", "relock", "peak us");
+    for(i = 0; i < BENCH_NUM_STREAMS; i ++) {
+        midi_clock_init();
+        midi_clock_set_source(MIDI_CLOCK_EXTERNAL);
+        bench_make_stream(&bench_streams[i]);
+        bench_run_stream(&bench_streams[i]);
+    }
+    return 0;
+}
+
+//
+// callbacks
+//
+// the clock ticked for a straight count - measure the phase error
+void midi_clock_ticked_straight(uint32_t tick_count) {
+    int tick, err;
+    if(!midi_clock_get_running() || (tick_count % MIDI_CLOCK_UPSAMPLE) != 0) {
+        return;
+    }
+    // the internal clock leads by one external tick
+    tick = (tick_count / MIDI_CLOCK_UPSAMPLE) - 1;
+    if(tick < 0 || tick >= bstate.num_ticks) {
+        return;
+    }
+#ifdef MIDI_CLOCK_TICK_TIMER
+    err = bstate.clock_timer_us - bstate.ideal[tick];
+#else
+    err = bstate.time_us - bstate.ideal[tick];
+#endif
+    if(bstate.step_time && bstate.ideal[tick] >= bstate.step_time &&
+            abs(err) > bstate.step_peak) {
+        bstate.step_peak = abs(err);
+    }
+    if(bstate.ideal[tick] >= bstate.measure_start) {
+        bstate.err_count ++;
+        bstate.err_sum += err;
+        bstate.err_sq_sum += (double)err * (double)err;
+        if(abs(err) > bstate.err_max) {
+            bstate.err_max = abs(err);
+        }
+    }
+}
+
+// get the clock timer time in us
+uint32_t clock_timer_get_time(void) {
+    return (uint32_t)bstate.time_us;
+}
+
+//
+// local functions
+//
+// make the ideal and arrival times for a stream
+void bench_make_stream(const struct bench_stream *bs) {
+    double t, tempo;
+    int64_t run_us = (int64_t)bs->run_ms * 1000;
+    int i;
+
+    bstate.rand = 12345;
+    bstate.step_time = (int64_t)bs->step_ms * 1000;
+    bstate.measure_start = run_us - ((int64_t)BENCH_MEASURE_MS * 1000);
+    // the start is sent at 1s and the first tick follows one interval later
+    t = 1000000.0;
+    for(i = 0; i < BENCH_MAX_TICKS; i ++) {
+        if(bs->step_ms) {
+            tempo = (t < bstate.step_time) ? bs->tempo : bs->tempo_end;
+        }
+        else {
+            tempo = bs->tempo + ((bs->tempo_end - bs->tempo) * (t / (double)run_us));
+        }
+        t += 60000000.0 / (tempo * 24.0);
+        if(t >= run_us) {
+            break;
+        }
+        bstate.ideal[i] = (int64_t)t;
+        bstate.arrive[i] = bstate.ideal[i];
+        if(bs->jitter_us) {
+            bstate.arrive[i] += bench_rand(bs->jitter_us * 2 + 1) - bs->jitter_us;
+        }
+    }
+    bstate.num_ticks = i;
+}
+
+// run a stream and print the results
+void bench_run_stream(const struct bench_stream *bs) {
+    int64_t run_us = (int64_t)bs->run_ms * 1000;
+    int64_t start_us = 1000000;
+    int64_t lock_time = -1, relock_time = -1;
+    int tick = 0;
+    double mean;
+
+    bstate.time_us = 0;
+    bstate.clock_timer_us = 0;
+    bstate.err_count = 0;
+    bstate.err_sum = 0.0;
+    bstate.err_sq_sum = 0.0;
+    bstate.err_max = 0;
+    bstate.step_peak = 0;
+    while(bstate.time_us < run_us) {
+        bench_timer_task();
+        // deliver what arrived during the last period
+        if(start_us && bstate.time_us >= start_us) {
+            midi_clock_midi_rx_start();
+            start_us = 0;
+        }
+        while(tick < bstate.num_ticks && bstate.arrive[tick] <= bstate.time_us) {
+            midi_clock_midi_rx_tick();
+            tick ++;
+        }
+        // lock times
+        if(midi_clock_is_ext_locked()) {
+            if(lock_time < 0) {
+                lock_time = bstate.time_us;
+            }
+            if(bstate.step_time && relock_time < 0 && bstate.time_us > bstate.step_time) {
+                relock_time = bstate.time_us;
+            }
+        }
+        else if(bstate.step_time && bstate.time_us > bstate.step_time) {
+            relock_time = -1;
+        }
+    }
+
+    printf("%-24s ", bs->name);
+    if(lock_time < 0) {
+        printf("%8s ", "none");
+    }
+    else {
+        printf("%8d ", (int)((lock_time - bstate.ideal[0]) / 1000));
+    }
+    if(bstate.err_count) {
+        mean = bstate.err_sum / bstate.err_count;
+        printf("%8.0f %8.0f %8d ", mean,
+            sqrt((bstate.err_sq_sum / bstate.err_count) - (mean * mean)),
+            bstate.err_max);
+    }
+    else {
+        printf("%8s %8s %8s ", "-", "-", "-");
+    }
+    if(bstate.step_time) {
+        if(relock_time < 0) {
+            printf("%8s ", "none");
+        }
+        else {
+            printf("%8d ", (int)((relock_time - bstate.step_time) / 1000));
+        }
+        printf("%8d", bstate.step_peak);
+    }
+    else {
+        printf("%8s %8s", "-", "-");
+    }
+    printf("\n");
+}
+
+// run one 1ms task period - clock timer compares and then the RT task
+void bench_timer_task(void) {
+#ifdef MIDI_CLOCK_TICK_TIMER
+    uint32_t next_time;
+    while(bstate.clock_timer_us < (bstate.time_us + BENCH_TASK_INTERVAL_US)) {
+        next_time = midi_clock_tick_task((uint32_t)bstate.clock_timer_us);
+        if((int32_t)(next_time - (uint32_t)bstate.clock_timer_us) < 1) {
+            next_time = (uint32_t)bstate.clock_timer_us + 1;
+        }
+        bstate.clock_timer_us += (int32_t)(next_time - (uint32_t)bstate.clock_timer_us);
+    }
+#endif
+    bstate.time_us += BENCH_TASK_INTERVAL_US;
+    midi_clock_timer_task();
+}
+
+// get a random number from 0 to range - 1
+int bench_rand(int range) {
+    bstate.rand = (bstate.rand * 1103515245) + 12345;
+    return (bstate.rand >> 8) % range;
+}
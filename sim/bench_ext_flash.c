@@ -0,0 +1,429 @@
+/*
+ * CARBON Sequencer Host Benchmark - External Flash Load and Save
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Runs ext_flash.c loads and saves against a stub SPI flash transport
+ * that takes as long as the real part would. Transfers take a fixed DMA
+ * setup time plus the time to clock the bytes at the SPI3 rate. Page
+ * programs and sector erases keep the busy flag set for their typical
+ * time after the command is sent. rt_prof counts are virtual us so the
+ * ext_flash timings can be printed directly.
+ *
+ * Each load and save is run two ways:
+ *  - timer - the ext flash task runs every 1ms and is the only thing
+ *    that moves the state machine along - no transfer complete callbacks
+ *  - irq - transfer complete interrupts chain the next command and the
+ *    ext flash task runs every 500us to poll the busy flag
+ * Loads are also run with the page at a time path used for buffers in
+ * CCMRAM and with the fast read path.
+ *
+ * Loaded data must match the flash and saved data must match the buffer.
+ *
+ * Usage: bench_ext_flash [spi_clock_hz]
+ *
+ */
+#include "config.h"
+#include "ext_flash.h"
+#include "spi_flash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// settings
+#define BENCH_TIMER_INTERVAL_US 1000  // ext flash task interval - timer only
+#define BENCH_IRQ_INTERVAL_US 500  // ext flash task interval - irq driven
+#define BENCH_DEFAULT_SPI_HZ 5250000  // SPI3 - APB1 42MHz / 8
+#define BENCH_XFER_SETUP_US 5  // DMA setup and complete interrupt per transfer
+#define BENCH_FAST_READ_CHUNK 0x8000  // max len of each fast read DMA
+#define BENCH_PAGE_PROG_US 700  // S25FL116K typical page program time
+#define BENCH_SECTOR_ERASE_US 50000  // S25FL116K typical sector erase time
+#define BENCH_TIMEOUT_US 60000000  // give up on a load or save after this long
+
+// test modes
+#define BENCH_MODE_TIMER 0  // only the 1ms task runs the state machine
+#define BENCH_MODE_IRQ 1  // transfer complete callbacks and 500us polling
+
+static const int bench_load_sizes[] = {
+    EXT_FLASH_SECTOR_SIZE, EXT_FLASH_SONG_SIZE, 0x10000, EXT_FLASH_MEMORY_SIZE
+};
+#define BENCH_NUM_LOAD_SIZES (sizeof(bench_load_sizes) / sizeof(int))
+
+static const int bench_save_sizes[] = {
+    EXT_FLASH_SECTOR_SIZE, EXT_FLASH_SONG_SIZE
+};
+#define BENCH_NUM_SAVE_SIZES (sizeof(bench_save_sizes) / sizeof(int))
+
+// results for one load or save
+struct bench_result {
+    int64_t time_us;  // time until ext_flash was done
+    struct ext_flash_save_timing save;  // save timing from ext_flash
+    int64_t bus_us;  // time the bus was busy
+    int tasks;  // ext flash task calls
+    int xfers;  // SPI transfers
+    int polls;  // status register reads
+};
+
+// bench state
+struct bench_state {
+    int64_t time_us;  // virtual time
+    int spi_hz;  // SPI clock rate
+    int fast_read;  // 1 = fast read is allowed
+    int state;  // SPI flash state
+    int64_t done_us;  // time the current transfer is done
+    int64_t busy_us;  // time the flash is done programming or erasing
+    void (*done_cb)(void);  // transfer done callback
+    uint32_t addr;  // address of the last command
+    int len;  // length of the last command
+    uint8_t prog_buf[SPI_FLASH_PAGE_SIZE];  // staged page program data
+    int prog_len;  // length of staged page program data
+    int64_t bus_us;  // time the bus was busy
+    int xfers;  // number of transfers
+    int polls;  // number of status register reads
+    uint8_t mem[SPI_FLASH_MEMORY_SIZE];  // flash contents
+    uint8_t buf[SPI_FLASH_MEMORY_SIZE];  // load / save buffer
+};
+struct bench_state bstate;
+
+// local functions
+int bench_load(int len, int fast_read, int mode, struct bench_result *res);
+int bench_save(int len, int mode, struct bench_result *res);
+void bench_reset(void);
+int bench_run(int done_state, int mode, struct bench_result *res);
+void bench_print(char *op, int len, char *mode, struct bench_result *res);
+int bench_xfer_active(void);
+void bench_xfer(int state, int bytes);
+
+int main(int argc, char **argv) {
+    struct bench_result res;
+    int i, fails = 0;
+
+    bstate.spi_hz = BENCH_DEFAULT_SPI_HZ;
+    if(argc > 1) {
+        bstate.spi_hz = atoi(argv[1]);
+    }
+    if(bstate.spi_hz < 100000) {
+        fprintf(stderr, "usage: bench_ext_flash [spi_clock_hz]\n");
+        return 1;
+    }
+    for(i = 0; i < SPI_FLASH_MEMORY_SIZE; i ++) {
+        bstate.mem[i] = (i * 7) ^ (i >> 8) ^ (i >> 16);
+    }
+    ext_flash_init();
+
+    printf("SPI clock %d Hz - %d us setup per transfer - bus max %.1f KB/s\n",
+        bstate.spi_hz, BENCH_XFER_SETUP_US, bstate.spi_hz / 8.0 / 1024.0);
+    printf("page program %d us - sector erase %d us\n",
+        BENCH_PAGE_PROG_US, BENCH_SECTOR_ERASE_US);
+    printf("%-5s %-8s %-11s | %9s %9s %9s %8s %6s | %6s %6s %6s\n",
+        "op", "bytes", "mode", "total ms", "erase ms", "prog ms", "KB/s",
+        "bus %", "tasks", "xfers", "polls");
+    for(i = 0; i < BENCH_NUM_LOAD_SIZES; i ++) {
+        fails += bench_load(bench_load_sizes[i], 0, BENCH_MODE_TIMER, &res);
+        bench_print("load", bench_load_sizes[i], "page timer", &res);
+        fails += bench_load(bench_load_sizes[i], 0, BENCH_MODE_IRQ, &res);
+        bench_print("load", bench_load_sizes[i], "page irq", &res);
+        fails += bench_load(bench_load_sizes[i], 1, BENCH_MODE_IRQ, &res);
+        bench_print("load", bench_load_sizes[i], "fast irq", &res);
+    }
+    for(i = 0; i < BENCH_NUM_SAVE_SIZES; i ++) {
+        fails += bench_save(bench_save_sizes[i], BENCH_MODE_TIMER, &res);
+        bench_print("save", bench_save_sizes[i], "timer", &res);
+        fails += bench_save(bench_save_sizes[i], BENCH_MODE_IRQ, &res);
+        bench_print("save", bench_save_sizes[i], "irq", &res);
+    }
+    if(fails) {
+        printf("%d loads / saves failed\n", fails);
+    }
+    return (fails > 0) ? 1 : 0;
+}
+
+//
+// stub rt_prof - counts are virtual us
+//
+// get the current count
+uint32_t rt_prof_start(void) {
+    return (uint32_t)bstate.time_us;
+}
+
+// get the number of counts per us
+int rt_prof_get_counts_per_us(void) {
+    return 1;
+}
+
+//
+// stub SPI flash transport
+//
+// init the SPI flash interface
+void spi_flash_init(void) {
+    bstate.state = SPI_FLASH_STATE_IDLE;
+}
+
+// set a function to call when a command completes
+void spi_flash_set_done_cb(void (*done_cb)(void)) {
+    bstate.done_cb = done_cb;
+}
+
+// get the SPI flash state - transfers finish when their time is up
+int spi_flash_get_state(void) {
+    if(bench_xfer_active() && bstate.time_us >= bstate.done_us) {
+        bstate.state ++;  // done state follows each busy state
+    }
+    return bstate.state;
+}
+
+// starts an SPI flash command - programs and erases change the flash
+// right away but keep the busy flag set
+// returns error if the module is busy or cmd is invalid
+int spi_flash_start_cmd(int cmd, uint32_t addr, uint8_t *tx_data, int len) {
+    if(spi_flash_get_state() != SPI_FLASH_STATE_IDLE) {
+        return SPI_FLASH_ERROR_BUSY;
+    }
+    if(len > SPI_FLASH_PAGE_SIZE) {
+        return SPI_FLASH_ERROR_INVALID_PARAMS;
+    }
+    bstate.addr = addr;
+    bstate.len = len;
+    switch(cmd) {
+        case SPI_FLASH_CMD_READ_STATUS_REG:
+            bstate.polls ++;
+            bench_xfer(SPI_FLASH_STATE_READ_STATUS_REG, 2);
+            break;
+        case SPI_FLASH_CMD_READ_MEM:
+            bench_xfer(SPI_FLASH_STATE_READ_MEM, 4 + len);
+            break;
+        case SPI_FLASH_CMD_WRITE_ENABLE:
+            bench_xfer(SPI_FLASH_STATE_WRITE_ENABLE, 1);
+            break;
+        case SPI_FLASH_CMD_WRITE_MEM:
+            if(tx_data == NULL) {
+                if(len != bstate.prog_len) {
+                    return SPI_FLASH_ERROR_INVALID_PARAMS;
+                }
+                tx_data = bstate.prog_buf;
+            }
+            memcpy(&bstate.mem[addr], tx_data, len);
+            bench_xfer(SPI_FLASH_STATE_WRITE_MEM, 4 + len);
+            bstate.busy_us = bstate.done_us + BENCH_PAGE_PROG_US;
+            break;
+        case SPI_FLASH_CMD_ERASE_MEM:
+            memset(&bstate.mem[addr & ~(SPI_FLASH_SECTOR_SIZE - 1)], 0xff,
+                SPI_FLASH_SECTOR_SIZE);
+            bench_xfer(SPI_FLASH_STATE_ERASE_MEM, 4);
+            bstate.busy_us = bstate.done_us + BENCH_SECTOR_ERASE_US;
+            break;
+        default:
+            return SPI_FLASH_ERROR_INVALID_STATE;
+    }
+    return SPI_FLASH_ERROR_OK;
+}
+
+// copy data for the next page program into the program buffer
+int spi_flash_stage_write(uint8_t *tx_data, int len) {
+    if(bstate.state == SPI_FLASH_STATE_WRITE_MEM) {
+        return SPI_FLASH_ERROR_BUSY;
+    }
+    memcpy(bstate.prog_buf, tx_data, len);
+    bstate.prog_len = len;
+    return SPI_FLASH_ERROR_OK;
+}
+
+// starts a fast read of any length straight into rx_data
+// returns error if the module is busy or fast reads are turned off
+int spi_flash_start_fast_read(uint32_t addr, uint8_t *rx_data, int len) {
+    int chunks;
+    if(spi_flash_get_state() != SPI_FLASH_STATE_IDLE) {
+        return SPI_FLASH_ERROR_BUSY;
+    }
+    // acts like a buffer in CCMRAM
+    if(!bstate.fast_read) {
+        return SPI_FLASH_ERROR_INVALID_PARAMS;
+    }
+    memcpy(rx_data, &bstate.mem[addr], len);
+    bstate.len = len;
+    // the header and each chunk are separate DMA transfers
+    chunks = (len + BENCH_FAST_READ_CHUNK - 1) / BENCH_FAST_READ_CHUNK;
+    bench_xfer(SPI_FLASH_STATE_FAST_READ_MEM, 5 + len);
+    bstate.done_us += chunks * BENCH_XFER_SETUP_US;
+    bstate.bus_us += chunks * BENCH_XFER_SETUP_US;
+    bstate.xfers += chunks;
+    return SPI_FLASH_ERROR_OK;
+}
+
+// get the result of an SPI flash command and reset the state to idle
+// returns the length of the resulting data
+int spi_flash_get_result(uint8_t *rx_data) {
+    int ret;
+    switch(spi_flash_get_state()) {
+        case SPI_FLASH_STATE_READ_STATUS_REG_DONE:
+            rx_data[0] = (bstate.time_us < bstate.busy_us) ? 0x01 : 0x00;
+            ret = 1;
+            break;
+        case SPI_FLASH_STATE_READ_MEM_DONE:
+            memcpy(rx_data, &bstate.mem[bstate.addr], bstate.len);
+            ret = bstate.len;
+            break;
+        case SPI_FLASH_STATE_WRITE_ENABLE_DONE:
+        case SPI_FLASH_STATE_ERASE_MEM_DONE:
+            ret = SPI_FLASH_ERROR_OK;
+            break;
+        case SPI_FLASH_STATE_WRITE_MEM_DONE:
+        case SPI_FLASH_STATE_FAST_READ_MEM_DONE:
+            ret = bstate.len;
+            break;
+        default:
+            return SPI_FLASH_ERROR_INVALID_STATE;
+    }
+    bstate.state = SPI_FLASH_STATE_IDLE;
+    return ret;
+}
+
+//
+// local functions
+//
+// load from flash and check the data
+// returns 1 on failure
+int bench_load(int len, int fast_read, int mode, struct bench_result *res) {
+    bstate.fast_read = fast_read;
+    memset(bstate.buf, 0, len);
+    bench_reset();
+    if(ext_flash_load(0, len, bstate.buf) == -1) {
+        printf("load of %d bytes could not start\n", len);
+        return 1;
+    }
+    if(bench_run(EXT_FLASH_STATE_LOAD_DONE, mode, res)) {
+        return 1;
+    }
+    if(memcmp(bstate.buf, bstate.mem, len) != 0) {
+        printf("load of %d bytes has bad data\n", len);
+        return 1;
+    }
+    memset(&res->save, 0, sizeof(struct ext_flash_save_timing));
+    return 0;
+}
+
+// save to flash and check the data
+// returns 1 on failure
+int bench_save(int len, int mode, struct bench_result *res) {
+    int i;
+    for(i = 0; i < len; i ++) {
+        bstate.buf[i] = rand();
+    }
+    bench_reset();
+    if(ext_flash_save(0, len, bstate.buf) == -1) {
+        printf("save of %d bytes could not start\n", len);
+        return 1;
+    }
+    if(bench_run(EXT_FLASH_STATE_SAVE_DONE, mode, res)) {
+        return 1;
+    }
+    if(memcmp(bstate.buf, bstate.mem, len) != 0) {
+        printf("save of %d bytes has bad data\n", len);
+        return 1;
+    }
+    ext_flash_get_save_timing(&res->save);
+    return 0;
+}
+
+// reset the time and counters before a load or save
+void bench_reset(void) {
+    bstate.time_us = 0;
+    bstate.done_us = 0;
+    bstate.busy_us = 0;
+    bstate.bus_us = 0;
+    bstate.xfers = 0;
+    bstate.polls = 0;
+}
+
+// run the ext flash task and transfer callbacks until done
+// returns 1 on failure
+int bench_run(int done_state, int mode, struct bench_result *res) {
+    int64_t next_task_us;
+    int state, interval;
+
+    interval = BENCH_TIMER_INTERVAL_US;
+    if(mode == BENCH_MODE_IRQ) {
+        interval = BENCH_IRQ_INTERVAL_US;
+    }
+    res->tasks = 0;
+    next_task_us = 0;
+    while(1) {
+        // a transfer completes before the next task
+        if(mode == BENCH_MODE_IRQ && bench_xfer_active() &&
+                bstate.done_us < next_task_us) {
+            bstate.time_us = bstate.done_us;
+            spi_flash_get_state();
+            bstate.done_cb();
+            continue;
+        }
+        bstate.time_us = next_task_us;
+        next_task_us += interval;
+        ext_flash_timer_task();
+        res->tasks ++;
+        state = ext_flash_get_state();
+        if(state == done_state) {
+            break;
+        }
+        if((state != EXT_FLASH_STATE_LOAD && state != EXT_FLASH_STATE_SAVE) ||
+                bstate.time_us > BENCH_TIMEOUT_US) {
+            printf("run failed - state: %d\n", state);
+            return 1;
+        }
+    }
+    res->time_us = ext_flash_get_last_time();
+    res->bus_us = bstate.bus_us;
+    res->xfers = bstate.xfers;
+    res->polls = bstate.polls;
+    return 0;
+}
+
+// print the result of a load or save
+void bench_print(char *op, int len, char *mode, struct bench_result *res) {
+    printf("%-5s %-8d %-11s | %9.1f %9.1f %9.1f %8.1f %6.1f | %6d %6d %6d\n",
+        op, len, mode, res->time_us / 1000.0, res->save.erase_time / 1000.0,
+        res->save.program_time / 1000.0,
+        len / 1.024 / res->time_us * 1000.0,
+        100.0 * res->bus_us / res->time_us,
+        res->tasks, res->xfers, res->polls);
+}
+
+// check if a transfer is running
+int bench_xfer_active(void) {
+    switch(bstate.state) {
+        case SPI_FLASH_STATE_READ_STATUS_REG:
+        case SPI_FLASH_STATE_READ_MEM:
+        case SPI_FLASH_STATE_WRITE_ENABLE:
+        case SPI_FLASH_STATE_WRITE_MEM:
+        case SPI_FLASH_STATE_ERASE_MEM:
+        case SPI_FLASH_STATE_FAST_READ_MEM:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// start a transfer of a number of bytes on the bus
+void bench_xfer(int state, int bytes) {
+    int64_t xfer_us = BENCH_XFER_SETUP_US +
+        (((int64_t)bytes * 8 * 1000000) + bstate.spi_hz - 1) / bstate.spi_hz;
+    bstate.state = state;
+    bstate.done_us = bstate.time_us + xfer_us;
+    bstate.bus_us += xfer_us;
+    bstate.xfers ++;
+}
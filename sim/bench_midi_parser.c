@@ -0,0 +1,341 @@
+/*
+ * CARBON Host Simulator - MIDI Byte Parser Benchmark
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Runs a corpus of tricky byte streams through the midi_stream byte parser
+ * and checks the messages that come out, then measures parser throughput
+ * for midi_stream_send_byte() and midi_stream_send_bytes().
+ *
+ * Each corpus stream is fed both a byte at a time and as a single buffer
+ * split in two at every possible point. The output is written as messages
+ * separated by commas with the bytes of each message in hex.
+ *
+ * Each stream is then fed again with midi_stream_send_timed_bytes() with
+ * synthetic byte timing - a byte at a time with uneven gaps and as a single
+ * buffer at the DIN byte rate. The timestamp of each message must be the
+ * time of the byte listed for it in the corpus. The times start just before
+ * the 32 bit wrap.
+ *
+ * Usage: bench_midi_parser [megabytes]
+ *
+ */
+#include "config.h"
+#include "midi/midi_stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// settings
+#define BENCH_DEFAULT_MBYTES 16
+#define BENCH_PORT MIDI_PORT_DIN1_IN
+#define BENCH_MAX_STREAM 32
+#define BENCH_OUT_LEN 256
+#define BENCH_BLOCK_LEN 64  // bytes fed between drains
+#define BENCH_BYTE_TIME 320  // us per byte at 31250 baud
+#define BENCH_TIME_START 0xfffff000  // first byte time - wraps during a case
+
+// a corpus entry - input bytes and expected output
+struct bench_case {
+    const char *name;
+    int len;
+    uint8_t in[BENCH_MAX_STREAM];
+    const char *out;
+    const char *at;  // index of the first byte of each output message
+};
+
+static const struct bench_case bench_corpus[] = {
+    {"running status", 5, {0x90, 0x3c, 0x40, 0x3e, 0x41},
+        "90 3c 40,90 3e 41", "0,3"},
+    {"note on velocity 0", 3, {0x91, 0x3c, 0x00},
+        "81 3c 40", "0"},
+    {"running status velocity 0", 5, {0x90, 0x3c, 0x40, 0x3c, 0x00},
+        "90 3c 40,80 3c 40", "0,3"},
+    {"2 byte running status", 3, {0xc2, 0x01, 0x02},
+        "c2 01,c2 02", "0,2"},
+    {"pitch bend", 3, {0xe0, 0x00, 0x40},
+        "e0 00 40", "0"},
+    {"realtime inside message", 4, {0x90, 0xf8, 0x3c, 0x40},
+        "f8,90 3c 40", "1,0"},
+    {"realtime between data bytes", 4, {0x90, 0x3c, 0xfe, 0x40},
+        "fe,90 3c 40", "2,0"},
+    {"undefined realtime ignored", 4, {0x90, 0x3c, 0xf9, 0x40},
+        "90 3c 40", "0"},
+    {"leading data dropped", 5, {0x3c, 0x40, 0x90, 0x3c, 0x40},
+        "90 3c 40", "2"},
+    {"SYSEX short", 3, {0xf0, 0x01, 0xf7},
+        "f0 01 f7", "0"},
+    {"SYSEX exact chunk", 4, {0xf0, 0x01, 0x02, 0xf7},
+        "f0 01 02,f7", "0,3"},
+    {"SYSEX continuation", 8, {0xf0, 0x00, 0x01, 0x72, 0x02, 0x03, 0x04, 0xf7},
+        "f0 00 01,72 02 03,04 f7", "0,3,6"},
+    {"realtime inside SYSEX", 7, {0xf0, 0x00, 0xf8, 0x01, 0x02, 0x03, 0xf7},
+        "f8,f0 00 01,02 03 f7", "2,0,4"},
+    {"SYSEX ended by channel status", 5, {0xf0, 0x01, 0x90, 0x3c, 0x40},
+        "f0 01 f7,90 3c 40", "0,2"},
+    {"SYSEX ended by new SYSEX", 7, {0xf0, 0x01, 0x02, 0x03, 0xf0, 0x04, 0xf7},
+        "f0 01 02,03 f7,f0 04 f7", "0,3,4"},
+    {"SYSEX ended by common", 4, {0xf0, 0x01, 0xf3, 0x05},
+        "f0 01 f7,f3 05", "0,2"},
+    {"SYSEX clears running status", 8, {0x90, 0x3c, 0x40, 0xf0, 0x01, 0xf7, 0x3c, 0x40},
+        "90 3c 40,f0 01 f7", "0,3"},
+    {"stray SYSEX end", 4, {0xf7, 0x90, 0x3c, 0x40},
+        "90 3c 40", "1"},
+    {"song position", 4, {0xf2, 0x01, 0x02, 0x03},
+        "f2 01 02", "0"},
+    {"MTC quarter frame", 2, {0xf1, 0x20},
+        "f1 20", "0"},
+    {"tune request", 1, {0xf6},
+        "f6", "0"},
+    {"common clears running status", 6, {0x90, 0x3c, 0x40, 0xf6, 0x3c, 0x40},
+        "90 3c 40,f6", "0,3"},
+    {"undefined status", 4, {0x90, 0x3c, 0xf4, 0x40},
+        "", ""},
+    {"system reset mid message", 4, {0x90, 0x3c, 0xff, 0x40},
+        "ff", "2"},
+    {"system reset inside SYSEX", 5, {0xf0, 0x01, 0xff, 0x02, 0xf7},
+        "ff", "2"},
+    {"clock run", 4, {0xfa, 0xf8, 0xf8, 0xfc},
+        "fa,f8,f8,fc", "0,1,2,3"}
+};
+#define BENCH_NUM_CASES (sizeof(bench_corpus) / sizeof(struct bench_case))
+
+// local functions
+int bench_run_case(const struct bench_case *bc, int split);
+int bench_run_timed_case(const struct bench_case *bc, int uneven);
+int bench_collect(char *out, int outlen, uint32_t *times);
+int bench_drain(void);
+double bench_get_time(void);
+
+// main!
+int main(int argc, char **argv) {
+    int i, split, fails = 0, total_fails, mbytes = BENCH_DEFAULT_MBYTES;
+    int len, pos, msgs;
+    uint8_t *stream;
+    double start, byte_s, bytes_s;
+
+    if(argc > 1) {
+        mbytes = atoi(argv[1]);
+    }
+    if(mbytes <= 0) {
+        fprintf(stderr, "usage: bench_midi_parser [megabytes]\n");
+        return 1;
+    }
+    midi_stream_init();
+
+    // corpus - split -1 feeds a byte at a time
+    for(i = 0; i < BENCH_NUM_CASES; i ++) {
+        for(split = -1; split <= bench_corpus[i].len; split ++) {
+            if(bench_run_case(&bench_corpus[i], split) != 0) {
+                fails ++;
+                break;
+            }
+        }
+    }
+    printf("corpus: %d cases - %d failed\n", (int)BENCH_NUM_CASES, fails);
+    total_fails = fails;
+
+    // timestamps - uneven byte gaps and then a buffer at the byte rate
+    fails = 0;
+    for(i = 0; i < BENCH_NUM_CASES; i ++) {
+        if(bench_run_timed_case(&bench_corpus[i], 1) != 0 ||
+                bench_run_timed_case(&bench_corpus[i], 0) != 0) {
+            fails ++;
+        }
+    }
+    printf("timestamps: %d cases - %d failed\n", (int)BENCH_NUM_CASES, fails);
+    total_fails += fails;
+
+    // throughput - running status notes with clock and SYSEX mixed in
+    len = mbytes * 1024 * 1024;
+    stream = malloc(len);
+    if(stream == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for(pos = 0; pos < len; pos ++) {
+        switch(pos & 0x3f) {
+            case 0:
+                stream[pos] = 0x90;
+                break;
+            case 24:
+            case 48:
+                stream[pos] = 0xf8;
+                break;
+            case 32:
+                stream[pos] = 0xf0;
+                break;
+            case 40:
+                stream[pos] = 0xf7;
+                break;
+            default:
+                stream[pos] = pos & 0x7f;
+                break;
+        }
+    }
+
+    msgs = 0;
+    start = bench_get_time();
+    for(pos = 0; pos < len; pos ++) {
+        midi_stream_send_byte(BENCH_PORT, stream[pos]);
+        if((pos & (BENCH_BLOCK_LEN - 1)) == (BENCH_BLOCK_LEN - 1)) {
+            msgs += bench_drain();
+        }
+    }
+    byte_s = bench_get_time() - start;
+
+    start = bench_get_time();
+    for(pos = 0; pos < len; pos += BENCH_BLOCK_LEN) {
+        midi_stream_send_bytes(BENCH_PORT, &stream[pos], BENCH_BLOCK_LEN);
+        msgs += bench_drain();
+    }
+    bytes_s = bench_get_time() - start;
+    free(stream);
+
+    printf("throughput - %d MB - %d msgs\n", mbytes, msgs);
+    printf("  midi_stream_send_byte():  %8.2f MB/s\n", mbytes / byte_s);
+    printf("  midi_stream_send_bytes(): %8.2f MB/s\n", mbytes / bytes_s);
+    return (total_fails > 0) ? 1 : 0;
+}
+
+//
+// local functions
+//
+// run a corpus case - split is where to split the buffer or -1 for byte mode
+// returns 0 on pass and -1 on fail
+int bench_run_case(const struct bench_case *bc, int split) {
+    char out[BENCH_OUT_LEN];
+    int i;
+    // clear the parser and queue
+    midi_stream_send_byte(BENCH_PORT, MIDI_SYSTEM_RESET);
+    bench_drain();
+    if(split < 0) {
+        for(i = 0; i < bc->len; i ++) {
+            midi_stream_send_byte(BENCH_PORT, bc->in[i]);
+        }
+    }
+    else {
+        midi_stream_send_bytes(BENCH_PORT, (uint8_t *)bc->in, split);
+        midi_stream_send_bytes(BENCH_PORT, (uint8_t *)&bc->in[split], bc->len - split);
+    }
+    bench_collect(out, sizeof(out), NULL);
+    if(strcmp(out, bc->out) != 0) {
+        printf("FAIL: %s (split: %d)\n  expected: \"%s\"\n  got:      \"%s\"\n",
+            bc->name, split, bc->out, out);
+        return -1;
+    }
+    return 0;
+}
+
+// run a corpus case with timed bytes and check the message timestamps
+// uneven = 1 feeds a byte at a time with uneven gaps, 0 feeds one buffer
+// returns 0 on pass and -1 on fail
+int bench_run_timed_case(const struct bench_case *bc, int uneven) {
+    char out[BENCH_OUT_LEN];
+    uint32_t byte_times[BENCH_MAX_STREAM];
+    uint32_t times[BENCH_OUT_LEN];
+    uint32_t time = BENCH_TIME_START;
+    const char *at = bc->at;
+    char *end;
+    int i, num, index;
+    for(i = 0; i < bc->len; i ++) {
+        byte_times[i] = time;
+        time += BENCH_BYTE_TIME;
+        if(uneven) {
+            time += (i * 1237) % 5000;  // anything from none to a few ms
+        }
+    }
+    midi_stream_send_byte(BENCH_PORT, MIDI_SYSTEM_RESET);
+    bench_drain();
+    if(uneven) {
+        for(i = 0; i < bc->len; i ++) {
+            midi_stream_send_timed_bytes(BENCH_PORT, (uint8_t *)&bc->in[i], 1,
+                byte_times[i], 0);
+        }
+    }
+    else {
+        midi_stream_send_timed_bytes(BENCH_PORT, (uint8_t *)bc->in, bc->len,
+            BENCH_TIME_START, BENCH_BYTE_TIME);
+    }
+    num = bench_collect(out, sizeof(out), times);
+    if(strcmp(out, bc->out) != 0) {
+        printf("FAIL: %s (timed)\n  expected: \"%s\"\n  got:      \"%s\"\n",
+            bc->name, bc->out, out);
+        return -1;
+    }
+    for(i = 0; i < num; i ++) {
+        index = strtol(at, &end, 10);
+        if(end == at || index < 0 || index >= bc->len) {
+            printf("FAIL: %s (timed) - bad index list: \"%s\"\n", bc->name, bc->at);
+            return -1;
+        }
+        at = (*end == ',') ? end + 1 : end;
+        if(times[i] != byte_times[index]) {
+            printf("FAIL: %s (timed, %s) - msg %d - expected: %u us - got: %u us\n",
+                bc->name, uneven ? "uneven" : "buffer", i,
+                byte_times[index] - BENCH_TIME_START, times[i] - BENCH_TIME_START);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// collect the messages on the port as text and their timestamps if times is set
+// returns the number of messages collected
+int bench_collect(char *out, int outlen, uint32_t *times) {
+    struct midi_msg msg;
+    int pos = 0, num = 0;
+    out[0] = 0;
+    while(midi_stream_receive_msg(BENCH_PORT, &msg) == 0 && pos < (outlen - 16)) {
+        if(times != NULL) {
+            times[num] = msg.timestamp;
+        }
+        num ++;
+        if(pos) {
+            out[pos++] = ',';
+        }
+        pos += sprintf(&out[pos], "%02x", msg.status);
+        if(msg.len > 1) {
+            pos += sprintf(&out[pos], " %02x", msg.data0);
+        }
+        if(msg.len > 2) {
+            pos += sprintf(&out[pos], " %02x", msg.data1);
+        }
+    }
+    return num;
+}
+
+// drain the port - returns the number of messages removed
+int bench_drain(void) {
+    struct midi_msg *msgs;
+    int num, total = 0;
+    while((num = midi_stream_peek(BENCH_PORT, &msgs)) > 0) {
+        midi_stream_consume(BENCH_PORT, num);
+        total += num;
+    }
+    return total;
+}
+
+// get the host time in seconds
+double bench_get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
+}
@@ -0,0 +1,452 @@
+/*
+ * CARBON Host Simulator - Output Routing Benchmark
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Measures the cost of delivering a raw track message to its outputs.
+ * The reference is the original outproc_deliver_msg() loop that looked up
+ * the port and channel maps from the song for each output of each message.
+ * It is compared against outproc_deliver_msg() with the route table. Even
+ * tracks go to two outputs and odd tracks to one. The messages sent by
+ * both are summed and checked to be the same. Most of the time goes to
+ * encoding and queueing the output messages, so the same messages are
+ * also sent straight to the streams and the lookup overhead of each way
+ * is reported above that. The three ways take turns a few times and the
+ * fastest run of each is used to keep host noise down.
+ *
+ * Then overlapping processed notes are played from all tracks onto a
+ * shared output channel with transpose and tonality changes in between,
+ * once for each overlapping note policy. The output is played into a
+ * model synth that starts a voice for every note on and ends one voice
+ * for every note off. No note may ever have more than one voice and none
+ * may be left sounding after the tracks release or stop their notes.
+ *
+ * Usage: bench_outproc [iterations]
+ *
+ */
+#include "sim_spi_flash.h"
+#include "config.h"
+#include "cvproc.h"
+#include "ext_flash.h"
+#include "midi/midi_stream.h"
+#include "midi/midi_utils.h"
+#include "seq/outproc.h"
+#include "seq/scale.h"
+#include "seq/seq_ctrl.h"
+#include "seq/song.h"
+#include "util/log.h"
+#include "util/state_change.h"
+#include "util/state_change_events.h"
+#include "util/time_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// settings
+#define BENCH_DEFAULT_ITERATIONS 10000000
+#define BENCH_LOAD_TIMEOUT_MS 5000
+#define BENCH_BATCH 64  // messages sent between output drains
+#define BENCH_NUM_MSGS 1024  // message stream length - must be a power of 2
+#define BENCH_NOTE_LOW 36  // note range for overlapping notes
+#define BENCH_NOTE_RANGE 12
+#define BENCH_CHANGE_INTERVAL 4096  // messages between transpose changes
+
+// delivery modes
+#define BENCH_MODE_REF 0  // original song map lookup loop
+#define BENCH_MODE_ROUTE 1  // outproc route table
+#define BENCH_MODE_SEND 2  // send only - outputs are known ahead
+#define BENCH_NUM_MODES 3
+#define BENCH_MODE_REPEATS 3  // runs of each mode - the fastest is used
+
+// bench state
+struct bench_state {
+    int64_t time_us;  // virtual time
+    struct midi_msg msgs[BENCH_NUM_MSGS];  // track messages to deliver
+    struct midi_msg outs[BENCH_NUM_MSGS][SEQ_NUM_TRACK_OUTPUTS];  // output messages to send
+    int num_outs[BENCH_NUM_MSGS];  // number of output messages
+    int tracks[BENCH_NUM_MSGS];  // track for each message
+    uint32_t msg_count;  // output messages
+    uint32_t msg_sum;  // output message checksum
+    int held[SEQ_NUM_TRACKS][128];  // note ons held by each track - can be more than outproc holds
+    uint8_t voices[MIDI_PORT_NUM_TRACK_OUTPUTS][16][128];  // model synth voices
+    int max_voices;  // most voices on one note
+    uint32_t rand;  // random state
+};
+struct bench_state bstate;
+
+// local functions
+void bench_ref_deliver_msg(int scene, int track, struct midi_msg *msg, int deliver);
+void bench_send_deliver_msg(int n);
+double bench_run(int iterations, int mode);
+double bench_run_notes(int iterations, int policy);
+int bench_count_voices(void);
+void bench_timer_task(void);
+void bench_drain_outputs(void);
+int bench_rand(int range);
+double bench_get_time(void);
+
+// main!
+int main(int argc, char **argv) {
+    int i, mode, track, fails = 0, iterations = BENCH_DEFAULT_ITERATIONS;
+    uint32_t rand = 12345, counts[BENCH_NUM_MODES], sums[BENCH_NUM_MODES];
+    double ns[BENCH_NUM_MODES], run_ns, ref_ns, route_ns, send_ns, note_ns;
+
+    if(argc > 1) {
+        iterations = atoi(argv[1]);
+    }
+    if(iterations <= 0) {
+        fprintf(stderr, "usage: bench_outproc [iterations]\n");
+        return 1;
+    }
+    iterations = (iterations + BENCH_BATCH - 1) & ~(BENCH_BATCH - 1);
+
+    // same init as the simulator with erased flash
+    log_init();
+    midi_stream_init();
+    ext_flash_init();
+    sim_spi_flash_erase();
+    cvproc_init();
+    bstate.time_us = 0;
+    seq_ctrl_init();
+    state_change_fire0(SCE_CONFIG_CLEARED);
+    seq_ctrl_load_song(0);
+    for(i = 0; i < BENCH_LOAD_TIMEOUT_MS && seq_ctrl_is_run_lockout(); i ++) {
+        bench_timer_task();
+    }
+    if(seq_ctrl_is_run_lockout()) {
+        fprintf(stderr, "song load timed out\n");
+        return 1;
+    }
+
+    // map the tracks - the route table follows the song change events
+    for(track = 0; track < SEQ_NUM_TRACKS; track ++) {
+        song_set_midi_port_map(track, 0, MIDI_PORT_DIN1_OUT);
+        song_set_midi_channel_map(track, 0, track);
+        song_set_midi_port_map(track, 1, (track & 0x01) ? SONG_PORT_DISABLE :
+            MIDI_PORT_USB_DEV_OUT1);
+        song_set_midi_channel_map(track, 1, track + 8);
+    }
+    // CC, pressure and bend messages on random tracks - notes are tracked below
+    for(i = 0; i < BENCH_NUM_MSGS; i ++) {
+        rand = (rand * 1103515245) + 12345;
+        bstate.tracks[i] = (rand >> 8) % SEQ_NUM_TRACKS;
+        switch(i % 3) {
+            case 0:
+                midi_utils_enc_control_change(&bstate.msgs[i], 0, 0, 1, (rand >> 16) & 0x7f);
+                break;
+            case 1:
+                midi_utils_enc_channel_pressure(&bstate.msgs[i], 0, 0, (rand >> 16) & 0x7f);
+                break;
+            default:
+                midi_utils_enc_pitch_bend(&bstate.msgs[i], 0, 0, ((rand >> 16) & 0x3fff) - 8192);
+                break;
+        }
+        // the same message on each mapped output
+        bstate.num_outs[i] = (bstate.tracks[i] & 0x01) ? 1 : 2;
+        for(track = 0; track < bstate.num_outs[i]; track ++) {
+            bstate.outs[i][track] = bstate.msgs[i];
+            bstate.outs[i][track].port = (track == 0) ? MIDI_PORT_DIN1_OUT :
+                MIDI_PORT_USB_DEV_OUT1;
+            bstate.outs[i][track].status |= bstate.tracks[i] + (track * 8);
+        }
+    }
+    bench_drain_outputs();
+
+    for(i = 0; i < BENCH_MODE_REPEATS; i ++) {
+        for(mode = 0; mode < BENCH_NUM_MODES; mode ++) {
+            run_ns = bench_run(iterations, mode);
+            if(i == 0 || run_ns < ns[mode]) {
+                ns[mode] = run_ns;
+            }
+            counts[mode] = bstate.msg_count;
+            sums[mode] = bstate.msg_sum;
+        }
+    }
+    ref_ns = ns[BENCH_MODE_REF];
+    route_ns = ns[BENCH_MODE_ROUTE];
+    send_ns = ns[BENCH_MODE_SEND];
+    printf("check: ref: %u msgs - %08x - route table: %u msgs - %08x - "
+        "send: %u msgs - %08x - %s\n", counts[BENCH_MODE_REF], sums[BENCH_MODE_REF],
+        counts[BENCH_MODE_ROUTE], sums[BENCH_MODE_ROUTE], counts[BENCH_MODE_SEND],
+        sums[BENCH_MODE_SEND], (counts[BENCH_MODE_ROUTE] == counts[BENCH_MODE_REF] &&
+        sums[BENCH_MODE_ROUTE] == sums[BENCH_MODE_REF] &&
+        counts[BENCH_MODE_SEND] == counts[BENCH_MODE_REF] &&
+        sums[BENCH_MODE_SEND] == sums[BENCH_MODE_REF]) ? "ok" : "FAIL");
+
+    printf("raw message delivery - %d messages - %d tracks\n", iterations,
+        SEQ_NUM_TRACKS);
+    printf("  send only:       %8.2f ns/msg\n", send_ns);
+    printf("  song map lookup: %8.2f ns/msg - lookup: %6.2f ns/msg\n", ref_ns,
+        ref_ns - send_ns);
+    printf("  route table:     %8.2f ns/msg - lookup: %6.2f ns/msg (%.1fx)\n",
+        route_ns, route_ns - send_ns, (route_ns > send_ns) ?
+        (ref_ns - send_ns) / (route_ns - send_ns) : 0.0);
+    if(counts[BENCH_MODE_ROUTE] != counts[BENCH_MODE_REF] ||
+            sums[BENCH_MODE_ROUTE] != sums[BENCH_MODE_REF] ||
+            counts[BENCH_MODE_SEND] != counts[BENCH_MODE_REF] ||
+            sums[BENCH_MODE_SEND] != sums[BENCH_MODE_REF]) {
+        fails ++;
+    }
+
+    // all tracks share an output channel and even tracks have their own
+    for(track = 0; track < SEQ_NUM_TRACKS; track ++) {
+        song_set_midi_channel_map(track, 0, 0);
+    }
+    bench_drain_outputs();
+    printf("overlapping processed notes - %d messages - %d notes\n", iterations,
+        BENCH_NOTE_RANGE);
+    for(i = OUTPROC_NOTE_RETRIGGER; i <= OUTPROC_NOTE_MERGE; i ++) {
+        note_ns = bench_run_notes(iterations, i);
+        printf("  %-10s %8.2f ns/msg - output msgs: %u - max voices: %d - "
+            "hung voices: %d\n", (i == OUTPROC_NOTE_RETRIGGER) ? "retrigger:" :
+            "merge:", note_ns, bstate.msg_count, bstate.max_voices,
+            bench_count_voices());
+        if(bstate.max_voices > 1 || bench_count_voices() != 0) {
+            fails ++;
+        }
+    }
+    return (fails > 0) ? 1 : 0;
+}
+
+//
+// local functions
+//
+// deliver a raw track message the original way - notes are tracked now so
+// only the other messages are compared
+__attribute__((noinline)) void bench_ref_deliver_msg(int scene, int track,
+        struct midi_msg *msg, int deliver) {
+    struct midi_msg send_msg;
+    int out, port, channel;
+
+    // generate message for each output port for this track
+    for(out = 0; out < SEQ_NUM_TRACK_OUTPUTS; out ++) {
+        // skip ports that we don't want
+        if(deliver == OUTPROC_DELIVER_A && out == 1) {
+            continue;
+        }
+        else if(deliver == OUTPROC_DELIVER_B && out == 0) {
+            continue;
+        }
+        // get port mapping
+        port = song_get_midi_port_map(track, out);
+        if(port == SONG_PORT_DISABLE) {
+            continue;  // port not assigned
+        }
+        // get channel mapping
+        channel = song_get_midi_channel_map(track, out);
+
+        // handle event types
+        switch(msg->status & 0xf0) {
+            case MIDI_NOTE_OFF:
+                midi_utils_enc_note_off(&send_msg, port, channel, msg->data0, msg->data1);
+                midi_stream_send_msg(&send_msg);
+                break;
+            case MIDI_NOTE_ON:
+                midi_utils_enc_note_on(&send_msg, port, channel, msg->data0, msg->data1);
+                midi_stream_send_msg(&send_msg);
+                break;
+            case MIDI_CONTROL_CHANGE:
+                midi_utils_enc_control_change(&send_msg, port, channel, msg->data0, msg->data1);
+                midi_stream_send_msg(&send_msg);
+                break;
+            case MIDI_CHANNEL_PRESSURE:
+                midi_utils_enc_channel_pressure(&send_msg, port, channel, msg->data0);
+                midi_stream_send_msg(&send_msg);
+                break;
+            case MIDI_PITCH_BEND:
+                midi_utils_enc_pitch_bend(&send_msg, port, channel, (msg->data0 |
+                    (msg->data1 << 7)) - 8192);
+                midi_stream_send_msg(&send_msg);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// send the output messages for a track message with no lookup at all
+__attribute__((noinline)) void bench_send_deliver_msg(int n) {
+    int i;
+    for(i = 0; i < bstate.num_outs[n]; i ++) {
+        midi_stream_send_msg(&bstate.outs[n][i]);
+    }
+}
+
+// deliver messages in batches and return the average time per message in ns
+double bench_run(int iterations, int mode) {
+    double start, total = 0.0;
+    int i, j, n;
+    bstate.msg_count = 0;
+    bstate.msg_sum = 0;
+    for(i = 0; i < iterations; i += BENCH_BATCH) {
+        start = bench_get_time();
+        for(j = 0; j < BENCH_BATCH; j ++) {
+            n = (i + j) & (BENCH_NUM_MSGS - 1);
+            if(mode == BENCH_MODE_SEND) {
+                bench_send_deliver_msg(n);
+            }
+            else if(mode == BENCH_MODE_REF) {
+                bench_ref_deliver_msg(0, bstate.tracks[n], &bstate.msgs[n],
+                    OUTPROC_DELIVER_BOTH);
+            }
+            else {
+                outproc_deliver_msg(0, bstate.tracks[n], &bstate.msgs[n],
+                    OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_RAW);
+            }
+        }
+        total += bench_get_time() - start;
+        bench_drain_outputs();
+    }
+    return (total * 1000000000.0) / iterations;
+}
+
+// play overlapping processed notes and return the average time per message in ns
+// the model synth is checked after all tracks release or stop their notes
+double bench_run_notes(int iterations, int policy) {
+    struct midi_msg msg;
+    double start, total = 0.0;
+    int i, j, track, note;
+    outproc_set_note_policy(policy);
+    bstate.msg_count = 0;
+    bstate.msg_sum = 0;
+    bstate.max_voices = 0;
+    bstate.rand = 12345;
+    for(i = 0; i < iterations; i += BENCH_BATCH) {
+        // change the transpose or tonality on a track with notes held
+        if((i % BENCH_CHANGE_INTERVAL) == 0) {
+            track = bench_rand(SEQ_NUM_TRACKS);
+            if(bench_rand(4) == 0) {
+                song_set_tonality(0, track, bench_rand(SCALE_NUM_TONALITIES));
+                // the released notes are forgotten by outproc
+            }
+            else {
+                song_set_transpose(0, track, bench_rand(25) - 12);
+            }
+        }
+        start = bench_get_time();
+        for(j = 0; j < BENCH_BATCH; j ++) {
+            track = bench_rand(SEQ_NUM_TRACKS);
+            note = BENCH_NOTE_LOW + bench_rand(BENCH_NOTE_RANGE);
+            // release a held note or play one
+            if(bstate.held[track][note] && bench_rand(2)) {
+                midi_utils_enc_note_off(&msg, 0, 0, note, 0x40);
+                bstate.held[track][note] --;
+            }
+            else {
+                midi_utils_enc_note_on(&msg, 0, 0, note, 0x60);
+                bstate.held[track][note] ++;
+            }
+            outproc_deliver_msg(0, track, &msg, OUTPROC_DELIVER_BOTH,
+                OUTPROC_OUTPUT_PROCESSED);
+        }
+        total += bench_get_time() - start;
+        bench_drain_outputs();
+    }
+    // even tracks release their notes and odd tracks stop them
+    for(track = 0; track < SEQ_NUM_TRACKS; track ++) {
+        if(track & 0x01) {
+            outproc_stop_all_notes(track);
+        }
+        for(note = 0; note < 128; note ++) {
+            while(bstate.held[track][note]) {
+                midi_utils_enc_note_off(&msg, 0, 0, note, 0x40);
+                outproc_deliver_msg(0, track, &msg, OUTPROC_DELIVER_BOTH,
+                    OUTPROC_OUTPUT_PROCESSED);
+                bstate.held[track][note] --;
+            }
+        }
+        song_set_transpose(0, track, 0);
+        song_set_tonality(0, track, SCALE_CHROMATIC);
+    }
+    bench_drain_outputs();
+    return (total * 1000000000.0) / iterations;
+}
+
+// count the voices left sounding on the model synth
+int bench_count_voices(void) {
+    int port, channel, note, count = 0;
+    for(port = 0; port < MIDI_PORT_NUM_TRACK_OUTPUTS; port ++) {
+        for(channel = 0; channel < 16; channel ++) {
+            for(note = 0; note < 128; note ++) {
+                count += bstate.voices[port][channel][note];
+            }
+        }
+    }
+    return count;
+}
+
+// run one 1ms task period - the RT parts of main_timer_task()
+void bench_timer_task(void) {
+    bstate.time_us += 1000;
+    time_utils_set_btime((btime)bstate.time_us);
+    seq_ctrl_rt_task();
+    bench_drain_outputs();
+    ext_flash_timer_task();
+    cvproc_timer_task();
+    seq_ctrl_ui_task();
+}
+
+// drain the MIDI output ports and sum up what left - CV is left to cvproc
+void bench_drain_outputs(void) {
+    struct midi_msg *msgs;
+    uint8_t *voice;
+    int port, i, num;
+    for(port = MIDI_PORT_DIN1_OUT; port <= MIDI_PORT_USB_DEV_OUT3; port ++) {
+        if(port == MIDI_PORT_CV_OUT) {
+            continue;  // drained by cvproc
+        }
+        while((num = midi_stream_peek(port, &msgs)) > 0) {
+            for(i = 0; i < num; i ++) {
+                bstate.msg_count ++;
+                // data1 is not set on 2 byte messages
+                bstate.msg_sum = (bstate.msg_sum * 31) + (msgs[i].port << 24) +
+                    (msgs[i].status << 16) + (msgs[i].data0 << 8) +
+                    ((msgs[i].len > 2) ? msgs[i].data1 : 0);
+                if(port >= MIDI_PORT_NUM_TRACK_OUTPUTS) {
+                    continue;
+                }
+                // play the model synth
+                voice = &bstate.voices[port][msgs[i].status & 0x0f][msgs[i].data0 & 0x7f];
+                if((msgs[i].status & 0xf0) == MIDI_NOTE_ON) {
+                    (*voice) ++;
+                    if(*voice > bstate.max_voices) {
+                        bstate.max_voices = *voice;
+                    }
+                }
+                else if((msgs[i].status & 0xf0) == MIDI_NOTE_OFF && *voice) {
+                    (*voice) --;
+                }
+            }
+            midi_stream_consume(port, num);
+        }
+    }
+}
+
+// get a random number from 0 to range - 1
+int bench_rand(int range) {
+    bstate.rand = (bstate.rand * 1103515245) + 12345;
+    return (bstate.rand >> 8) % range;
+}
+
+// get the host time in seconds
+double bench_get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
+}
@@ -0,0 +1,243 @@
+/*
+ * CARBON Host Simulator - Scale Quantize Benchmark
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Compares the note processing done by outproc for each note: the
+ * original scale table search plus transpose, scale_quantize() from the
+ * quantize maps plus transpose, and the per-track note map lookup. All
+ * three are first checked against each other for every scale, note and
+ * transpose.
+ *
+ * Usage: bench_quantize [iterations]
+ *
+ */
+#include "config.h"
+#include "seq/scale.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// settings
+#define BENCH_DEFAULT_ITERATIONS 10000000
+#define BENCH_TRANSPOSE_MAX 24
+#define BENCH_NUM_NOTES 1024  // note stream length - must be a power of 2
+
+// reference implementation - the original scale tables and search
+static const unsigned char ref_chromatic[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const unsigned char ref_major[] = {0, 2, 4, 5, 7, 9, 11};
+static const unsigned char ref_nat_minor[] = {0, 2, 3, 5, 7, 8, 10};
+static const unsigned char ref_har_minor[] = {0, 2, 3, 5, 7, 8, 11};
+static const unsigned char ref_dorian[] = {0, 2, 3, 5, 7, 9, 10};
+static const unsigned char ref_whole[] = {0, 2, 4, 6, 8, 10};
+static const unsigned char ref_pent[] = {0, 2, 4, 7, 9};
+static const unsigned char ref_dim[] = {0, 2, 3, 5, 6, 8, 9, 11};
+static const unsigned char ref_phrygian[] = {0, 1, 3, 5, 7, 8, 10};
+static const unsigned char ref_lydian[] = {0, 2, 4, 6, 7, 9, 11};
+static const unsigned char ref_mixolydian[] = {0, 2, 4, 5, 7, 9, 10};
+static const unsigned char ref_locrian[] = {0, 1, 3, 5, 6, 8, 10};
+static const unsigned char ref_pent_minor[] = {0, 3, 5, 7, 10};
+static const unsigned char ref_blues[] = {0, 3, 5, 6, 7, 10};
+static const unsigned char ref_half_dim[] = {0, 2, 3, 5, 6, 8, 10};
+static const unsigned char ref_seven_chord[] = {0, 4, 7, 11};
+
+struct ref_scale {
+    const unsigned char *notes;
+    int len;
+};
+static const struct ref_scale ref_scales[SCALE_NUM_TONALITIES] = {
+    {ref_chromatic, 0},  // chromatic was not searched
+    {ref_major, sizeof(ref_major)},
+    {ref_nat_minor, sizeof(ref_nat_minor)},
+    {ref_har_minor, sizeof(ref_har_minor)},
+    {ref_dorian, sizeof(ref_dorian)},
+    {ref_whole, sizeof(ref_whole)},
+    {ref_pent, sizeof(ref_pent)},
+    {ref_dim, sizeof(ref_dim)},
+    {ref_phrygian, sizeof(ref_phrygian)},
+    {ref_lydian, sizeof(ref_lydian)},
+    {ref_mixolydian, sizeof(ref_mixolydian)},
+    {ref_locrian, sizeof(ref_locrian)},
+    {ref_pent_minor, sizeof(ref_pent_minor)},
+    {ref_blues, sizeof(ref_blues)},
+    {ref_half_dim, sizeof(ref_half_dim)},
+    {ref_seven_chord, sizeof(ref_seven_chord)}
+};
+
+// bench state
+struct bench_state {
+    int tonality[SEQ_NUM_TRACKS];
+    int transpose[SEQ_NUM_TRACKS];
+    uint8_t note_map[SEQ_NUM_TRACKS][128];
+    uint8_t notes[BENCH_NUM_NOTES];
+};
+struct bench_state bstate;
+
+volatile int bench_sink;  // keeps the results from being optimized out
+
+// local functions
+unsigned char bench_ref_quantize(unsigned char note, unsigned char scale);
+int bench_ref_process(int track, int note);
+int bench_lut_process(int track, int note);
+int bench_map_process(int track, int note);
+double bench_get_time(void);
+
+// main!
+int main(int argc, char **argv) {
+    int i, scale, note, transpose, track, fails = 0, iterations = BENCH_DEFAULT_ITERATIONS;
+    int ref, lut, map, sum;
+    uint32_t rand = 12345;
+    uint8_t note_map[128];
+    double start, ref_ns, lut_ns, map_ns;
+
+    if(argc > 1) {
+        iterations = atoi(argv[1]);
+    }
+    if(iterations <= 0) {
+        fprintf(stderr, "usage: bench_quantize [iterations]\n");
+        return 1;
+    }
+
+    // check every scale, note and transpose - -1 is out of range
+    for(scale = 0; scale < SCALE_NUM_TONALITIES; scale ++) {
+        for(transpose = -BENCH_TRANSPOSE_MAX; transpose <= BENCH_TRANSPOSE_MAX; transpose ++) {
+            scale_build_note_map(note_map, scale, transpose);
+            for(note = 0; note < 128; note ++) {
+                ref = bench_ref_quantize(note, scale) + transpose;
+                lut = scale_quantize(note, scale) + transpose;
+                map = note_map[note];
+                if(ref < 0 || ref > 127) {
+                    ref = -1;
+                }
+                if(lut < 0 || lut > 127) {
+                    lut = -1;
+                }
+                if(map == SCALE_NOTE_INVALID) {
+                    map = -1;
+                }
+                if(lut != ref || map != ref) {
+                    if(fails < 10) {
+                        printf("FAIL: scale: %d - transpose: %d - note: %d - "
+                            "ref: %d - lut: %d - map: %d\n", scale, transpose, note,
+                            ref, lut, map);
+                    }
+                    fails ++;
+                }
+            }
+        }
+    }
+    printf("check: %d scales x %d transposes x 128 notes - %d failed\n",
+        SCALE_NUM_TONALITIES, (BENCH_TRANSPOSE_MAX * 2) + 1, fails);
+
+    // a different tonality and transpose on each track
+    for(track = 0; track < SEQ_NUM_TRACKS; track ++) {
+        bstate.tonality[track] = ((track * 3) + 1) % SCALE_NUM_TONALITIES;
+        bstate.transpose[track] = (track * 5) - 12;
+        scale_build_note_map(bstate.note_map[track], bstate.tonality[track],
+            bstate.transpose[track]);
+    }
+    for(i = 0; i < BENCH_NUM_NOTES; i ++) {
+        rand = (rand * 1103515245) + 12345;
+        bstate.notes[i] = 24 + ((rand >> 8) % 80);
+    }
+
+    sum = 0;
+    start = bench_get_time();
+    for(i = 0; i < iterations; i ++) {
+        sum += bench_ref_process(i % SEQ_NUM_TRACKS, bstate.notes[i & (BENCH_NUM_NOTES - 1)]);
+    }
+    ref_ns = ((bench_get_time() - start) * 1000000000.0) / iterations;
+    bench_sink = sum;
+
+    sum = 0;
+    start = bench_get_time();
+    for(i = 0; i < iterations; i ++) {
+        sum += bench_lut_process(i % SEQ_NUM_TRACKS, bstate.notes[i & (BENCH_NUM_NOTES - 1)]);
+    }
+    lut_ns = ((bench_get_time() - start) * 1000000000.0) / iterations;
+    bench_sink += sum;
+
+    sum = 0;
+    start = bench_get_time();
+    for(i = 0; i < iterations; i ++) {
+        sum += bench_map_process(i % SEQ_NUM_TRACKS, bstate.notes[i & (BENCH_NUM_NOTES - 1)]);
+    }
+    map_ns = ((bench_get_time() - start) * 1000000000.0) / iterations;
+    bench_sink += sum;
+
+    printf("note processing - %d iterations - %d tracks\n", iterations, SEQ_NUM_TRACKS);
+    printf("  table search:    %8.2f ns/note\n", ref_ns);
+    printf("  scale_quantize(): %7.2f ns/note (%.1fx)\n", lut_ns,
+        (lut_ns > 0.0) ? ref_ns / lut_ns : 0.0);
+    printf("  track note map:  %8.2f ns/note (%.1fx)\n", map_ns,
+        (map_ns > 0.0) ? ref_ns / map_ns : 0.0);
+    return (fails > 0) ? 1 : 0;
+}
+
+//
+// local functions
+//
+// quantize a note with the reference implementation
+unsigned char bench_ref_quantize(unsigned char note, unsigned char scale) {
+    unsigned char nt;
+    int i, shift;
+    shift = (note / 12) * 12;
+    nt = note - shift;
+    for(i = ref_scales[scale].len - 1; i >= 0; i --) {
+        if(ref_scales[scale].notes[i] <= nt) {
+            nt = ref_scales[scale].notes[i];
+            break;
+        }
+    }
+    return nt + shift;
+}
+
+// process a note the original way - returns -1 if out of range
+__attribute__((noinline)) int bench_ref_process(int track, int note) {
+    int temp = bench_ref_quantize(note, bstate.tonality[track]) + bstate.transpose[track];
+    if(temp < 0 || temp > 127) {
+        return -1;
+    }
+    return temp;
+}
+
+// process a note with scale_quantize() - returns -1 if out of range
+__attribute__((noinline)) int bench_lut_process(int track, int note) {
+    int temp = scale_quantize(note, bstate.tonality[track]) + bstate.transpose[track];
+    if(temp < 0 || temp > 127) {
+        return -1;
+    }
+    return temp;
+}
+
+// process a note with the track note map - returns -1 if out of range
+__attribute__((noinline)) int bench_map_process(int track, int note) {
+    int temp = bstate.note_map[track][note & 0x7f];
+    if(temp > 127) {
+        return -1;
+    }
+    return temp;
+}
+
+// get the host time in seconds
+double bench_get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
+}
@@ -0,0 +1,243 @@
+/*
+ * CARBON Host Simulator - Record Timing Test Bench
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Replays timestamped note input against the running internal clock and
+ * measures where RT recording would place each note. Notes are played at
+ * random times and stamped with the time they were played like the input
+ * drivers do. Each one then waits in the queue for a random delay and is
+ * handled on the next 1ms task like the sequencer does.
+ *
+ * Each note is placed by the tick position when it is handled, which is
+ * how recording used to work, and by the tick position at its timestamp.
+ * The placement error is the tick placed on minus the tick nearest to the
+ * time the note was played. The timestamp placement must always land on
+ * the nearest tick. Without MIDI_CLOCK_TICK_TIMER the ticks run on the
+ * 1ms task and notes are placed against the times the ticks really ran.
+ *
+ * Usage: bench_record_timing [max_delay_us]
+ *
+ */
+#include "config.h"
+#include "midi/midi_clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// settings
+#define BENCH_TASK_INTERVAL_US 1000  // RT task interval
+#define BENCH_DEFAULT_DELAY_US 3000  // max queue delay
+#define BENCH_START_US 1000000  // time the clock is started
+#define BENCH_RUN_US 20000000  // time to play notes for after the start
+#define BENCH_NUM_NOTES 2000  // notes played per tempo
+#define BENCH_MAX_TICKS 16384  // max ticks per run
+
+static const float bench_tempos[] = {60.0, 120.0, 180.0, 240.0};
+#define BENCH_NUM_TEMPOS (sizeof(bench_tempos) / sizeof(float))
+
+// placement results for one method
+struct bench_result {
+    int exact;  // notes placed on the nearest tick
+    int err_sum;  // sum of abs tick error
+    int err_max;  // max abs tick error
+};
+
+// bench state
+struct bench_state {
+    int64_t time_us;  // virtual time
+    int64_t clock_timer_us;  // virtual clock timer compare time
+    int64_t tick_time[BENCH_MAX_TICKS];  // time each running tick was due
+    int num_ticks;  // number of running ticks so far
+    int64_t played[BENCH_NUM_NOTES];  // time each note was played
+    int64_t handled[BENCH_NUM_NOTES];  // time each note is handled
+    int queued_pos[BENCH_NUM_NOTES];  // tick position when handled
+    int stamped_pos[BENCH_NUM_NOTES];  // tick position at the timestamp
+    int stamped_offset[BENCH_NUM_NOTES];  // offset from the stamped tick
+    uint32_t rand;  // random state
+};
+struct bench_state bstate;
+
+// local functions
+int bench_run_tempo(float tempo, int max_delay);
+void bench_timer_task(void);
+int bench_nearest_tick(int64_t time);
+void bench_score(struct bench_result *res, int pos, int nearest);
+int bench_rand(int range);
+
+// main!
+int main(int argc, char **argv) {
+    int i, fails = 0, max_delay = BENCH_DEFAULT_DELAY_US;
+
+    if(argc > 1) {
+        max_delay = atoi(argv[1]);
+    }
+    if(max_delay < 0) {
+        fprintf(stderr, "usage: bench_record_timing [max_delay_us]\n");
+        return 1;
+    }
+    printf("%d notes per tempo - queue delay 0-%d us - errors in ticks\n",
+        BENCH_NUM_NOTES, max_delay);
+    printf("%-8s %8s | %8s %8s %8s | %8s %8s %8s %8s\n", "", "",
+        "queued", "", "", "stamped", "", "", "");
+    printf("%-8s %8s | %8s %8s %8s | %8s %8s %8s %8s\n", "tempo", "tick us",
+        "exact %", "mean", "max", "exact %", "mean", "max", "us err");
+    for(i = 0; i < BENCH_NUM_TEMPOS; i ++) {
+        fails += bench_run_tempo(bench_tempos[i], max_delay);
+    }
+    return (fails > 0) ? 1 : 0;
+}
+
+//
+// callbacks
+//
+// the clock ticked for a straight count - save the time it was due
+void midi_clock_ticked_straight(uint32_t tick_count) {
+    if(!midi_clock_get_running() || tick_count >= BENCH_MAX_TICKS) {
+        return;
+    }
+#ifdef MIDI_CLOCK_TICK_TIMER
+    bstate.tick_time[tick_count] = bstate.clock_timer_us;
+#else
+    bstate.tick_time[tick_count] = bstate.time_us;
+#endif
+    bstate.num_ticks = tick_count + 1;
+}
+
+// get the clock timer time in us
+uint32_t clock_timer_get_time(void) {
+    return (uint32_t)bstate.time_us;
+}
+
+//
+// local functions
+//
+// play the notes at a tempo and print the results
+// returns the number of notes not placed on the nearest tick from the timestamp
+int bench_run_tempo(float tempo, int max_delay) {
+    struct bench_result queued, stamped;
+    int64_t end_us = BENCH_START_US + BENCH_RUN_US;
+    int64_t us_err, us_err_max = 0;
+    int i, note, nearest, fails = 0;
+
+    midi_clock_init();
+    midi_clock_set_tempo(tempo);
+    bstate.time_us = 0;
+    bstate.clock_timer_us = 0;
+    bstate.num_ticks = 0;
+    bstate.rand = 12345;
+
+    // notes are played in order at random times after the first few ticks
+    for(i = 0; i < BENCH_NUM_NOTES; i ++) {
+        bstate.played[i] = BENCH_START_US + 100000 +
+            (((int64_t)BENCH_RUN_US - 200000) * i / BENCH_NUM_NOTES) +
+            bench_rand(BENCH_RUN_US / BENCH_NUM_NOTES);
+        bstate.handled[i] = bstate.played[i] + bench_rand(max_delay + 1);
+    }
+
+    // run the clock and handle the notes on the task after they leave the queue
+    note = 0;
+    while(bstate.time_us < end_us) {
+        if(bstate.time_us == BENCH_START_US) {
+            midi_clock_request_continue();
+        }
+        bench_timer_task();
+        while(note < BENCH_NUM_NOTES && bstate.handled[note] <= bstate.time_us) {
+            bstate.queued_pos[note] = midi_clock_get_tick_pos();
+            bstate.stamped_pos[note] = midi_clock_get_tick_pos_at(
+                (uint32_t)bstate.played[note], &bstate.stamped_offset[note]);
+            note ++;
+        }
+    }
+
+    // score against the tick nearest to when each note was played
+    queued.exact = 0;
+    queued.err_sum = 0;
+    queued.err_max = 0;
+    stamped = queued;
+    for(i = 0; i < note; i ++) {
+        nearest = bench_nearest_tick(bstate.played[i]);
+        bench_score(&queued, bstate.queued_pos[i], nearest);
+        bench_score(&stamped, bstate.stamped_pos[i], nearest);
+        if(bstate.stamped_pos[i] != nearest) {
+            fails ++;
+        }
+        // the offset gets back to the time it was played
+        if(bstate.stamped_pos[i] < bstate.num_ticks) {
+            us_err = bstate.tick_time[bstate.stamped_pos[i]] +
+                bstate.stamped_offset[i] - bstate.played[i];
+            if(llabs(us_err) > us_err_max) {
+                us_err_max = llabs(us_err);
+            }
+        }
+    }
+    printf("%-8.1f %8d | %8.1f %8.2f %8d | %8.1f %8.2f %8d %8d%s\n",
+        (double)tempo, (int)(60000000.0 / (tempo * MIDI_CLOCK_PPQ)),
+        100.0 * queued.exact / note, (double)queued.err_sum / note, queued.err_max,
+        100.0 * stamped.exact / note, (double)stamped.err_sum / note, stamped.err_max,
+        (int)us_err_max, fails ? " - FAIL" : "");
+    return fails;
+}
+
+// run one 1ms task period - clock timer compares and then the RT task
+void bench_timer_task(void) {
+#ifdef MIDI_CLOCK_TICK_TIMER
+    uint32_t next_time;
+    while(bstate.clock_timer_us < (bstate.time_us + BENCH_TASK_INTERVAL_US)) {
+        next_time = midi_clock_tick_task((uint32_t)bstate.clock_timer_us);
+        if((int32_t)(next_time - (uint32_t)bstate.clock_timer_us) < 1) {
+            next_time = (uint32_t)bstate.clock_timer_us + 1;
+        }
+        bstate.clock_timer_us += (int32_t)(next_time - (uint32_t)bstate.clock_timer_us);
+    }
+#endif
+    bstate.time_us += BENCH_TASK_INTERVAL_US;
+    midi_clock_timer_task();
+}
+
+// get the running tick nearest to a time
+int bench_nearest_tick(int64_t time) {
+    int i;
+    for(i = 1; i < bstate.num_ticks; i ++) {
+        if(bstate.tick_time[i] > time) {
+            if((bstate.tick_time[i] - time) <= (time - bstate.tick_time[i - 1])) {
+                return i;
+            }
+            return i - 1;
+        }
+    }
+    return bstate.num_ticks - 1;
+}
+
+// score a placement
+void bench_score(struct bench_result *res, int pos, int nearest) {
+    int err = abs(pos - nearest);
+    if(err == 0) {
+        res->exact ++;
+    }
+    res->err_sum += err;
+    if(err > res->err_max) {
+        res->err_max = err;
+    }
+}
+
+// get a random number from 0 to range - 1
+int bench_rand(int range) {
+    bstate.rand = (bstate.rand * 1103515245) + 12345;
+    return (bstate.rand >> 8) % range;
+}
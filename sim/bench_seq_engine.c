@@ -0,0 +1,206 @@
+/*
+ * CARBON Host Simulator - Sequencer Engine Tick Benchmark
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Measures the cost of seq_engine_run() per clock tick with every step
+ * on every track holding a chord that ratchets at 8 notes. Every other
+ * step also has a start delay. The sequencer runs on the virtual 1ms
+ * clock from the simulator and the output messages are counted and
+ * summed so that runs against different engine builds can be compared.
+ *
+ * Usage: bench_seq_engine [run_ms] [tempo]
+ *
+ */
+#include "sim_spi_flash.h"
+#include "config.h"
+#include "cvproc.h"
+#include "ext_flash.h"
+#include "midi/midi_stream.h"
+#include "seq/seq_ctrl.h"
+#include "seq/song.h"
+#include "util/log.h"
+#include "util/rt_prof.h"
+#include "util/state_change.h"
+#include "util/state_change_events.h"
+#include "util/time_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// settings
+#define BENCH_DEFAULT_RUN_MS 60000
+#define BENCH_DEFAULT_TEMPO 240.0
+#define BENCH_LOAD_TIMEOUT_MS 5000
+#define BENCH_CHORD_NOTES 4  // notes on each step
+#define BENCH_NOTE_LEN 24  // ticks - one 16th step
+#define BENCH_START_DELAY 6  // ticks - on odd steps
+
+// bench state
+struct bench_state {
+    int64_t time_us;  // virtual time
+    int64_t clock_timer_us;  // virtual clock timer compare time
+    uint32_t msg_count;  // output messages
+    uint32_t msg_sum;  // output message checksum
+};
+struct bench_state bstate;
+
+// local functions
+void bench_setup_song(void);
+void bench_timer_task(void);
+void bench_drain_outputs(void);
+
+// main!
+int main(int argc, char **argv) {
+    struct rt_prof_stats stats;
+    int i, bin, run_ms = BENCH_DEFAULT_RUN_MS;
+    float tempo = BENCH_DEFAULT_TEMPO;
+
+    if(argc > 1) {
+        run_ms = atoi(argv[1]);
+    }
+    if(argc > 2) {
+        tempo = atof(argv[2]);
+    }
+    if(run_ms <= 0 || tempo <= 0.0) {
+        fprintf(stderr, "usage: bench_seq_engine [run_ms] [tempo]\n");
+        return 1;
+    }
+
+    // same init as the simulator with erased flash
+    log_init();
+    rt_prof_init();
+    midi_stream_init();
+    ext_flash_init();
+    sim_spi_flash_erase();
+    cvproc_init();
+    bstate.time_us = 0;
+    bstate.clock_timer_us = 0;
+    bstate.msg_count = 0;
+    bstate.msg_sum = 0;
+    seq_ctrl_init();
+    state_change_fire0(SCE_CONFIG_CLEARED);
+    seq_ctrl_load_song(0);
+    for(i = 0; i < BENCH_LOAD_TIMEOUT_MS && seq_ctrl_is_run_lockout(); i ++) {
+        bench_timer_task();
+    }
+    if(seq_ctrl_is_run_lockout()) {
+        fprintf(stderr, "song load timed out\n");
+        return 1;
+    }
+    bench_setup_song();
+    song_set_tempo(tempo);
+    bench_drain_outputs();
+    bstate.msg_count = 0;
+    bstate.msg_sum = 0;
+
+    // run
+    seq_ctrl_set_run_state(1);
+    rt_prof_set_enable(1);
+    for(i = 0; i < run_ms; i ++) {
+        bench_timer_task();
+    }
+    rt_prof_set_enable(0);
+
+    rt_prof_get_stats(RT_PROF_TASK_SEQ_ENGINE_RUN, &stats);
+    printf("seq_engine_run() - %d tracks ratcheting x%d - %d note chords - "
+        "%.1f BPM\n", SEQ_NUM_TRACKS, SEQ_RATCHET_MAX, BENCH_CHORD_NOTES,
+        (double)tempo);
+    if(stats.calls == 0) {
+        printf("  no ticks\n");
+        return 1;
+    }
+    printf("  ticks: %u - min: %u ns - avg: %u ns - max: %u ns\n",
+        stats.calls, stats.min, (uint32_t)(stats.total / stats.calls), stats.max);
+    printf("  histogram (bin 0 < %d ns, bin n >= 2^(n+%d) ns):",
+        1 << (RT_PROF_BIN_SHIFT + 1), RT_PROF_BIN_SHIFT);
+    for(bin = 0; bin < RT_PROF_NUM_BINS; bin ++) {
+        printf(" %u", stats.hist[bin]);
+    }
+    printf("\n  output msgs: %u - checksum: %08x\n", bstate.msg_count,
+        bstate.msg_sum);
+    return 0;
+}
+
+//
+// local functions
+//
+// put a ratcheting chord on every step of every track
+void bench_setup_song(void) {
+    struct track_event event;
+    int scene, track, step, note;
+    for(scene = 0; scene < SEQ_NUM_SCENES; scene ++) {
+        for(track = 0; track < SEQ_NUM_TRACKS; track ++) {
+            for(step = 0; step < SEQ_NUM_STEPS; step ++) {
+                song_clear_step(scene, track, step);
+                for(note = 0; note < BENCH_CHORD_NOTES; note ++) {
+                    event.type = SONG_EVENT_NOTE;
+                    event.data0 = 48 + (track * 2) + (note * 4) + (step & 0x07);
+                    event.data1 = 0x60;
+                    event.length = BENCH_NOTE_LEN;
+                    song_add_step_event(scene, track, step, &event);
+                }
+                song_set_ratchet_mode(scene, track, step, SEQ_RATCHET_MAX);
+                song_set_start_delay(scene, track, step,
+                    (step & 0x01) ? BENCH_START_DELAY : 0);
+            }
+        }
+    }
+}
+
+// run one 1ms task period - the RT parts of main_timer_task()
+void bench_timer_task(void) {
+#ifdef MIDI_CLOCK_TICK_TIMER
+    uint32_t next_time;
+    // clock timer compares that fall within this period - same as carbon_sim
+    while(bstate.clock_timer_us < (bstate.time_us + 1000)) {
+        next_time = seq_ctrl_tick_task((uint32_t)bstate.clock_timer_us);
+        if((int32_t)(next_time - (uint32_t)bstate.clock_timer_us) < 1) {
+            next_time = (uint32_t)bstate.clock_timer_us + 1;
+        }
+        bstate.clock_timer_us += (int32_t)(next_time - (uint32_t)bstate.clock_timer_us);
+    }
+#endif
+    bstate.time_us += 1000;
+    time_utils_set_btime((btime)bstate.time_us);
+    seq_ctrl_rt_task();
+    bench_drain_outputs();
+    ext_flash_timer_task();
+    cvproc_timer_task();
+    seq_ctrl_ui_task();
+}
+
+// drain the MIDI output ports and sum up what left - CV is left to cvproc
+void bench_drain_outputs(void) {
+    struct midi_msg *msgs;
+    int port, i, num;
+    for(port = MIDI_PORT_DIN1_OUT; port <= MIDI_PORT_USB_DEV_OUT3; port ++) {
+        if(port == MIDI_PORT_CV_OUT) {
+            continue;  // drained by cvproc
+        }
+        while((num = midi_stream_peek(port, &msgs)) > 0) {
+            for(i = 0; i < num; i ++) {
+                bstate.msg_count ++;
+                bstate.msg_sum = (bstate.msg_sum * 31) + (uint32_t)(bstate.time_us / 1000) +
+                    (msgs[i].port << 24) + (msgs[i].status << 16) +
+                    (msgs[i].data0 << 8) + msgs[i].data1;
+            }
+            midi_stream_consume(port, num);
+        }
+    }
+}
@@ -0,0 +1,449 @@
+/*
+ * CARBON Sequencer Host Benchmark - Incremental Song Saves
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Checks that saving only the changed chunks of a song gives the same
+ * song as saving the whole song. The song starts with notes on every step
+ * so it is stored in several chunks. Each round makes random edits and
+ * saves the song to slot A, which only writes chunks holding changes.
+ * The same song is then saved to slot B, which is always a full save.
+ * Slot A is loaded back and must match the song that was saved to slot B
+ * so that the following save is incremental again. Every save also
+ * writes the song table.
+ *
+ * Some rounds also edit the song while the save is running or write over
+ * slot A behind the song's back like the SYSEX flash write does. Saves
+ * are written from a snapshot so edits during a save must not reach the
+ * flash until the next save. The time spent making the snapshot and each
+ * step of encoding is how long the sequencer task is held up by a save.
+ *
+ * Flash time is estimated from the typical sector erase and page program
+ * times of the part.
+ *
+ * Usage: bench_song_save [rounds] [seed]
+ *
+ */
+#include "sim_spi_flash.h"
+#include "config.h"
+#include "ext_flash.h"
+#include "seq/song.h"
+#include "util/log.h"
+#include "util/rt_prof.h"
+#include "util/state_change.h"
+#include "util/state_change_events.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// settings
+#define BENCH_DEFAULT_ROUNDS 20
+#define BENCH_DEFAULT_SEED 1
+#define BENCH_MAX_EDITS 8  // random edits per round
+#define BENCH_FILL_NOTES 4  // most notes per step in the starting song
+#define BENCH_TIMEOUT_MS 10000
+#define BENCH_SLOT_A 0
+#define BENCH_SLOT_B 1
+#define BENCH_ERASE_US 50000  // typical sector erase time
+#define BENCH_PROGRAM_US 700  // typical page program time
+
+// bench state
+struct bench_state {
+    int done;  // load or save finished
+    int error;  // load or save failed
+    int erases;  // sector erases for incremental saves
+    int programs;  // page programs for incremental saves
+    int full_erases;  // sector erases for full saves
+    int full_programs;  // page programs for full saves
+};
+struct bench_state bstate;
+uint8_t bench_junk[EXT_FLASH_SECTOR_SIZE];  // written over a sector of slot A
+
+// song data changed by the random edits
+struct bench_song {
+    float tempo;
+    int magic_chance;
+    int song_list_scene[SEQ_SONG_LIST_ENTRIES];
+    int transpose[SEQ_NUM_SCENES][SEQ_NUM_TRACKS];
+    int ratchet[SEQ_NUM_SCENES][SEQ_NUM_TRACKS][SEQ_NUM_STEPS];
+    int start_delay[SEQ_NUM_SCENES][SEQ_NUM_TRACKS][SEQ_NUM_STEPS];
+    struct track_event events[SEQ_NUM_SCENES][SEQ_NUM_TRACKS][SEQ_NUM_STEPS][SEQ_TRACK_POLY];
+};
+struct bench_song bench_saved;  // song saved to slot B
+struct bench_song bench_loaded;  // song loaded from slot A
+
+// local functions
+void bench_handle_state_change(int event_type, int *data, int data_len);
+int bench_load(int song_num);
+int bench_save(int song_num, int edit_during, int *erases, int *programs);
+int bench_wait(void);
+int bench_wait_table(void);
+int bench_write_flash(int32_t addr, int len, uint8_t *data);
+void bench_fill_song(void);
+void bench_random_edit(void);
+void bench_get_song(struct bench_song *song);
+int bench_compare(int round);
+float bench_get_flash_tempo(int song_num);
+
+// main!
+int main(int argc, char **argv) {
+    int32_t junk_addr;
+    int i, round, rounds = BENCH_DEFAULT_ROUNDS;
+    int edits, erases, programs;
+    int64_t inc_us, full_us;
+    struct rt_prof_stats stats;
+    float tempo;
+
+    if(argc > 1) {
+        rounds = atoi(argv[1]);
+    }
+    if(argc > 2) {
+        srand(atoi(argv[2]));
+    }
+    else {
+        srand(BENCH_DEFAULT_SEED);
+    }
+    if(rounds <= 0) {
+        fprintf(stderr, "usage: bench_song_save [rounds] [seed]\n");
+        return 1;
+    }
+
+    log_init();
+    rt_prof_init();
+    state_change_init();
+    ext_flash_init();
+    sim_spi_flash_erase();
+    state_change_register(bench_handle_state_change, SCEC_SONG);
+    song_init();
+    memset(&bstate, 0, sizeof(bstate));
+    memset(bench_junk, 0x5a, sizeof(bench_junk));
+    rt_prof_set_enable(1);
+    if(bench_wait_table() == -1) {
+        return 1;
+    }
+
+    // start with a full save of a song with notes on every step
+    bench_fill_song();
+    if(bench_save(BENCH_SLOT_A, 0, &erases, &programs) == -1) {
+        return 1;
+    }
+    for(round = 0; round < rounds; round ++) {
+        // the first round checks that an unchanged song writes nothing
+        edits = (round == 0) ? 0 : (rand() % BENCH_MAX_EDITS) + 1;
+        for(i = 0; i < edits; i ++) {
+            bench_random_edit();
+        }
+        // someone else wrote over the song - the next save must be full
+        if((round % 10) == 5) {
+            junk_addr = song_get_flash_addr(BENCH_SLOT_A,
+                song_get_flash_size(BENCH_SLOT_A) - 1);
+            junk_addr -= junk_addr % EXT_FLASH_SECTOR_SIZE;
+            if(bench_write_flash(junk_addr, EXT_FLASH_SECTOR_SIZE, bench_junk) == -1) {
+                fprintf(stderr, "round %d: flash write failed\n", round);
+                return 1;
+            }
+            song_flash_changed(junk_addr, EXT_FLASH_SECTOR_SIZE);
+        }
+        // incremental save - some rounds edit while the save is running
+        tempo = song_get_tempo();
+        if(bench_save(BENCH_SLOT_A, (round % 4) == 3, &erases, &programs) == -1) {
+            return 1;
+        }
+#ifdef SONG_SAVE_SNAPSHOT
+        if(bench_get_flash_tempo(BENCH_SLOT_A) != tempo) {
+            fprintf(stderr, "round %d: edit during save reached the flash\n", round);
+            return 1;
+        }
+#endif
+        if(round == 0 && (erases != 0 || programs != 0)) {
+            fprintf(stderr, "round 0: unchanged song wrote %d sectors\n", erases);
+            return 1;
+        }
+        bstate.erases += erases;
+        bstate.programs += programs;
+        // edits during the save are only in RAM - flush them before comparing
+        // - this is not counted since the full save would also need it
+        if(bench_save(BENCH_SLOT_A, 0, &erases, &programs) == -1) {
+            return 1;
+        }
+        // full save of the same song to another slot
+        if(bench_save(BENCH_SLOT_B, 0, &erases, &programs) == -1) {
+            return 1;
+        }
+        bstate.full_erases += erases;
+        bstate.full_programs += programs;
+        // back to slot A so the next save is incremental
+        bench_get_song(&bench_saved);
+        if(bench_load(BENCH_SLOT_A) == -1) {
+            return 1;
+        }
+        if(bench_compare(round) == -1) {
+            return 1;
+        }
+    }
+
+    inc_us = ((int64_t)bstate.erases * BENCH_ERASE_US) +
+        ((int64_t)bstate.programs * BENCH_PROGRAM_US);
+    full_us = ((int64_t)bstate.full_erases * BENCH_ERASE_US) +
+        ((int64_t)bstate.full_programs * BENCH_PROGRAM_US);
+    printf("song_save() - %d rounds of 0-%d random edits - %d byte song - "
+        "%d bytes stored\n", rounds, BENCH_MAX_EDITS, EXT_FLASH_SONG_SIZE,
+        song_get_flash_size(BENCH_SLOT_A));
+    printf("  incremental: %d sector erases - %d page programs - "
+        "avg: %d us per round\n", bstate.erases, bstate.programs,
+        (int)(inc_us / rounds));
+    printf("  full:        %d sector erases - %d page programs - "
+        "avg: %d us per round\n", bstate.full_erases, bstate.full_programs,
+        (int)(full_us / rounds));
+    printf("  loaded songs match\n");
+    rt_prof_get_stats(RT_PROF_TASK_SONG_SNAPSHOT, &stats);
+    if(stats.calls) {
+        printf("  snapshots: %u - min: %u ns - avg: %u ns - max: %u ns\n",
+            stats.calls, stats.min, (uint32_t)(stats.total / stats.calls),
+            stats.max);
+    }
+    rt_prof_get_stats(RT_PROF_TASK_SONG_ENCODE, &stats);
+    if(stats.calls) {
+        printf("  encode steps: %u - min: %u ns - avg: %u ns - max: %u ns\n",
+            stats.calls, stats.min, (uint32_t)(stats.total / stats.calls),
+            stats.max);
+    }
+    return 0;
+}
+
+//
+// local functions
+//
+// handle song load and save events
+void bench_handle_state_change(int event_type, int *data, int data_len) {
+    switch(event_type) {
+        case SCE_SONG_LOADED:
+        case SCE_SONG_SAVED:
+            bstate.done = 1;
+            break;
+        case SCE_SONG_LOAD_ERROR:
+        case SCE_SONG_SAVE_ERROR:
+            bstate.done = 1;
+            bstate.error = 1;
+            break;
+        default:
+            break;
+    }
+}
+
+// load a song and wait for it - returns -1 on error
+int bench_load(int song_num) {
+    bstate.done = 0;
+    bstate.error = 0;
+    if(song_load(song_num) == -1 || bench_wait() == -1 || bstate.error) {
+        fprintf(stderr, "song %d load failed\n", song_num);
+        return -1;
+    }
+    return 0;
+}
+
+// save a song and wait for it - returns -1 on error
+// the number of erases and programs used by the save are returned
+int bench_save(int song_num, int edit_during, int *erases, int *programs) {
+    int start_erases, start_programs, i;
+    sim_spi_flash_get_counts(&start_erases, &start_programs);
+    bstate.done = 0;
+    bstate.error = 0;
+    if(song_save(song_num) == -1) {
+        fprintf(stderr, "song %d save start failed\n", song_num);
+        return -1;
+    }
+    // edit after the save has started but before it is written
+    if(edit_during) {
+        for(i = 0; i < BENCH_MAX_EDITS; i ++) {
+            bench_random_edit();
+        }
+        song_set_tempo(song_get_tempo() + 1.0);
+    }
+    if(bench_wait() == -1 || bstate.error) {
+        fprintf(stderr, "song %d save failed\n", song_num);
+        return -1;
+    }
+    sim_spi_flash_get_counts(erases, programs);
+    *erases -= start_erases;
+    *programs -= start_programs;
+    return 0;
+}
+
+// run the tasks until the song load or save is done - returns -1 on timeout
+int bench_wait(void) {
+    int i;
+    for(i = 0; i < BENCH_TIMEOUT_MS; i ++) {
+        if(bstate.done) {
+            return 0;
+        }
+        ext_flash_timer_task();
+        song_timer_task();
+    }
+    fprintf(stderr, "timeout\n");
+    return -1;
+}
+
+// run the tasks until the song table is loaded - returns -1 on timeout
+int bench_wait_table(void) {
+    int i;
+    for(i = 0; i < BENCH_TIMEOUT_MS; i ++) {
+        if(song_get_flash_free() != -1) {
+            return 0;
+        }
+        ext_flash_timer_task();
+        song_timer_task();
+    }
+    fprintf(stderr, "song table load timeout\n");
+    return -1;
+}
+
+// write the flash directly like the SYSEX flash write - returns -1 on error
+int bench_write_flash(int32_t addr, int len, uint8_t *data) {
+    int i;
+    if(ext_flash_save(addr, len, data) == -1) {
+        return -1;
+    }
+    for(i = 0; i < BENCH_TIMEOUT_MS; i ++) {
+        switch(ext_flash_get_state()) {
+            case EXT_FLASH_STATE_SAVE_DONE:
+                return 0;
+            case EXT_FLASH_STATE_SAVE_ERROR:
+                return -1;
+            default:
+                break;
+        }
+        ext_flash_timer_task();
+    }
+    return -1;
+}
+
+// put some notes on every step of the song
+void bench_fill_song(void) {
+    struct track_event event;
+    int scene, track, step, i, notes;
+    for(scene = 0; scene < SEQ_NUM_SCENES; scene ++) {
+        for(track = 0; track < SEQ_NUM_TRACKS; track ++) {
+            for(step = 0; step < SEQ_NUM_STEPS; step ++) {
+                notes = (rand() % BENCH_FILL_NOTES) + 1;
+                for(i = 0; i < notes; i ++) {
+                    event.type = SONG_EVENT_NOTE;
+                    event.data0 = rand() % 128;
+                    event.data1 = (rand() % 127) + 1;
+                    event.dummy = 0;
+                    event.length = (rand() % 96) + 1;
+                    song_add_step_event(scene, track, step, &event);
+                }
+            }
+        }
+    }
+}
+
+// make a random edit to the song
+void bench_random_edit(void) {
+    struct track_event event;
+    int scene = rand() % SEQ_NUM_SCENES;
+    int track = rand() % SEQ_NUM_TRACKS;
+    int step = rand() % SEQ_NUM_STEPS;
+    switch(rand() % 8) {
+        case 0:
+            song_clear_step(scene, track, step);
+            break;
+        case 1:
+        case 2:
+            event.type = SONG_EVENT_NOTE;
+            event.data0 = rand() % 128;
+            event.data1 = (rand() % 127) + 1;
+            event.dummy = 0;
+            event.length = (rand() % 96) + 1;
+            if(song_add_step_event(scene, track, step, &event) == -1) {
+                song_set_step_event(scene, track, step, 0, &event);
+            }
+            break;
+        case 3:
+            song_set_ratchet_mode(scene, track, step,
+                SEQ_RATCHET_MIN + (rand() % (SEQ_RATCHET_MAX - SEQ_RATCHET_MIN + 1)));
+            song_set_start_delay(scene, track, step, rand() % 12);
+            break;
+        case 4:
+            song_set_tempo(60.0 + (rand() % 120));
+            break;
+        case 5:
+            song_set_song_list_scene(rand() % SEQ_SONG_LIST_ENTRIES, scene);
+            break;
+        case 6:
+            song_set_transpose(scene, track, (rand() % 49) - 24);
+            break;
+        default:
+            song_set_magic_chance(SONG_MAGIC_CHANCE_MIN +
+                (rand() % (SONG_MAGIC_CHANCE_MAX - SONG_MAGIC_CHANCE_MIN + 1)));
+            break;
+    }
+}
+
+// get the song data changed by the random edits
+void bench_get_song(struct bench_song *song) {
+    struct track_event event;
+    int scene, track, step, slot;
+    memset(song, 0, sizeof(struct bench_song));
+    song->tempo = song_get_tempo();
+    song->magic_chance = song_get_magic_chance();
+    for(step = 0; step < SEQ_SONG_LIST_ENTRIES; step ++) {
+        song->song_list_scene[step] = song_get_song_list_scene(step);
+    }
+    for(scene = 0; scene < SEQ_NUM_SCENES; scene ++) {
+        for(track = 0; track < SEQ_NUM_TRACKS; track ++) {
+            song->transpose[scene][track] = song_get_transpose(scene, track);
+            for(step = 0; step < SEQ_NUM_STEPS; step ++) {
+                song->ratchet[scene][track][step] =
+                    song_get_ratchet_mode(scene, track, step);
+                song->start_delay[scene][track][step] =
+                    song_get_start_delay(scene, track, step);
+                // only used slots are stored and the dummy byte is not
+                for(slot = 0; slot < SEQ_TRACK_POLY; slot ++) {
+                    if(song_get_step_event(scene, track, step, slot, &event) == -1) {
+                        continue;
+                    }
+                    event.dummy = 0;
+                    song->events[scene][track][step][slot] = event;
+                }
+            }
+        }
+    }
+}
+
+// compare the song loaded from the incremental save with the song that
+// was saved in full - returns -1 on mismatch
+int bench_compare(int round) {
+    bench_get_song(&bench_loaded);
+    if(memcmp(&bench_loaded, &bench_saved, sizeof(struct bench_song)) != 0) {
+        fprintf(stderr, "round %d: incremental save does not match the full save\n",
+            round);
+        return -1;
+    }
+    return 0;
+}
+
+// get the tempo of a song in flash - it follows the version at the start
+float bench_get_flash_tempo(int song_num) {
+    float tempo;
+    memcpy(&tempo, sim_spi_flash_get_mem() +
+        song_get_flash_addr(song_num, sizeof(uint32_t)), sizeof(tempo));
+    return tempo;
+}
@@ -0,0 +1,431 @@
+/*
+ * CARBON Sequencer Host Benchmark - Encoded Song Storage
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Checks the sparse song encoding and the song table. Songs with a
+ * range of step densities are saved, loaded back and checked slot by
+ * slot, and the stored size and estimated load time are reported
+ * against the raw song. Songs are then saved until the flash is full to
+ * check that all song numbers fit with half of the slots used, and to
+ * report how many fit with every slot used.
+ *
+ * A song in a fixed slot of older firmware with no song table must still
+ * load, and a table bank that was not written completely must fall back
+ * to the older bank.
+ *
+ * Load time is estimated from the SPI clock used for flash reads.
+ *
+ * Usage: bench_song_store [seed]
+ *
+ */
+#include "sim_spi_flash.h"
+#include "config.h"
+#include "ext_flash.h"
+#include "seq/song.h"
+#include "util/log.h"
+#include "util/rt_prof.h"
+#include "util/state_change.h"
+#include "util/state_change_events.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// settings
+#define BENCH_DEFAULT_SEED 1
+#define BENCH_TIMEOUT_MS 10000
+#define BENCH_SPI_KHZ 5250  // SPI clock for flash reads
+#define BENCH_SLOT 0
+#define BENCH_SLOT_COPY 1
+#define BENCH_LEGACY_SLOT 3
+#define BENCH_LEGACY_TEMPO 133.0
+#define BENCH_NUM_DENSITIES 5
+#define BENCH_FIT_DENSITY 50  // all songs must fit with this density
+
+// percent of slots used for each density test
+int bench_densities[BENCH_NUM_DENSITIES] = {
+    0, 10, 25, 50, 100
+};
+
+// bench state
+struct bench_state {
+    int done;  // load or save finished
+    int error;  // load or save failed
+    struct track_event events[SEQ_NUM_TRACKS][SEQ_NUM_STEPS][SEQ_TRACK_POLY];
+    int ratchet[SEQ_NUM_TRACKS][SEQ_NUM_STEPS];
+    int start_delay[SEQ_NUM_TRACKS][SEQ_NUM_STEPS];
+};
+struct bench_state bstate;
+uint8_t bench_image[EXT_FLASH_SONG_SIZE];  // raw song for the legacy test
+
+// local functions
+void bench_handle_state_change(int event_type, int *data, int data_len);
+void bench_reset(void);
+int bench_load(int song_num);
+int bench_save(int song_num, int *erases);
+int bench_wait(void);
+int bench_wait_table(void);
+void bench_fill(int density);
+int bench_check(void);
+int bench_compare_stored(int song_a, int song_b);
+int bench_capacity(int density);
+int bench_legacy(void);
+int bench_fallback(void);
+
+// main!
+int main(int argc, char **argv) {
+    struct rt_prof_stats stats;
+    int i, len, erases, ret, fail = 0;
+
+    if(argc > 1) {
+        srand(atoi(argv[1]));
+    }
+    else {
+        srand(BENCH_DEFAULT_SEED);
+    }
+
+    log_init();
+    rt_prof_init();
+    state_change_init();
+    ext_flash_init();
+    state_change_register(bench_handle_state_change, SCEC_SONG);
+    bench_reset();
+    rt_prof_set_enable(1);
+    if(bench_wait_table() == -1) {
+        return 1;
+    }
+
+    printf("song storage - %d byte song - raw load: %d.%d ms\n",
+        EXT_FLASH_SONG_SIZE, (EXT_FLASH_SONG_SIZE * 8) / BENCH_SPI_KHZ,
+        (((EXT_FLASH_SONG_SIZE * 8) % BENCH_SPI_KHZ) * 10) / BENCH_SPI_KHZ);
+    for(i = 0; i < BENCH_NUM_DENSITIES; i ++) {
+        bench_fill(bench_densities[i]);
+        if(bench_save(BENCH_SLOT, &erases) == -1) {
+            return 1;
+        }
+        len = song_get_flash_size(BENCH_SLOT);
+        // load it back over a different song and save it again
+        song_clear();
+        ret = 0;
+        if(bench_load(BENCH_SLOT) == -1 || bench_check() == -1 ||
+                bench_save(BENCH_SLOT_COPY, &ret) == -1 ||
+                bench_compare_stored(BENCH_SLOT, BENCH_SLOT_COPY) == -1) {
+            ret = -1;
+            fail = 1;
+        }
+        printf("  %3d%% of slots: %5d bytes - %d sectors - load: %d.%d ms - "
+            "erases per save: %d - %s\n", bench_densities[i], len,
+            (len + EXT_FLASH_SECTOR_SIZE - 1) / EXT_FLASH_SECTOR_SIZE,
+            (len * 8) / BENCH_SPI_KHZ, (((len * 8) % BENCH_SPI_KHZ) * 10) / BENCH_SPI_KHZ,
+            erases, (ret == -1) ? "FAIL" : "match");
+    }
+    rt_prof_get_stats(RT_PROF_TASK_SONG_SNAPSHOT, &stats);
+    if(stats.calls) {
+        printf("  snapshots: %u - avg: %u ns - max: %u ns\n", stats.calls,
+            (uint32_t)(stats.total / stats.calls), stats.max);
+    }
+    rt_prof_get_stats(RT_PROF_TASK_SONG_ENCODE, &stats);
+    if(stats.calls) {
+        printf("  encode steps: %u - avg: %u ns - max: %u ns\n", stats.calls,
+            (uint32_t)(stats.total / stats.calls), stats.max);
+    }
+    rt_prof_get_stats(RT_PROF_TASK_SONG_DECODE, &stats);
+    if(stats.calls) {
+        printf("  decodes: %u - avg: %u ns - max: %u ns\n", stats.calls,
+            (uint32_t)(stats.total / stats.calls), stats.max);
+    }
+    if(bench_capacity(BENCH_FIT_DENSITY) == -1 || bench_capacity(100) < 0) {
+        fail = 1;
+    }
+    if(bench_legacy() == -1) {
+        fail = 1;
+    }
+    if(bench_fallback() == -1) {
+        fail = 1;
+    }
+    return fail;
+}
+
+//
+// local functions
+//
+// handle song load and save events
+void bench_handle_state_change(int event_type, int *data, int data_len) {
+    switch(event_type) {
+        case SCE_SONG_LOADED:
+        case SCE_SONG_SAVED:
+            bstate.done = 1;
+            break;
+        case SCE_SONG_LOAD_ERROR:
+        case SCE_SONG_SAVE_ERROR:
+            bstate.done = 1;
+            bstate.error = 1;
+            break;
+        default:
+            break;
+    }
+}
+
+// start again with an erased flash
+void bench_reset(void) {
+    sim_spi_flash_erase();
+    song_init();
+}
+
+// load a song and wait for it - returns -1 on error
+int bench_load(int song_num) {
+    bstate.done = 0;
+    bstate.error = 0;
+    if(song_load(song_num) == -1 || bench_wait() == -1 || bstate.error) {
+        fprintf(stderr, "song %d load failed\n", song_num);
+        return -1;
+    }
+    return 0;
+}
+
+// save a song and wait for it - returns -1 on error
+// the number of sector erases used by the save is returned
+int bench_save(int song_num, int *erases) {
+    int start_erases, programs;
+    sim_spi_flash_get_counts(&start_erases, &programs);
+    bstate.done = 0;
+    bstate.error = 0;
+    if(song_save(song_num) == -1 || bench_wait() == -1 || bstate.error) {
+        return -1;
+    }
+    sim_spi_flash_get_counts(erases, &programs);
+    *erases -= start_erases;
+    return 0;
+}
+
+// run the tasks until the song load or save is done - returns -1 on timeout
+int bench_wait(void) {
+    int i;
+    for(i = 0; i < BENCH_TIMEOUT_MS; i ++) {
+        if(bstate.done) {
+            return 0;
+        }
+        ext_flash_timer_task();
+        song_timer_task();
+    }
+    fprintf(stderr, "timeout\n");
+    return -1;
+}
+
+// run the tasks until the song table is loaded - returns -1 on timeout
+int bench_wait_table(void) {
+    int i;
+    for(i = 0; i < BENCH_TIMEOUT_MS; i ++) {
+        if(song_get_flash_free() != -1) {
+            return 0;
+        }
+        ext_flash_timer_task();
+        song_timer_task();
+    }
+    fprintf(stderr, "song table load timeout\n");
+    return -1;
+}
+
+// fill the song with random events in a percent of the slots
+// - the used slots are spread out so steps have gaps
+void bench_fill(int density) {
+    struct track_event event;
+    int track, step, slot;
+    song_clear();
+    for(track = 0; track < SEQ_NUM_TRACKS; track ++) {
+        for(step = 0; step < SEQ_NUM_STEPS; step ++) {
+            song_clear_step(0, track, step);
+            for(slot = 0; slot < SEQ_TRACK_POLY; slot ++) {
+                if((rand() % 100) >= density) {
+                    continue;
+                }
+                event.type = (rand() & 1) ? SONG_EVENT_NOTE : SONG_EVENT_CC;
+                event.data0 = rand() % 128;
+                event.data1 = rand() % 128;
+                event.dummy = 0;
+                event.length = rand() % 0x10000;
+                song_set_step_event(0, track, step, slot, &event);
+            }
+            if((rand() % 100) < density) {
+                song_set_ratchet_mode(0, track, step,
+                    SEQ_RATCHET_MIN + (rand() % (SEQ_RATCHET_MAX - SEQ_RATCHET_MIN + 1)));
+                song_set_start_delay(0, track, step, rand() % 12);
+            }
+            memcpy(bstate.events[track][step], song_get_step_event_slots(0, track, step),
+                sizeof(bstate.events[track][step]));
+            bstate.ratchet[track][step] = song_get_ratchet_mode(0, track, step);
+            bstate.start_delay[track][step] = song_get_start_delay(0, track, step);
+        }
+    }
+}
+
+// check the loaded song against the filled song - returns -1 on mismatch
+int bench_check(void) {
+    struct track_event event, *want;
+    int track, step, slot, ret;
+    for(track = 0; track < SEQ_NUM_TRACKS; track ++) {
+        for(step = 0; step < SEQ_NUM_STEPS; step ++) {
+            for(slot = 0; slot < SEQ_TRACK_POLY; slot ++) {
+                want = &bstate.events[track][step][slot];
+                ret = song_get_step_event(0, track, step, slot, &event);
+                if(want->type == SONG_EVENT_NULL && ret == -1) {
+                    continue;
+                }
+                if(ret == -1 || event.type != want->type ||
+                        event.data0 != want->data0 || event.data1 != want->data1 ||
+                        event.length != want->length) {
+                    fprintf(stderr, "track %d step %d slot %d mismatch\n",
+                        track, step, slot);
+                    return -1;
+                }
+            }
+            if(song_get_ratchet_mode(0, track, step) != bstate.ratchet[track][step] ||
+                    song_get_start_delay(0, track, step) != bstate.start_delay[track][step]) {
+                fprintf(stderr, "track %d step %d params mismatch\n", track, step);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// compare two stored songs - returns -1 on mismatch
+int bench_compare_stored(int song_a, int song_b) {
+    uint8_t *mem = sim_spi_flash_get_mem();
+    int i, len = song_get_flash_size(song_a);
+    if(len <= 0 || len != song_get_flash_size(song_b)) {
+        fprintf(stderr, "stored size mismatch: %d - %d\n", len,
+            song_get_flash_size(song_b));
+        return -1;
+    }
+    for(i = 0; i < len; i ++) {
+        if(mem[song_get_flash_addr(song_a, i)] != mem[song_get_flash_addr(song_b, i)]) {
+            fprintf(stderr, "stored songs differ at offset 0x%05x\n", i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// save songs with a percent of the slots used until the flash is full
+// returns the number of songs that fit, -1 if not all songs fit at the
+// fit density or -2 if a changed song can't be saved again
+int bench_capacity(int density) {
+    int song, erases, free_start;
+    bench_reset();
+    if(bench_wait_table() == -1) {
+        return -1;
+    }
+    free_start = song_get_flash_free();
+    bench_fill(density);
+    for(song = 0; song < SEQ_NUM_SONGS; song ++) {
+        if(bench_save(song, &erases) == -1) {
+            break;
+        }
+    }
+    printf("  capacity: %d songs with %d%% of slots - %d of %d sectors free - "
+        "raw slots: %d\n", song, density, song_get_flash_free(), free_start,
+        SEQ_NUM_LEGACY_SONGS);
+    if(density <= BENCH_FIT_DENSITY && song < SEQ_NUM_SONGS) {
+        printf("  FAIL - flash full after %d songs\n", song);
+        return -1;
+    }
+    // a changed song only needs room for its changed sectors
+    song_set_tempo(song_get_tempo() + 1.0);
+    if(bench_save(0, &erases) == -1) {
+        printf("  FAIL - changed song could not be saved again\n");
+        return -2;
+    }
+    return song;
+}
+
+// load a song written in a fixed slot by older firmware
+// returns -1 on error
+int bench_legacy(void) {
+    float tempo = BENCH_LEGACY_TEMPO;
+    uint32_t magic = SONG_MAGIC_NUM;
+    int erases;
+    bench_reset();
+    // raw song with the tempo after the version and the magic number at the end
+    memset(bench_image, 0, sizeof(bench_image));
+    memcpy(bench_image + sizeof(uint32_t), &tempo, sizeof(tempo));
+    memcpy(bench_image + EXT_FLASH_SONG_SIZE - sizeof(magic), &magic, sizeof(magic));
+    memcpy(sim_spi_flash_get_mem() + EXT_FLASH_SONG_OFFSET +
+        (EXT_FLASH_SONG_SIZE * BENCH_LEGACY_SLOT), bench_image, sizeof(bench_image));
+    if(bench_wait_table() == -1) {
+        return -1;
+    }
+    // empty slots are free
+    if(song_get_flash_size(BENCH_LEGACY_SLOT) != EXT_FLASH_SONG_SIZE ||
+            song_get_flash_size(BENCH_LEGACY_SLOT - 1) != 0 ||
+            bench_load(BENCH_LEGACY_SLOT) == -1 ||
+            song_get_tempo() != BENCH_LEGACY_TEMPO) {
+        printf("  legacy: FAIL - slot %d did not load\n", BENCH_LEGACY_SLOT);
+        return -1;
+    }
+    // saving a change stores it encoded and writes the first table
+    song_set_tempo(BENCH_LEGACY_TEMPO + 1.0);
+    if(bench_save(BENCH_LEGACY_SLOT, &erases) == -1 || bench_load(BENCH_LEGACY_SLOT) == -1 ||
+            song_get_tempo() != (BENCH_LEGACY_TEMPO + 1.0) ||
+            song_get_flash_size(BENCH_LEGACY_SLOT) >= EXT_FLASH_SONG_SIZE) {
+        printf("  legacy: FAIL - slot %d did not save\n", BENCH_LEGACY_SLOT);
+        return -1;
+    }
+    printf("  legacy: slot %d loaded - %d bytes after save\n", BENCH_LEGACY_SLOT,
+        song_get_flash_size(BENCH_LEGACY_SLOT));
+    return 0;
+}
+
+// damage the newest table bank and check the older one is used
+// returns -1 on error
+int bench_fallback(void) {
+    uint8_t *mem = sim_spi_flash_get_mem();
+    uint32_t seq0, seq1;
+    int32_t addr;
+    int erases;
+    bench_reset();
+    if(bench_wait_table() == -1) {
+        return -1;
+    }
+    bench_fill(25);
+    song_set_tempo(100.0);
+    if(bench_save(BENCH_SLOT, &erases) == -1) {
+        return -1;
+    }
+    song_set_tempo(101.0);
+    if(bench_save(BENCH_SLOT, &erases) == -1) {
+        return -1;
+    }
+    // the newest bank has the highest sequence number
+    memcpy(&seq0, mem + EXT_FLASH_SONG_TABLE_OFFSET + sizeof(uint32_t), sizeof(seq0));
+    memcpy(&seq1, mem + EXT_FLASH_SONG_TABLE_OFFSET + EXT_FLASH_SONG_TABLE_SIZE +
+        sizeof(uint32_t), sizeof(seq1));
+    addr = EXT_FLASH_SONG_TABLE_OFFSET;
+    if((int32_t)(seq1 - seq0) > 0) {
+        addr += EXT_FLASH_SONG_TABLE_SIZE;
+    }
+    mem[addr + 16] ^= 0xff;
+    song_flash_changed(addr + 16, 1);
+    if(bench_load(BENCH_SLOT) == -1 || song_get_tempo() != 100.0) {
+        printf("  fallback: FAIL - tempo: %.1f\n", (double)song_get_tempo());
+        return -1;
+    }
+    printf("  fallback: damaged table bank skipped - older song loaded\n");
+    return 0;
+}
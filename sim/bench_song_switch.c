@@ -0,0 +1,413 @@
+/*
+ * CARBON Host Simulator - Song Switch Benchmark
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Checks that a song loaded while the sequencer is running is preloaded
+ * in the background and switched in on a beat without stopping. Two songs
+ * with a different note on every step of track 1 are saved to flash. The
+ * first is played and the second is loaded part way through a beat. The
+ * run state, clock position and note spacing are checked across the
+ * switch and the switch time is reported. SCE_SONG_LOADED must follow
+ * from the UI task. Then a load is requested and the sequencer stopped
+ * before the switch, once before the song is loaded and once when it is
+ * ready. The song must be loaded when stopped and an edit made after
+ * that must survive the next start.
+ *
+ * Usage: bench_song_switch [run_ms] [tempo]
+ *
+ */
+#include "sim_spi_flash.h"
+#include "config.h"
+#include "cvproc.h"
+#include "ext_flash.h"
+#include "midi/midi_clock.h"
+#include "midi/midi_protocol.h"
+#include "midi/midi_stream.h"
+#include "seq/seq_ctrl.h"
+#include "seq/song.h"
+#include "util/log.h"
+#include "util/rt_prof.h"
+#include "util/state_change.h"
+#include "util/state_change_events.h"
+#include "util/time_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// settings
+#define BENCH_DEFAULT_RUN_MS 6000
+#define BENCH_DEFAULT_TEMPO 120.0
+#define BENCH_IO_TIMEOUT_MS 5000
+#define BENCH_OLD_NOTE 60  // note on every step of the playing song
+#define BENCH_NEW_NOTE 72  // note on every step of the next song
+#define BENCH_NOTE_LEN 12  // ticks
+#define BENCH_LOAD_OFFSET_MS 37  // queue the load off the beat
+#define BENCH_READY_MS 50  // time for a preload to be ready - less than a beat
+#define BENCH_RESTART_MS 1500  // run time after stopping with a preload
+
+// bench state
+struct bench_state {
+    int64_t time_us;  // virtual time
+    int64_t clock_timer_us;  // virtual clock timer compare time
+    int saved;  // a song save finished
+    int64_t switch_us;  // time the next song was switched in - -1 = none
+    uint32_t switch_tick;  // tick position at the switch
+    uint32_t switches;  // songs switched in by the sequencer
+    int64_t loaded_us;  // time SCE_SONG_LOADED followed the switch - -1 = none
+    int64_t last_note_us;  // time of the last note on - -1 = none
+    int max_interval_ms;  // longest time between note ons
+    int old_after;  // old song notes after the switch
+    int new_before;  // new song notes before the switch
+    int first_new_tick;  // tick of the first new song note - -1 = none
+};
+struct bench_state bstate;
+
+// local functions
+void bench_handle_state_change(int event_type, int *data, int data_len);
+int bench_setup_song(int song, int note);
+int bench_wait(int *flag);
+int bench_check_stop(const char *name, int song, int wait_ms, float tempo);
+void bench_check_switch(void);
+void bench_timer_task(void);
+void bench_drain_outputs(void);
+
+// main!
+int main(int argc, char **argv) {
+    struct rt_prof_stats stats;
+    uint32_t tick_pos, last_tick_pos, start_tick, expected;
+    int64_t start_us;
+    int i, run_ms = BENCH_DEFAULT_RUN_MS, stopped = 0, backwards = 0, fail = 0;
+    int load_ms, step_ms;
+    float tempo = BENCH_DEFAULT_TEMPO;
+
+    if(argc > 1) {
+        run_ms = atoi(argv[1]);
+    }
+    if(argc > 2) {
+        tempo = atof(argv[2]);
+    }
+    if(run_ms <= 0 || tempo <= 0.0) {
+        fprintf(stderr, "usage: bench_song_switch [run_ms] [tempo]\n");
+        return 1;
+    }
+    load_ms = (run_ms / 3) + BENCH_LOAD_OFFSET_MS;
+    step_ms = (int)(60000.0 / (tempo * 4.0));  // 16th note steps
+
+    // same init as the simulator with erased flash
+    log_init();
+    rt_prof_init();
+    midi_stream_init();
+    ext_flash_init();
+    sim_spi_flash_erase();
+    cvproc_init();
+    bstate.time_us = 0;
+    bstate.clock_timer_us = 0;
+    bstate.switch_us = -1;
+    bstate.switches = 0;
+    bstate.loaded_us = -1;
+    seq_ctrl_init();
+    state_change_register(bench_handle_state_change, SCEC_SONG);
+    state_change_fire0(SCE_CONFIG_CLEARED);
+    seq_ctrl_load_song(0);
+    for(i = 0; i < BENCH_IO_TIMEOUT_MS && seq_ctrl_is_run_lockout(); i ++) {
+        bench_timer_task();
+    }
+    if(seq_ctrl_is_run_lockout()) {
+        fprintf(stderr, "song load timed out\n");
+        return 1;
+    }
+
+    // write the next song and then the playing song so it stays loaded
+    song_set_tempo(tempo);
+    if(bench_setup_song(1, BENCH_NEW_NOTE) == -1 ||
+            bench_setup_song(0, BENCH_OLD_NOTE) == -1) {
+        fprintf(stderr, "song save timed out\n");
+        return 1;
+    }
+    bench_drain_outputs();
+    bstate.last_note_us = -1;
+    bstate.max_interval_ms = 0;
+    bstate.old_after = 0;
+    bstate.new_before = 0;
+    bstate.first_new_tick = -1;
+
+    // start running - the clock starts on the next task
+    seq_ctrl_set_run_state(1);
+    for(i = 0; i < BENCH_IO_TIMEOUT_MS && !midi_clock_get_running(); i ++) {
+        bench_timer_task();
+    }
+    start_us = bstate.time_us;
+    start_tick = midi_clock_get_tick_pos();
+    last_tick_pos = start_tick;
+
+    // run and load the next song part way through
+    rt_prof_set_enable(1);
+    for(i = 0; i < run_ms; i ++) {
+        if(i == load_ms) {
+            seq_ctrl_load_song(1);
+        }
+        bench_timer_task();
+        if(!seq_ctrl_get_run_state()) {
+            stopped ++;
+        }
+        tick_pos = midi_clock_get_tick_pos();
+        if(tick_pos < last_tick_pos) {
+            backwards ++;
+        }
+        last_tick_pos = tick_pos;
+    }
+    expected = start_tick +
+        (uint32_t)((double)run_ms * tempo * MIDI_CLOCK_PPQ / 60000.0);
+
+    printf("song switch - %d ms run - %.1f BPM - load at %d ms\n", run_ms,
+        (double)tempo, load_ms);
+    if(bstate.switch_us == -1) {
+        printf("  FAIL - song was not switched\n");
+        return 1;
+    }
+    rt_prof_get_stats(RT_PROF_TASK_SONG_SWITCH, &stats);
+    printf("  switched at %d ms (%d ms after load) - tick: %u - switch: %u ns\n",
+        (int)((bstate.switch_us - start_us) / 1000),
+        (int)((bstate.switch_us - start_us) / 1000) - load_ms,
+        bstate.switch_tick, stats.max);
+    printf("  first new note: %d ticks after switch - max note interval: %d ms "
+        "(step: %d ms)\n", (bstate.first_new_tick == -1) ? -1 :
+        (bstate.first_new_tick - (int)bstate.switch_tick),
+        bstate.max_interval_ms, step_ms);
+    printf("  tick pos: %u - expected: %u\n", last_tick_pos, expected);
+    if(bstate.loaded_us == -1 || seq_ctrl_get_current_song() != 1) {
+        printf("  FAIL - song loaded event did not follow the switch\n");
+        fail = 1;
+    }
+    else {
+        printf("  song loaded event: %d ms after switch\n",
+            (int)((bstate.loaded_us - bstate.switch_us) / 1000));
+    }
+    if(stopped) {
+        printf("  FAIL - stopped for %d ms\n", stopped);
+        fail = 1;
+    }
+    if(backwards || last_tick_pos + 1 < expected) {
+        printf("  FAIL - clock position was reset\n");
+        fail = 1;
+    }
+    if((bstate.switch_tick % MIDI_CLOCK_PPQ) != 0) {
+        printf("  FAIL - switch was not on a beat\n");
+        fail = 1;
+    }
+    if(bstate.first_new_tick == -1 || bstate.old_after || bstate.new_before) {
+        printf("  FAIL - notes crossed the switch - old after: %d - new before: %d\n",
+            bstate.old_after, bstate.new_before);
+        fail = 1;
+    }
+    if(bstate.max_interval_ms > (step_ms + 1)) {
+        printf("  FAIL - gap in playback\n");
+        fail = 1;
+    }
+    if(!fail) {
+        printf("  gapless\n");
+    }
+
+    // stop before a requested switch - still loading and ready
+    fail |= bench_check_stop("queued", 0, 0, tempo + 10.0);
+    fail |= bench_check_stop("ready", 1, BENCH_READY_MS, tempo + 20.0);
+    rt_prof_set_enable(0);
+    return fail;
+}
+
+//
+// local functions
+//
+// handle state change
+void bench_handle_state_change(int event_type, int *data, int data_len) {
+    switch(event_type) {
+        case SCE_SONG_SAVED:
+            bstate.saved = 1;
+            break;
+        case SCE_SONG_LOADED:
+            if(data_len > 1 && data[1] && bstate.loaded_us == -1) {
+                bstate.loaded_us = bstate.time_us;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// put a note on every step of track 1 and save the song
+// returns -1 on error
+int bench_setup_song(int song, int note) {
+    struct track_event event;
+    int scene, track, step;
+    for(scene = 0; scene < SEQ_NUM_SCENES; scene ++) {
+        for(track = 0; track < SEQ_NUM_TRACKS; track ++) {
+            for(step = 0; step < SEQ_NUM_STEPS; step ++) {
+                song_clear_step(scene, track, step);
+                if(track != 0) {
+                    continue;
+                }
+                event.type = SONG_EVENT_NOTE;
+                event.data0 = note;
+                event.data1 = 0x60;
+                event.length = BENCH_NOTE_LEN;
+                song_add_step_event(scene, track, step, &event);
+            }
+        }
+    }
+    bstate.saved = 0;
+    if(song_save(song) == -1) {
+        return -1;
+    }
+    return bench_wait(&bstate.saved);
+}
+
+// run the tasks until a flag is set - returns -1 on timeout
+int bench_wait(int *flag) {
+    int i;
+    for(i = 0; i < BENCH_IO_TIMEOUT_MS && !*flag; i ++) {
+        bench_timer_task();
+    }
+    if(!*flag) {
+        return -1;
+    }
+    return 0;
+}
+
+// load a song while running and stop before it is switched in
+// - the song must be loaded when stopped and an edit made after that
+//   must survive the next start
+// returns 1 on failure
+int bench_check_stop(const char *name, int song, int wait_ms, float tempo) {
+    uint32_t switches;
+    int i, ok;
+    // load just after a beat so there is time before the next one
+    seq_ctrl_set_run_state(1);
+    for(i = 0; i < BENCH_IO_TIMEOUT_MS &&
+            (!midi_clock_get_running() ||
+            (midi_clock_get_tick_pos() % MIDI_CLOCK_PPQ) != 1); i ++) {
+        bench_timer_task();
+    }
+    switches = bstate.switches;
+    seq_ctrl_load_song(song);
+    for(i = 0; i < wait_ms; i ++) {
+        bench_timer_task();
+    }
+    // with no wait the load is asked for again on each task until the
+    // sequencer stops so it is still queued when it does
+    seq_ctrl_set_run_state(0);
+    for(i = 0; i < BENCH_IO_TIMEOUT_MS && midi_clock_get_running(); i ++) {
+        if(wait_ms == 0) {
+            seq_ctrl_load_song(song);
+        }
+        bench_timer_task();
+    }
+    for(i = 0; i < BENCH_IO_TIMEOUT_MS && seq_ctrl_is_run_lockout(); i ++) {
+        bench_timer_task();
+    }
+    ok = !seq_ctrl_is_run_lockout() && !midi_clock_get_running() &&
+        seq_ctrl_get_current_song() == song && bstate.switches == switches;
+    // edit and start again - the edit must not be replaced by a switch
+    song_set_tempo(tempo);
+    seq_ctrl_set_run_state(1);
+    for(i = 0; i < BENCH_RESTART_MS; i ++) {
+        bench_timer_task();
+    }
+    ok = ok && bstate.switches == switches && song_get_tempo() == tempo;
+    printf("  stop while %-7s - song: %d - tempo: %.1f - switches: %u - %s\n", name,
+        seq_ctrl_get_current_song() + 1, (double)song_get_tempo(),
+        bstate.switches - switches, ok ? "loaded on stop" : "FAIL - preload left armed");
+    return ok ? 0 : 1;
+}
+
+// check if the sequencer switched songs during the last task
+void bench_check_switch(void) {
+    struct rt_prof_stats stats;
+    rt_prof_get_stats(RT_PROF_TASK_SONG_SWITCH, &stats);
+    if(stats.calls == bstate.switches) {
+        return;
+    }
+    bstate.switches = stats.calls;
+    if(bstate.switch_us == -1) {
+        bstate.switch_us = bstate.time_us;
+        // the clock has moved on by the time the task is done
+        bstate.switch_tick = midi_clock_get_tick_pos() - 1;
+    }
+}
+
+// run one 1ms task period - the RT parts of main_timer_task() and the UI task
+void bench_timer_task(void) {
+#ifdef MIDI_CLOCK_TICK_TIMER
+    uint32_t next_time;
+    // clock timer compares that fall within this period - same as carbon_sim
+    while(bstate.clock_timer_us < (bstate.time_us + 1000)) {
+        next_time = seq_ctrl_tick_task((uint32_t)bstate.clock_timer_us);
+        if((int32_t)(next_time - (uint32_t)bstate.clock_timer_us) < 1) {
+            next_time = (uint32_t)bstate.clock_timer_us + 1;
+        }
+        bstate.clock_timer_us += (int32_t)(next_time - (uint32_t)bstate.clock_timer_us);
+    }
+#endif
+    bstate.time_us += 1000;
+    time_utils_set_btime((btime)bstate.time_us);
+    seq_ctrl_rt_task();
+    bench_check_switch();
+    bench_drain_outputs();
+    ext_flash_timer_task();
+    cvproc_timer_task();
+    seq_ctrl_ui_task();
+}
+
+// drain the MIDI output ports and check the note ons - CV is left to cvproc
+void bench_drain_outputs(void) {
+    struct midi_msg *msgs;
+    int port, i, num, interval;
+    for(port = MIDI_PORT_DIN1_OUT; port <= MIDI_PORT_USB_DEV_OUT3; port ++) {
+        if(port == MIDI_PORT_CV_OUT) {
+            continue;  // drained by cvproc
+        }
+        while((num = midi_stream_peek(port, &msgs)) > 0) {
+            for(i = 0; i < num; i ++) {
+                if((msgs[i].status & 0xf0) != MIDI_NOTE_ON || msgs[i].data1 == 0) {
+                    continue;
+                }
+                // spacing between note ons - notes on several ports count once
+                if(bstate.last_note_us != -1 && bstate.last_note_us != bstate.time_us) {
+                    interval = (int)((bstate.time_us - bstate.last_note_us) / 1000);
+                    if(interval > bstate.max_interval_ms) {
+                        bstate.max_interval_ms = interval;
+                    }
+                }
+                bstate.last_note_us = bstate.time_us;
+                if(msgs[i].data0 == BENCH_NEW_NOTE) {
+                    if(bstate.switch_us == -1) {
+                        bstate.new_before ++;
+                    }
+                    else if(bstate.first_new_tick == -1) {
+                        // the clock has moved on by the time outputs are drained
+                        bstate.first_new_tick = (int)midi_clock_get_tick_pos() - 1;
+                    }
+                }
+                else if(bstate.switch_us != -1) {
+                    bstate.old_after ++;
+                }
+            }
+            midi_stream_consume(port, num);
+        }
+    }
+}
@@ -0,0 +1,193 @@
+/*
+ * CARBON Host Simulator - Bulk State Change Benchmark
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Checks that a deferred handler like the GUI still ends up up to date
+ * after operations that fire more events than the deferred queue holds.
+ * A handler is registered deferred for the same classes as the GUI and
+ * the song is cleared, saved and loaded and a scene is copied through
+ * seq_ctrl. After each one the UI task is run until the queue is empty
+ * and the last song event fired must have been delivered or followed by
+ * a resync.
+ *
+ * Usage: bench_state_bulk
+ *
+ */
+#include "sim_spi_flash.h"
+#include "config.h"
+#include "cvproc.h"
+#include "ext_flash.h"
+#include "midi/midi_stream.h"
+#include "seq/seq_ctrl.h"
+#include "seq/song.h"
+#include "util/log.h"
+#include "util/rt_prof.h"
+#include "util/state_change.h"
+#include "util/state_change_events.h"
+#include "util/time_utils.h"
+#include <stdio.h>
+#include <string.h>
+
+// settings
+#define BENCH_IO_TIMEOUT_MS 5000
+#define BENCH_SONG 0
+
+// bench state
+struct bench_state {
+    int64_t time_us;  // virtual time
+    int saved;  // a song save finished
+    int last_fired;  // last song event fired - -1 = none
+    int last_delivered;  // last song event delivered to the deferred handler
+    int fired;  // song events fired
+    int delivered;  // events delivered to the deferred handler
+    int resyncs;  // resyncs delivered to the deferred handler
+};
+struct bench_state bstate;
+
+// local functions
+void bench_handle_state_change(int event_type, int *data, int data_len);
+void bench_handle_deferred(int event_type, int *data, int data_len);
+int bench_check(const char *name);
+void bench_timer_task(void);
+void bench_drain_outputs(void);
+
+// main!
+int main(int argc, char **argv) {
+    int i, fail = 0;
+
+    // same init as the simulator with erased flash
+    log_init();
+    rt_prof_init();
+    midi_stream_init();
+    ext_flash_init();
+    sim_spi_flash_erase();
+    cvproc_init();
+    memset(&bstate, 0, sizeof(bstate));
+    seq_ctrl_init();
+    state_change_register(bench_handle_state_change, SCEC_SONG);
+    state_change_register_deferred(bench_handle_deferred, SCEC_SONG);
+    state_change_register_deferred(bench_handle_deferred, SCEC_CTRL);
+    state_change_register_deferred(bench_handle_deferred, SCEC_ENG);
+    state_change_fire0(SCE_CONFIG_CLEARED);
+    for(i = 0; i < BENCH_IO_TIMEOUT_MS && song_get_flash_free() == -1; i ++) {
+        bench_timer_task();
+    }
+
+    printf("bulk state changes - %d byte song\n", EXT_FLASH_SONG_SIZE);
+    bstate.last_fired = -1;
+    seq_ctrl_clear_song();
+    fail |= bench_check("clear");
+
+    song_set_tempo(135.0);
+    seq_ctrl_save_song(BENCH_SONG);
+    for(i = 0; i < BENCH_IO_TIMEOUT_MS && !bstate.saved; i ++) {
+        bench_timer_task();
+    }
+    fail |= bench_check("save");
+
+    seq_ctrl_load_song(BENCH_SONG);
+    fail |= bench_check("load");
+
+    seq_ctrl_copy_scene(1);
+    fail |= bench_check("copy scene");
+    return fail;
+}
+
+//
+// local functions
+//
+// handle state change - runs as the event is fired
+void bench_handle_state_change(int event_type, int *data, int data_len) {
+    if(event_type == SCE_SONG_SAVED) {
+        bstate.saved = 1;
+    }
+    bstate.last_fired = event_type;
+    bstate.fired ++;
+}
+
+// handle deferred state change - runs from the UI task
+void bench_handle_deferred(int event_type, int *data, int data_len) {
+    bstate.delivered ++;
+    switch(event_type) {
+        case SCE_SONG_RESYNC:
+        case SCE_CTRL_RESYNC:
+        case SCE_ENG_RESYNC:
+            bstate.resyncs ++;
+            break;
+        default:
+            break;
+    }
+    // a song resync covers everything fired before it
+    if((event_type & 0xff0000) == SCEC_SONG) {
+        bstate.last_delivered = event_type;
+    }
+}
+
+// run the tasks until the UI is unlocked and the queue is empty and check
+// that the last song event fired reached the deferred handler
+// returns 1 on failure
+int bench_check(const char *name) {
+    uint32_t queued, coalesced, dropped;
+    int i, ok;
+    for(i = 0; i < BENCH_IO_TIMEOUT_MS && seq_ctrl_is_run_lockout(); i ++) {
+        bench_timer_task();
+    }
+    bench_timer_task();  // drain what was fired by the last task
+    state_change_get_deferred_stats(&queued, &coalesced, &dropped);
+    ok = !seq_ctrl_is_run_lockout() && bstate.last_fired != -1 &&
+        (bstate.last_delivered == bstate.last_fired ||
+        bstate.last_delivered == SCE_SONG_RESYNC);
+    printf("  %-10s - fired: %5d - delivered: %4d - queued: %5u - coalesced: %5u - "
+        "dropped: %5u - resyncs: %d - %s\n", name, bstate.fired, bstate.delivered,
+        queued, coalesced, dropped, bstate.resyncs,
+        ok ? "final event delivered" : "FAIL - final event lost");
+    state_change_reset_stats();
+    bstate.fired = 0;
+    bstate.delivered = 0;
+    bstate.resyncs = 0;
+    bstate.last_fired = -1;
+    bstate.last_delivered = -1;
+    return ok ? 0 : 1;
+}
+
+// run one 1ms task period - the RT parts of main_timer_task() and the UI task
+void bench_timer_task(void) {
+    bstate.time_us += 1000;
+    time_utils_set_btime((btime)bstate.time_us);
+    seq_ctrl_rt_task();
+    bench_drain_outputs();
+    ext_flash_timer_task();
+    cvproc_timer_task();
+    seq_ctrl_ui_task();
+}
+
+// drain the MIDI output ports - CV is left to cvproc
+void bench_drain_outputs(void) {
+    struct midi_msg *msgs;
+    int port, num;
+    for(port = MIDI_PORT_DIN1_OUT; port <= MIDI_PORT_USB_DEV_OUT3; port ++) {
+        if(port == MIDI_PORT_CV_OUT) {
+            continue;  // drained by cvproc
+        }
+        while((num = midi_stream_peek(port, &msgs)) > 0) {
+            midi_stream_consume(port, num);
+        }
+    }
+}
@@ -0,0 +1,203 @@
+/*
+ * CARBON Host Simulator - State Change Dispatch Benchmark
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Compares the cost of state_change_fire() against the original flat
+ * 256 slot dispatch. The same set of handler registrations as the
+ * firmware is used. A third run registers the GUI handler as deferred
+ * and drains the queue the way the UI loop does.
+ *
+ * Usage: bench_state_change [iterations]
+ *
+ */
+#include "config.h"
+#include "util/rt_prof.h"
+#include "util/state_change.h"
+#include "util/state_change_events.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// settings
+#define BENCH_DEFAULT_ITERATIONS 10000000
+#define BENCH_REF_NUM_REGISTERS 256
+#define BENCH_GUI_HANDLER 3
+#define BENCH_DRAIN_INTERVAL 16  // fires between UI loop drains
+
+// firmware handler registrations - handler index and class
+struct bench_reg {
+    int handler;
+    int event_class;
+};
+static const struct bench_reg bench_regs[] = {
+    {0, SCEC_CTRL}, {0, SCEC_ENG},  // step_edit
+    {1, SCEC_SONG}, {1, SCEC_CTRL}, {1, SCEC_ENG}, {1, SCEC_POWER},  // panel
+    {2, SCEC_SONG}, {2, SCEC_CTRL}, {2, SCEC_ENG}, {2, SCEC_CONFIG},  // panel_menu
+    {3, SCEC_SONG}, {3, SCEC_CTRL}, {3, SCEC_ENG},  // gui
+    {4, SCEC_CTRL}, {4, SCEC_SONG},  // pattern_edit
+    {5, SCEC_SONG}, {5, SCEC_CTRL},  // clock_out
+    {6, SCEC_CONFIG},  // pattern
+    {7, SCEC_SONG}, {7, SCEC_CONFIG}, {7, SCEC_POWER},  // seq_ctrl
+    {8, SCEC_SONG}, {8, SCEC_CTRL},  // seq_engine
+    {9, SCEC_CONFIG}  // iface_midi_router
+};
+#define BENCH_NUM_REGS (sizeof(bench_regs) / sizeof(struct bench_reg))
+
+// reference implementation - the original flat handler array
+struct bench_ref_state {
+    void (*handler[BENCH_REF_NUM_REGISTERS])(int event_type, int *data, int data_len);
+    int event_class_map[BENCH_REF_NUM_REGISTERS];
+};
+struct bench_ref_state bref;
+
+volatile int bench_sink;  // keeps the handlers from being optimized out
+
+// local functions
+void bench_handler(int event_type, int *data, int data_len);
+void bench_ref_init(void);
+void bench_ref_register(void (*handler)(int, int*, int), int event_class);
+void bench_ref_fire(int event_type, int *data, int data_len);
+double bench_get_time(void);
+
+// main!
+int main(int argc, char **argv) {
+    int i, iterations = BENCH_DEFAULT_ITERATIONS;
+    int data[2];
+    double start, ref_ns, new_ns, def_ns;
+    uint32_t queued, coalesced, dropped;
+
+    if(argc > 1) {
+        iterations = atoi(argv[1]);
+    }
+    if(iterations <= 0) {
+        fprintf(stderr, "usage: bench_state_change [iterations]\n");
+        return 1;
+    }
+
+    // register the same handlers with both implementations
+    rt_prof_init();  // profiling disabled - no handler timing
+    state_change_init();
+    bench_ref_init();
+    for(i = 0; i < BENCH_NUM_REGS; i ++) {
+        state_change_register(bench_handler, bench_regs[i].event_class);
+        bench_ref_register(bench_handler, bench_regs[i].event_class);
+    }
+
+    // SCE_ENG_ACTIVE_STEP is the most common event on the RT path
+    data[0] = 0;
+    data[1] = 0;
+    start = bench_get_time();
+    for(i = 0; i < iterations; i ++) {
+        data[1] = i & 0x3f;
+        bench_ref_fire(SCE_ENG_ACTIVE_STEP, data, 2);
+    }
+    ref_ns = ((bench_get_time() - start) * 1000000000.0) / iterations;
+
+    start = bench_get_time();
+    for(i = 0; i < iterations; i ++) {
+        data[1] = i & 0x3f;
+        state_change_fire(SCE_ENG_ACTIVE_STEP, data, 2);
+    }
+    new_ns = ((bench_get_time() - start) * 1000000000.0) / iterations;
+
+    // GUI handler deferred - active step for each track between drains
+    state_change_init();
+    for(i = 0; i < BENCH_NUM_REGS; i ++) {
+        if(bench_regs[i].handler == BENCH_GUI_HANDLER) {
+            state_change_register_deferred(bench_handler, bench_regs[i].event_class);
+        }
+        else {
+            state_change_register(bench_handler, bench_regs[i].event_class);
+        }
+    }
+    start = bench_get_time();
+    for(i = 0; i < iterations; i ++) {
+        data[0] = i % SEQ_NUM_TRACKS;
+        data[1] = (i / SEQ_NUM_TRACKS) & 0x3f;
+        state_change_fire(SCE_ENG_ACTIVE_STEP, data, 2);
+        if((i % BENCH_DRAIN_INTERVAL) == (BENCH_DRAIN_INTERVAL - 1)) {
+            state_change_drain_deferred();
+        }
+    }
+    def_ns = ((bench_get_time() - start) * 1000000000.0) / iterations;
+    state_change_get_deferred_stats(&queued, &coalesced, &dropped);
+
+    printf("state_change_fire(SCE_ENG_ACTIVE_STEP) - %d iterations - "
+        "%d registrations\n", iterations, (int)BENCH_NUM_REGS);
+    printf("  flat array:      %8.2f ns/fire\n", ref_ns);
+    printf("  per-class lists: %8.2f ns/fire (%.1fx)\n", new_ns,
+        (new_ns > 0.0) ? ref_ns / new_ns : 0.0);
+    printf("  deferred GUI:    %8.2f ns/fire incl. drain - queued: %u - "
+        "coalesced: %u - dropped: %u\n", def_ns, queued, coalesced, dropped);
+    printf("  fire count: %u\n", state_change_get_fire_count(SCE_ENG_ACTIVE_STEP));
+    return 0;
+}
+
+//
+// local functions
+//
+// dummy handler - about the cost of a switch that ignores the event
+void bench_handler(int event_type, int *data, int data_len) {
+    if(event_type == SCE_ENG_ACTIVE_STEP) {
+        bench_sink += data[1];
+    }
+}
+
+// init the reference implementation
+void bench_ref_init(void) {
+    int i;
+    for(i = 0; i < BENCH_REF_NUM_REGISTERS; i ++) {
+        bref.handler[i] = NULL;
+        bref.event_class_map[i] = -1;
+    }
+}
+
+// register with the reference implementation
+void bench_ref_register(void (*handler)(int, int*, int), int event_class) {
+    int i;
+    for(i = 0; i < BENCH_REF_NUM_REGISTERS; i ++) {
+        if(bref.handler[i] == NULL) {
+            bref.handler[i] = handler;
+            bref.event_class_map[i] = event_class;
+            return;
+        }
+    }
+}
+
+// fire with the reference implementation
+void bench_ref_fire(int event_type, int *data, int data_len) {
+    int i;
+    int cls = event_type & 0xff0000;
+    for(i = 0; i < BENCH_REF_NUM_REGISTERS; i ++) {
+        if(bref.handler[i] == NULL) {
+            continue;
+        }
+        else if(bref.event_class_map[i] == cls) {
+            (*bref.handler[i])(event_type, data, data_len);
+        }
+    }
+}
+
+// get the host time in seconds
+double bench_get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
+}
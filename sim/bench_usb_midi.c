@@ -0,0 +1,535 @@
+/*
+ * CARBON Host Simulator - USB MIDI Event Packing Test Bench
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Checks the USB MIDI event encoding against the CIN table from the USB
+ * MIDI spec for every kind of message and SYSEX chunk, and then runs
+ * workloads through the USB device IN path and checks the transfers.
+ *
+ * The workloads are fed as bytes into the USB device output streams. The
+ * device side runs the same way as usbd_midi: the 1ms task queues events
+ * from the streams, SOF sends whatever is queued if the endpoint is idle
+ * and a finished transfer sends again right away during a burst, if a full
+ * packet is queued or if realtime events are waiting. Each transfer takes
+ * BENCH_XFER_US to finish. The host side decodes each transfer by CIN and
+ * puts the byte streams back together.
+ *
+ * Every transfer must hold 1 to 16 events with the realtime events first
+ * and every event must have the CIN the spec gives for its bytes. The byte
+ * stream on each cable with realtime messages taken out must match what
+ * was sent, and the same number of realtime messages must arrive.
+ *
+ * Usage: bench_usb_midi [sysex_kbytes]
+ *
+ */
+#include "config.h"
+#include "midi/midi_stream.h"
+#include "midi/midi_usb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// settings
+#define BENCH_DEFAULT_SYSEX_KB 16
+#define BENCH_NUM_CABLES 3  // same as USBD_MIDI_NUM_OUT_PORTS
+#define BENCH_PORT_OUT (MIDI_PORT_USB_DEV_OUT1)  // same as USBD_MIDI_PORT_OUT
+#define BENCH_TX_EVENTS 16  // events in a full 64 byte packet
+#define BENCH_TASK_INTERVAL_US 1000  // timer task interval
+#define BENCH_SOF_PHASE_US 300  // SOF time within each task interval
+#define BENCH_XFER_US 60  // time for a transfer to finish
+#define BENCH_MAX_BYTES (1024 * 1024)  // max bytes per cable per workload
+#define BENCH_RUN_MS 2000  // time to feed notes and clock for
+#define BENCH_DRAIN_MS 100  // time to let the queues drain at the end
+#define BENCH_FEED_PER_MS 600  // SYSEX bytes fed per ms
+#define BENCH_MAX_RT 4096  // max realtime bytes timed per cable
+
+// a workload
+enum {
+    BENCH_LOAD_NOTES,  // chords and clock
+    BENCH_LOAD_SYSEX,  // SYSEX dump
+    BENCH_LOAD_SYSEX_CLOCK,  // SYSEX dump with clock in the middle of it
+    BENCH_LOAD_CABLES,  // notes on all cables with clock
+    BENCH_NUM_LOADS
+};
+static const char *bench_load_names[BENCH_NUM_LOADS] = {
+    "notes + clock",
+    "sysex dump",
+    "sysex dump + clock",
+    "3 cables + clock"
+};
+
+// results for a workload
+struct bench_result {
+    int transfers;  // transfers sent
+    int full_transfers;  // transfers with a full packet
+    int sof_transfers;  // partial transfers flushed on SOF
+    int events;  // events sent
+    int rt_events;  // realtime events sent
+    int64_t rt_lat_sum;  // realtime latency sum
+    int rt_lat_max;  // realtime latency max
+    int lat_max;  // other message latency max
+    int fails;  // failed checks
+};
+
+// byte stream for one cable - realtime bytes are kept separately
+struct bench_stream {
+    uint8_t *bytes;  // bytes without realtime
+    int64_t *time;  // time each byte was sent
+    int len;  // number of bytes
+    int rt_count;  // realtime bytes
+    int64_t rt_time[BENCH_MAX_RT];  // time each realtime byte was sent
+};
+
+// bench state
+struct bench_state {
+    int64_t time_us;  // virtual time
+    struct midi_usb_tx tx;  // device IN queues
+    int busy;  // a transfer is running
+    int burst;  // the last transfer was full
+    int64_t done_time;  // time the running transfer finishes
+    uint8_t buf[BENCH_TX_EVENTS * MIDI_USB_EVENT_LEN];  // transfer buffer
+    int buf_events;  // events in the transfer buffer
+    struct bench_stream sent[BENCH_NUM_CABLES];
+    struct bench_stream recv[BENCH_NUM_CABLES];
+    int sysex_left;  // SYSEX bytes left to feed
+    int sysex_count;  // SYSEX bytes fed
+    struct bench_result res;
+};
+struct bench_state bstate;
+
+// local functions
+int bench_check_cin(void);
+int bench_ref_cin(uint8_t *bytes, int len);
+int bench_cin_len(int cin);
+int bench_check_event(uint8_t *bytes, int len, int cable);
+void bench_run_load(int load, int sysex_bytes);
+void bench_feed(int load, int cable, uint8_t *buf, int len);
+void bench_feed_load(int load, int ms);
+void bench_send(void);
+void bench_receive(void);
+void bench_stream_add(struct bench_stream *s, uint8_t byte, int64_t time);
+
+// main!
+int main(int argc, char **argv) {
+    int load, fails, sysex_kb = BENCH_DEFAULT_SYSEX_KB;
+
+    if(argc > 1) {
+        sysex_kb = atoi(argv[1]);
+    }
+    if(sysex_kb <= 0 || sysex_kb > (BENCH_MAX_BYTES / 1024 / 2)) {
+        fprintf(stderr, "usage: bench_usb_midi [sysex_kbytes]\n");
+        return 1;
+    }
+    for(load = 0; load < BENCH_NUM_CABLES; load ++) {
+        bstate.sent[load].bytes = malloc(BENCH_MAX_BYTES);
+        bstate.sent[load].time = malloc(BENCH_MAX_BYTES * sizeof(int64_t));
+        bstate.recv[load].bytes = malloc(BENCH_MAX_BYTES);
+        bstate.recv[load].time = malloc(BENCH_MAX_BYTES * sizeof(int64_t));
+    }
+
+    fails = bench_check_cin();
+    printf("%-20s %6s %6s %6s %6s %6s %7s %9s %8s %8s %8s\n", "workload",
+        "events", "xfers", "ev/xfr", "full", "sof", "rt", "bytes/s",
+        "rt avg", "rt max", "lat max");
+    for(load = 0; load < BENCH_NUM_LOADS; load ++) {
+        bench_run_load(load, sysex_kb * 1024);
+        fails += bstate.res.fails;
+    }
+    return (fails > 0) ? 1 : 0;
+}
+
+//
+// local functions
+//
+// check the CIN of every kind of message against the spec
+// returns the number of failed checks
+int bench_check_cin(void) {
+    struct midi_msg msg;
+    uint8_t bytes[3];
+    uint8_t event[MIDI_USB_EVENT_LEN];
+    int status, len, last, cable, count = 0, fails = 0;
+    static const uint8_t lasts[] = {0x00, 0x55, MIDI_SYSEX_END};
+
+    for(status = 0; status < 0x100; status ++) {
+        for(len = 1; len <= 3; len ++) {
+            for(last = 0; last < sizeof(lasts); last ++) {
+                bytes[0] = status;
+                bytes[1] = 0x12;
+                bytes[2] = 0x34;
+                if(len > 1) {
+                    bytes[len - 1] = lasts[last];
+                }
+                else if(last > 0) {
+                    continue;
+                }
+                // only messages that can come out of a stream
+                if(bench_ref_cin(bytes, len) == -1) {
+                    continue;
+                }
+                for(cable = 0; cable < MIDI_USB_NUM_CABLES; cable += 5) {
+                    midi_utils_enc_3byte(&msg, 0, bytes[0], bytes[1], bytes[2]);
+                    msg.len = len;
+                    if(midi_usb_encode_event(&msg, cable, event) != 0) {
+                        printf("FAIL: %02x len %d was not encoded\n", status, len);
+                        fails ++;
+                        continue;
+                    }
+                    count ++;
+                    if(bench_check_event(event, MIDI_USB_EVENT_LEN, cable)) {
+                        fails ++;
+                    }
+                }
+            }
+        }
+    }
+    // bad lengths and cables
+    midi_utils_enc_note_on(&msg, 0, 0, 60, 100);
+    if(midi_usb_encode_event(&msg, MIDI_USB_NUM_CABLES, event) != -1) {
+        printf("FAIL: cable %d was encoded\n", MIDI_USB_NUM_CABLES);
+        fails ++;
+    }
+    msg.len = 0;
+    if(midi_usb_encode_event(&msg, 0, event) != -1) {
+        printf("FAIL: len 0 was encoded\n");
+        fails ++;
+    }
+    msg.len = 4;
+    if(midi_usb_encode_event(&msg, 0, event) != -1) {
+        printf("FAIL: len 4 was encoded\n");
+        fails ++;
+    }
+    printf("CIN check: %d events - %d failed\n", count, fails);
+    return fails;
+}
+
+// get the CIN for message bytes from the spec - table 4-1
+// returns -1 if the bytes are not a message or SYSEX chunk that the stream makes
+int bench_ref_cin(uint8_t *bytes, int len) {
+    uint8_t status = bytes[0];
+    uint8_t end = bytes[len - 1];
+    int i;
+    // data bytes can't have the high bit set except for SYSEX start / end
+    for(i = 1; i < len; i ++) {
+        if(bytes[i] & 0x80 && !(i == (len - 1) && bytes[i] == MIDI_SYSEX_END)) {
+            return -1;
+        }
+    }
+    // channel messages - CIN is the status high nibble
+    if(status >= 0x80 && status < 0xf0) {
+        if((status & 0xf0) == MIDI_PROGRAM_CHANGE ||
+                (status & 0xf0) == MIDI_CHANNEL_PRESSURE) {
+            return (len == 2 && end != MIDI_SYSEX_END) ? (status >> 4) : -1;
+        }
+        return (len == 3 && end != MIDI_SYSEX_END) ? (status >> 4) : -1;
+    }
+    // system common
+    if(status == MIDI_MTC_QFRAME || status == MIDI_SONG_SELECT) {
+        return (len == 2 && end != MIDI_SYSEX_END) ? 0x02 : -1;
+    }
+    if(status == MIDI_SONG_POSITION) {
+        return (len == 3 && end != MIDI_SYSEX_END) ? 0x03 : -1;
+    }
+    if(status == MIDI_TUNE_REQUEST) {
+        return (len == 1) ? 0x05 : -1;
+    }
+    // realtime - single byte
+    if(status >= MIDI_TIMING_TICK) {
+        return (len == 1) ? 0x0f : -1;
+    }
+    // SYSEX - start / continue with 3 bytes or ends with 1-3 bytes
+    if(status == MIDI_SYSEX_START || status == MIDI_SYSEX_END || status < 0x80) {
+        if(end == MIDI_SYSEX_END) {
+            if(status == MIDI_SYSEX_END && len > 1) {
+                return -1;
+            }
+            return 0x04 + len;
+        }
+        return (len == 3) ? 0x04 : -1;
+    }
+    return -1;  // undefined
+}
+
+// get the number of MIDI bytes in an event for a CIN - table 4-1
+int bench_cin_len(int cin) {
+    static const int lens[16] = {-1, -1, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};
+    return lens[cin & 0x0f];
+}
+
+// check an encoded event against the spec
+// returns 0 if it is ok, or 1 if it failed
+int bench_check_event(uint8_t *event, int len, int cable) {
+    int cin = event[0] & 0x0f;
+    int ref, count = bench_cin_len(cin);
+    if(count < 1) {
+        printf("FAIL: reserved CIN: %x\n", cin);
+        return 1;
+    }
+    ref = bench_ref_cin(&event[1], count);
+    if(ref != cin || (event[0] >> 4) != cable) {
+        printf("FAIL: event %02x %02x %02x %02x - expected CIN: %x cable: %d\n",
+            event[0], event[1], event[2], event[3], ref, cable);
+        return 1;
+    }
+    // padding must be zero
+    if((count < 2 && event[2] != 0) || (count < 3 && event[3] != 0)) {
+        printf("FAIL: event %02x %02x %02x %02x - padding not zero\n",
+            event[0], event[1], event[2], event[3]);
+        return 1;
+    }
+    return 0;
+}
+
+// run a workload and print the results
+void bench_run_load(int load, int sysex_bytes) {
+    struct bench_stream *sent, *recv;
+    int cable, i, ms, mismatch;
+    int64_t sysex_time = -1;
+    double rate;
+
+    midi_stream_init();
+    midi_usb_tx_init(&bstate.tx);
+    bstate.time_us = 0;
+    bstate.busy = 0;
+    bstate.burst = 0;
+    for(cable = 0; cable < BENCH_NUM_CABLES; cable ++) {
+        bstate.sent[cable].len = 0;
+        bstate.sent[cable].rt_count = 0;
+        bstate.recv[cable].len = 0;
+        bstate.recv[cable].rt_count = 0;
+    }
+    bstate.sysex_left = 0;
+    bstate.sysex_count = 0;
+    if(load == BENCH_LOAD_SYSEX || load == BENCH_LOAD_SYSEX_CLOCK) {
+        bstate.sysex_left = sysex_bytes;
+    }
+    memset(&bstate.res, 0, sizeof(struct bench_result));
+
+    // feed for 2s or until the dump is sent and then let it drain
+    for(ms = 0; ms < (BENCH_RUN_MS + BENCH_DRAIN_MS) || bstate.sysex_left; ms ++) {
+        if(ms < BENCH_RUN_MS || bstate.sysex_left) {
+            bench_feed_load(load, ms);
+        }
+        // timer task
+        for(cable = 0; cable < BENCH_NUM_CABLES; cable ++) {
+            midi_usb_tx_queue_stream(&bstate.tx, BENCH_PORT_OUT + cable, cable);
+        }
+        // USB interrupts until the next task
+        for(i = 0; i < BENCH_TASK_INTERVAL_US; i ++) {
+            if(bstate.busy && bstate.time_us >= bstate.done_time) {
+                bench_receive();
+                bstate.busy = 0;
+                if(bstate.burst || midi_usb_tx_get_rt_queued(&bstate.tx) ||
+                        midi_usb_tx_get_queued(&bstate.tx) >= BENCH_TX_EVENTS) {
+                    bench_send();
+                }
+            }
+            if(i == BENCH_SOF_PHASE_US && !bstate.busy) {
+                bench_send();
+                if(bstate.buf_events && !bstate.burst) {
+                    bstate.res.sof_transfers ++;
+                }
+            }
+            bstate.time_us ++;
+        }
+        // time until the whole dump was sent
+        if(bstate.sysex_count && bstate.sysex_left == 0 && sysex_time == -1 &&
+                !bstate.busy && midi_usb_tx_get_queued(&bstate.tx) == 0 &&
+                midi_stream_data_available(BENCH_PORT_OUT) == 0) {
+            sysex_time = bstate.time_us;
+        }
+    }
+
+    // check the byte streams
+    for(cable = 0; cable < BENCH_NUM_CABLES; cable ++) {
+        sent = &bstate.sent[cable];
+        recv = &bstate.recv[cable];
+        mismatch = (sent->len != recv->len) || (sent->rt_count != recv->rt_count);
+        for(i = 0; i < sent->len && i < recv->len && !mismatch; i ++) {
+            if(sent->bytes[i] != recv->bytes[i]) {
+                mismatch = 1;
+            }
+            else if((recv->time[i] - sent->time[i]) > bstate.res.lat_max) {
+                bstate.res.lat_max = recv->time[i] - sent->time[i];
+            }
+        }
+        if(mismatch) {
+            printf("FAIL: cable %d - sent %d bytes + %d rt - received %d bytes + %d rt"
+                " - first difference at %d\n", cable, sent->len, sent->rt_count,
+                recv->len, recv->rt_count, i);
+            bstate.res.fails ++;
+        }
+        for(i = 0; i < sent->rt_count && i < recv->rt_count && i < BENCH_MAX_RT; i ++) {
+            bstate.res.rt_lat_sum += recv->rt_time[i] - sent->rt_time[i];
+            if((recv->rt_time[i] - sent->rt_time[i]) > bstate.res.rt_lat_max) {
+                bstate.res.rt_lat_max = recv->rt_time[i] - sent->rt_time[i];
+            }
+        }
+    }
+
+    rate = 0.0;
+    if(sysex_time > 0) {
+        rate = (double)bstate.sysex_count * 1000000.0 / (double)sysex_time;
+    }
+    printf("%-20s %6d %6d %6.1f %6d %6d %7d %9.0f %8.0f %8d %8d%s\n",
+        bench_load_names[load], bstate.res.events, bstate.res.transfers,
+        bstate.res.transfers ? (double)bstate.res.events / bstate.res.transfers : 0.0,
+        bstate.res.full_transfers, bstate.res.sof_transfers, bstate.res.rt_events, rate,
+        bstate.res.rt_events ? (double)bstate.res.rt_lat_sum / bstate.res.rt_events : 0.0,
+        bstate.res.rt_lat_max, bstate.res.lat_max,
+        bstate.res.fails ? " - FAIL" : "");
+}
+
+// feed bytes into a device output stream and remember what was sent
+void bench_feed(int load, int cable, uint8_t *buf, int len) {
+    int i;
+    if(midi_stream_send_bytes(BENCH_PORT_OUT + cable, buf, len) != 0) {
+        printf("FAIL: %s - stream full on cable %d\n", bench_load_names[load], cable);
+        bstate.res.fails ++;
+    }
+    for(i = 0; i < len; i ++) {
+        bench_stream_add(&bstate.sent[cable], buf[i], bstate.time_us);
+    }
+}
+
+// feed one ms of a workload
+void bench_feed_load(int load, int ms) {
+    uint8_t buf[BENCH_FEED_PER_MS + 8];
+    uint8_t tick = MIDI_TIMING_TICK;
+    int cable, note, i, len, step;
+
+    // clock at 120 BPM - every 20.8ms
+    if(load != BENCH_LOAD_SYSEX && ((ms * 24 * 2) / 1000) != (((ms + 1) * 24 * 2) / 1000)) {
+        bench_feed(load, 0, &tick, 1);
+    }
+    // a 4 note chord every 10ms and note offs 5ms later
+    if(load == BENCH_LOAD_NOTES || load == BENCH_LOAD_CABLES) {
+        for(cable = 0; cable < BENCH_NUM_CABLES; cable ++) {
+            if(load == BENCH_LOAD_NOTES && cable > 0) {
+                break;
+            }
+            step = (ms / 10) + cable;
+            if((ms % 10) != 0 && (ms % 10) != 5) {
+                continue;
+            }
+            len = 0;
+            for(note = 0; note < 4; note ++) {
+                buf[len++] = ((ms % 10) == 0) ? (MIDI_NOTE_ON | cable) : (MIDI_NOTE_OFF | cable);
+                buf[len++] = 48 + ((step * 7) % 24) + (note * 4);
+                buf[len++] = 0x64;
+            }
+            bench_feed(load, cable, buf, len);
+        }
+    }
+    // SYSEX dump in messages of up to 256 bytes
+    if(bstate.sysex_left) {
+        len = 0;
+        while(bstate.sysex_left && len < BENCH_FEED_PER_MS) {
+            step = bstate.sysex_count & 0xff;
+            if(step == 0) {
+                buf[len++] = MIDI_SYSEX_START;
+            }
+            else if(step == 0xff || bstate.sysex_left == 1) {
+                buf[len++] = MIDI_SYSEX_END;
+            }
+            else {
+                buf[len++] = (bstate.sysex_count * 13) & 0x7f;
+            }
+            bstate.sysex_count ++;
+            bstate.sysex_left --;
+        }
+        // clock in the middle of the dump
+        if(load == BENCH_LOAD_SYSEX_CLOCK && ((ms * 24 * 2) / 1000) !=
+                (((ms + 1) * 24 * 2) / 1000)) {
+            for(i = len; i > len / 2; i --) {
+                buf[i] = buf[i - 1];
+            }
+            buf[len / 2] = MIDI_TIMING_TICK;
+            len ++;
+        }
+        bench_feed(load, 0, buf, len);
+    }
+}
+
+// send a transfer if anything is queued - same as usbd_midi_prepare_in_ep()
+void bench_send(void) {
+    int rt_events;
+    bstate.buf_events = midi_usb_tx_fill(&bstate.tx, bstate.buf, BENCH_TX_EVENTS,
+        &rt_events);
+    bstate.burst = (bstate.buf_events == BENCH_TX_EVENTS);
+    if(bstate.buf_events == 0) {
+        return;
+    }
+    bstate.res.transfers ++;
+    bstate.res.events += bstate.buf_events;
+    bstate.res.rt_events += rt_events;
+    if(bstate.burst) {
+        bstate.res.full_transfers ++;
+    }
+    bstate.busy = 1;
+    bstate.done_time = bstate.time_us + BENCH_XFER_US;
+}
+
+// the host received a transfer - check and decode it
+void bench_receive(void) {
+    uint8_t *event;
+    int i, j, cable, cin, rt_done = 0;
+    if(bstate.buf_events < 1 || bstate.buf_events > BENCH_TX_EVENTS) {
+        printf("FAIL: transfer with %d events\n", bstate.buf_events);
+        bstate.res.fails ++;
+    }
+    for(i = 0; i < bstate.buf_events; i ++) {
+        event = &bstate.buf[i * MIDI_USB_EVENT_LEN];
+        cable = event[0] >> 4;
+        cin = event[0] & 0x0f;
+        if(cable >= BENCH_NUM_CABLES || bench_check_event(event, MIDI_USB_EVENT_LEN, cable)) {
+            bstate.res.fails ++;
+            continue;
+        }
+        // realtime events go first
+        if(cin == MIDI_CIN_SINGLE_BYTE && event[1] >= MIDI_TIMING_TICK) {
+            if(rt_done) {
+                printf("FAIL: realtime event after other events\n");
+                bstate.res.fails ++;
+            }
+        }
+        else {
+            rt_done = 1;
+        }
+        for(j = 0; j < bench_cin_len(cin); j ++) {
+            bench_stream_add(&bstate.recv[cable], event[1 + j], bstate.time_us);
+        }
+    }
+}
+
+// add a byte to a stream
+void bench_stream_add(struct bench_stream *s, uint8_t byte, int64_t time) {
+    if(byte >= MIDI_TIMING_TICK) {
+        if(s->rt_count < BENCH_MAX_RT) {
+            s->rt_time[s->rt_count] = time;
+        }
+        s->rt_count ++;
+        return;
+    }
+    if(s->len < BENCH_MAX_BYTES) {
+        s->bytes[s->len] = byte;
+        s->time[s->len] = time;
+        s->len ++;
+    }
+}
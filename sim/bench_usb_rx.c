@@ -0,0 +1,635 @@
+/*
+ * CARBON Host Simulator - USB MIDI Event Decoding Benchmark
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Runs captures of USB MIDI OUT transfers through the event decoder in
+ * midi_usb and through the old path which fed the bytes of each event
+ * into the midi_stream byte parser by CIN length. Both paths must put the
+ * same messages with the same timestamps into their streams. The cost per
+ * event of each path is then measured over many passes of each capture.
+ *
+ * The captures are built in to cover what is seen from real hosts:
+ *  - keyboard - notes, velocity 0 note offs, CC, bend and pressure
+ *  - DAW - clock, transport, song position and notes on 3 cables
+ *  - SYSEX dump - long SYSEX messages with clock between the events
+ *  - legacy peer - older CARBON units which send realtime messages on the
+ *    1 byte CIN and SYSEX data on the 2 and 3 byte CINs
+ *  - single bytes - voice messages with running status and SYSEX sent one
+ *    byte per event on the single byte CIN with clock in between
+ *
+ * A capture file can be given instead. Each line holds one transfer as
+ * hex bytes with 4 bytes per event. Lines starting with # are ignored.
+ *
+ * Usage: bench_usb_rx [capture_file]
+ *
+ */
+#include "config.h"
+#include "midi/midi_protocol.h"
+#include "midi/midi_stream.h"
+#include "midi/midi_usb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// settings
+#define BENCH_NUM_CABLES 3  // cables checked
+#define BENCH_PORT_OLD (MIDI_PORT_USB_DEV_IN1)  // byte parser path ports
+#define BENCH_PORT_NEW (MIDI_PORT_DIN1_OUT)  // event decoder path ports
+#define BENCH_XFER_EVENTS 16  // events in a full 64 byte transfer
+#define BENCH_MAX_EVENTS 65536  // max events in a capture
+#define BENCH_MAX_XFERS 65536  // max transfers in a capture
+#define BENCH_XFER_US 1000  // time between transfers
+#define BENCH_TIME_START 0xfff00000  // first transfer time - wraps during a capture
+#define BENCH_TIMED_EVENTS 20000000  // events decoded for each timing
+#define BENCH_LINE_LEN 1024  // max capture file line length
+
+// a capture - events grouped into transfers
+struct bench_capture {
+    const char *name;
+    uint8_t *events;  // 4 bytes per event
+    int num_events;
+    int *xfer_events;  // events in each transfer
+    int num_xfers;
+    int xfer_fill;  // events in the transfer being built
+};
+
+// the built in captures
+enum {
+    BENCH_CAP_KEYBOARD,
+    BENCH_CAP_DAW,
+    BENCH_CAP_SYSEX,
+    BENCH_CAP_LEGACY,
+    BENCH_CAP_SINGLE,
+    BENCH_NUM_CAPS
+};
+struct bench_capture bench_caps[BENCH_NUM_CAPS];
+
+// decoder state for the new path
+struct midi_usb_rx bench_rx[BENCH_NUM_CABLES];
+
+// local functions
+void bench_cap_init(struct bench_capture *cap, const char *name);
+void bench_cap_event(struct bench_capture *cap, uint8_t cin, int cable,
+    uint8_t b0, uint8_t b1, uint8_t b2);
+void bench_cap_msg(struct bench_capture *cap, int cable, int len,
+    uint8_t status, uint8_t data0, uint8_t data1);
+void bench_cap_legacy_msg(struct bench_capture *cap, int cable, int len,
+    uint8_t status, uint8_t data0, uint8_t data1);
+void bench_cap_sysex(struct bench_capture *cap, int cable, int len, int legacy,
+    int clock_every);
+void bench_cap_bytes(struct bench_capture *cap, int cable, const uint8_t *buf,
+    int len);
+void bench_cap_end_xfer(struct bench_capture *cap);
+void bench_build_keyboard(struct bench_capture *cap);
+void bench_build_daw(struct bench_capture *cap);
+void bench_build_sysex(struct bench_capture *cap);
+void bench_build_legacy(struct bench_capture *cap);
+void bench_build_single(struct bench_capture *cap);
+int bench_load_file(struct bench_capture *cap, const char *filename);
+int bench_check_capture(struct bench_capture *cap, int *msgs);
+void bench_time_capture(struct bench_capture *cap, double *old_ns,
+    double *new_ns);
+void bench_reset(void);
+void bench_old_event(uint8_t *event, uint32_t time);
+int bench_drain(int port);
+double bench_get_time(void);
+
+// main!
+int main(int argc, char **argv) {
+    struct bench_capture file_cap;
+    struct bench_capture *caps = bench_caps;
+    int i, msgs, fails = 0, num_caps = BENCH_NUM_CAPS;
+    double old_ns, new_ns;
+
+    if(argc > 2) {
+        fprintf(stderr, "usage: bench_usb_rx [capture_file]\n");
+        return 1;
+    }
+    if(argc > 1) {
+        bench_cap_init(&file_cap, argv[1]);
+        if(bench_load_file(&file_cap, argv[1]) != 0) {
+            return 1;
+        }
+        caps = &file_cap;
+        num_caps = 1;
+    }
+    else {
+        bench_build_keyboard(&bench_caps[BENCH_CAP_KEYBOARD]);
+        bench_build_daw(&bench_caps[BENCH_CAP_DAW]);
+        bench_build_sysex(&bench_caps[BENCH_CAP_SYSEX]);
+        bench_build_legacy(&bench_caps[BENCH_CAP_LEGACY]);
+        bench_build_single(&bench_caps[BENCH_CAP_SINGLE]);
+    }
+
+    printf("%-20s %7s %7s %7s %6s %12s %12s %8s\n", "capture", "xfers",
+        "events", "msgs", "fails", "parser ns/ev", "decode ns/ev", "speedup");
+    for(i = 0; i < num_caps; i ++) {
+        int cap_fails = bench_check_capture(&caps[i], &msgs);
+        bench_time_capture(&caps[i], &old_ns, &new_ns);
+        printf("%-20s %7d %7d %7d %6d %12.1f %12.1f %7.2fx\n", caps[i].name,
+            caps[i].num_xfers, caps[i].num_events, msgs, cap_fails,
+            old_ns, new_ns, old_ns / new_ns);
+        fails += cap_fails;
+    }
+    return (fails > 0) ? 1 : 0;
+}
+
+//
+// local functions
+//
+// set up an empty capture
+void bench_cap_init(struct bench_capture *cap, const char *name) {
+    cap->name = name;
+    cap->events = malloc(BENCH_MAX_EVENTS * MIDI_USB_EVENT_LEN);
+    cap->xfer_events = malloc(BENCH_MAX_XFERS * sizeof(int));
+    if(cap->events == NULL || cap->xfer_events == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    cap->num_events = 0;
+    cap->num_xfers = 0;
+    cap->xfer_fill = 0;
+}
+
+// add an event to a capture - a full transfer is ended automatically
+void bench_cap_event(struct bench_capture *cap, uint8_t cin, int cable,
+        uint8_t b0, uint8_t b1, uint8_t b2) {
+    uint8_t *event;
+    if(cap->num_events >= BENCH_MAX_EVENTS) {
+        return;
+    }
+    event = &cap->events[cap->num_events * MIDI_USB_EVENT_LEN];
+    event[0] = (cable << 4) | cin;
+    event[1] = b0;
+    event[2] = b1;
+    event[3] = b2;
+    cap->num_events ++;
+    cap->xfer_fill ++;
+    if(cap->xfer_fill == BENCH_XFER_EVENTS) {
+        bench_cap_end_xfer(cap);
+    }
+}
+
+// add a message to a capture with the CIN the spec gives for it
+void bench_cap_msg(struct bench_capture *cap, int cable, int len,
+        uint8_t status, uint8_t data0, uint8_t data1) {
+    struct midi_msg msg;
+    uint8_t event[MIDI_USB_EVENT_LEN];
+    midi_utils_enc_3byte(&msg, 0, status, data0, data1);
+    msg.len = len;
+    if(midi_usb_encode_event(&msg, cable, event) == 0) {
+        bench_cap_event(cap, event[0] & 0x0f, cable, event[1], event[2],
+            event[3]);
+    }
+}
+
+// add a message to a capture with the CIN older CARBON units used for it
+void bench_cap_legacy_msg(struct bench_capture *cap, int cable, int len,
+        uint8_t status, uint8_t data0, uint8_t data1) {
+    uint8_t cin;
+    if(status >= MIDI_TIMING_TICK || status == MIDI_TUNE_REQUEST) {
+        cin = MIDI_CIN_1_BYTE_MESSAGE;
+    }
+    else if(status == MIDI_SYSEX_START) {
+        cin = MIDI_CIN_SYSEX_START;
+    }
+    else if(status >= 0x80) {
+        bench_cap_msg(cap, cable, len, status, data0, data1);
+        return;
+    }
+    // SYSEX data in the status position
+    else if(len == 3) {
+        cin = (data1 == MIDI_SYSEX_END) ? MIDI_CIN_SYSEX_ENDS_3 :
+            MIDI_CIN_3_BYTE_MESSAGE;
+    }
+    else if(len == 2) {
+        cin = (data0 == MIDI_SYSEX_END) ? MIDI_CIN_SYSEX_ENDS_2 :
+            MIDI_CIN_2_BYTE_MESSAGE;
+    }
+    else {
+        cin = MIDI_CIN_1_BYTE_MESSAGE;
+    }
+    bench_cap_event(cap, cin, cable, status, (len > 1) ? data0 : 0,
+        (len > 2) ? data1 : 0);
+}
+
+// add a SYSEX message of len bytes including the start and end bytes
+// a timing tick is put in every clock_every events if it is not 0
+void bench_cap_sysex(struct bench_capture *cap, int cable, int len, int legacy,
+        int clock_every) {
+    uint8_t chunk[3];
+    int i, pos, chunk_len, count = 0;
+    for(pos = 0; pos < len; pos += 3) {
+        chunk_len = len - pos;
+        if(chunk_len > 3) {
+            chunk_len = 3;
+        }
+        for(i = 0; i < 3; i ++) {
+            if(i >= chunk_len) {
+                chunk[i] = 0;
+            }
+            else if(pos + i == 0) {
+                chunk[i] = MIDI_SYSEX_START;
+            }
+            else if(pos + i == len - 1) {
+                chunk[i] = MIDI_SYSEX_END;
+            }
+            else {
+                chunk[i] = (pos + i) & 0x7f;
+            }
+        }
+        if(legacy) {
+            bench_cap_legacy_msg(cap, cable, chunk_len, chunk[0], chunk[1],
+                chunk[2]);
+        }
+        else {
+            bench_cap_msg(cap, cable, chunk_len, chunk[0], chunk[1], chunk[2]);
+        }
+        count ++;
+        if(clock_every && (count % clock_every) == 0) {
+            if(legacy) {
+                bench_cap_legacy_msg(cap, cable, 1, MIDI_TIMING_TICK, 0, 0);
+            }
+            else {
+                bench_cap_msg(cap, cable, 1, MIDI_TIMING_TICK, 0, 0);
+            }
+        }
+    }
+}
+
+// add bytes to a capture with one byte per event on the single byte CIN
+void bench_cap_bytes(struct bench_capture *cap, int cable, const uint8_t *buf,
+        int len) {
+    int i;
+    for(i = 0; i < len; i ++) {
+        bench_cap_event(cap, MIDI_CIN_SINGLE_BYTE, cable, buf[i], 0, 0);
+    }
+}
+
+// end the transfer being built
+void bench_cap_end_xfer(struct bench_capture *cap) {
+    if(cap->xfer_fill == 0 || cap->num_xfers >= BENCH_MAX_XFERS) {
+        return;
+    }
+    cap->xfer_events[cap->num_xfers++] = cap->xfer_fill;
+    cap->xfer_fill = 0;
+}
+
+// keyboard - one or two messages per transfer
+void bench_build_keyboard(struct bench_capture *cap) {
+    int i, note;
+    bench_cap_init(cap, "keyboard");
+    for(i = 0; i < 4000; i ++) {
+        note = 36 + ((i * 7) % 48);
+        bench_cap_msg(cap, 0, 3, MIDI_NOTE_ON, note, 1 + (i % 127));
+        if(i & 1) {
+            bench_cap_msg(cap, 0, 3, MIDI_CONTROL_CHANGE, 1, i & 0x7f);
+        }
+        bench_cap_end_xfer(cap);
+        switch(i % 4) {
+            case 0:  // note on with velocity 0
+                bench_cap_msg(cap, 0, 3, MIDI_NOTE_ON, note, 0);
+                break;
+            case 1:
+                bench_cap_msg(cap, 0, 3, MIDI_NOTE_OFF, note, 0x40);
+                break;
+            case 2:
+                bench_cap_msg(cap, 0, 3, MIDI_PITCH_BEND, i & 0x7f, 0x40);
+                bench_cap_msg(cap, 0, 3, MIDI_NOTE_OFF, note, 0x20);
+                break;
+            default:
+                bench_cap_msg(cap, 0, 2, MIDI_CHANNEL_PRESSURE, i & 0x7f, 0);
+                bench_cap_msg(cap, 0, 3, MIDI_POLY_KEY_PRESSURE, note, 0x10);
+                bench_cap_msg(cap, 0, 3, MIDI_NOTE_OFF, note, 0x40);
+                break;
+        }
+        bench_cap_end_xfer(cap);
+    }
+}
+
+// DAW - clock every transfer with notes on 3 cables and transport
+void bench_build_daw(struct bench_capture *cap) {
+    int i, cable;
+    bench_cap_init(cap, "daw clock + notes");
+    for(i = 0; i < 8000; i ++) {
+        if((i % 2000) == 0) {
+            bench_cap_msg(cap, 0, 1, MIDI_CLOCK_STOP, 0, 0);
+            bench_cap_msg(cap, 0, 3, MIDI_SONG_POSITION, 0, 0);
+            bench_cap_msg(cap, 0, 1, MIDI_CLOCK_START, 0, 0);
+        }
+        bench_cap_msg(cap, 0, 1, MIDI_TIMING_TICK, 0, 0);
+        if((i % 6) == 0) {
+            for(cable = 0; cable < BENCH_NUM_CABLES; cable ++) {
+                bench_cap_msg(cap, cable, 3, MIDI_NOTE_OFF | cable,
+                    48 + ((i / 6 - 1) & 0x0f), 0x40);
+                bench_cap_msg(cap, cable, 3, MIDI_NOTE_ON | cable,
+                    48 + ((i / 6) & 0x0f), 100);
+            }
+        }
+        if((i % 96) == 0) {
+            bench_cap_msg(cap, 1, 2, MIDI_PROGRAM_CHANGE | 1, (i / 96) & 0x7f, 0);
+            bench_cap_msg(cap, 2, 2, MIDI_MTC_QFRAME, (i / 96) & 0x7f, 0);
+        }
+        bench_cap_end_xfer(cap);
+    }
+}
+
+// SYSEX dump - full transfers of SYSEX of every end length with clock
+void bench_build_sysex(struct bench_capture *cap) {
+    int i;
+    bench_cap_init(cap, "sysex dump + clock");
+    for(i = 0; i < 120; i ++) {
+        bench_cap_sysex(cap, 0, 1000 + (i % 3), 0, (i & 1) ? 11 : 0);
+    }
+    bench_cap_sysex(cap, 1, 2, 0, 0);  // F0 F7 only
+    bench_cap_sysex(cap, 1, 3, 0, 0);
+    bench_cap_end_xfer(cap);
+}
+
+// legacy peer - realtime on the 1 byte CIN and SYSEX data on 2 and 3 byte CINs
+void bench_build_legacy(struct bench_capture *cap) {
+    int i;
+    bench_cap_init(cap, "legacy carbon peer");
+    for(i = 0; i < 80; i ++) {
+        bench_cap_sysex(cap, i % BENCH_NUM_CABLES, 500 + (i % 5), 1, 7);
+        bench_cap_legacy_msg(cap, 0, 3, MIDI_NOTE_ON, 60, 100);
+        bench_cap_legacy_msg(cap, 0, 1, MIDI_CLOCK_CONTINUE, 0, 0);
+        bench_cap_legacy_msg(cap, 0, 3, MIDI_NOTE_ON, 60, 0);
+        bench_cap_legacy_msg(cap, 0, 1, MIDI_TUNE_REQUEST, 0, 0);
+        bench_cap_end_xfer(cap);
+    }
+}
+
+// single bytes - messages split across events and transfers on the single byte CIN
+void bench_build_single(struct bench_capture *cap) {
+    uint8_t buf[16];
+    int i, cable;
+    bench_cap_init(cap, "single bytes");
+    for(i = 0; i < 3000; i ++) {
+        cable = i % BENCH_NUM_CABLES;
+        // note on, then a note off with running status and clock in the middle
+        buf[0] = MIDI_NOTE_ON | cable;
+        buf[1] = 36 + (i % 48);
+        buf[2] = 1 + (i % 127);
+        buf[3] = 36 + (i % 48);
+        buf[4] = MIDI_TIMING_TICK;
+        buf[5] = 0;
+        bench_cap_bytes(cap, cable, buf, 6);
+        bench_cap_end_xfer(cap);
+        // program change, pitch bend and song position
+        buf[0] = MIDI_PROGRAM_CHANGE | cable;
+        buf[1] = i & 0x7f;
+        buf[2] = MIDI_PITCH_BEND | cable;
+        buf[3] = i & 0x7f;
+        buf[4] = MIDI_CLOCK_CONTINUE;
+        buf[5] = 0x40;
+        buf[6] = MIDI_SONG_POSITION;
+        buf[7] = i & 0x7f;
+        buf[8] = (i >> 7) & 0x7f;
+        bench_cap_bytes(cap, cable, buf, 9);
+        // a short SYSEX message every so often
+        if((i % 10) == 0) {
+            buf[0] = MIDI_SYSEX_START;
+            buf[1] = 0x7d;
+            buf[2] = i & 0x7f;
+            buf[3] = MIDI_TIMING_TICK;
+            buf[4] = 0x01;
+            buf[5] = 0x02;
+            buf[6] = MIDI_SYSEX_END;
+            bench_cap_bytes(cap, cable, buf, 7);
+        }
+        bench_cap_end_xfer(cap);
+    }
+}
+
+// load a capture file - each line is one transfer in hex
+// returns 0 on success, -1 on error
+int bench_load_file(struct bench_capture *cap, const char *filename) {
+    FILE *f;
+    char line[BENCH_LINE_LEN];
+    char *p, *end;
+    uint8_t event[MIDI_USB_EVENT_LEN];
+    int count, line_num = 0;
+    long val;
+
+    f = fopen(filename, "r");
+    if(f == NULL) {
+        fprintf(stderr, "could not open: %s\n", filename);
+        return -1;
+    }
+    while(fgets(line, sizeof(line), f) != NULL) {
+        line_num ++;
+        if(line[0] == '#') {
+            continue;
+        }
+        count = 0;
+        p = line;
+        while(1) {
+            val = strtol(p, &end, 16);
+            if(end == p) {
+                break;
+            }
+            if(val < 0 || val > 0xff) {
+                fprintf(stderr, "%s:%d - byte invalid\n", filename, line_num);
+                fclose(f);
+                return -1;
+            }
+            event[count++] = val;
+            if(count == MIDI_USB_EVENT_LEN) {
+                bench_cap_event(cap, event[0] & 0x0f, event[0] >> 4,
+                    event[1], event[2], event[3]);
+                count = 0;
+            }
+            p = end;
+        }
+        if(count != 0) {
+            fprintf(stderr, "%s:%d - partial event\n", filename, line_num);
+            fclose(f);
+            return -1;
+        }
+        bench_cap_end_xfer(cap);
+    }
+    fclose(f);
+    if(cap->num_events == 0) {
+        fprintf(stderr, "%s - no events\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+// run a capture through both paths and compare the messages
+// returns the number of mismatched messages - msgs is set to the number checked
+int bench_check_capture(struct bench_capture *cap, int *msgs) {
+    struct midi_msg old_msg, new_msg;
+    uint8_t *event;
+    uint32_t time = BENCH_TIME_START;
+    int x, i, cable, old_ret, new_ret, pos = 0, fails = 0;
+
+    *msgs = 0;
+    bench_reset();
+    for(x = 0; x < cap->num_xfers; x ++) {
+        for(i = 0; i < cap->xfer_events[x]; i ++) {
+            event = &cap->events[(pos + i) * MIDI_USB_EVENT_LEN];
+            cable = event[0] >> 4;
+            if(cable >= BENCH_NUM_CABLES) {
+                continue;
+            }
+            bench_old_event(event, time);
+            midi_usb_rx_event(&bench_rx[cable], BENCH_PORT_NEW + cable,
+                event, time);
+        }
+        pos += cap->xfer_events[x];
+        time += BENCH_XFER_US;
+
+        // compare the streams after each transfer
+        for(cable = 0; cable < BENCH_NUM_CABLES; cable ++) {
+            while(1) {
+                old_ret = midi_stream_receive_msg(BENCH_PORT_OLD + cable, &old_msg);
+                new_ret = midi_stream_receive_msg(BENCH_PORT_NEW + cable, &new_msg);
+                if(old_ret != 0 && new_ret != 0) {
+                    break;
+                }
+                (*msgs) ++;
+                if(old_ret != 0 || new_ret != 0 ||
+                        old_msg.len != new_msg.len ||
+                        old_msg.status != new_msg.status ||
+                        (old_msg.len > 1 && old_msg.data0 != new_msg.data0) ||
+                        (old_msg.len > 2 && old_msg.data1 != new_msg.data1) ||
+                        old_msg.timestamp != new_msg.timestamp) {
+                    if(fails < 10) {
+                        printf("FAIL: %s - xfer %d cable %d - "
+                            "parser: %d %02x %02x %02x @%u - decoder: %d %02x %02x %02x @%u\n",
+                            cap->name, x, cable,
+                            (old_ret == 0) ? old_msg.len : 0, old_msg.status,
+                            old_msg.data0, old_msg.data1, old_msg.timestamp,
+                            (new_ret == 0) ? new_msg.len : 0, new_msg.status,
+                            new_msg.data0, new_msg.data1, new_msg.timestamp);
+                    }
+                    fails ++;
+                }
+            }
+        }
+    }
+    return fails;
+}
+
+// time both paths over a capture - results in ns per event
+void bench_time_capture(struct bench_capture *cap, double *old_ns,
+        double *new_ns) {
+    uint8_t *event;
+    uint32_t time;
+    int pass, passes, x, i, cable, pos, path;
+    double start, elapsed[2];
+
+    passes = BENCH_TIMED_EVENTS / cap->num_events;
+    if(passes < 1) {
+        passes = 1;
+    }
+    for(path = 0; path < 2; path ++) {
+        bench_reset();
+        time = BENCH_TIME_START;
+        start = bench_get_time();
+        for(pass = 0; pass < passes; pass ++) {
+            pos = 0;
+            for(x = 0; x < cap->num_xfers; x ++) {
+                for(i = 0; i < cap->xfer_events[x]; i ++) {
+                    event = &cap->events[(pos + i) * MIDI_USB_EVENT_LEN];
+                    cable = event[0] >> 4;
+                    if(cable >= BENCH_NUM_CABLES) {
+                        continue;
+                    }
+                    if(path == 0) {
+                        bench_old_event(event, time);
+                    }
+                    else {
+                        midi_usb_rx_event(&bench_rx[cable],
+                            BENCH_PORT_NEW + cable, event, time);
+                    }
+                }
+                pos += cap->xfer_events[x];
+                time += BENCH_XFER_US;
+                for(cable = 0; cable < BENCH_NUM_CABLES; cable ++) {
+                    bench_drain(((path == 0) ? BENCH_PORT_OLD : BENCH_PORT_NEW) +
+                        cable);
+                }
+            }
+        }
+        elapsed[path] = bench_get_time() - start;
+    }
+    *old_ns = elapsed[0] * 1000000000.0 / ((double)passes * cap->num_events);
+    *new_ns = elapsed[1] * 1000000000.0 / ((double)passes * cap->num_events);
+}
+
+// reset the streams and decoder state
+void bench_reset(void) {
+    int cable;
+    midi_stream_init();
+    for(cable = 0; cable < BENCH_NUM_CABLES; cable ++) {
+        midi_usb_rx_init(&bench_rx[cable]);
+    }
+}
+
+// the old path - feeds the bytes of an event into the byte parser by CIN length
+void bench_old_event(uint8_t *event, uint32_t time) {
+    int port = BENCH_PORT_OLD + (event[0] >> 4);
+    switch(event[0] & 0x0f) {
+        case MIDI_CIN_1_BYTE_MESSAGE:  // one byte
+        case MIDI_CIN_SINGLE_BYTE:
+            midi_stream_send_timed_bytes(port, &event[1], 1, time, 0);
+            break;
+        case MIDI_CIN_2_BYTE_MESSAGE:  // two bytes
+        case MIDI_CIN_SYSEX_ENDS_2:
+        case MIDI_CIN_PROGRAM_CHANGE:
+        case MIDI_CIN_CHANNEL_PRESSURE:
+            midi_stream_send_timed_bytes(port, &event[1], 2, time, 0);
+            break;
+        case MIDI_CIN_3_BYTE_MESSAGE:  // three bytes
+        case MIDI_CIN_SYSEX_START:
+        case MIDI_CIN_SYSEX_ENDS_3:
+        case MIDI_CIN_NOTE_OFF:
+        case MIDI_CIN_NOTE_ON:
+        case MIDI_CIN_POLY_KEY_PRESSURE:
+        case MIDI_CIN_CONTROL_CHANGE:
+        case MIDI_CIN_PITCH_BEND:
+            midi_stream_send_timed_bytes(port, &event[1], 3, time, 0);
+            break;
+        default:
+            break;
+    }
+}
+
+// drain a port - returns the number of messages removed
+int bench_drain(int port) {
+    struct midi_msg *msgs;
+    int num, total = 0;
+    while((num = midi_stream_peek(port, &msgs)) > 0) {
+        midi_stream_consume(port, num);
+        total += num;
+    }
+    return total;
+}
+
+// get the time in seconds
+double bench_get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
+}
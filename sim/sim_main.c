@@ -0,0 +1,306 @@
+/*
+ * CARBON Host Simulator
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Runs the sequencer core headless on a Linux host. The RT task is driven
+ * from a virtual 1ms clock as fast as the host can go, and every message
+ * leaving a MIDI stream port plus every analog output change is written
+ * to a timestamped trace.
+ *
+ * With MIDI_CLOCK_TICK_TIMER the clock ticks are run at the exact times
+ * the clock timer compare would fire in between the 1ms task periods.
+ *
+ * Usage: carbon_sim [-f flash_image] [-s song] [-t run_ms] [-o trace] [-n] [-p] [-j]
+ *  -f  - external flash image to load songs from (default: erased flash)
+ *  -s  - song number to load (1-64, default: 1)
+ *  -t  - virtual run time in ms (default: 10000)
+ *  -o  - trace output file - "-" for stdout (default: carbon_sim.trace)
+ *  -n  - do not start the sequencer running after load
+ *  -p  - profile the RT tasks and print a report at the end
+ *  -j  - measure clock tick jitter and print a histogram at the end
+ *
+ */
+#include "sim_spi_flash.h"
+#include "sim_trace.h"
+#include "config.h"
+#include "cvproc.h"
+#include "ext_flash.h"
+#include "midi/midi_clock.h"
+#include "midi/midi_stream.h"
+#include "seq/seq_ctrl.h"
+#include "util/log.h"
+#include "util/rt_prof.h"
+#include "util/state_change.h"
+#include "util/state_change_events.h"
+#include "util/time_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// settings
+#define SIM_TASK_INTERVAL_US 1000  // matches the 1ms tasks in main_timer_task
+#define SIM_LOAD_TIMEOUT_MS 5000  // max time to wait for the song to load
+
+// output ports that are drained by the DIN and USB drivers on hardware
+static const int sim_drain_ports[] = {
+    MIDI_PORT_DIN1_OUT,
+    MIDI_PORT_DIN2_OUT,
+    MIDI_PORT_USB_HOST_OUT,
+    MIDI_PORT_USB_DEV_OUT1,
+    MIDI_PORT_USB_DEV_OUT2,
+    MIDI_PORT_USB_DEV_OUT3
+};
+#define SIM_NUM_DRAIN_PORTS (sizeof(sim_drain_ports) / sizeof(int))
+
+// simulator state
+struct sim_state {
+    int64_t time_us;  // virtual time
+    int64_t clock_timer_us;  // virtual clock timer compare time
+};
+struct sim_state sims;
+
+// local functions
+void sim_usage(void);
+void sim_timer_task(void);
+void sim_drain_outputs(void);
+void sim_print_prof_report(void);
+void sim_print_jitter_report(void);
+double sim_get_wall_time(void);
+
+// main!
+int main(int argc, char **argv) {
+    char *flash_file = NULL;
+    char *trace_file = "carbon_sim.trace";
+    int song = 0;
+    int64_t run_ms = 10000;
+    int autorun = 1;
+    int profile = 0;
+    int jitter = 0;
+    int64_t i;
+    int opt;
+    double start_time, elapsed;
+
+    while((opt = getopt(argc, argv, "f:s:t:o:npjh")) != -1) {
+        switch(opt) {
+            case 'f':
+                flash_file = optarg;
+                break;
+            case 's':
+                song = atoi(optarg) - 1;
+                break;
+            case 't':
+                run_ms = atoll(optarg);
+                break;
+            case 'o':
+                trace_file = optarg;
+                break;
+            case 'n':
+                autorun = 0;
+                break;
+            case 'p':
+                profile = 1;
+                break;
+            case 'j':
+                jitter = 1;
+                break;
+            default:
+                sim_usage();
+                return 1;
+        }
+    }
+    if(song < 0 || song >= SEQ_NUM_SONGS || run_ms < 0) {
+        sim_usage();
+        return 1;
+    }
+
+    // hardware init - same order as main()
+    log_init();
+    rt_prof_init();
+    midi_stream_init();
+    ext_flash_init();
+    sim_spi_flash_erase();
+    if(flash_file != NULL && sim_spi_flash_load_image(flash_file) == -1) {
+        return 1;
+    }
+    cvproc_init();
+    if(sim_trace_open(trace_file) == -1) {
+        return 1;
+    }
+    // module init
+    sims.time_us = 0;
+    sims.clock_timer_us = 0;
+    seq_ctrl_init();
+    // there is no config store so start from defaults
+    state_change_fire0(SCE_CONFIG_CLEARED);
+
+    // load the song through the real flash path
+    seq_ctrl_load_song(song);
+    for(i = 0; i < SIM_LOAD_TIMEOUT_MS && seq_ctrl_is_run_lockout(); i ++) {
+        sim_timer_task();
+    }
+    if(seq_ctrl_is_run_lockout()) {
+        fprintf(stderr, "song %d load timed out\n", song + 1);
+        sim_trace_close();
+        return 1;
+    }
+    if(autorun) {
+        seq_ctrl_set_run_state(1);
+    }
+
+    // run
+    rt_prof_set_enable(profile);
+    midi_clock_set_jitter_enable(jitter);
+    state_change_reset_stats();
+    start_time = sim_get_wall_time();
+    for(i = 0; i < run_ms; i ++) {
+        sim_timer_task();
+    }
+    elapsed = sim_get_wall_time() - start_time;
+    sim_trace_close();
+
+    fprintf(stderr, "ran %" PRId64 " ms in %.3f s (%.1fx realtime) - "
+        "%" PRId64 " trace records\n",
+        run_ms, elapsed, (elapsed > 0.0) ? ((double)run_ms / 1000.0) / elapsed : 0.0,
+        sim_trace_get_count());
+    if(profile) {
+        sim_print_prof_report();
+    }
+    if(jitter) {
+        sim_print_jitter_report();
+    }
+    return 0;
+}
+
+//
+// local functions
+//
+// print usage
+void sim_usage(void) {
+    fprintf(stderr, "usage: carbon_sim [-f flash_image] [-s song] "
+        "[-t run_ms] [-o trace] [-n] [-p] [-j]\n");
+}
+
+// run one 1ms task period - same order as main_timer_task()
+void sim_timer_task(void) {
+    uint32_t main_start, task_start;
+#ifdef MIDI_CLOCK_TICK_TIMER
+    uint32_t next_time;
+    // clock timer compares that fall within this period
+    while(sims.clock_timer_us < (sims.time_us + SIM_TASK_INTERVAL_US)) {
+        sim_trace_set_time(sims.clock_timer_us);
+        next_time = seq_ctrl_tick_task((uint32_t)sims.clock_timer_us);
+        if((int32_t)(next_time - (uint32_t)sims.clock_timer_us) < 1) {
+            next_time = (uint32_t)sims.clock_timer_us + 1;
+        }
+        sims.clock_timer_us += (int32_t)(next_time - (uint32_t)sims.clock_timer_us);
+    }
+#endif
+    sims.time_us += SIM_TASK_INTERVAL_US;
+    sim_trace_set_time(sims.time_us);
+    main_start = rt_prof_start();
+    time_utils_set_btime((btime)sims.time_us);
+    task_start = rt_prof_start();
+    seq_ctrl_rt_task();  // sequencer realtime stuff
+    rt_prof_end(RT_PROF_TASK_SEQ_CTRL, task_start);
+    task_start = rt_prof_start();
+    sim_drain_outputs();  // stands in for DIN and USB MIDI
+    rt_prof_end(RT_PROF_TASK_DIN_MIDI, task_start);
+    task_start = rt_prof_start();
+    ext_flash_timer_task();  // loading/saving to external flash
+    rt_prof_end(RT_PROF_TASK_EXT_FLASH, task_start);
+    task_start = rt_prof_start();
+    cvproc_timer_task();  // hardware CV/gate/clock outputs
+    rt_prof_end(RT_PROF_TASK_CVPROC, task_start);
+    rt_prof_end(RT_PROF_TASK_MAIN, main_start);
+    seq_ctrl_ui_task();
+}
+
+// drain the MIDI output ports - messages are traced as they leave
+void sim_drain_outputs(void) {
+    struct midi_msg *msgs;
+    int i, num;
+    for(i = 0; i < SIM_NUM_DRAIN_PORTS; i ++) {
+        while((num = midi_stream_peek(sim_drain_ports[i], &msgs)) > 0) {
+            midi_stream_consume(sim_drain_ports[i], num);
+        }
+    }
+}
+
+// print the RT profiler report - times are in ns on the host
+void sim_print_prof_report(void) {
+    struct rt_prof_stats stats;
+    int task, bin, cls, event;
+    uint32_t fires, queued, coalesced, dropped;
+    char name[16];
+    fprintf(stderr, "%-16s %10s %8s %8s %8s  histogram (bin 0 < %d ns, "
+        "bin n >= 2^(n+%d) ns)\n", "task", "calls", "min", "avg", "max",
+        1 << (RT_PROF_BIN_SHIFT + 1), RT_PROF_BIN_SHIFT);
+    for(task = 0; task < RT_PROF_NUM_TASKS; task ++) {
+        rt_prof_get_stats(task, &stats);
+        if(stats.calls == 0) {
+            continue;
+        }
+        fprintf(stderr, "%-16s %10u %8u %8u %8u ", rt_prof_get_task_name(task),
+            stats.calls, stats.min, (uint32_t)(stats.total / stats.calls), stats.max);
+        for(bin = 0; bin < RT_PROF_NUM_BINS; bin ++) {
+            fprintf(stderr, " %u", stats.hist[bin]);
+        }
+        fprintf(stderr, "\n");
+    }
+    // state change events
+    fprintf(stderr, "%-16s %10s %8s\n", "event", "fires", "avg");
+    for(cls = SCEC_SONG; cls <= SCEC_POWER; cls += 0x010000) {
+        for(event = cls; event < (cls + 0x40); event ++) {
+            fires = state_change_get_fire_count(event);
+            if(fires == 0) {
+                continue;
+            }
+            snprintf(name, sizeof(name), "0x%06x", event);
+            fprintf(stderr, "%-16s %10u %8u\n", name, fires,
+                state_change_get_handler_time(event) / fires);
+        }
+    }
+    state_change_get_deferred_stats(&queued, &coalesced, &dropped);
+    fprintf(stderr, "deferred events - queued: %u - coalesced: %u - dropped: %u - "
+        "resyncs: %u\n", queued, coalesced, dropped, state_change_get_resync_count());
+}
+
+// print the clock tick jitter report
+void sim_print_jitter_report(void) {
+    struct midi_clock_jitter_stats stats;
+    int bin;
+    midi_clock_get_jitter_stats(&stats);
+    fprintf(stderr, "tick jitter - intervals: %u - min: %d us - max: %d us\n",
+        stats.ticks, stats.min, stats.max);
+    for(bin = 0; bin < MIDI_CLOCK_JITTER_NUM_BINS; bin ++) {
+        fprintf(stderr, "  %5d us: %u\n",
+            (bin - (MIDI_CLOCK_JITTER_NUM_BINS / 2)) * MIDI_CLOCK_JITTER_BIN_US,
+            stats.hist[bin]);
+    }
+}
+
+// get the host wall time in seconds
+double sim_get_wall_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
+}
+
@@ -0,0 +1,234 @@
+/*
+ * CARBON Host Simulator - SPI Flash
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Emulates the SPI flash command interface on top of a RAM image so that
+ * the real ext_flash.c state machine runs in the simulator. Commands
+ * complete immediately - the busy flag is never set.
+ *
+ */
+#include "spi_flash.h"
+#include "sim_spi_flash.h"
+#include "util/log.h"
+#include <stdio.h>
+#include <string.h>
+
+// SPI flash state
+struct sim_spi_flash_state {
+    int state;  // the flash state
+    int write_enable;  // write enable latch
+    uint32_t addr;  // address of the last command
+    int len;  // length of the last command
+    uint8_t prog_buf[SPI_FLASH_PAGE_SIZE];  // staged page program data
+    int prog_len;  // length of staged page program data
+    int erases;  // number of sector erases
+    int programs;  // number of page programs
+    uint8_t mem[SPI_FLASH_MEMORY_SIZE];  // flash contents
+};
+struct sim_spi_flash_state ssflash;
+
+// init the SPI flash interface
+void spi_flash_init(void) {
+    ssflash.state = SPI_FLASH_STATE_IDLE;
+    ssflash.write_enable = 0;
+}
+
+// set a function to call when a command completes
+// commands complete before they return so the callback is never needed
+void spi_flash_set_done_cb(void (*done_cb)(void)) {
+}
+
+// get the SPI flash state
+int spi_flash_get_state(void) {
+    return ssflash.state;
+}
+
+// starts an SPI flash command
+// returns error if the module is busy or cmd is invalid
+int spi_flash_start_cmd(int cmd, uint32_t addr, uint8_t *tx_data, int len) {
+    int i;
+    if(ssflash.state != SPI_FLASH_STATE_IDLE) {
+        return SPI_FLASH_ERROR_BUSY;
+    }
+    if(len > SPI_FLASH_PAGE_SIZE) {
+        return SPI_FLASH_ERROR_INVALID_PARAMS;
+    }
+    ssflash.addr = addr & (SPI_FLASH_MEMORY_SIZE - 1);
+    ssflash.len = len;
+    switch(cmd) {
+        case SPI_FLASH_CMD_READ_STATUS_REG:
+            ssflash.state = SPI_FLASH_STATE_READ_STATUS_REG_DONE;
+            break;
+        case SPI_FLASH_CMD_READ_MEM:
+            ssflash.state = SPI_FLASH_STATE_READ_MEM_DONE;
+            break;
+        case SPI_FLASH_CMD_WRITE_ENABLE:
+            ssflash.write_enable = 1;
+            ssflash.state = SPI_FLASH_STATE_WRITE_ENABLE_DONE;
+            break;
+        case SPI_FLASH_CMD_WRITE_MEM:
+            if(!ssflash.write_enable) {
+                log_error("ssfsc - write not enabled: 0x%x", addr);
+            }
+            else {
+                ssflash.programs ++;
+                if(tx_data == NULL) {
+                    if(len != ssflash.prog_len) {
+                        return SPI_FLASH_ERROR_INVALID_PARAMS;
+                    }
+                    tx_data = ssflash.prog_buf;
+                }
+                // page program wraps within the page and can only clear bits
+                for(i = 0; i < len; i ++) {
+                    ssflash.mem[(ssflash.addr & ~(SPI_FLASH_PAGE_SIZE - 1)) |
+                        ((ssflash.addr + i) & (SPI_FLASH_PAGE_SIZE - 1))] &= tx_data[i];
+                }
+            }
+            ssflash.write_enable = 0;
+            ssflash.state = SPI_FLASH_STATE_WRITE_MEM_DONE;
+            break;
+        case SPI_FLASH_CMD_ERASE_MEM:
+            if(!ssflash.write_enable) {
+                log_error("ssfsc - erase not enabled: 0x%x", addr);
+            }
+            else {
+                ssflash.erases ++;
+                memset(&ssflash.mem[ssflash.addr & ~(SPI_FLASH_SECTOR_SIZE - 1)],
+                    0xff, SPI_FLASH_SECTOR_SIZE);
+            }
+            ssflash.write_enable = 0;
+            ssflash.state = SPI_FLASH_STATE_ERASE_MEM_DONE;
+            break;
+        default:
+            return SPI_FLASH_ERROR_INVALID_STATE;
+    }
+    return 0;
+}
+
+// copy data for the next page program into the program buffer
+// returns error if len is invalid
+int spi_flash_stage_write(uint8_t *tx_data, int len) {
+    if(len > SPI_FLASH_PAGE_SIZE) {
+        return SPI_FLASH_ERROR_INVALID_PARAMS;
+    }
+    memcpy(ssflash.prog_buf, tx_data, len);
+    ssflash.prog_len = len;
+    return 0;
+}
+
+// starts a fast read of any length straight into rx_data
+// returns error if the module is busy or params are invalid
+int spi_flash_start_fast_read(uint32_t addr, uint8_t *rx_data, int len) {
+    if(ssflash.state != SPI_FLASH_STATE_IDLE) {
+        return SPI_FLASH_ERROR_BUSY;
+    }
+    if(len < 1 || (addr + len) > SPI_FLASH_MEMORY_SIZE) {
+        return SPI_FLASH_ERROR_INVALID_PARAMS;
+    }
+    memcpy(rx_data, &ssflash.mem[addr], len);
+    ssflash.len = len;
+    ssflash.state = SPI_FLASH_STATE_FAST_READ_MEM_DONE;
+    return 0;
+}
+
+// get the result of an SPI flash command and reset the state to idle
+// returns the length of the resulting data
+// returns error if the module is busy or cmd was not run
+int spi_flash_get_result(uint8_t *rx_data) {
+    int ret;
+    switch(ssflash.state) {
+        case SPI_FLASH_STATE_READ_STATUS_REG_DONE:
+            rx_data[0] = (ssflash.write_enable << 1);  // never busy
+            ret = 1;
+            break;
+        case SPI_FLASH_STATE_READ_MEM_DONE:
+            memcpy(rx_data, &ssflash.mem[ssflash.addr], ssflash.len);
+            ret = ssflash.len;
+            break;
+        case SPI_FLASH_STATE_WRITE_ENABLE_DONE:
+        case SPI_FLASH_STATE_ERASE_MEM_DONE:
+            ret = SPI_FLASH_ERROR_OK;
+            break;
+        case SPI_FLASH_STATE_WRITE_MEM_DONE:
+        case SPI_FLASH_STATE_FAST_READ_MEM_DONE:
+            ret = ssflash.len;
+            break;
+        default:
+            return SPI_FLASH_ERROR_INVALID_STATE;
+    }
+    ssflash.state = SPI_FLASH_STATE_IDLE;
+    return ret;
+}
+
+//
+// simulator functions
+//
+// erase the whole flash image
+void sim_spi_flash_erase(void) {
+    memset(ssflash.mem, 0xff, SPI_FLASH_MEMORY_SIZE);
+}
+
+// get a pointer to the flash image
+uint8_t *sim_spi_flash_get_mem(void) {
+    return ssflash.mem;
+}
+
+// get the number of sector erases and page programs so far
+void sim_spi_flash_get_counts(int *erases, int *programs) {
+    *erases = ssflash.erases;
+    *programs = ssflash.programs;
+}
+
+// load the flash image from a file - returns -1 on error
+int sim_spi_flash_load_image(char *filename) {
+    FILE *fp;
+    size_t len;
+    sim_spi_flash_erase();
+    fp = fopen(filename, "rb");
+    if(fp == NULL) {
+        log_error("ssfli - could not open image: %s", filename);
+        return -1;
+    }
+    len = fread(ssflash.mem, 1, SPI_FLASH_MEMORY_SIZE, fp);
+    fclose(fp);
+    if(len == 0) {
+        log_error("ssfli - image empty: %s", filename);
+        return -1;
+    }
+    return 0;
+}
+
+// save the flash image to a file - returns -1 on error
+int sim_spi_flash_save_image(char *filename) {
+    FILE *fp;
+    fp = fopen(filename, "wb");
+    if(fp == NULL) {
+        log_error("ssfsi - could not open image: %s", filename);
+        return -1;
+    }
+    if(fwrite(ssflash.mem, 1, SPI_FLASH_MEMORY_SIZE, fp) != SPI_FLASH_MEMORY_SIZE) {
+        log_error("ssfsi - image write error: %s", filename);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    return 0;
+}
+
@@ -0,0 +1,44 @@
+/*
+ * CARBON Host Simulator - SPI Flash
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SIM_SPI_FLASH_H
+#define SIM_SPI_FLASH_H
+
+#include <inttypes.h>
+
+// erase the whole flash image
+void sim_spi_flash_erase(void);
+
+// get a pointer to the flash image
+uint8_t *sim_spi_flash_get_mem(void);
+
+// get the number of sector erases and page programs so far
+void sim_spi_flash_get_counts(int *erases, int *programs);
+
+// load the flash image from a file - returns -1 on error
+int sim_spi_flash_load_image(char *filename);
+
+// save the flash image to a file - returns -1 on error
+int sim_spi_flash_save_image(char *filename);
+
+#endif
+
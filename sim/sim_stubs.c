@@ -0,0 +1,211 @@
+/*
+ * CARBON Host Simulator - Hardware and UI Stubs
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * The simulator runs headless so the GUI, panel, edit modes, interface
+ * mode and SYSEX handler are replaced with empty versions. The config
+ * store is kept in RAM only.
+ *
+ */
+#include "config.h"
+#include "clock_timer.h"
+#include "config_store.h"
+#include "power_ctrl.h"
+#include "gui/gui.h"
+#include "gui/panel.h"
+#include "gui/pattern_edit.h"
+#include "gui/song_edit.h"
+#include "gui/step_edit.h"
+#include "iface/iface_midi_router.h"
+#include "iface/iface_panel.h"
+#include "seq/sysex.h"
+#include "util/time_utils.h"
+#include <inttypes.h>
+
+//
+// config store
+//
+int32_t sim_config_ram[CONFIG_STORE_NUM_ITEMS];
+
+// gets a config byte
+int32_t config_store_get_val(int32_t addr) {
+    return sim_config_ram[addr & (CONFIG_STORE_NUM_ITEMS - 1)];
+}
+
+// sets a config byte
+void config_store_set_val(int32_t addr, int32_t val) {
+    sim_config_ram[addr & (CONFIG_STORE_NUM_ITEMS - 1)] = val;
+}
+
+//
+// clock timer
+//
+// get the clock timer time in us - the sim sets the btime in us
+uint32_t clock_timer_get_time(void) {
+    return (uint32_t)time_utils_get_btime();
+}
+
+//
+// power control
+//
+// get the current power state
+int power_ctrl_get_power_state(void) {
+    return POWER_CTRL_STATE_ON;
+}
+
+//
+// GUI
+//
+// init the GUI and reset all vars
+int gui_init(void) {
+    return 0;
+}
+
+// start the GUI and load all layout params - config store must be loaded
+void gui_startup(void) {
+}
+
+// run the refresh task - run on the main polling loop
+void gui_refresh_task(void) {
+}
+
+// clear the grid overlay
+void gui_grid_clear_overlay(void) {
+}
+
+// set a grid overlay color index
+void gui_grid_set_overlay_color(int step, int index) {
+}
+
+// enable or disable the grid overlay
+void gui_grid_set_overlay_enable(int enable) {
+}
+
+//
+// panel
+//
+// init the panel
+void panel_init(void) {
+}
+
+// run the panel timer task
+void panel_timer_task(void) {
+}
+
+// handle a control from the panel
+void panel_handle_input(int ctrl, int val) {
+}
+
+// blink the beat LED
+void panel_blink_beat_led(void) {
+}
+
+//
+// edit modes
+//
+// init the step edit mode
+void pattern_edit_init(void) {
+}
+
+// run step edit timer task
+void pattern_edit_timer_task(void) {
+}
+
+// start and stop step edit mode
+void pattern_edit_set_enable(int enable) {
+}
+
+// get whether step edit mode is enabled
+int pattern_edit_get_enable(void) {
+    return 0;
+}
+
+// init the song edit mode
+void song_edit_init(void) {
+}
+
+// run the song edit timer task
+void song_edit_timer_task(void) {
+}
+
+// start and stop song edit mode
+void song_edit_set_enable(int enable) {
+}
+
+// get whether song edit mode is enabled
+int song_edit_get_enable(void) {
+    return 0;
+}
+
+// init the step edit mode
+void step_edit_init(void) {
+}
+
+// run step edit timer task
+void step_edit_timer_task(void) {
+}
+
+// start and stop step edit mode
+void step_edit_set_enable(int enable) {
+}
+
+// get whether step edit mode is enabled
+int step_edit_get_enable(void) {
+    return 0;
+}
+
+// the clock ticked - do note timeouts for preview
+void step_edit_run(uint32_t tick_count) {
+}
+
+// handle a input from the keyboard
+void step_edit_handle_input(struct midi_msg *msg) {
+}
+
+//
+// interface mode
+//
+// init the interface panel
+void iface_panel_init(void) {
+}
+
+// init the interface MIDI router
+void iface_midi_router_init(void) {
+}
+
+// run the interface MIDI router timer task
+void iface_midi_router_timer_task(void) {
+}
+
+//
+// SYSEX
+//
+// init the sysex handler
+void sysex_init(void) {
+}
+
+// handle processing of requests that can take time
+void sysex_timer_task(void) {
+}
+
+// handle a portion of SYSEX message received
+void sysex_handle_msg(struct midi_msg *msg) {
+}
+
@@ -0,0 +1,275 @@
+/*
+ * CARBON Sequencer Host SYSEX Device Emulator
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Runs the firmware SYSEX handler and ext flash code against a RAM flash
+ * image so that the librarian can be tested without hardware. MIDI bytes
+ * from stdin go into the SYSEX input port and bytes from the SYSEX output
+ * port are written to stdout. The tasks run every 1ms in the same order
+ * as on the device.
+ *
+ * Loss can be added to test retransmits. Each SYSEX message in either
+ * direction is dropped or has a byte corrupted with the given chance.
+ *
+ * Usage: sim_sysex_dev [-i flash_image] [-o flash_image] [-l loss_percent]
+ *   [-s seed]
+ *
+ * The flash image is saved when stdin is closed.
+ *
+ */
+#include "config.h"
+#include "ext_flash.h"
+#include "sim_spi_flash.h"
+#include "midi/midi_protocol.h"
+#include "midi/midi_stream.h"
+#include "midi/midi_utils.h"
+#include "seq/song.h"
+#include "seq/sysex.h"
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// settings
+#define SIM_SYSEX_DEV_MAX_MSG 512  // max SYSEX message length
+#define SIM_SYSEX_DEV_READ_LEN 384  // max bytes taken from the host each tick
+#define SIM_SYSEX_DEV_EXIT_MS 500  // time to run after the host closes
+
+// a SYSEX message being collected in one direction
+struct sim_sysex_dev_msg {
+    uint8_t buf[SIM_SYSEX_DEV_MAX_MSG];
+    int len;
+};
+
+// state
+struct sim_sysex_dev_state {
+    int loss;  // loss chance in percent
+    struct sim_sysex_dev_msg in;  // message from the host
+    struct sim_sysex_dev_msg out;  // message to the host
+    int dropped;  // number of messages dropped
+    int corrupted;  // number of messages corrupted
+};
+struct sim_sysex_dev_state ssdev;
+
+//
+// firmware functions not used by the emulator
+//
+// sets a config byte
+void config_store_set_val(int32_t addr, int32_t val) {
+}
+
+// notify the song that part of the flash was written
+void song_flash_changed(int32_t addr, int len) {
+}
+
+// wipe the config store
+void config_store_wipe_flash(void) {
+}
+
+// local functions
+void sim_sysex_dev_tick(void);
+void sim_sysex_dev_input(uint8_t *buf, int len);
+void sim_sysex_dev_output(void);
+int sim_sysex_dev_add_byte(struct sim_sysex_dev_msg *msg, uint8_t data);
+int sim_sysex_dev_lossy(struct sim_sysex_dev_msg *msg);
+uint64_t sim_sysex_dev_time_ms(void);
+
+int main(int argc, char **argv) {
+    char *in_file = NULL;
+    char *out_file = NULL;
+    struct pollfd pfd;
+    uint8_t buf[SIM_SYSEX_DEV_READ_LEN];
+    uint64_t next_tick;
+    int opt, len, timeout, in_count = 0, exit_timer = -1;
+    unsigned int seed = 1;
+
+    while((opt = getopt(argc, argv, "i:o:l:s:")) != -1) {
+        switch(opt) {
+            case 'i':
+                in_file = optarg;
+                break;
+            case 'o':
+                out_file = optarg;
+                break;
+            case 'l':
+                ssdev.loss = atoi(optarg);
+                break;
+            case 's':
+                seed = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-i flash_image] [-o flash_image] "
+                    "[-l loss_percent] [-s seed]\n", argv[0]);
+                return 1;
+        }
+    }
+    srand(seed);
+
+    midi_stream_init();
+    ext_flash_init();
+    sim_spi_flash_erase();
+    if(in_file != NULL && sim_spi_flash_load_image(in_file) == -1) {
+        return 1;
+    }
+    sysex_init();
+
+    pfd.fd = STDIN_FILENO;
+    pfd.events = POLLIN;
+    next_tick = sim_sysex_dev_time_ms() + 1;
+    while(exit_timer != 0) {
+        // wait for host data or the next tick
+        timeout = next_tick - sim_sysex_dev_time_ms();
+        if(timeout < 0) {
+            timeout = 0;
+        }
+        // the host is held off like USB once enough is taken for a tick
+        if(exit_timer == -1 && in_count < SIM_SYSEX_DEV_READ_LEN) {
+            if(poll(&pfd, 1, timeout) > 0) {
+                len = read(STDIN_FILENO, buf, SIM_SYSEX_DEV_READ_LEN - in_count);
+                if(len > 0) {
+                    sim_sysex_dev_input(buf, len);
+                    in_count += len;
+                }
+                else {
+                    exit_timer = SIM_SYSEX_DEV_EXIT_MS;
+                }
+            }
+        }
+        else if(timeout > 0) {
+            usleep(timeout * 1000);
+        }
+        if(sim_sysex_dev_time_ms() < next_tick) {
+            continue;
+        }
+        next_tick ++;
+        in_count = 0;
+        sim_sysex_dev_tick();
+        if(exit_timer > 0) {
+            exit_timer --;
+        }
+    }
+
+    if(ssdev.loss) {
+        fprintf(stderr, "sim_sysex_dev: dropped %d and corrupted %d messages\n",
+            ssdev.dropped, ssdev.corrupted);
+    }
+    if(out_file != NULL && sim_spi_flash_save_image(out_file) == -1) {
+        return 1;
+    }
+    return 0;
+}
+
+//
+// local functions
+//
+// run the tasks for 1ms
+void sim_sysex_dev_tick(void) {
+    struct midi_msg msg;
+    // seq_engine passes SYSEX input to the handler
+    while(midi_stream_receive_msg(MIDI_PORT_SYSEX_IN, &msg) == 0) {
+        if(msg.len > 0 && (msg.status == MIDI_SYSEX_START ||
+                msg.status < 0x80 || msg.status == MIDI_SYSEX_END)) {
+            sysex_handle_msg(&msg);
+        }
+    }
+    sysex_timer_task();
+    ext_flash_timer_task();
+    sim_sysex_dev_output();
+}
+
+// handle bytes from the host
+void sim_sysex_dev_input(uint8_t *buf, int len) {
+    int i;
+    for(i = 0; i < len; i ++) {
+        if(sim_sysex_dev_add_byte(&ssdev.in, buf[i]) &&
+                sim_sysex_dev_lossy(&ssdev.in)) {
+            midi_stream_send_bytes(MIDI_PORT_SYSEX_IN, ssdev.in.buf,
+                ssdev.in.len);
+        }
+    }
+}
+
+// write device output to the host
+void sim_sysex_dev_output(void) {
+    struct midi_msg msg;
+    uint8_t bytes[3];
+    int i;
+    while(midi_stream_receive_msg(MIDI_PORT_SYSEX_OUT, &msg) == 0) {
+        bytes[0] = msg.status;
+        bytes[1] = msg.data0;
+        bytes[2] = msg.data1;
+        for(i = 0; i < msg.len; i ++) {
+            if(sim_sysex_dev_add_byte(&ssdev.out, bytes[i]) &&
+                    sim_sysex_dev_lossy(&ssdev.out)) {
+                if(write(STDOUT_FILENO, ssdev.out.buf, ssdev.out.len) !=
+                        ssdev.out.len) {
+                    exit(1);
+                }
+            }
+        }
+    }
+}
+
+// add a byte to a message being collected
+// returns 1 when a message is complete
+int sim_sysex_dev_add_byte(struct sim_sysex_dev_msg *msg, uint8_t data) {
+    if(data == MIDI_SYSEX_START) {
+        msg->len = 0;
+    }
+    // other bytes outside of a message are dropped
+    else if(msg->len == 0 || msg->len >= SIM_SYSEX_DEV_MAX_MSG ||
+            msg->buf[msg->len - 1] == MIDI_SYSEX_END) {
+        return 0;
+    }
+    msg->buf[msg->len++] = data;
+    if(data == MIDI_SYSEX_END) {
+        return 1;
+    }
+    return 0;
+}
+
+// apply loss to a complete message
+// returns 1 if the message should be passed on
+int sim_sysex_dev_lossy(struct sim_sysex_dev_msg *msg) {
+    int pos;
+    if(ssdev.loss == 0 || (rand() % 100) >= ssdev.loss) {
+        return 1;
+    }
+    // drop half of the lost messages and corrupt the rest
+    if(rand() & 0x01) {
+        ssdev.dropped ++;
+        return 0;
+    }
+    ssdev.corrupted ++;
+    if(msg->len > 2) {
+        pos = 1 + (rand() % (msg->len - 2));
+        msg->buf[pos] = (msg->buf[pos] + 1 + (rand() % 0x7e)) & 0x7f;
+    }
+    return 1;
+}
+
+// get the time in ms
+uint64_t sim_sysex_dev_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
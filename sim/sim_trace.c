@@ -0,0 +1,147 @@
+/*
+ * CARBON Host Simulator - Output Trace
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Trace format - one record per line:
+ *  <time_us> MIDI <port> <byte0> [<byte1> [<byte2>]]  - bytes in hex
+ *  <time_us> <output> <chan> <val>  - output: CV, GATE, CLOCK, RESET, METRO
+ *
+ */
+#include "sim_trace.h"
+#include "midi/midi_stream.h"
+#include "util/log.h"
+#include <stdio.h>
+#include <string.h>
+
+struct sim_trace_state {
+    FILE *fp;  // trace output
+    int64_t time_us;  // current virtual time
+    int64_t count;  // number of records written
+};
+struct sim_trace_state strace;
+
+// the real receive functions - wrapped by the linker
+int __real_midi_stream_receive_msg(int port, struct midi_msg *msg);
+int __real_midi_stream_consume(int port, int count);
+
+// open the trace file - returns -1 on error
+int sim_trace_open(char *filename) {
+    strace.time_us = 0;
+    strace.count = 0;
+    if(filename == NULL || strcmp(filename, "-") == 0) {
+        strace.fp = stdout;
+        return 0;
+    }
+    strace.fp = fopen(filename, "w");
+    if(strace.fp == NULL) {
+        log_error("sto - could not open trace: %s", filename);
+        return -1;
+    }
+    return 0;
+}
+
+// close the trace file
+void sim_trace_close(void) {
+    if(strace.fp == NULL) {
+        return;
+    }
+    if(strace.fp != stdout) {
+        fclose(strace.fp);
+    }
+    else {
+        fflush(strace.fp);
+    }
+    strace.fp = NULL;
+}
+
+// set the virtual time used to stamp trace records
+void sim_trace_set_time(int64_t time_us) {
+    strace.time_us = time_us;
+}
+
+// get the virtual time
+int64_t sim_trace_get_time(void) {
+    return strace.time_us;
+}
+
+// trace a MIDI message leaving a stream port
+void sim_trace_midi(struct midi_msg *msg) {
+    if(strace.fp == NULL) {
+        return;
+    }
+    switch(msg->len) {
+        case 1:
+            fprintf(strace.fp, "%" PRId64 " MIDI %d %02x\n",
+                strace.time_us, msg->port, msg->status);
+            break;
+        case 2:
+            fprintf(strace.fp, "%" PRId64 " MIDI %d %02x %02x\n",
+                strace.time_us, msg->port, msg->status, msg->data0);
+            break;
+        case 3:
+            fprintf(strace.fp, "%" PRId64 " MIDI %d %02x %02x %02x\n",
+                strace.time_us, msg->port, msg->status, msg->data0, msg->data1);
+            break;
+        default:
+            log_error("stm - msg len invalid: %d", msg->len);
+            return;
+    }
+    strace.count ++;
+}
+
+// trace a DAC / output pin change - name is the output type
+void sim_trace_output(char *name, int chan, int val) {
+    if(strace.fp == NULL) {
+        return;
+    }
+    fprintf(strace.fp, "%" PRId64 " %s %d %d\n",
+        strace.time_us, name, chan, val);
+    strace.count ++;
+}
+
+// get the number of records written
+int64_t sim_trace_get_count(void) {
+    return strace.count;
+}
+
+//
+// linker wrapped functions
+//
+// every message removed from a stream port is traced on its way out
+int __wrap_midi_stream_receive_msg(int port, struct midi_msg *msg) {
+    int ret = __real_midi_stream_receive_msg(port, msg);
+    if(ret == 0) {
+        sim_trace_midi(msg);
+    }
+    return ret;
+}
+
+// messages consumed from a span are traced before they are freed
+// consumers only consume within the span returned by midi_stream_peek()
+int __wrap_midi_stream_consume(int port, int count) {
+    struct midi_msg *msgs;
+    int i, num;
+    num = midi_stream_peek(port, &msgs);
+    for(i = 0; i < count && i < num; i ++) {
+        sim_trace_midi(&msgs[i]);
+    }
+    return __real_midi_stream_consume(port, count);
+}
+
@@ -0,0 +1,51 @@
+/*
+ * CARBON Host Simulator - Output Trace
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SIM_TRACE_H
+#define SIM_TRACE_H
+
+#include <inttypes.h>
+#include "midi/midi_utils.h"
+
+// open the trace file - returns -1 on error
+int sim_trace_open(char *filename);
+
+// close the trace file
+void sim_trace_close(void);
+
+// set the virtual time used to stamp trace records
+void sim_trace_set_time(int64_t time_us);
+
+// get the virtual time
+int64_t sim_trace_get_time(void);
+
+// trace a MIDI message leaving a stream port
+void sim_trace_midi(struct midi_msg *msg);
+
+// trace a DAC / output pin change - name is the output type
+void sim_trace_output(char *name, int chan, int val);
+
+// get the number of records written
+int64_t sim_trace_get_count(void);
+
+#endif
+
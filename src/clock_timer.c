@@ -0,0 +1,119 @@
+/*
+ * CARBON Sequencer Clock Timer
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "clock_timer.h"
+#include "stm32f4xx_hal.h"
+#include "config.h"
+#include "din_midi.h"
+#include "seq/seq_ctrl.h"
+#include "util/log.h"
+
+// settings
+#define CLOCK_TIMER_MIN_DELAY 5  // us - min time to the next compare
+
+TIM_HandleTypeDef clock_timer_handle;  // TIM5 clock timer
+
+// init and start the clock timer - the sequencer must be ready
+// it always runs as the timestamp base for MIDI input and with
+// MIDI_CLOCK_TICK_TIMER its compare interrupt runs the clock ticks
+void clock_timer_init(void) {
+#ifdef MIDI_CLOCK_TICK_TIMER
+    TIM_OC_InitTypeDef oc;
+#endif
+    uint32_t clk;
+
+    __HAL_RCC_TIM5_CLK_ENABLE();
+
+    // timer clock is 2x PCLK1 when the APB1 prescaler is not 1
+    clk = HAL_RCC_GetPCLK1Freq();
+    if((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+        clk *= 2;
+    }
+
+    // free running 32 bit counter at 1MHz
+    clock_timer_handle.Instance = TIM5;
+    clock_timer_handle.Init.Prescaler = (clk / 1000000) - 1;
+    clock_timer_handle.Init.CounterMode = TIM_COUNTERMODE_UP;
+    clock_timer_handle.Init.Period = 0xffffffff;
+    clock_timer_handle.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+#ifdef MIDI_CLOCK_TICK_TIMER
+    if(HAL_TIM_OC_Init(&clock_timer_handle) != HAL_OK) {
+        log_error("cti - timer init error");
+        return;
+    }
+
+    // compare channel for the next tick - the first tick is due right away
+    oc.OCMode = TIM_OCMODE_TIMING;
+    oc.Pulse = CLOCK_TIMER_MIN_DELAY;
+    oc.OCPolarity = TIM_OCPOLARITY_HIGH;
+    oc.OCFastMode = TIM_OCFAST_DISABLE;
+    if(HAL_TIM_OC_ConfigChannel(&clock_timer_handle, &oc, TIM_CHANNEL_1) != HAL_OK) {
+        log_error("cti - channel init error");
+        return;
+    }
+
+    // the sequencer runs from this interrupt so it must never preempt
+    // or be preempted by the RT task
+    HAL_NVIC_SetPriority(TIM5_IRQn, INT_PRIO_CLOCK_TIMER, 0);
+    HAL_NVIC_EnableIRQ(TIM5_IRQn);
+    if(HAL_TIM_OC_Start_IT(&clock_timer_handle, TIM_CHANNEL_1) != HAL_OK) {
+        log_error("cti - timer start error");
+    }
+#else
+    // timestamps only - no interrupt
+    if(HAL_TIM_Base_Init(&clock_timer_handle) != HAL_OK) {
+        log_error("cti - timer init error");
+        return;
+    }
+    if(HAL_TIM_Base_Start(&clock_timer_handle) != HAL_OK) {
+        log_error("cti - timer start error");
+    }
+#endif
+}
+
+// get the clock timer time in us
+// reads 0 until the timer is started
+uint32_t clock_timer_get_time(void) {
+    return TIM5->CNT;
+}
+
+#ifdef MIDI_CLOCK_TICK_TIMER
+//
+// callbacks
+//
+// the compare time was reached - run the ticks that are due
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim) {
+    uint32_t next_time, now;
+    if(htim != &clock_timer_handle) {
+        return;
+    }
+    next_time = seq_ctrl_tick_task(clock_timer_get_time());
+    // send notes out now instead of waiting for the RT task
+    din_midi_tx_task();
+    // if the next tick is already due make sure we don't wait for the counter to wrap
+    now = clock_timer_get_time();
+    if((int32_t)(next_time - now) < CLOCK_TIMER_MIN_DELAY) {
+        next_time = now + CLOCK_TIMER_MIN_DELAY;
+    }
+    __HAL_TIM_SET_COMPARE(&clock_timer_handle, TIM_CHANNEL_1, next_time);
+}
+#endif
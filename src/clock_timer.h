@@ -0,0 +1,41 @@
+/*
+ * CARBON Sequencer Clock Timer
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * TIM5 runs as a free running 32 bit counter at 1MHz. The channel 1
+ * compare interrupt is set to the time of the next MIDI clock tick so
+ * that ticks are not quantized to the 1ms RT task.
+ *
+ */
+#ifndef CLOCK_TIMER_H
+#define CLOCK_TIMER_H
+
+#include <inttypes.h>
+#include "config.h"
+
+// init and start the clock timer - the sequencer must be ready
+// it always runs as the timestamp base for MIDI input and with
+// MIDI_CLOCK_TICK_TIMER its compare interrupt runs the clock ticks
+void clock_timer_init(void);
+
+// get the clock timer time in us - 0 if not known
+uint32_t clock_timer_get_time(void);
+
+#endif
@@ -38,11 +38,16 @@
 //   - lcd_fsmc_if.c        - lcds
 //   - midi_stream.c        - midi_stream_queue
 //   - gui.c                - gstate
+// - the spare song image (song.c - song_images) used for the save snapshot,
+//   the encoded song and the song preload is in RAM and is only used with
+//   the smaller notes per song layout
+// - the song table (song.c - songt) is in RAM and grows with SEQ_NUM_SONGS
 //
 
 // interrupt priorities
 #define INT_PRIO_SPI_PANEL 0  // highest prio - avoids SPI lockup
 #define INT_PRIO_SYSTICK 1  // needs to be higher than everything else
+#define INT_PRIO_CLOCK_TIMER 15  // same as the SysTick after SysTick_Config() so they never preempt
 #define INT_PRIO_SPI_FLASH_DMA_TX 2
 #define INT_PRIO_SPI_FLASH_DMA_RX 2
 #define INT_PRIO_SPI_ANALOG_OUT 2
@@ -70,9 +75,14 @@
   #define EXT_FLASH_SONG_SIZE 0x16000
 #else
   #define EXT_FLASH_SONG_SIZE 0x5000
+  #define SONG_SAVE_SNAPSHOT  // save from a copy so playback can continue
+  #define SONG_PRELOAD  // load the next song in the background while playing
+  #define SONG_FLASH_ENCODED  // store only the used steps of songs in flash
 #endif
 #define EXT_FLASH_CONFIG_OFFSET 0x160000
 #define EXT_FLASH_CONFIG_SIZE 0x1000
+#define EXT_FLASH_SONG_TABLE_OFFSET 0x161000  // two banks
+#define EXT_FLASH_SONG_TABLE_SIZE 0x1000
 
 // config store
 #define CONFIG_STORE_WRITEBACK_INTERVAL 0xffff
@@ -151,6 +161,7 @@
 
 // MIDI clock
 #define MIDI_CLOCK_TASK_INTERVAL_US (SEQ_TASK_INTERVAL_US)
+#define MIDI_CLOCK_TICK_TIMER  // run ticks from the clock timer - comment out to run on the RT task
 #define MIDI_CLOCK_DEFAULT_TEMPO 60.0
 #define MIDI_CLOCK_TEMPO_MIN 30.0  // BPM
 #define MIDI_CLOCK_TEMPO_MAX 300.0  // BPM
@@ -161,6 +172,10 @@
 #define BEAT_LED_TIMEOUT 100  // ms
 #define CLOCK_OUT_PULSE_LEN 4  // ms
 
+// DIN MIDI
+#define DIN_MIDI_RUNNING_STATUS  // leave out repeated status bytes - comment out to always send them
+#define DIN_MIDI_RUNNING_STATUS_REFRESH 250000  // us - send the status again after this long
+
 // metronome
 #define METRONOME_MIDI_TRACK 5  // track 6
 #define METRONOME_SOUND_LENGTH_DEFAULT 100  // ms
@@ -175,10 +190,14 @@
 #define SEQ_SONG_LIST_DEFAULT_KBTRANS 0
 #define SEQ_SONG_LIST_MIN_LENGTH 1
 #define SEQ_SONG_LIST_MAX_LENGTH 256
+// songs are stored in any free flash sectors so more fit when they are encoded
+// - legacy songs are the fixed slots used by older firmware
 #ifdef SONG_NOTES_PER_SCENE
   #define SEQ_NUM_SONGS 16
+  #define SEQ_NUM_LEGACY_SONGS 16
 #else
-  #define SEQ_NUM_SONGS 64
+  #define SEQ_NUM_SONGS 128
+  #define SEQ_NUM_LEGACY_SONGS 64
 #endif
 #define SEQ_NUM_SCENES 6
 #define SEQ_NUM_TRACKS 6
@@ -236,6 +255,9 @@
 #ifdef DEBUG_DEVEL
 // instrumentation
 //#define DEBUG_RT_TIMING  // uncomment to enable debug timing of the RT thread
+//#define DEBUG_CLOCK_JITTER  // uncomment to log clock tick interval jitter histograms
+//#define DEBUG_DIN_MIDI_STATS  // uncomment to log DIN MIDI TX rate and latency
+//#define DEBUG_USBD_MIDI_STATS  // uncomment to log USB MIDI IN transfer packing
 // debug messages
 #define LOG_PRINT_ENABLE  // uncomment to allow log_ messages to render strings
 #define DEBUG_OVER_MIDI  // uncomment to route log messages to MIDI / enable active sensing
@@ -106,13 +106,13 @@ void cvproc_init(void) {
 
 // run the timer task
 void cvproc_timer_task(void) {
-    struct midi_msg msg;
-    int pair;
-    // CV/gate
-    if(midi_stream_data_available(MIDI_PORT_CV_OUT)) {
-        while(midi_stream_data_available(MIDI_PORT_CV_OUT)) {
-            midi_stream_receive_msg(MIDI_PORT_CV_OUT, &msg);
-            pair = msg.status & 0x0f;  // channel is which pair to use
+    struct midi_msg *msgs, *msg;
+    int pair, i, num;
+    // CV/gate - process messages in place
+    while((num = midi_stream_peek(MIDI_PORT_CV_OUT, &msgs)) > 0) {
+        for(i = 0; i < num; i ++) {
+            msg = &msgs[i];
+            pair = msg->status & 0x0f;  // channel is which pair to use
             switch(cvstate.pairs) {
                 case CVPROC_PAIRS_ABCD:
                     switch(pair) {
@@ -123,11 +123,11 @@ void cvproc_timer_task(void) {
                             // note / velocity
                             if(cvstate.pair_mode[pair] == CVPROC_MODE_NOTE ||
                                     cvstate.pair_mode[pair] == CVPROC_MODE_VELO) {
-                                cvproc_mono_handler(pair, &msg);
+                                cvproc_mono_handler(pair, msg);
                             }
                             // CC
                             else {
-                                cvproc_cc_handler(pair, &msg);
+                                cvproc_cc_handler(pair, msg);
                             }
                             break;
                     }
@@ -138,11 +138,11 @@ void cvproc_timer_task(void) {
                             // note / velocity
                             if(cvstate.pair_mode[pair] == CVPROC_MODE_NOTE ||
                                     cvstate.pair_mode[pair] == CVPROC_MODE_VELO) {
-                                cvproc_poly_handler(pair, &msg);
+                                cvproc_poly_handler(pair, msg);
                             }
                             // CC
                             else {
-                                cvproc_cc_handler(pair, &msg);                            
+                                cvproc_cc_handler(pair, msg);                            
                             }
                             break;
                         case 1:  // B mono
@@ -150,11 +150,11 @@ void cvproc_timer_task(void) {
                             // note / velocity
                             if(cvstate.pair_mode[pair] == CVPROC_MODE_NOTE ||
                                     cvstate.pair_mode[pair] == CVPROC_MODE_VELO) {
-                                cvproc_mono_handler(pair, &msg);
+                                cvproc_mono_handler(pair, msg);
                             }
                             // CC
                             else {
-                                cvproc_cc_handler(pair, &msg);                            
+                                cvproc_cc_handler(pair, msg);                            
                             }
                     }
                     break;
@@ -165,11 +165,11 @@ void cvproc_timer_task(void) {
                             // note / velocity
                             if(cvstate.pair_mode[pair] == CVPROC_MODE_NOTE ||
                                     cvstate.pair_mode[pair] == CVPROC_MODE_VELO) {
-                                cvproc_poly_handler(pair, &msg);
+                                cvproc_poly_handler(pair, msg);
                             }
                             // CC
                             else {
-                                cvproc_cc_handler(pair, &msg);                            
+                                cvproc_cc_handler(pair, msg);                            
                             }
                             break;
                     }
@@ -181,15 +181,16 @@ void cvproc_timer_task(void) {
                     // note / velocity
                     if(cvstate.pair_mode[pair] == CVPROC_MODE_NOTE ||
                             cvstate.pair_mode[pair] == CVPROC_MODE_VELO) {
-                        cvproc_poly_handler(0, &msg);
+                        cvproc_poly_handler(0, msg);
                     }
                     // CC
                     else {
-                        cvproc_cc_handler(pair, &msg);                    
+                        cvproc_cc_handler(pair, msg);                    
                     }
                     break;
             }
         }
+        midi_stream_consume(MIDI_PORT_CV_OUT, num);
     }
 }
 
@@ -24,34 +24,83 @@
  *  - PA1       - MIDI RX1                  - UART4 RX
  *  - PA2       - MIDI TX2                  - USART2 TX
  *
+ * DIN1 RX runs into a circular DMA buffer. Bytes are parsed as soon as the
+ * line goes idle or the DMA reaches the half or end of the buffer, and each
+ * message is stamped with the clock timer time its first byte arrived.
+ * Bytes between interrupts always arrive back to back since any gap in the
+ * input causes an idle interrupt, so the byte times are worked back from
+ * the time of the interrupt.
+ *
+ * Messages are still handled (performance, recording and thru to the track
+ * outputs) by the 1ms task since that touches song and output state owned
+ * by the task. Thru latency still includes up to one task period.
+ *
  */
 #include "din_midi.h"
+#include "clock_timer.h"
 #include "config.h"
 #include "debug.h"
 #include "stm32f4xx_hal.h"
 #include "midi/midi_stream.h"
 #include <inttypes.h>
 #include "util/log.h"
+#include "util/time_utils.h"
 
 // FIFOs for use with DMA
-#define DIN_MIDI_TX_BUFSIZE 16
+#define DIN_MIDI_TX_BUFSIZE 16  // size of each TX ping-pong buffer
 #define DIN_MIDI_RX_BUFSIZE 16
 #define DIN_MIDI_RX_BUFMASK (DIN_MIDI_RX_BUFSIZE - 1)
-uint8_t din_midi_tx1_buf[DIN_MIDI_TX_BUFSIZE];
+#define DIN_MIDI_BYTE_TIME 320  // us per byte at 31250 baud
+#define DIN_MIDI_NUM_TX 2
+
+// TX port state
+// the DMA sends one buffer while the other is filled for the next transfer
+// only the task reads the stream and fills buffers - the transfer complete
+// callback starts the buffer waiting behind it or lets the port go idle
+struct din_midi_tx_port {
+    UART_HandleTypeDef *handle;  // UART to send on
+    int port;  // MIDI stream port
+    uint8_t buf[2][DIN_MIDI_TX_BUFSIZE];  // ping-pong buffers
+    volatile int count[2];  // bytes in each buffer - set once the buffer is filled
+    volatile int fill;  // buffer to send next
+    volatile int busy;  // a transfer is running
+    uint8_t running_status;  // last channel status sent - 0 = none
+    btime running_status_time;  // time the status was last sent
+    // stats
+    uint32_t msgs;  // messages sent
+    uint32_t bytes;  // bytes sent
+    uint32_t bytes_saved;  // status bytes left out by running status
+    uint32_t errors;  // transfers that could not be started
+    int waiting;  // the stream has been waiting since wait_time
+    btime wait_time;  // time the stream started waiting
+    uint32_t latency_max;  // max stream wait time
+    uint32_t latency_sum;  // total stream wait time
+    uint32_t latency_count;  // number of waits
+};
+struct din_midi_tx_port din_midi_tx[DIN_MIDI_NUM_TX];
+btime din_midi_stats_time;  // time the stats were reset
 uint8_t din_midi_rx1_buf[DIN_MIDI_RX_BUFSIZE];
-uint8_t din_midi_tx2_buf[DIN_MIDI_TX_BUFSIZE];
 int din_midi_rx_inp;
 int din_midi_rx_outp;
-int din_midi_tx1_done;
-int din_midi_tx2_done;
+uint32_t din_midi_rx_time;  // time of the last byte received
 UART_HandleTypeDef din_midi1_handle;  // DIN1 RX and TX - UART4
 UART_HandleTypeDef din_midi2_handle;  // DIN2 TX - USART2
 DMA_HandleTypeDef din_midi1_dma_rx_handle;  // DMA handle for DIN1 RX
 DMA_HandleTypeDef din_midi1_dma_tx_handle;  // DMA handle for DIN1 TX
 DMA_HandleTypeDef din_midi2_dma_tx_handle;  // DMA handle for DIN2 TX
 
+// local functions
+void din_midi_rx_bytes(uint32_t end_time);
+int din_midi_tx_next(struct din_midi_tx_port *tx);
+void din_midi_tx_fill_next(struct din_midi_tx_port *tx);
+int din_midi_tx_fill(struct din_midi_tx_port *tx, int bufnum);
+int din_midi_tx_encode(struct din_midi_tx_port *tx, struct midi_msg *msg,
+    uint8_t *buf, btime now);
+
 // init the DIN MIDI
 void din_midi_init(void) {
+    int i;
+
     // setup DIN RX1 and TX1
     din_midi1_handle.Instance          = UART4;
     din_midi1_handle.Init.BaudRate     = 31250;
@@ -77,96 +126,169 @@ void din_midi_init(void) {
     // reset the buffer pointers
     din_midi_rx_inp = 0;
     din_midi_rx_outp = 0;
-    din_midi_tx1_done = 1;  // start with done transfer
-    din_midi_tx2_done = 1;  // start with done transfer
+    din_midi_rx_time = 0;
+    for(i = 0; i < DIN_MIDI_NUM_TX; i ++) {
+        din_midi_tx[i].count[0] = 0;
+        din_midi_tx[i].count[1] = 0;
+        din_midi_tx[i].fill = 0;
+        din_midi_tx[i].busy = 0;
+        din_midi_tx[i].running_status = 0;
+    }
+    din_midi_tx[0].handle = &din_midi1_handle;
+    din_midi_tx[0].port = MIDI_PORT_DIN1_OUT;
+    din_midi_tx[1].handle = &din_midi2_handle;
+    din_midi_tx[1].port = MIDI_PORT_DIN2_OUT;
+    din_midi_reset_tx_stats();
     
     // start the first DMA RX transfer
     if(HAL_UART_Receive_DMA(&din_midi1_handle, (uint8_t *)din_midi_rx1_buf, 
             DIN_MIDI_RX_BUFSIZE) != HAL_OK) {
         // XXX handle error
-    }    
+    }
+    // the half and full transfer interrupts are enabled by the HAL
+    __HAL_UART_ENABLE_IT(&din_midi1_handle, UART_IT_IDLE);
 }
 
 // run the DIN MIDI timer task
 void din_midi_timer_task(void) {
-    int count;
-    struct midi_msg msg;
-   
-    // DIN1 TX
-    if(midi_stream_data_available(MIDI_PORT_DIN1_OUT) && din_midi_tx1_done) {
-        count = 0;
-        while(midi_stream_data_available(MIDI_PORT_DIN1_OUT) && 
-                count < (DIN_MIDI_TX_BUFSIZE - 2)) {
-            midi_stream_receive_msg(MIDI_PORT_DIN1_OUT, &msg);
-            switch(msg.len) {
-                case 1:
-                    din_midi_tx1_buf[count++] = msg.status;
-                    break;
-                case 2:
-                    din_midi_tx1_buf[count++] = msg.status;
-                    din_midi_tx1_buf[count++] = msg.data0;
-                    break;
-                case 3:
-                    din_midi_tx1_buf[count++] = msg.status;
-                    din_midi_tx1_buf[count++] = msg.data0;
-                    din_midi_tx1_buf[count++] = msg.data1;
-                    break;
-            }            
+    din_midi_tx_task();
+}
+
+// send queued DIN MIDI TX messages if the ports are idle
+void din_midi_tx_task(void) {
+    struct din_midi_tx_port *tx;
+    btime now = time_utils_get_btime();
+    uint32_t wait;
+    int i;
+    for(i = 0; i < DIN_MIDI_NUM_TX; i ++) {
+        tx = &din_midi_tx[i];
+        din_midi_tx_fill_next(tx);
+        // start sending - the callback takes over while buffers are filled
+        if(!tx->busy) {
+            tx->busy = 1;
+            if(din_midi_tx_next(tx) == -1) {
+                tx->busy = 0;
+            }
+            else {
+                din_midi_tx_fill_next(tx);  // fill behind the transfer
+            }
         }
-        if(count > 0) {
-            din_midi_tx1_done = 0;
-            HAL_UART_Transmit_DMA(&din_midi1_handle, (uint8_t *)din_midi_tx1_buf, count);
+        // measure how long the stream waits for the port
+        if(midi_stream_data_available(tx->port)) {
+            if(!tx->waiting) {
+                tx->waiting = 1;
+                tx->wait_time = now;
+            }
+        }
+        else if(tx->waiting) {
+            tx->waiting = 0;
+            wait = now - tx->wait_time;
+            if(wait > tx->latency_max) {
+                tx->latency_max = wait;
+            }
+            tx->latency_sum += wait;
+            tx->latency_count ++;
         }
     }
+}
 
-    // DIN2 TX
-    if(midi_stream_data_available(MIDI_PORT_DIN2_OUT) && din_midi_tx2_done) {
-        count = 0;
-        while(midi_stream_data_available(MIDI_PORT_DIN2_OUT) && 
-                count < (DIN_MIDI_TX_BUFSIZE - 2)) {
-            midi_stream_receive_msg(MIDI_PORT_DIN2_OUT, &msg);
-            switch(msg.len) {
-                case 1:
-                    din_midi_tx2_buf[count++] = msg.status;
-                    break;
-                case 2:
-                    din_midi_tx2_buf[count++] = msg.status;
-                    din_midi_tx2_buf[count++] = msg.data0;
-                    break;
-                case 3:
-                    din_midi_tx2_buf[count++] = msg.status;
-                    din_midi_tx2_buf[count++] = msg.data0;
-                    din_midi_tx2_buf[count++] = msg.data1;
-                    break;
-            }            
-        }
-        if(count > 0) {
-            din_midi_tx2_done = 0;
-            HAL_UART_Transmit_DMA(&din_midi2_handle, (uint8_t *)din_midi_tx2_buf, count);
-        }
+// get the TX stats for a DIN MIDI output port
+// returns -1 if the port is invalid
+int din_midi_get_tx_stats(int port, struct din_midi_tx_stats *stats) {
+    struct din_midi_tx_port *tx;
+    int32_t elapsed;
+    if(port == MIDI_PORT_DIN1_OUT) {
+        tx = &din_midi_tx[0];
+    }
+    else if(port == MIDI_PORT_DIN2_OUT) {
+        tx = &din_midi_tx[1];
+    }
+    else {
+        log_error("dgts - port invalid: %d", port);
+        return -1;
+    }
+    stats->msgs = tx->msgs;
+    stats->bytes = tx->bytes;
+    stats->bytes_saved = tx->bytes_saved;
+    stats->errors = tx->errors;
+    elapsed = time_utils_get_btime() - din_midi_stats_time;
+    if(elapsed > 0) {
+        stats->bytes_per_sec = ((uint64_t)tx->bytes * 1000000) / elapsed;
     }
+    else {
+        stats->bytes_per_sec = 0;
+    }
+    stats->latency_max = tx->latency_max;
+    if(tx->latency_count) {
+        stats->latency_avg = tx->latency_sum / tx->latency_count;
+    }
+    else {
+        stats->latency_avg = 0;
+    }
+    return 0;
+}
 
-    // DIN1 RX
-    din_midi_rx_inp = DIN_MIDI_RX_BUFSIZE - __HAL_DMA_GET_COUNTER(&din_midi1_dma_rx_handle);
-    while(din_midi_rx_inp != din_midi_rx_outp) {
-        midi_stream_send_byte(MIDI_PORT_DIN1_IN, din_midi_rx1_buf[din_midi_rx_outp]);
-        din_midi_rx_outp = (din_midi_rx_outp + 1) & DIN_MIDI_RX_BUFMASK;
+// reset the TX stats
+void din_midi_reset_tx_stats(void) {
+    int i;
+    for(i = 0; i < DIN_MIDI_NUM_TX; i ++) {
+        din_midi_tx[i].msgs = 0;
+        din_midi_tx[i].bytes = 0;
+        din_midi_tx[i].bytes_saved = 0;
+        din_midi_tx[i].errors = 0;
+        din_midi_tx[i].waiting = 0;
+        din_midi_tx[i].latency_max = 0;
+        din_midi_tx[i].latency_sum = 0;
+        din_midi_tx[i].latency_count = 0;
+    }
+    din_midi_stats_time = time_utils_get_btime();
+}
+
+// handle the DIN1 UART idle interrupt - called from the UART IRQ handler
+// the idle flag is set one byte time after the last byte ended
+void din_midi_rx_idle_irq(void) {
+    if(!__HAL_UART_GET_IT_SOURCE(&din_midi1_handle, UART_IT_IDLE) ||
+            !__HAL_UART_GET_FLAG(&din_midi1_handle, UART_FLAG_IDLE)) {
+        return;
     }
+    __HAL_UART_CLEAR_IDLEFLAG(&din_midi1_handle);
+    din_midi_rx_bytes(clock_timer_get_time() - DIN_MIDI_BYTE_TIME);
 }
 
 //
 // callbacks
 //
 // the UART transfer is complete
+// start the buffer that was filled behind it - the task fills the next one
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart){
+    struct din_midi_tx_port *tx;
     if(huart == &din_midi1_handle) {
-        din_midi_tx1_done = 1;
-        return;
+        tx = &din_midi_tx[0];
+    }
+    else if(huart == &din_midi2_handle) {
+        tx = &din_midi_tx[1];
     }
-    if(huart == &din_midi2_handle) {
-        din_midi_tx2_done = 1;    
+    else {
         return;
     }
+    // the port goes idle if there is nothing more to send
+    if(din_midi_tx_next(tx) == -1) {
+        tx->busy = 0;
+    }
+}
+
+// the UART RX DMA reached the half of the buffer
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart) {
+    if(huart == &din_midi1_handle) {
+        din_midi_rx_bytes(clock_timer_get_time());
+    }
+}
+
+// the UART RX DMA reached the end of the buffer - it wraps around
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
+    if(huart == &din_midi1_handle) {
+        din_midi_rx_bytes(clock_timer_get_time());
+    }
 }
 
 // init the UART
@@ -283,3 +405,130 @@ void HAL_UART_MspInit(UART_HandleTypeDef *huart) {
     }
 }
 
+//
+// local functions
+//
+// parse the bytes received into the DIN1 RX DMA buffer since the last call
+// the bytes arrived back to back with the last one ending at end_time
+// called from the idle, half and full transfer interrupts which all run at
+// the same priority so only one runs at a time
+void din_midi_rx_bytes(uint32_t end_time) {
+    uint32_t time;
+    int len;
+    din_midi_rx_inp = (DIN_MIDI_RX_BUFSIZE -
+        __HAL_DMA_GET_COUNTER(&din_midi1_dma_rx_handle)) & DIN_MIDI_RX_BUFMASK;
+    len = (din_midi_rx_inp - din_midi_rx_outp) & DIN_MIDI_RX_BUFMASK;
+    if(len == 0) {
+        return;
+    }
+    // work back to the first byte - interrupt latency can't make it seem
+    // to have arrived before the last byte of the previous batch
+    time = end_time - ((len - 1) * DIN_MIDI_BYTE_TIME);
+    if((uint32_t)(din_midi_rx_time + DIN_MIDI_BYTE_TIME - time) <
+            (DIN_MIDI_RX_BUFSIZE * DIN_MIDI_BYTE_TIME)) {
+        time = din_midi_rx_time + DIN_MIDI_BYTE_TIME;
+    }
+    din_midi_rx_time = time + ((len - 1) * DIN_MIDI_BYTE_TIME);
+    // send the DMA buffer in up to 2 contiguous parts
+    if(din_midi_rx_inp < din_midi_rx_outp) {
+        midi_stream_send_timed_bytes(MIDI_PORT_DIN1_IN,
+            &din_midi_rx1_buf[din_midi_rx_outp], DIN_MIDI_RX_BUFSIZE - din_midi_rx_outp,
+            time, DIN_MIDI_BYTE_TIME);
+        time += (DIN_MIDI_RX_BUFSIZE - din_midi_rx_outp) * DIN_MIDI_BYTE_TIME;
+        din_midi_rx_outp = 0;
+    }
+    if(din_midi_rx_inp > din_midi_rx_outp) {
+        midi_stream_send_timed_bytes(MIDI_PORT_DIN1_IN,
+            &din_midi_rx1_buf[din_midi_rx_outp], din_midi_rx_inp - din_midi_rx_outp,
+            time, DIN_MIDI_BYTE_TIME);
+        din_midi_rx_outp = din_midi_rx_inp;
+    }
+}
+
+// start sending the buffer that was filled next
+// only called by the task when the port is idle or by the callback
+// returns -1 if there was nothing to send or the transfer could not start
+// - the buffer is kept so the next task tries it again
+int din_midi_tx_next(struct din_midi_tx_port *tx) {
+    int send = tx->fill;
+    if(tx->count[send] == 0) {
+        return -1;
+    }
+    if(HAL_UART_Transmit_DMA(tx->handle, tx->buf[send], tx->count[send]) != HAL_OK) {
+        tx->errors ++;
+        return -1;
+    }
+    tx->fill ^= 1;
+    tx->count[send] = 0;
+    return 0;
+}
+
+// fill the buffer that is sent next if it is empty - only called by the task
+// - the callback only starts the buffer once its count is set so it never
+//   reads the stream or a buffer that is being filled
+void din_midi_tx_fill_next(struct din_midi_tx_port *tx) {
+    int fill = tx->fill;
+    if(tx->count[fill] == 0) {
+        din_midi_tx_fill(tx, fill);
+    }
+}
+
+// fill a TX buffer from the stream
+// returns the number of bytes in the buffer
+int din_midi_tx_fill(struct din_midi_tx_port *tx, int bufnum) {
+    struct midi_msg *msgs;
+    btime now = time_utils_get_btime();
+    int count = 0, i, num;
+    while(count < (DIN_MIDI_TX_BUFSIZE - 2) &&
+            (num = midi_stream_peek(tx->port, &msgs)) > 0) {
+        for(i = 0; i < num && count < (DIN_MIDI_TX_BUFSIZE - 2); i ++) {
+            count += din_midi_tx_encode(tx, &msgs[i], &tx->buf[bufnum][count], now);
+        }
+        midi_stream_consume(tx->port, i);
+    }
+    tx->count[bufnum] = count;
+    tx->bytes += count;
+    return count;
+}
+
+// encode a message into a TX buffer
+// returns the number of bytes added
+int din_midi_tx_encode(struct din_midi_tx_port *tx, struct midi_msg *msg,
+        uint8_t *buf, btime now) {
+    int count = 0;
+    if(msg->len < 1 || msg->len > 3) {
+        return 0;
+    }
+#ifdef DIN_MIDI_RUNNING_STATUS
+    // channel messages leave out the status if it has not changed
+    // the status is sent again every so often in case a receiver missed it
+    if(msg->status >= 0x80 && msg->status < 0xf0) {
+        if(msg->status == tx->running_status &&
+                (now - tx->running_status_time) < DIN_MIDI_RUNNING_STATUS_REFRESH) {
+            tx->bytes_saved ++;
+        }
+        else {
+            buf[count++] = msg->status;
+            tx->running_status = msg->status;
+            tx->running_status_time = now;
+        }
+    }
+    else {
+        // system common and SYSEX cancel running status - realtime does not
+        if(msg->status >= 0xf0 && msg->status < 0xf8) {
+            tx->running_status = 0;
+        }
+        buf[count++] = msg->status;
+    }
+#else
+    buf[count++] = msg->status;
+#endif
+    if(msg->len > 1) {
+        buf[count++] = msg->data0;
+    }
+    if(msg->len > 2) {
+        buf[count++] = msg->data1;
+    }
+    tx->msgs ++;
+    return count;
+}
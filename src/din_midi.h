@@ -23,11 +23,38 @@
 #ifndef DIN_MIDI_H
 #define DIN_MIDI_H
 
+#include <inttypes.h>
+
+// DIN MIDI TX stats
+struct din_midi_tx_stats {
+    uint32_t msgs;  // messages sent
+    uint32_t bytes;  // bytes sent
+    uint32_t bytes_saved;  // status bytes left out by running status
+    uint32_t errors;  // transfers that could not be started
+    uint32_t bytes_per_sec;  // average rate since the stats were reset
+    uint32_t latency_max;  // max time the stream waited to be sent - us
+    uint32_t latency_avg;  // average time the stream waited to be sent - us
+};
+
 // init the DIN MIDI
 void din_midi_init(void);
 
 // run the DIN MIDI timer task
 void din_midi_timer_task(void);
 
+// handle the DIN1 UART idle interrupt - called from the UART IRQ handler
+void din_midi_rx_idle_irq(void);
+
+// send queued DIN MIDI TX messages if the previous transfers are done
+// this is also called after clock ticks to send notes out without waiting
+void din_midi_tx_task(void);
+
+// get the TX stats for a DIN MIDI output port
+// returns -1 if the port is invalid
+int din_midi_get_tx_stats(int port, struct din_midi_tx_stats *stats);
+
+// reset the TX stats
+void din_midi_reset_tx_stats(void);
+
 #endif
 
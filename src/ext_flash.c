@@ -22,6 +22,7 @@
  */
 #include "ext_flash.h"
 #include "util/log.h"
+#include "util/rt_prof.h"
 #include <string.h>
 
 //
@@ -31,15 +32,18 @@
 #define EXT_FLASH_SUBSTATE_LOAD_IDLE 0
 #define EXT_FLASH_SUBSTATE_LOAD_READ_START 1
 #define EXT_FLASH_SUBSTATE_LOAD_READ_DONE 2
+#define EXT_FLASH_SUBSTATE_LOAD_FAST_READ_DONE 3
 #define EXT_FLASH_SUBSTATE_SAVE_IDLE 0
 #define EXT_FLASH_SUBSTATE_SAVE_ERASE_WE_START 1
 #define EXT_FLASH_SUBSTATE_SAVE_ERASE_START 2
-#define EXT_FLASH_SUBSTATE_SAVE_ERASE_BUSY_CHECK_START 3
-#define EXT_FLASH_SUBSTATE_SAVE_ERASE_BUSY_CHECK_DONE 4
-#define EXT_FLASH_SUBSTATE_SAVE_WRITE_EN_START 5
-#define EXT_FLASH_SUBSTATE_SAVE_WRITE_START 6
-#define EXT_FLASH_SUBSTATE_SAVE_WRITE_BUSY_CHECK_START 7
-#define EXT_FLASH_SUBSTATE_SAVE_WRITE_BUSY_CHECK_DONE 8
+#define EXT_FLASH_SUBSTATE_SAVE_ERASE_SENT 3
+#define EXT_FLASH_SUBSTATE_SAVE_ERASE_BUSY_WAIT 4
+#define EXT_FLASH_SUBSTATE_SAVE_ERASE_BUSY_CHECK_DONE 5
+#define EXT_FLASH_SUBSTATE_SAVE_WRITE_EN_START 6
+#define EXT_FLASH_SUBSTATE_SAVE_WRITE_START 7
+#define EXT_FLASH_SUBSTATE_SAVE_WRITE_SENT 8
+#define EXT_FLASH_SUBSTATE_SAVE_WRITE_BUSY_WAIT 9
+#define EXT_FLASH_SUBSTATE_SAVE_WRITE_BUSY_CHECK_DONE 10
 
 struct ext_flash_state {
     int state;  // I/O state - are we loading, saving, etc.?
@@ -49,20 +53,141 @@ struct ext_flash_state {
     int32_t addrp;  // address counter
     int32_t last_io_len;  // length of the last I/O
     uint8_t *iop;  // pointer to the buffer to load or save
+    volatile int running;  // 1 = the state machine is being run
+    volatile int poll;  // 1 = the timer task allows a busy flag check
+    uint32_t start_time;  // rt_prof count when the load or save started
+    uint32_t phase_time;  // rt_prof count when the save erase or program started
+    int32_t last_time;  // time of the last completed load or save in us
+    struct ext_flash_save_timing save_timing;  // timing of the last save
 };
 struct ext_flash_state extfs;
 
 // local functions
+void ext_flash_run(void);
+int ext_flash_step(void);
+void ext_flash_stage_page(void);
 int32_t ext_flash_get_remain_io_bytes(void);
+int32_t ext_flash_end_phase(void);
+void ext_flash_finish(int state);
 
 // init external flash
 void ext_flash_init(void) {
     spi_flash_init();
+    spi_flash_set_done_cb(ext_flash_run);
     extfs.state = EXT_FLASH_STATE_IDLE;
+    extfs.running = 0;
 }
 
 // run the external flash timer task to handle data transfer
+// transfers are chained from the SPI transfer complete interrupt so
+// this starts new loads and saves and polls the busy flag during saves
 void ext_flash_timer_task(void) {
+    extfs.poll = 1;
+    ext_flash_run();
+}
+
+// get the state of the external flash
+// if we are in an error state the error will be cleared to IDLE after read
+int ext_flash_get_state(void) {
+    int state = extfs.state;
+    switch(state) {
+        case EXT_FLASH_STATE_LOAD_ERROR:
+        case EXT_FLASH_STATE_LOAD_DONE:
+        case EXT_FLASH_STATE_SAVE_ERROR:
+        case EXT_FLASH_STATE_SAVE_DONE:
+            extfs.state = EXT_FLASH_STATE_IDLE;
+            break;
+        default:
+            // no action
+            break;
+    }
+    return state;
+}
+
+// start load from external flash - return -1 in case of error
+int ext_flash_load(int32_t addr, int len, uint8_t *loadp) {
+    // can't load if we're busy
+    if(extfs.state != EXT_FLASH_STATE_IDLE) {
+        return -1;
+    }
+    extfs.flash_addr = addr;
+    extfs.addrp = addr;
+    extfs.rw_len = len;
+    extfs.iop = loadp;
+    extfs.state = EXT_FLASH_STATE_LOAD;
+    extfs.substate = EXT_FLASH_SUBSTATE_LOAD_IDLE;
+    extfs.start_time = rt_prof_start();
+    return 0;
+}
+
+// start save to external flash - return -1 in case of error
+int ext_flash_save(int32_t addr, int len, uint8_t *savep) {
+    // can't save if we're busy
+    if(extfs.state != EXT_FLASH_STATE_IDLE) {
+        return -1;
+    }
+    extfs.flash_addr = addr;
+    extfs.addrp = addr;
+    extfs.rw_len = len;
+    extfs.iop = savep;
+    extfs.state = EXT_FLASH_STATE_SAVE;
+    extfs.substate = EXT_FLASH_SUBSTATE_SAVE_IDLE;
+    extfs.start_time = rt_prof_start();
+    return 0;
+}
+
+// start save to external flash without performing a sector erase first
+// returns -1 in case of error
+int ext_flash_save_noerase(int32_t addr, int len, uint8_t *savep) {
+    // can't save if we're busy
+    if(extfs.state != EXT_FLASH_STATE_IDLE) {
+        return -1;
+    }
+    extfs.flash_addr = addr;
+    extfs.addrp = addr;
+    extfs.rw_len = len;
+    extfs.iop = savep;
+    extfs.state = EXT_FLASH_STATE_SAVE_NOERASE;
+    extfs.substate = EXT_FLASH_SUBSTATE_SAVE_IDLE;
+    extfs.start_time = rt_prof_start();
+    return 0;
+}
+
+// get the size of the external flash
+int32_t ext_flash_get_mem_size(void) {
+    return SPI_FLASH_MEMORY_SIZE;
+}
+
+// get the time taken by the last completed load or save in us
+int32_t ext_flash_get_last_time(void) {
+    return extfs.last_time;
+}
+
+// get the erase, program and total time of the last completed save
+void ext_flash_get_save_timing(struct ext_flash_save_timing *timing) {
+    *timing = extfs.save_timing;
+}
+
+//
+// local functions
+//
+// run the state machine until it has to wait for the flash
+// this runs from the timer task and the SPI transfer complete interrupt
+void ext_flash_run(void) {
+    // the timer task can interrupt a run from the SPI interrupt
+    if(extfs.running) {
+        return;
+    }
+    extfs.running = 1;
+    while(ext_flash_step()) {
+        // keep going until we need to wait
+    }
+    extfs.running = 0;
+}
+
+// run one step of loading or saving
+// returns 1 if the step is done or 0 if we need to wait
+int ext_flash_step(void) {
     uint8_t buf[SPI_FLASH_PAGE_SIZE];
     int ret;
 
@@ -72,15 +197,44 @@ void ext_flash_timer_task(void) {
                 case EXT_FLASH_SUBSTATE_LOAD_IDLE:
                     // make sure the flash is ready
                     if(spi_flash_get_state() != SPI_FLASH_STATE_IDLE) {
-                        log_error("eftt - load idle flash busy");
-                        return;
+                        log_error("efs - load idle flash busy");
+                        return 0;
+                    }
+                    // read everything with one command if DMA can reach the buffer
+                    ret = spi_flash_start_fast_read(extfs.addrp, extfs.iop,
+                        extfs.rw_len);
+                    if(ret == SPI_FLASH_ERROR_OK) {
+                        extfs.substate = EXT_FLASH_SUBSTATE_LOAD_FAST_READ_DONE;
+                        return 1;
+                    }
+                    if(ret != SPI_FLASH_ERROR_INVALID_PARAMS) {
+                        log_error("efs - load flash fast read error: %d", ret);
+                        extfs.state = EXT_FLASH_STATE_LOAD_ERROR;  // cancel
+                        return 0;
                     }
+                    // otherwise read a page at a time
                     extfs.substate = EXT_FLASH_SUBSTATE_LOAD_READ_START;
-                    break;
+                    return 1;
+                case EXT_FLASH_SUBSTATE_LOAD_FAST_READ_DONE:
+                    // make sure the whole read is done
+                    if(spi_flash_get_state() != SPI_FLASH_STATE_FAST_READ_MEM_DONE) {
+                        return 0;
+                    }
+                    // data is already in the buffer - this just clears the state
+                    ret = spi_flash_get_result(NULL);
+                    if(ret != extfs.rw_len) {
+                        log_error("efs - load flash fast read result error: %d", ret);
+                        extfs.state = EXT_FLASH_STATE_LOAD_ERROR;  // cancel
+                        return 0;
+                    }
+                    extfs.addrp += extfs.rw_len;
+                    extfs.iop += extfs.rw_len;
+                    ext_flash_finish(EXT_FLASH_STATE_LOAD_DONE);
+                    return 0;
                 case EXT_FLASH_SUBSTATE_LOAD_READ_START:
                     // make sure the flash is ready
                     if(spi_flash_get_state() != SPI_FLASH_STATE_IDLE) {
-                        return;
+                        return 0;
                     }
                     // should we read a full page or less than?
                     if(ext_flash_get_remain_io_bytes() >= SPI_FLASH_PAGE_SIZE) {
@@ -93,23 +247,23 @@ void ext_flash_timer_task(void) {
                     ret = spi_flash_start_cmd(SPI_FLASH_CMD_READ_MEM, 
                         extfs.addrp, NULL, extfs.last_io_len);
                     if(ret != SPI_FLASH_ERROR_OK) {
-                        log_error("eftt - load flash read error: %d", ret);
+                        log_error("efs - load flash read error: %d", ret);
                         extfs.state = EXT_FLASH_STATE_LOAD_ERROR;  // cancel
-                        return;                 
+                        return 0;
                     }
                     extfs.substate = EXT_FLASH_SUBSTATE_LOAD_READ_DONE;                
-                    break;
+                    return 1;
                 case EXT_FLASH_SUBSTATE_LOAD_READ_DONE:
                     // make sure the flash is ready to read the result
                     if(spi_flash_get_state() != SPI_FLASH_STATE_READ_MEM_DONE) {
-                        return;
+                        return 0;
                     }
                     // read the data out of the result
                     ret = spi_flash_get_result(buf);
                     if(ret == -1) {
-                        log_error("eftt - load flash get result error: %d", ret);
+                        log_error("efs - load flash get result error: %d", ret);
                         extfs.state = EXT_FLASH_STATE_LOAD_ERROR;  // cancel
-                        return;
+                        return 0;
                     }
                     // copy data into the song
                     memcpy(extfs.iop, buf, extfs.last_io_len);
@@ -118,9 +272,10 @@ void ext_flash_timer_task(void) {
                     extfs.substate = EXT_FLASH_SUBSTATE_LOAD_READ_START;
                     // load is complete - we read enough data
                     if(ext_flash_get_remain_io_bytes() <= 0) {
-                        extfs.state = EXT_FLASH_STATE_LOAD_DONE;
+                        ext_flash_finish(EXT_FLASH_STATE_LOAD_DONE);
+                        return 0;
                     }
-                    break;
+                    return 1;
             }
             break;
         case EXT_FLASH_STATE_SAVE:
@@ -129,9 +284,14 @@ void ext_flash_timer_task(void) {
                 case EXT_FLASH_SUBSTATE_SAVE_IDLE:
                     // make sure the flash is ready
                     if(spi_flash_get_state() != SPI_FLASH_STATE_IDLE) {
-                        log_error("eftt - save idle flash busy");
-                        return;
-                    }
+                        log_error("efs - save idle flash busy");
+                        return 0;
+                    }
+                    extfs.phase_time = rt_prof_start();
+                    extfs.save_timing.erase_time = 0;
+                    extfs.save_timing.program_time = 0;
+                    // the first page is copied while we erase
+                    ext_flash_stage_page();
                     // if we're saving normally we need to erase first
                     if(extfs.state == EXT_FLASH_STATE_SAVE) {
                         extfs.substate = EXT_FLASH_SUBSTATE_SAVE_ERASE_WE_START;
@@ -140,276 +300,245 @@ void ext_flash_timer_task(void) {
                     else {
                         extfs.substate = EXT_FLASH_SUBSTATE_SAVE_WRITE_EN_START;
                     }
-                    break;
+                    return 1;
                 case EXT_FLASH_SUBSTATE_SAVE_ERASE_WE_START:
                     // make sure the flash is ready
                     if(spi_flash_get_state() != SPI_FLASH_STATE_IDLE) {
-                        return;
+                        return 0;
                     }
                     // start the write enable process
                     ret = spi_flash_start_cmd(SPI_FLASH_CMD_WRITE_ENABLE,
                         0, NULL, 0);
                     if(ret != SPI_FLASH_ERROR_OK) {
-                        log_error("eftt - save flash we start error: %d", ret);
+                        log_error("efs - save flash we start error: %d", ret);
                         extfs.state = EXT_FLASH_STATE_SAVE_ERROR;  // cancel
-                        return;                 
+                        return 0;
                     }
                     extfs.substate = EXT_FLASH_SUBSTATE_SAVE_ERASE_START;
-                    break;
+                    return 1;
                 case EXT_FLASH_SUBSTATE_SAVE_ERASE_START:
                     // make sure the flash is done write enabling
                     if(spi_flash_get_state() != SPI_FLASH_STATE_WRITE_ENABLE_DONE) {
-                        return;
+                        return 0;
                     }
                     // read result to clear state
                     ret = spi_flash_get_result(buf);
                     if(ret == -1) {
-                        log_error("eftt - save flash erase start error: %d", ret);
+                        log_error("efs - save flash erase start error: %d", ret);
                         extfs.state = EXT_FLASH_STATE_SAVE_ERROR;  // cancel
-                        return;
+                        return 0;
                     }
                     // start the sector erase process
                     ret = spi_flash_start_cmd(SPI_FLASH_CMD_ERASE_MEM,
                         extfs.addrp, NULL, 0);
                     if(ret != SPI_FLASH_ERROR_OK) {
-                        log_error("eftt - save flash erase error: %d", ret);
+                        log_error("efs - save flash erase error: %d", ret);
                         extfs.state = EXT_FLASH_STATE_SAVE_ERROR;  // cancel
-                        return;                 
-                    }
-                    extfs.substate = EXT_FLASH_SUBSTATE_SAVE_ERASE_BUSY_CHECK_START;    
-                    break;
-                case EXT_FLASH_SUBSTATE_SAVE_ERASE_BUSY_CHECK_START:
-                    // make sure the flash is done erasing or is idle (retry busy check)
-                    // this just means the command is sent
-                    if(spi_flash_get_state() != SPI_FLASH_STATE_ERASE_MEM_DONE &&
-                            spi_flash_get_state() != SPI_FLASH_STATE_IDLE) {
-                        return;
+                        return 0;
+                    }
+                    extfs.substate = EXT_FLASH_SUBSTATE_SAVE_ERASE_SENT;
+                    return 1;
+                case EXT_FLASH_SUBSTATE_SAVE_ERASE_SENT:
+                    // make sure the erase command is sent
+                    if(spi_flash_get_state() != SPI_FLASH_STATE_ERASE_MEM_DONE) {
+                        return 0;
                     }
                     // read result to clear state
                     ret = spi_flash_get_result(buf);
                     if(ret == -1) {
-                        log_error("eftt - save flash erase busy check start error: %d", ret);
+                        log_error("efs - save flash erase sent error: %d", ret);
                         extfs.state = EXT_FLASH_STATE_SAVE_ERROR;  // cancel
-                        return;
+                        return 0;
+                    }
+                    // the erase takes many ms so wait for the timer to check
+                    extfs.poll = 0;
+                    extfs.substate = EXT_FLASH_SUBSTATE_SAVE_ERASE_BUSY_WAIT;
+                    return 1;
+                case EXT_FLASH_SUBSTATE_SAVE_ERASE_BUSY_WAIT:
+                    // wait for the timer task and make sure the flash is ready
+                    if(!extfs.poll ||
+                            spi_flash_get_state() != SPI_FLASH_STATE_IDLE) {
+                        return 0;
                     }
+                    extfs.poll = 0;
                     // get the busy flag - read the status register
                     ret = spi_flash_start_cmd(SPI_FLASH_CMD_READ_STATUS_REG, 0, NULL, 0);
                     if(ret != SPI_FLASH_ERROR_OK) {
-                        log_error("eftt - save flash erase busy check error: %d", ret);
+                        log_error("efs - save flash erase busy check error: %d", ret);
                         extfs.state = EXT_FLASH_STATE_SAVE_ERROR;  // cancel
-                        return;                 
+                        return 0;
                     }
                     extfs.substate = EXT_FLASH_SUBSTATE_SAVE_ERASE_BUSY_CHECK_DONE;
-                    break;
+                    return 1;
                 case EXT_FLASH_SUBSTATE_SAVE_ERASE_BUSY_CHECK_DONE:
                     // make sure we got the status register
                     if(spi_flash_get_state() != SPI_FLASH_STATE_READ_STATUS_REG_DONE) {
-                        return;
+                        return 0;
                     }
                     // check the received busy flag
                     ret = spi_flash_get_result(buf);
                     if(ret == -1) {
-                        log_error("eftt - save flash erase busy check result error: %d", ret);
+                        log_error("efs - save flash erase busy check result error: %d", ret);
                         extfs.state = EXT_FLASH_STATE_SAVE_ERROR;  // cancel
-                        return;
+                        return 0;
                     }
-                    // device is busy
+                    // device is busy - check again on the next timer task
                     if((buf[0] & 0x01) == 1) {
-                        // check the status reg again
-                        extfs.substate = EXT_FLASH_SUBSTATE_SAVE_ERASE_BUSY_CHECK_START;
-                    }
-                    // device is done erasing
-                    else {
-                        // move to the next sector
-                        extfs.addrp += SPI_FLASH_SECTOR_SIZE;
-                        extfs.substate = EXT_FLASH_SUBSTATE_SAVE_ERASE_WE_START;
-                        // erasing is done - reset pointers for writing
-                        if(extfs.addrp >= (extfs.flash_addr + extfs.rw_len)) {
-                            extfs.addrp = extfs.flash_addr;
-                            extfs.substate = EXT_FLASH_SUBSTATE_SAVE_WRITE_EN_START;
-                        }
+                        extfs.substate = EXT_FLASH_SUBSTATE_SAVE_ERASE_BUSY_WAIT;
+                        return 1;
+                    }
+                    // device is done erasing - move to the next sector
+                    extfs.addrp += SPI_FLASH_SECTOR_SIZE;
+                    extfs.substate = EXT_FLASH_SUBSTATE_SAVE_ERASE_WE_START;
+                    // erasing is done - reset pointers for writing
+                    if(extfs.addrp >= (extfs.flash_addr + extfs.rw_len)) {
+                        extfs.addrp = extfs.flash_addr;
+                        extfs.save_timing.erase_time = ext_flash_end_phase();
+                        extfs.substate = EXT_FLASH_SUBSTATE_SAVE_WRITE_EN_START;
                     }
-                    break;
+                    return 1;
                 case EXT_FLASH_SUBSTATE_SAVE_WRITE_EN_START:
                     // make sure the flash is ready
                     if(spi_flash_get_state() != SPI_FLASH_STATE_IDLE) {
-                        return;
+                        return 0;
                     }
                     // start the write enable process
                     ret = spi_flash_start_cmd(SPI_FLASH_CMD_WRITE_ENABLE, 
                         extfs.addrp, NULL, 0);
                     if(ret != SPI_FLASH_ERROR_OK) {
-                        log_error("eftt - save flash write we error: %d", ret);
+                        log_error("efs - save flash write we error: %d", ret);
                         extfs.state = EXT_FLASH_STATE_SAVE_ERROR;  // cancel
-                        return;                 
+                        return 0;
                     }
                     extfs.substate = EXT_FLASH_SUBSTATE_SAVE_WRITE_START;
-                    break;
+                    return 1;
                 case EXT_FLASH_SUBSTATE_SAVE_WRITE_START:
                     // make sure the flash is done write enabling
                     if(spi_flash_get_state() != SPI_FLASH_STATE_WRITE_ENABLE_DONE) {
-                        return;
+                        return 0;
                     }
                     // read result to clear state
                     ret = spi_flash_get_result(buf);
                     if(ret == -1) {
-                        log_error("eftt - save flash write we result error: %d", ret);
+                        log_error("efs - save flash write we result error: %d", ret);
                         extfs.state = EXT_FLASH_STATE_SAVE_ERROR;  // cancel
-                        return;
-                    }
-                    // should we write a full page or less than?
-                    if(ext_flash_get_remain_io_bytes() >= SPI_FLASH_PAGE_SIZE) {
-                        extfs.last_io_len = SPI_FLASH_PAGE_SIZE;
+                        return 0;
                     }
-                    else {
-                        extfs.last_io_len = ext_flash_get_remain_io_bytes();
-                    }
-                    // start the write process
+                    // write the page that was already staged
                     ret = spi_flash_start_cmd(SPI_FLASH_CMD_WRITE_MEM,
-                        extfs.addrp, extfs.iop, extfs.last_io_len);
+                        extfs.addrp, NULL, extfs.last_io_len);
                     if(ret != SPI_FLASH_ERROR_OK) {
-                        log_error("eftt - save flash write error: %d", ret);
+                        log_error("efs - save flash write error: %d", ret);
                         extfs.state = EXT_FLASH_STATE_SAVE_ERROR;  // cancel
-                        return;                 
-                    }
-                    extfs.substate = EXT_FLASH_SUBSTATE_SAVE_WRITE_BUSY_CHECK_START;    
-                    break;
-                case EXT_FLASH_SUBSTATE_SAVE_WRITE_BUSY_CHECK_START:
-                    // make sure the flash is done writing or is idle (retry busy check)
-                    // this just means the command is sent
-                    if(spi_flash_get_state() != SPI_FLASH_STATE_WRITE_MEM_DONE &&
-                            spi_flash_get_state() != SPI_FLASH_STATE_IDLE) {
-                        return;
+                        return 0;
+                    }
+                    extfs.substate = EXT_FLASH_SUBSTATE_SAVE_WRITE_SENT;
+                    return 1;
+                case EXT_FLASH_SUBSTATE_SAVE_WRITE_SENT:
+                    // make sure the page is sent
+                    if(spi_flash_get_state() != SPI_FLASH_STATE_WRITE_MEM_DONE) {
+                        return 0;
                     }
                     // read result to clear state
                     ret = spi_flash_get_result(buf);
                     if(ret == -1) {
-                        log_error("eftt - save flash write busy check start error: %d", ret);
+                        log_error("efs - save flash write sent error: %d", ret);
                         extfs.state = EXT_FLASH_STATE_SAVE_ERROR;  // cancel
-                        return;
+                        return 0;
                     }
+                    extfs.addrp += extfs.last_io_len;
+                    extfs.iop += extfs.last_io_len;
+                    // copy the next page while this one is programmed
+                    if(ext_flash_get_remain_io_bytes() > 0) {
+                        ext_flash_stage_page();
+                    }
+                    extfs.poll = 0;
+                    extfs.substate = EXT_FLASH_SUBSTATE_SAVE_WRITE_BUSY_WAIT;
+                    return 1;
+                case EXT_FLASH_SUBSTATE_SAVE_WRITE_BUSY_WAIT:
+                    // wait for the timer task and make sure the flash is ready
+                    if(!extfs.poll ||
+                            spi_flash_get_state() != SPI_FLASH_STATE_IDLE) {
+                        return 0;
+                    }
+                    extfs.poll = 0;
                     // get the busy flag - read the status register
                     ret = spi_flash_start_cmd(SPI_FLASH_CMD_READ_STATUS_REG, 
                         0, NULL, 0);
                     if(ret != SPI_FLASH_ERROR_OK) {
-                        log_error("eftt - save flash write busy check error: %d", ret);
+                        log_error("efs - save flash write busy check error: %d", ret);
                         extfs.state = EXT_FLASH_STATE_SAVE_ERROR;  // cancel
-                        return;                 
+                        return 0;
                     }
                     extfs.substate = EXT_FLASH_SUBSTATE_SAVE_WRITE_BUSY_CHECK_DONE;
-                    break;
+                    return 1;
                 case EXT_FLASH_SUBSTATE_SAVE_WRITE_BUSY_CHECK_DONE:
                     // make sure we got the status register
                     if(spi_flash_get_state() != SPI_FLASH_STATE_READ_STATUS_REG_DONE) {
-                        return;
+                        return 0;
                     }
                     // check the received busy flag
                     ret = spi_flash_get_result(buf);
                     if(ret == -1) {
-                        log_error("eftt - save flash write busy check result error: %d", ret);
+                        log_error("efs - save flash write busy check result error: %d", ret);
                         extfs.state = EXT_FLASH_STATE_SAVE_ERROR;  // cancel
-                        return;
+                        return 0;
                     }
-                    // device is busy
+                    // device is busy - check again on the next timer task
                     if((buf[0] & 0x01) == 1) {
-                        // check the status reg again
-                        extfs.substate = EXT_FLASH_SUBSTATE_SAVE_WRITE_BUSY_CHECK_START;
+                        extfs.substate = EXT_FLASH_SUBSTATE_SAVE_WRITE_BUSY_WAIT;
+                        return 1;
                     }
-                    // device is done writing
-                    else {
-                        // move to the next sector
-                        extfs.addrp += extfs.last_io_len;
-                        extfs.iop += extfs.last_io_len;
-                        extfs.substate = EXT_FLASH_SUBSTATE_SAVE_WRITE_EN_START;
-                        // writing is done
-                        if(ext_flash_get_remain_io_bytes() <= 0) {
-                            extfs.state = EXT_FLASH_STATE_SAVE_DONE;
-                        }
+                    // writing is done
+                    if(ext_flash_get_remain_io_bytes() <= 0) {
+                        extfs.save_timing.program_time = ext_flash_end_phase();
+                        ext_flash_finish(EXT_FLASH_STATE_SAVE_DONE);
+                        return 0;
                     }
-                    break;
+                    // move to the next page
+                    extfs.substate = EXT_FLASH_SUBSTATE_SAVE_WRITE_EN_START;
+                    return 1;
             }
             break;
         default:
             // no action
             break;
     }
-}
-
-// get the state of the external flash
-// if we are in an error state the error will be cleared to IDLE after read
-int ext_flash_get_state(void) {
-    int state = extfs.state;
-    switch(extfs.state) {
-        case EXT_FLASH_STATE_LOAD_ERROR:
-        case EXT_FLASH_STATE_LOAD_DONE:
-        case EXT_FLASH_STATE_SAVE_ERROR:
-        case EXT_FLASH_STATE_SAVE_DONE:
-            extfs.state = EXT_FLASH_STATE_IDLE;
-            break;
-        default:
-            // no action
-            break;
-    }
-    return state;
-}
-
-// start load from external flash - return -1 in case of error
-int ext_flash_load(int32_t addr, int len, uint8_t *loadp) {
-    // can't load if we're busy
-    if(extfs.state != EXT_FLASH_STATE_IDLE) {
-        return -1;
-    }
-    extfs.flash_addr = addr;
-    extfs.addrp = addr;
-    extfs.rw_len = len;
-    extfs.iop = loadp;
-    extfs.state = EXT_FLASH_STATE_LOAD;
-    extfs.substate = EXT_FLASH_SUBSTATE_LOAD_IDLE;
     return 0;
 }
 
-// start save to external flash - return -1 in case of error
-int ext_flash_save(int32_t addr, int len, uint8_t *savep) {
-    // can't save if we're busy
-    if(extfs.state != EXT_FLASH_STATE_IDLE) {
-        return -1;
+// copy the next page to write into the SPI flash program buffer
+void ext_flash_stage_page(void) {
+    // should we write a full page or less than?
+    if(ext_flash_get_remain_io_bytes() >= SPI_FLASH_PAGE_SIZE) {
+        extfs.last_io_len = SPI_FLASH_PAGE_SIZE;
     }
-    extfs.flash_addr = addr;
-    extfs.addrp = addr;
-    extfs.rw_len = len;
-    extfs.iop = savep;
-    extfs.state = EXT_FLASH_STATE_SAVE;
-    extfs.substate = EXT_FLASH_SUBSTATE_SAVE_IDLE;
-    return 0;
-}
-
-// start save to external flash without performing a sector erase first
-// returns -1 in case of error
-int ext_flash_save_noerase(int32_t addr, int len, uint8_t *savep) {
-    // can't save if we're busy
-    if(extfs.state != EXT_FLASH_STATE_IDLE) {
-        return -1;
+    else {
+        extfs.last_io_len = ext_flash_get_remain_io_bytes();
     }
-    extfs.flash_addr = addr;
-    extfs.addrp = addr;
-    extfs.rw_len = len;
-    extfs.iop = savep;
-    extfs.state = EXT_FLASH_STATE_SAVE_NOERASE;
-    extfs.substate = EXT_FLASH_SUBSTATE_SAVE_IDLE;
-    return 0;
+    spi_flash_stage_write(extfs.iop, extfs.last_io_len);
 }
 
-// get the size of the external flash
-int32_t ext_flash_get_mem_size(void) {
-    return SPI_FLASH_MEMORY_SIZE;
-}
-
-//
-// local functions
-//
 // get the number of remaining I/O bytes to read or write
 int32_t ext_flash_get_remain_io_bytes(void) {
     return (extfs.flash_addr + extfs.rw_len) - extfs.addrp;
 }
 
+// end the erase or program phase of a save
+// returns the time taken by the phase in us
+int32_t ext_flash_end_phase(void) {
+    uint32_t now = rt_prof_start();
+    int32_t time = (now - extfs.phase_time) / rt_prof_get_counts_per_us();
+    extfs.phase_time = now;
+    return time;
+}
 
+// finish a load or save and record how long it took
+void ext_flash_finish(int state) {
+    extfs.last_time = (rt_prof_start() - extfs.start_time) /
+        rt_prof_get_counts_per_us();
+    if(state == EXT_FLASH_STATE_SAVE_DONE) {
+        extfs.save_timing.total_time = extfs.last_time;
+    }
+    extfs.state = state;
+}
@@ -41,10 +41,18 @@
 #define EXT_FLASH_STATE_SAVE_ERROR 6
 #define EXT_FLASH_STATE_SAVE_DONE 7
 
+// timing of a save in us
+struct ext_flash_save_timing {
+    int32_t erase_time;  // time spent erasing sectors
+    int32_t program_time;  // time spent programming pages
+    int32_t total_time;  // time from the start of the save until done
+};
+
 // init external flash
 void ext_flash_init(void);
 
 // run the external flash timer task to handle data transfer
+// this polls the busy flag during saves - call every 500us
 void ext_flash_timer_task(void);
 
 // get the state of the external flash
@@ -64,4 +72,10 @@ int ext_flash_save_noerase(int32_t addr, int len, uint8_t *savep);
 // get the size of the external flash
 int32_t ext_flash_get_mem_size(void);
 
+// get the time taken by the last completed load or save in us
+int32_t ext_flash_get_last_time(void);
+
+// get the erase, program and total time of the last completed save
+void ext_flash_get_save_timing(struct ext_flash_save_timing *timing);
+
 #endif
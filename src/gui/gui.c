@@ -336,6 +336,7 @@ void gui_update_pattern_type(int scene, int track, int pattern);
 void gui_update_track_type(int scene, int track, int type);
 void gui_update_active_step(int track, int step);
 void gui_update_song_mode(void);
+void gui_update_all(void);
 
 // init the GUI and reset all vars
 int gui_init(void) {
@@ -607,10 +608,10 @@ void gui_startup(void) {
     gstate.force_refresh = 0;
     gstate.force_reinit = 0;
 
-    // register for events
-    state_change_register(gui_handle_state_change, SCEC_SONG);
-    state_change_register(gui_handle_state_change, SCEC_CTRL);
-    state_change_register(gui_handle_state_change, SCEC_ENG);
+    // register for events - delivered on the main loop from seq_ctrl_ui_task
+    state_change_register_deferred(gui_handle_state_change, SCEC_SONG);
+    state_change_register_deferred(gui_handle_state_change, SCEC_CTRL);
+    state_change_register_deferred(gui_handle_state_change, SCEC_ENG);
 
     // unblock the drawing
     gstate.started = 1;
@@ -905,6 +906,11 @@ void gui_handle_state_change(int event_type, int *data, int data_len) {
         case SCE_SONG_SAVED:
             gui_update_song(data[0]);
             break;
+        case SCE_SONG_RESYNC:
+        case SCE_CTRL_RESYNC:
+        case SCE_ENG_RESYNC:
+            gui_update_all();  // events were dropped - refresh everything
+            break;
         case SCE_CTRL_TRACK_SELECT:
             gui_update_track_select(data[0], data[1]);
             break;
@@ -1215,6 +1221,22 @@ void gui_update_song(int song) {
     gui_set_label(GUI_LABEL_SONG, tempstr);
 }
 
+// update everything shown from the song and sequencer state
+void gui_update_all(void) {
+    int track;
+    gui_update_song(seq_ctrl_get_current_song());
+    gui_update_tempo(song_get_tempo());
+    gui_update_scene(seq_ctrl_get_scene());
+    gui_update_song_mode();
+    gui_update_clock_source(song_get_midi_clock_source());
+    gui_update_run_enable(seq_ctrl_get_run_state());
+    gui_update_rec_mode(seq_ctrl_get_record_mode());
+    gui_update_live_mode(seq_ctrl_get_live_mode());
+    for(track = 0; track < SEQ_NUM_TRACKS; track ++) {
+        gui_update_track_select(track, seq_ctrl_get_track_select(track));
+    }
+}
+
 // update the scene because it probably changed
 void gui_update_scene(int scene) {
     int track;
@@ -25,6 +25,7 @@
 #include "config.h"
 #include "ioctl.h"
 #include "analog_out.h"
+#include "clock_timer.h"
 #include "config_store.h"
 #include "cvproc.h"
 #include "debug.h"
@@ -36,6 +37,8 @@
 #include "spi_callbacks.h"
 #include "util/time_utils.h"
 #include "util/log.h"
+#include "util/rt_prof.h"
+#include "midi/midi_clock.h"
 #include "midi/midi_utils.h"
 #include "midi/midi_stream.h"
 #include "usbd_midi/usbd_midi.h"
@@ -48,6 +51,9 @@
 #ifdef DEBUG_RT_TIMING
 #warning main RT task timing enabled
 #endif
+#ifdef DEBUG_CLOCK_JITTER
+#warning clock tick jitter measurement enabled
+#endif
 
 // local functions
 static void SystemClock_Config(void);
@@ -70,6 +76,7 @@ int main(void) {
     spi_callbacks_init();  // must be before anything uses SPI
     debug_init();
     log_init();
+    rt_prof_init();
     ioctl_init();
     analog_out_init();
     midi_stream_init();
@@ -87,16 +94,15 @@ int main(void) {
     power_ctrl_init();  // must cme after ioctl_init()
 
 #ifdef DEBUG_RT_TIMING
-    // set up instrumentation
-    CoreDebug->DEMCR &= ~0x01000000;  // set up counter
-    CoreDebug->DEMCR |=  0x01000000;
-    DWT->CTRL &= ~0x00000001;  // enable counter
-    DWT->CTRL |=  0x00000001;
-    DWT->CYCCNT = 0; // reset the counter
+    rt_prof_set_enable(1);  // profiling normally enabled over SYSEX
+#endif
+#ifdef DEBUG_CLOCK_JITTER
+    midi_clock_set_jitter_enable(1);
 #endif
 
     // unblock RT thread
     startup_wait = 0;  // cause main timer task to begin
+    clock_timer_init();  // start the timestamp base and the clock ticks
 
     // power up timeout - 10ms
     start_time = time_utils_get_btime();
@@ -113,10 +119,20 @@ int main(void) {
 void main_timer_task(void) {
     static int32_t current_time = 0;
     static int task_div = 0;
+    uint32_t main_start, task_start;
 #ifdef DEBUG_RT_TIMING
-    uint32_t task_timing;
-    static uint32_t task_timing_min = 0x7fffffff;
-    static uint32_t task_timing_max = 0;
+    struct rt_prof_stats stats;
+    int cpu;
+#endif
+#ifdef DEBUG_CLOCK_JITTER
+    struct midi_clock_jitter_stats jitter;
+#endif
+#ifdef DEBUG_DIN_MIDI_STATS
+    struct din_midi_tx_stats tx_stats;
+    int port;
+#endif
+#ifdef DEBUG_USBD_MIDI_STATS
+    struct usbd_midi_tx_stats usbd_stats;
 #endif
 
     // do this always - even before startup - 1000us
@@ -130,29 +146,43 @@ void main_timer_task(void) {
         return;
     }
 
-#ifdef DEBUG_RT_TIMING
-    // handle task timing
-    DWT->CYCCNT = 0;  // reset cycle counter
-#endif
-
     // tasks - every 1000us
     if((task_div & 0x01) == 0) {
+        main_start = rt_prof_start();
         time_utils_set_btime(current_time);
+        task_start = rt_prof_start();
         panel_if_timer_task();  // do this first for nice LED dimming
+        rt_prof_end(RT_PROF_TASK_PANEL_IF, task_start);
+        task_start = rt_prof_start();
         seq_ctrl_rt_task();  // sequencer realtime stuff
+        rt_prof_end(RT_PROF_TASK_SEQ_CTRL, task_start);
+        task_start = rt_prof_start();
         din_midi_timer_task();  // hardware MIDI I/O
-        ext_flash_timer_task();  // loading/saving to external flash
+        rt_prof_end(RT_PROF_TASK_DIN_MIDI, task_start);
+        task_start = rt_prof_start();
         usbd_midi_timer_task();  // USB device
+        rt_prof_end(RT_PROF_TASK_USBD_MIDI, task_start);
+        task_start = rt_prof_start();
         usbh_midi_timer_task();  // USB host
+        rt_prof_end(RT_PROF_TASK_USBH_MIDI, task_start);
         config_store_timer_task();  // system config loading / saving
+        task_start = rt_prof_start();
         cvproc_timer_task();  // hardware CV/gate/clock outputs
+        rt_prof_end(RT_PROF_TASK_CVPROC, task_start);
         power_ctrl_timer_task();  // power control monitoring / switching
+        rt_prof_end(RT_PROF_TASK_MAIN, main_start);
     }
 
     // hardware I/O - every 250us
     ioctl_timer_task();
     analog_out_timer_task();
 
+    // loading/saving to external flash - every 500us
+    // transfers are chained from the SPI interrupt - this polls the busy flag
+    task_start = rt_prof_start();
+    ext_flash_timer_task();
+    rt_prof_end(RT_PROF_TASK_EXT_FLASH, task_start);
+
     // nom entropy to make it more random (since we only have one seed)
     if((task_div & 0xff) == 0) {
         rand();
@@ -169,21 +199,54 @@ void main_timer_task(void) {
 #endif
 
 #ifdef DEBUG_RT_TIMING
-    // handle task timing
-    task_timing = DWT->CYCCNT;  // get timing
-    if(task_timing < task_timing_min) {
-        task_timing_min = task_timing;
-    }
-    if(task_timing > task_timing_max) {
-        task_timing_max = task_timing;
-    }
+    // report the 1ms task timing
     if((task_div & 0x7ff) == 0) {
-        task_timing_min = (task_timing_min * 6) / 1000;  // convert to us (168MHz clock)
-        task_timing_max = (task_timing_max * 6) / 1000;  // convert to us (168MHz clock)
+        cpu = rt_prof_get_counts_per_us();
+        rt_prof_get_stats(RT_PROF_TASK_MAIN, &stats);
         log_debug("RT timing - min: %d us - max: %d us",
-            task_timing_min , task_timing_max);
-        task_timing_min = 0x7fffffff;
-        task_timing_max = 0;
+            stats.min / cpu, stats.max / cpu);
+        rt_prof_reset();
+    }
+#endif
+
+#ifdef DEBUG_CLOCK_JITTER
+    // report the tick interval deviation - histogram bins are listed from -1ms
+    if((task_div & 0x1fff) == 0x1000) {
+        midi_clock_get_jitter_stats(&jitter);
+        log_debug("tick jitter - ticks: %d - min: %d us - max: %d us",
+            jitter.ticks, jitter.min, jitter.max);
+        log_debug("hist: %d %d %d %d %d %d %d %d | %d %d %d %d %d %d %d %d",
+            jitter.hist[0], jitter.hist[1], jitter.hist[2], jitter.hist[3],
+            jitter.hist[4], jitter.hist[5], jitter.hist[6], jitter.hist[7],
+            jitter.hist[8], jitter.hist[9], jitter.hist[10], jitter.hist[11],
+            jitter.hist[12], jitter.hist[13], jitter.hist[14], jitter.hist[15]);
+        midi_clock_reset_jitter_stats();
+    }
+#endif
+
+#ifdef DEBUG_DIN_MIDI_STATS
+    // report the DIN MIDI TX rate and how long the streams waited to be sent
+    if((task_div & 0x1fff) == 0x800) {
+        for(port = MIDI_PORT_DIN1_OUT; port <= MIDI_PORT_DIN2_OUT; port ++) {
+            din_midi_get_tx_stats(port, &tx_stats);
+            log_debug("DIN%d TX - %d bytes/s - msgs: %d - saved: %d - "
+                "latency avg: %d us - max: %d us - errors: %d", port + 1,
+                tx_stats.bytes_per_sec, tx_stats.msgs, tx_stats.bytes_saved,
+                tx_stats.latency_avg, tx_stats.latency_max, tx_stats.errors);
+        }
+        din_midi_reset_tx_stats();
+    }
+#endif
+
+#ifdef DEBUG_USBD_MIDI_STATS
+    // report the USB MIDI IN rate and how full the transfers are
+    if((task_div & 0x1fff) == 0xc00) {
+        usbd_midi_get_tx_stats(&usbd_stats);
+        log_debug("USBD TX - %d bytes/s - events: %d - rt: %d - transfers: %d - "
+            "full: %d - sof: %d", usbd_stats.bytes_per_sec, usbd_stats.events,
+            usbd_stats.rt_events, usbd_stats.transfers, usbd_stats.full_transfers,
+            usbd_stats.sof_transfers);
+        usbd_midi_reset_tx_stats();
     }
 #endif
 }
@@ -23,19 +23,34 @@
 #include "../config.h"
 #include "../util/log.h"
 #include "../util/seq_utils.h"
+#include "../clock_timer.h"
 #include <math.h>
+#include <stdlib.h>
 
 // setings
 #define MIDI_CLOCK_US_PER_TICK_MAX ((uint64_t)(60000000.0 / (MIDI_CLOCK_TEMPO_MIN * (float)MIDI_CLOCK_PPQ)))
 #define MIDI_CLOCK_US_PER_TICK_MIN ((uint64_t)(60000000.0 / (MIDI_CLOCK_TEMPO_MAX * (float)MIDI_CLOCK_PPQ)))
 #define MIDI_CLOCK_TAP_TIMEOUT 2500000  // us (just longer than 30BPM)
 #define MIDI_CLOCK_TAP_HIST_LEN 2  // taps in history buffer - required taps will be +1
-#define MIDI_CLOCK_EXT_HIST_LEN 8  // number of historical intervals to average (must be a power of 2)
-#define MIDI_CLOCK_EXT_HIST_MASK (MIDI_CLOCK_EXT_HIST_LEN - 1)
-#define MIDI_CLOCK_EXT_MIN_HIST 3  // number of interval samples needed before changing internal clock
 #define MIDI_CLOCK_EXT_SYNC_TIMEOUT 125000  // timeout for receiving external sync (us)
-#define MIDI_CLOCK_EXT_ERROR_ADJ 500  // lock adjust amount
-#define MIDI_CLOCK_EXT_SYNC_TEMPO_FILTER 0.9  // tempo average filter coeff
+#define MIDI_CLOCK_EXT_PLL_BW_ACQUIRE 4.0  // loop bandwidth while acquiring lock (Hz)
+#ifndef MIDI_CLOCK_EXT_PLL_BW_LOCKED
+#define MIDI_CLOCK_EXT_PLL_BW_LOCKED 1.0  // loop bandwidth once locked (Hz)
+#endif
+#define MIDI_CLOCK_EXT_PLL_OMEGA_MAX 0.5  // max loop gain per tick - keeps slow tempos stable
+#define MIDI_CLOCK_EXT_OUTLIER_SHIFT 1  // reject ticks more than period >> shift from prediction
+#define MIDI_CLOCK_EXT_OUTLIER_MAX 4  // rejected ticks in a row before acquiring again
+#define MIDI_CLOCK_EXT_LOCK_US 2000  // average phase error to declare lock
+#define MIDI_CLOCK_EXT_UNLOCK_US 4000  // average phase error to lose lock
+#define MIDI_CLOCK_EXT_LOCK_TICKS 24  // min ticks after acquiring before lock
+#define MIDI_CLOCK_EXT_ERROR_FILTER_SHIFT 3  // phase error average filter
+#define MIDI_CLOCK_EXT_PHASE_SHIFT 1  // internal phase correction per tick - 1/2^n of the error
+#define MIDI_CLOCK_EXT_PHASE_ADJ_SHIFT 3  // max internal period adjust - 1/2^n of the period
+#define MIDI_CLOCK_FRAC_BITS 8  // fractional bits of the tick period
+#define MIDI_CLOCK_FRAC_MASK ((1 << MIDI_CLOCK_FRAC_BITS) - 1)
+#define MIDI_CLOCK_TIMESTAMP_MAX_AGE 50000  // oldest time that can be placed on a tick (us)
+#define MIDI_CLOCK_RUN_HIST_LEN 32  // tick run times kept - covers the max age at max tempo
+#define MIDI_CLOCK_RUN_HIST_MASK (MIDI_CLOCK_RUN_HIST_LEN - 1)
 
 enum {
     MIDI_CLOCK_RUNSTOP_IDLE,  // no action
@@ -56,30 +71,55 @@ struct midi_clock_state {
     int runstop_f;  // flag indicates we want to change the playback state
     int reset_f;  // flag to signal we want to reset playback (but not change playback state)
     int ext_tick_f;  // external tick received flag
+    uint64_t ext_tick_time;  // time the external tick was received
     uint64_t time_count;  // running time count
     uint64_t next_tick_time;  // time for the next tick
+#ifdef MIDI_CLOCK_TICK_TIMER
+    uint32_t timer_next_tick_time;  // tick timer time for the next tick
+    uint32_t timer_tick_frac;  // fractional us accumulator for the tick timer
+    uint32_t timer_tick_time;  // tick timer time the last tick was due
+#else
+    uint32_t run_time_hist[MIDI_CLOCK_RUN_HIST_LEN];  // clock timer time each tick ran
+    uint32_t next_run_time;  // clock timer time the next tick will run
+#endif
     // internal clock state
     int32_t run_tick_count;  // running tick count
     int32_t stop_tick_count;   // stopped tick count
     int32_t int_us_per_beat;  // master tempo setting value - to match MIDI file format
     int32_t int_us_per_tick;  // number of us per tick (internal)
+    int32_t int_tick_period;  // tick period in us with MIDI_CLOCK_FRAC_BITS fraction
     // external clock recovery state
-    int32_t ext_interval_hist[MIDI_CLOCK_EXT_HIST_LEN];  // historical interval history
-    int32_t ext_interval_count;  // number of historical intervals measured
+    int ext_acquire_count;  // number of ticks received since acquiring
     int ext_sync_timeout;  // countdown for invalidating clock
-    uint64_t ext_last_tick_time;  // time of the last tick received
+    int64_t ext_pred_time;  // predicted time of the next tick - us with fraction
+    int32_t ext_period;  // recovered tick interval - us with fraction
+    int ext_outlier_count;  // number of ticks rejected in a row
+    int32_t ext_error_avg;  // average phase error (us)
+    int ext_locked;  // 0 = not locked, 1 = phase locked
     int32_t ext_run_tick_count;  // count of external ticks
-    int ext_sync_tempo_average;  // average tempo for display
+    int ext_sync_tempo_average;  // recovered tempo for display
     // tap tempo state
     int tap_beat_f;  // tap tempo beat was received
     uint64_t tap_clock_last_tap;  // last tap time
     int tap_clock_period;  // tap clock period - averaged
     int tap_hist_count;  // number of historical taps
     uint64_t tap_hist[MIDI_CLOCK_TAP_HIST_LEN];  // historical taps
+    // jitter measurement state
+    int jitter_enable;  // 0 = disabled, 1 = enabled
+    int jitter_last_valid;  // last tick time is valid
+    uint32_t jitter_last_time;  // time the last tick ran
+    uint32_t jitter_last_due;  // time the last tick was due
+    struct midi_clock_jitter_stats jitter;  // tick interval deviation stats
 };
 struct midi_clock_state mcs;
 
 // local functions
+void midi_clock_run_tick(void);
+void midi_clock_set_tick_period(int32_t period);
+void midi_clock_measure_jitter(uint32_t time, uint32_t due);
+void midi_clock_ext_acquire(void);
+void midi_clock_ext_recover(uint64_t time);
+void midi_clock_ext_drive(int64_t tick_time);
 void midi_clock_reset_pos(void);
 void midi_clock_change_run_state(int run);
 
@@ -95,16 +135,23 @@ void midi_clock_init(void) {
     mcs.runstop_f = MIDI_CLOCK_RUNSTOP_IDLE;
     mcs.reset_f = 0;
     mcs.ext_tick_f = 0;
+    mcs.ext_tick_time = 0;
     mcs.time_count = 0;
     mcs.next_tick_time = 0;
+#ifdef MIDI_CLOCK_TICK_TIMER
+    mcs.timer_next_tick_time = 0;
+    mcs.timer_tick_frac = 0;
+    mcs.timer_tick_time = 0;
+#else
+    mcs.next_run_time = 0;
+#endif
     // internal clock state
     mcs.run_tick_count = 0;
     mcs.stop_tick_count = 0;
     midi_clock_set_tempo(MIDI_CLOCK_DEFAULT_TEMPO);
     // external clock recovery state
-    mcs.ext_interval_count = 0;
     mcs.ext_sync_timeout = 0;  // timed out
-    mcs.ext_last_tick_time = 0;
+    midi_clock_ext_acquire();
     mcs.ext_run_tick_count = 0;
     mcs.ext_sync_tempo_average = mcs.int_us_per_tick;  // default
     // tap tempo
@@ -112,13 +159,15 @@ void midi_clock_init(void) {
     mcs.tap_clock_last_tap = 0;
     mcs.tap_clock_period = 0;
     mcs.tap_hist_count = 0;
+    // jitter measurement
+    mcs.jitter_enable = 0;
+    midi_clock_reset_jitter_stats();
 }
 
 // run the MIDI clock timer task
 // call at MIDI_CLOCK_TASK_INTERVAL_US interval
 void midi_clock_timer_task(void) {
-    int i, error;
-    uint32_t tick_count;
+    int i;
     int32_t temp;
 
     // handle playback state change flags
@@ -149,62 +198,32 @@ void midi_clock_timer_task(void) {
         mcs.source = mcs.desired_source;
         midi_clock_source_changed(mcs.source);
         midi_clock_change_run_state(0);  // force stop
+        midi_clock_ext_acquire();
     }
 
     // run clock timebase
+#ifdef MIDI_CLOCK_TICK_TIMER
+    // follow the tick timer so that external ticks and internal ticks
+    // are measured on the same time base
+    mcs.time_count += (uint32_t)(clock_timer_get_time() - (uint32_t)mcs.time_count);
+#else
     mcs.time_count += MIDI_CLOCK_TASK_INTERVAL_US;
     // decide if we should issue a clock
     while(mcs.time_count > mcs.next_tick_time) {
-        // if run state changed
-        if(mcs.run_state != mcs.desired_run_state) {
-            // stopping
-            if(mcs.desired_run_state == 0) {
-                mcs.stop_tick_count = mcs.run_tick_count;
-            }
-            midi_clock_change_run_state(mcs.desired_run_state);
-        }
-        // get the correct tick count
+        midi_clock_measure_jitter(mcs.time_count, mcs.next_tick_time);
+        midi_clock_run_tick();
+        // timestamps are placed against when the ticks really ran
         if(mcs.run_state) {
-            tick_count = mcs.run_tick_count;
-        }
-        else {
-            tick_count = mcs.stop_tick_count;
+            mcs.run_time_hist[(mcs.run_tick_count - 1) & MIDI_CLOCK_RUN_HIST_MASK] =
+                clock_timer_get_time();
         }
-        // calculate beat cross before processing sequencer stuff
-        if((tick_count % MIDI_CLOCK_PPQ) == 0) {
-            // if the swing is adjusting we change it now
-            if(mcs.desired_swing != mcs.swing) {
-                mcs.swing = mcs.desired_swing;
-            }
-            midi_clock_beat_crossed();
-            // update the recovered tempo display
-            if(midi_clock_is_ext_synced()) {
-                midi_clock_ext_tempo_changed();
-            }
-//            // XXX debug
-//            log_debug("us: %d - run_tick: %d - ext_run_tick: %d - diff: %d",
-//                mcs.int_us_per_tick,
-//                mcs.run_tick_count, mcs.ext_run_tick_count,
-//                (mcs.run_tick_count - mcs.ext_run_tick_count));
-        }            
-        // XXX the tick count should probably vary for swing?
-        // generate correct number of pulses for current swing mode
-        for(i = 0; i < swing[mcs.swing][tick_count % MIDI_CLOCK_PPQ]; i ++) {
-            midi_clock_ticked_swing(tick_count);
-        }
-        // run the straight tick each time
-        midi_clock_ticked_straight(tick_count);
-
-        tick_count ++;
         mcs.next_tick_time += mcs.int_us_per_tick;
-        // write back the tick count
-        if(mcs.run_state) {
-            mcs.run_tick_count = tick_count;
-        }
-        else {
-            mcs.stop_tick_count = tick_count;
-        }
     }
+    // the next tick runs on the first task after it is due
+    mcs.next_run_time = clock_timer_get_time() + MIDI_CLOCK_TASK_INTERVAL_US +
+        (((uint32_t)(mcs.next_tick_time - mcs.time_count) / MIDI_CLOCK_TASK_INTERVAL_US) *
+        MIDI_CLOCK_TASK_INTERVAL_US);
+#endif
 
     // recover external clock and drive the internal clock
     if(mcs.source == MIDI_CLOCK_EXTERNAL) {
@@ -216,41 +235,11 @@ void midi_clock_timer_task(void) {
                 midi_clock_ext_sync_changed(1);
             }
             mcs.ext_sync_timeout = MIDI_CLOCK_EXT_SYNC_TIMEOUT;
-            // measure interval - skip the very first time since it will be wrong
-            mcs.ext_interval_hist[(mcs.ext_interval_count - 1) & MIDI_CLOCK_EXT_HIST_MASK] =
-                mcs.time_count - mcs.ext_last_tick_time;
-            // average the number of samples we have
-            temp = 0;
-            for(i = 0; i < MIDI_CLOCK_EXT_HIST_LEN && i < mcs.ext_interval_count; i ++) {
-                temp += mcs.ext_interval_hist[i];
-            }
-            // if we have at least MIDI_CLOCK_EXT_MIN_HIST samples let's update the internal clock
-            if(i >= MIDI_CLOCK_EXT_MIN_HIST) {
-                temp /= i;
-                // set the internal clock to this value
-                mcs.int_us_per_tick = temp / MIDI_CLOCK_UPSAMPLE;  // convert to 96PPQ
-//                // XXX debug
-//                log_debug("i: %d - avg: %d - time: %lld - last: %lld - diff: %lld", i, temp,
-//                    mcs.time_count, mcs.ext_last_tick_time, 
-//                    (mcs.time_count - mcs.ext_last_tick_time));
-                mcs.ext_sync_tempo_average = ((float)mcs.ext_sync_tempo_average * 
-                    MIDI_CLOCK_EXT_SYNC_TEMPO_FILTER) +
-                    ((float)mcs.int_us_per_tick * (1.0 - MIDI_CLOCK_EXT_SYNC_TEMPO_FILTER ));
-            }
             // count external ticks if running
             if(mcs.run_state) {
                 mcs.ext_run_tick_count += MIDI_CLOCK_UPSAMPLE;
-                // compensate for error
-                error = mcs.run_tick_count - mcs.ext_run_tick_count;
-                if(error < 0) {
-                    mcs.int_us_per_tick -= MIDI_CLOCK_EXT_ERROR_ADJ;
-                }
-                else if(error > 0) {
-                    mcs.int_us_per_tick += MIDI_CLOCK_EXT_ERROR_ADJ;
-                }
             }
-            mcs.ext_last_tick_time = mcs.time_count;
-            mcs.ext_interval_count ++;
+            midi_clock_ext_recover(mcs.ext_tick_time);
         }
     }
 
@@ -260,7 +249,7 @@ void midi_clock_timer_task(void) {
         // ext sync lost
         if(mcs.ext_sync_timeout <= 0) {
             midi_clock_ext_sync_changed(0);
-            mcs.ext_interval_count = 0;  // reset
+            midi_clock_ext_acquire();  // reset
             mcs.runstop_f = MIDI_CLOCK_RUNSTOP_STOP;
         }
     }
@@ -283,14 +272,12 @@ void midi_clock_timer_task(void) {
             temp = (mcs.tap_clock_period / MIDI_CLOCK_PPQ);            
             // ensure that tempo fits in the valid range before accepting
             if(temp < MIDI_CLOCK_US_PER_TICK_MIN) {
-                mcs.int_us_per_tick = MIDI_CLOCK_US_PER_TICK_MIN;
+                temp = MIDI_CLOCK_US_PER_TICK_MIN;
             }
             else if(temp > MIDI_CLOCK_US_PER_TICK_MAX) {
-                mcs.int_us_per_tick = MIDI_CLOCK_US_PER_TICK_MAX;
-            }
-            else {
-                mcs.int_us_per_tick = temp;
+                temp = MIDI_CLOCK_US_PER_TICK_MAX;
             }
+            midi_clock_set_tick_period(temp << MIDI_CLOCK_FRAC_BITS);
             mcs.int_us_per_beat = mcs.int_us_per_tick * MIDI_CLOCK_PPQ;
             midi_clock_tap_locked();
         }
@@ -302,6 +289,31 @@ void midi_clock_timer_task(void) {
     }
 }
 
+#ifdef MIDI_CLOCK_TICK_TIMER
+// run the clock ticks that are due on the tick timer
+// time is the current tick timer time in us
+// returns the tick timer time when the next tick is due
+uint32_t midi_clock_tick_task(uint32_t time) {
+    uint32_t due;
+    // run every tick that is due - more than one if we are running late
+    while((int32_t)(time - mcs.timer_next_tick_time) >= 0) {
+        due = mcs.timer_next_tick_time;
+        midi_clock_measure_jitter(time, due);
+        mcs.timer_tick_time = due;
+        midi_clock_run_tick();
+        // advance by the tick period and carry the fraction
+        mcs.timer_tick_frac += mcs.int_tick_period;
+        mcs.timer_next_tick_time += mcs.timer_tick_frac >> MIDI_CLOCK_FRAC_BITS;
+        mcs.timer_tick_frac &= MIDI_CLOCK_FRAC_MASK;
+        // the clock was stopped for a long time so don't try to catch up
+        if((int32_t)(time - mcs.timer_next_tick_time) > (int32_t)MIDI_CLOCK_US_PER_TICK_MAX) {
+            mcs.timer_next_tick_time = time;
+        }
+    }
+    return mcs.timer_next_tick_time;
+}
+#endif
+
 // get the clock source
 int midi_clock_get_source(void) {
     return mcs.source;
@@ -325,6 +337,14 @@ int midi_clock_is_ext_synced(void) {
     return 0;
 }
 
+// check if the external clock is phase locked
+int midi_clock_is_ext_locked(void) {
+    if(midi_clock_is_ext_synced() && mcs.ext_locked) {
+        return 1;
+    }
+    return 0;
+}
+
 // get the clock tempo (internal clock)
 float midi_clock_get_tempo(void) {
     // external sync
@@ -340,7 +360,8 @@ float midi_clock_get_tempo(void) {
 void midi_clock_set_tempo(float tempo) {
     mcs.int_us_per_beat = (int32_t)(60000000.0 / tempo);
 //    mcs.int_us_per_tick = (int32_t)(60000000.0 / (tempo * (float)MIDI_CLOCK_PPQ));
-    mcs.int_us_per_tick = mcs.int_us_per_beat / MIDI_CLOCK_PPQ;
+    midi_clock_set_tick_period(((int64_t)mcs.int_us_per_beat << MIDI_CLOCK_FRAC_BITS) /
+        MIDI_CLOCK_PPQ);
 }
 
 // get the clock swing
@@ -386,17 +407,119 @@ uint32_t midi_clock_get_tick_pos(void) {
     return mcs.stop_tick_count;
 }
 
+// get the clock tick position nearest to a time in the recent past
+// time is a clock timer time in us - 0 if not known
+// offset is set to the time in us from the returned tick - negative if before
+// returns the current position with an offset of 0 if the time can't be placed
+uint32_t midi_clock_get_tick_pos_at(uint32_t time, int *offset) {
+#ifdef MIDI_CLOCK_TICK_TIMER
+    int32_t since, period, back;
+    *offset = 0;
+    if(!mcs.run_state || time == 0 || mcs.run_tick_count == 0) {
+        return midi_clock_get_tick_pos();
+    }
+    // the last tick that ran is one before the current position
+    since = (int32_t)(time - mcs.timer_tick_time);
+    period = mcs.int_tick_period >> MIDI_CLOCK_FRAC_BITS;
+    if(since >= period || since < -MIDI_CLOCK_TIMESTAMP_MAX_AGE || period < 1) {
+        return mcs.run_tick_count;
+    }
+    // count back whole ticks if it arrived before the last tick
+    back = 0;
+    if(since < 0) {
+        back = ((-since) + period - 1) / period;
+        if(back >= mcs.run_tick_count) {
+            return 0;  // before the start
+        }
+        since += back * period;
+    }
+    // round to the nearest tick - the next tick may not have run yet
+    if((since << 1) >= period) {
+        *offset = since - period;
+        return mcs.run_tick_count - back;
+    }
+    *offset = since;
+    return mcs.run_tick_count - 1 - back;
+#else
+    int32_t since, gap;
+    uint32_t tick, next;
+    *offset = 0;
+    if(!mcs.run_state || time == 0 || mcs.run_tick_count == 0) {
+        return midi_clock_get_tick_pos();
+    }
+    // ticks run on the task up to a task period late so look back through
+    // the times they really ran for the two around the time
+    next = mcs.next_run_time;
+    for(tick = mcs.run_tick_count; tick > 0 &&
+            (mcs.run_tick_count - tick) < MIDI_CLOCK_RUN_HIST_LEN; tick --) {
+        since = (int32_t)(time - mcs.run_time_hist[(tick - 1) & MIDI_CLOCK_RUN_HIST_MASK]);
+        if(since < -MIDI_CLOCK_TIMESTAMP_MAX_AGE) {
+            break;
+        }
+        if(since < 0) {
+            next = mcs.run_time_hist[(tick - 1) & MIDI_CLOCK_RUN_HIST_MASK];
+            continue;
+        }
+        gap = (int32_t)(next - mcs.run_time_hist[(tick - 1) & MIDI_CLOCK_RUN_HIST_MASK]);
+        if(since >= gap) {
+            return mcs.run_tick_count;  // after the next tick is due
+        }
+        // round to the nearest tick - the next tick may not have run yet
+        if((since << 1) >= gap) {
+            *offset = since - gap;
+            return tick;
+        }
+        *offset = since;
+        return tick - 1;
+    }
+    // before the start or too old to place
+    if(tick == 0) {
+        return 0;
+    }
+    return mcs.run_tick_count;
+#endif
+}
+
 // get the running state of the clock
 int midi_clock_get_running(void) {
     return mcs.run_state;
 }
 
+// enable or disable tick jitter measurement - stats are reset when enabled
+void midi_clock_set_jitter_enable(int enable) {
+    if(enable) {
+        midi_clock_reset_jitter_stats();
+        mcs.jitter_enable = 1;
+    }
+    else {
+        mcs.jitter_enable = 0;
+    }
+}
+
+// reset the tick jitter stats
+void midi_clock_reset_jitter_stats(void) {
+    int i;
+    mcs.jitter_last_valid = 0;
+    mcs.jitter.ticks = 0;
+    mcs.jitter.min = 0;
+    mcs.jitter.max = 0;
+    for(i = 0; i < MIDI_CLOCK_JITTER_NUM_BINS; i ++) {
+        mcs.jitter.hist[i] = 0;
+    }
+}
+
+// get the tick jitter stats
+void midi_clock_get_jitter_stats(struct midi_clock_jitter_stats *stats) {
+    *stats = mcs.jitter;
+}
+
 //
 // external clock inputs
 //
 // a MIDI tick was received
 void midi_clock_midi_rx_tick(void) {
     mcs.ext_tick_f = 1;
+    mcs.ext_tick_time = mcs.time_count;
 }
 
 // a MIDI clock start was received
@@ -465,6 +588,210 @@ __weak void midi_clock_ext_sync_changed(int synced) {
 //
 // local functions
 //
+// run a clock tick
+void midi_clock_run_tick(void) {
+    uint32_t tick_count;
+    int i;
+
+    // if run state changed
+    if(mcs.run_state != mcs.desired_run_state) {
+        // stopping
+        if(mcs.desired_run_state == 0) {
+            mcs.stop_tick_count = mcs.run_tick_count;
+        }
+        midi_clock_change_run_state(mcs.desired_run_state);
+    }
+    // get the correct tick count
+    if(mcs.run_state) {
+        tick_count = mcs.run_tick_count;
+    }
+    else {
+        tick_count = mcs.stop_tick_count;
+    }
+    // calculate beat cross before processing sequencer stuff
+    if((tick_count % MIDI_CLOCK_PPQ) == 0) {
+        // if the swing is adjusting we change it now
+        if(mcs.desired_swing != mcs.swing) {
+            mcs.swing = mcs.desired_swing;
+        }
+        midi_clock_beat_crossed();
+        // update the recovered tempo display
+        if(midi_clock_is_ext_synced()) {
+            midi_clock_ext_tempo_changed();
+        }
+//            // XXX debug
+//            log_debug("us: %d - run_tick: %d - ext_run_tick: %d - diff: %d",
+//                mcs.int_us_per_tick,
+//                mcs.run_tick_count, mcs.ext_run_tick_count,
+//                (mcs.run_tick_count - mcs.ext_run_tick_count));
+    }            
+    // XXX the tick count should probably vary for swing?
+    // generate correct number of pulses for current swing mode
+    for(i = 0; i < swing[mcs.swing][tick_count % MIDI_CLOCK_PPQ]; i ++) {
+        midi_clock_ticked_swing(tick_count);
+    }
+    // run the straight tick each time
+    midi_clock_ticked_straight(tick_count);
+
+    tick_count ++;
+    // write back the tick count
+    if(mcs.run_state) {
+        mcs.run_tick_count = tick_count;
+    }
+    else {
+        mcs.stop_tick_count = tick_count;
+    }
+}
+
+// set the tick period - period is in us with MIDI_CLOCK_FRAC_BITS fraction
+void midi_clock_set_tick_period(int32_t period) {
+    mcs.int_tick_period = period;
+    mcs.int_us_per_tick = period >> MIDI_CLOCK_FRAC_BITS;
+}
+
+// measure the interval deviation of a tick that ran at time and was due at due
+void midi_clock_measure_jitter(uint32_t time, uint32_t due) {
+    int32_t dev;
+    int bin;
+    if(!mcs.jitter_enable) {
+        return;
+    }
+    if(mcs.jitter_last_valid) {
+        // actual interval minus the ideal interval
+        dev = (int32_t)(time - mcs.jitter_last_time) - (int32_t)(due - mcs.jitter_last_due);
+        if(mcs.jitter.ticks == 0 || dev < mcs.jitter.min) {
+            mcs.jitter.min = dev;
+        }
+        if(mcs.jitter.ticks == 0 || dev > mcs.jitter.max) {
+            mcs.jitter.max = dev;
+        }
+        mcs.jitter.ticks ++;
+        // linear bins centered on zero
+        dev += (MIDI_CLOCK_JITTER_NUM_BINS / 2) * MIDI_CLOCK_JITTER_BIN_US;
+        if(dev < 0) {
+            bin = 0;
+        }
+        else {
+            bin = dev / MIDI_CLOCK_JITTER_BIN_US;
+            if(bin >= MIDI_CLOCK_JITTER_NUM_BINS) {
+                bin = MIDI_CLOCK_JITTER_NUM_BINS - 1;
+            }
+        }
+        mcs.jitter.hist[bin] ++;
+    }
+    mcs.jitter_last_time = time;
+    mcs.jitter_last_due = due;
+    mcs.jitter_last_valid = 1;
+}
+
+// start acquiring the external clock again
+void midi_clock_ext_acquire(void) {
+    mcs.ext_acquire_count = 0;
+    mcs.ext_outlier_count = 0;
+    mcs.ext_error_avg = MIDI_CLOCK_EXT_UNLOCK_US;
+    mcs.ext_locked = 0;
+}
+
+// recover the external clock from a tick received at time
+// a second order loop tracks the tick phase and interval so that jitter
+// on the input is filtered out and tempo drift gives no phase error
+void midi_clock_ext_recover(uint64_t time) {
+    int64_t tick_time = (int64_t)time << MIDI_CLOCK_FRAC_BITS;
+    int32_t error, error_us;
+    float omega;
+
+    // the first tick only gives the start time
+    if(mcs.ext_acquire_count == 0) {
+        mcs.ext_pred_time = tick_time;
+        mcs.ext_acquire_count ++;
+        return;
+    }
+    // the second tick gives the first interval
+    if(mcs.ext_acquire_count == 1) {
+        mcs.ext_period = seq_utils_clamp(tick_time - mcs.ext_pred_time,
+            (MIDI_CLOCK_US_PER_TICK_MIN * MIDI_CLOCK_UPSAMPLE) << MIDI_CLOCK_FRAC_BITS,
+            (MIDI_CLOCK_US_PER_TICK_MAX * MIDI_CLOCK_UPSAMPLE) << MIDI_CLOCK_FRAC_BITS);
+        mcs.ext_pred_time = tick_time + mcs.ext_period;
+        mcs.ext_acquire_count ++;
+        midi_clock_ext_drive(tick_time);
+        return;
+    }
+
+    // reject ticks that are way off the prediction - a jump in tempo
+    // will keep missing so start over after a few in a row
+    error = tick_time - mcs.ext_pred_time;
+    if(abs(error) > (mcs.ext_period >> MIDI_CLOCK_EXT_OUTLIER_SHIFT)) {
+        mcs.ext_outlier_count ++;
+        if(mcs.ext_outlier_count >= MIDI_CLOCK_EXT_OUTLIER_MAX) {
+            midi_clock_ext_acquire();
+            mcs.ext_pred_time = tick_time;
+            mcs.ext_acquire_count ++;
+            return;
+        }
+        mcs.ext_pred_time += mcs.ext_period;  // assume it was on time
+        return;
+    }
+    mcs.ext_outlier_count = 0;
+    if(mcs.ext_acquire_count < MIDI_CLOCK_EXT_LOCK_TICKS) {
+        mcs.ext_acquire_count ++;
+    }
+
+    // lock detection on the average phase error
+    error_us = abs(error) >> MIDI_CLOCK_FRAC_BITS;
+    mcs.ext_error_avg += (error_us - mcs.ext_error_avg) >> MIDI_CLOCK_EXT_ERROR_FILTER_SHIFT;
+    if(mcs.ext_locked) {
+        if(mcs.ext_error_avg > MIDI_CLOCK_EXT_UNLOCK_US) {
+            mcs.ext_locked = 0;
+        }
+    }
+    else if(mcs.ext_acquire_count >= MIDI_CLOCK_EXT_LOCK_TICKS &&
+            mcs.ext_error_avg < MIDI_CLOCK_EXT_LOCK_US) {
+        mcs.ext_locked = 1;
+    }
+
+    // loop gain for the bandwidth at the current tick rate
+    omega = 2.0 * M_PI * ((mcs.ext_locked) ? MIDI_CLOCK_EXT_PLL_BW_LOCKED : MIDI_CLOCK_EXT_PLL_BW_ACQUIRE) *
+        (float)mcs.ext_period / (float)(1000000 << MIDI_CLOCK_FRAC_BITS);
+    if(omega > MIDI_CLOCK_EXT_PLL_OMEGA_MAX) {
+        omega = MIDI_CLOCK_EXT_PLL_OMEGA_MAX;
+    }
+    // filtered tick time and interval
+    tick_time = mcs.ext_pred_time + (int32_t)(M_SQRT2 * omega * (float)error);
+    mcs.ext_period = seq_utils_clamp(mcs.ext_period + (int32_t)(omega * omega * (float)error),
+        (MIDI_CLOCK_US_PER_TICK_MIN * MIDI_CLOCK_UPSAMPLE) << MIDI_CLOCK_FRAC_BITS,
+        (MIDI_CLOCK_US_PER_TICK_MAX * MIDI_CLOCK_UPSAMPLE) << MIDI_CLOCK_FRAC_BITS);
+    mcs.ext_pred_time = tick_time + mcs.ext_period;
+    midi_clock_ext_drive(tick_time);
+}
+
+// drive the internal clock from the recovered tick time and interval
+// the internal clock runs one external tick ahead since playback starts
+// on the first internal tick after a start is received
+void midi_clock_ext_drive(int64_t tick_time) {
+    int32_t period, adj_max;
+    int64_t until, phase;
+
+    period = mcs.ext_period / MIDI_CLOCK_UPSAMPLE;
+    mcs.ext_sync_tempo_average = period >> MIDI_CLOCK_FRAC_BITS;
+    if(mcs.run_state) {
+        // time from the tick until the next internal tick is due
+#ifdef MIDI_CLOCK_TICK_TIMER
+        until = (int64_t)(int32_t)(mcs.timer_next_tick_time -
+            (uint32_t)(tick_time >> MIDI_CLOCK_FRAC_BITS)) << MIDI_CLOCK_FRAC_BITS;
+#else
+        until = ((int64_t)mcs.next_tick_time << MIDI_CLOCK_FRAC_BITS) - tick_time;
+#endif
+        // phase of the internal clock - positive is ahead of external
+        phase = ((int64_t)(mcs.run_tick_count - mcs.ext_run_tick_count) *
+            mcs.int_tick_period) - until;
+        // spread the correction over the next external tick
+        adj_max = period >> MIDI_CLOCK_EXT_PHASE_ADJ_SHIFT;
+        period += seq_utils_clamp((phase >> MIDI_CLOCK_EXT_PHASE_SHIFT) / MIDI_CLOCK_UPSAMPLE,
+            -adj_max, adj_max);
+    }
+    midi_clock_set_tick_period(period);
+}
+
 // reset the position
 void midi_clock_reset_pos(void) {
     mcs.run_tick_count = 0;
@@ -23,6 +23,7 @@
 
 #include <inttypes.h>
 #include "midi_utils.h"
+#include "../config.h"
 
 // make weak references work
 #ifndef __weak
@@ -33,6 +34,18 @@
 #define MIDI_CLOCK_EXTERNAL 0
 #define MIDI_CLOCK_INTERNAL 1
 
+// tick jitter measurement
+#define MIDI_CLOCK_JITTER_NUM_BINS 16  // histogram bins - centered on zero deviation
+#define MIDI_CLOCK_JITTER_BIN_US 125  // width of each histogram bin
+
+// tick jitter stats - deviation of each tick interval from the ideal interval
+struct midi_clock_jitter_stats {
+    uint32_t ticks;  // number of tick intervals measured
+    int32_t min;  // min deviation (us)
+    int32_t max;  // max deviation (us)
+    uint32_t hist[MIDI_CLOCK_JITTER_NUM_BINS];  // histogram - out of range goes in the end bins
+};
+
 // init the MIDI clock
 void midi_clock_init(void);
 
@@ -40,6 +53,13 @@ void midi_clock_init(void);
 // call at MIDI_CLOCK_TASK_INTERVAL_US interval
 void midi_clock_timer_task(void);
 
+#ifdef MIDI_CLOCK_TICK_TIMER
+// run the clock ticks that are due on the tick timer
+// time is the current tick timer time in us
+// returns the tick timer time when the next tick is due
+uint32_t midi_clock_tick_task(uint32_t time);
+#endif
+
 // get the MIDI clock source
 int midi_clock_get_source(void);
 
@@ -49,6 +69,9 @@ void midi_clock_set_source(int source);
 // check if the external clock is synced
 int midi_clock_is_ext_synced(void);
 
+// check if the external clock is phase locked
+int midi_clock_is_ext_locked(void);
+
 // get the clock tempo (internal clock)
 float midi_clock_get_tempo(void);
 
@@ -76,9 +99,24 @@ void midi_clock_request_reset_pos(void);
 // get the current clock tick position
 uint32_t midi_clock_get_tick_pos(void);
 
+// get the clock tick position nearest to a time in the recent past
+// time is a clock timer time in us - 0 if not known
+// offset is set to the time in us from the returned tick - negative if before
+// returns the current position with an offset of 0 if the time can't be placed
+uint32_t midi_clock_get_tick_pos_at(uint32_t time, int *offset);
+
 // get the running state of the clock
 int midi_clock_get_running(void);
 
+// enable or disable tick jitter measurement - stats are reset when enabled
+void midi_clock_set_jitter_enable(int enable);
+
+// reset the tick jitter stats
+void midi_clock_reset_jitter_stats(void);
+
+// get the tick jitter stats
+void midi_clock_get_jitter_stats(struct midi_clock_jitter_stats *stats);
+
 //
 // external clock inputs
 //
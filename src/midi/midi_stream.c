@@ -38,6 +38,36 @@
  * receives data and stores it until a complete SYSEX message is received or
  * another valid status byte is encountered.
  *
+ * Byte Parser:
+ *
+ * Bytes sent with midi_stream_send_byte() or midi_stream_send_bytes() are
+ * assembled into messages by a table-driven parser with one state per port.
+ * Channel messages keep running status. System common messages and SYSEX
+ * clear it. Realtime bytes are passed through immediately wherever they
+ * occur, including in the middle of another message or a SYSEX message,
+ * without disturbing the parser state. SYSEX data is sent in 3 byte chunks
+ * and any status byte other than realtime ends a SYSEX message with 0xf7.
+ * Data bytes with no status are dropped.
+ *
+ * Bytes sent with midi_stream_send_timed_bytes() carry their arrival time.
+ * Each message is stamped with the time of its first byte: the status byte,
+ * or the first data byte under running status. Realtime messages get the
+ * time of their own byte and SYSEX chunks the time of their first byte.
+ * Messages parsed from untimed bytes are stamped 0.
+ *
+ * Span Access:
+ *
+ * Consumers can avoid the per-message copy by peeking at a contiguous span
+ * of queued messages and consuming them once processed. Producers can
+ * likewise reserve a contiguous span of free slots, fill it in place and
+ * commit it. A span ends at the end of the ring so a second peek or reserve
+ * may be needed to get everything.
+ *
+ * Each queue is safe for a single producer and a single consumer running
+ * in different contexts (e.g. a UART or USB interrupt and the timer task)
+ * without disabling interrupts. The message data is always written before
+ * the index that publishes it.
+ *
  */
 #include "midi_stream.h"
 #include "../config.h"
@@ -45,25 +75,82 @@
 #include "../util/log.h"
 #include <stdlib.h>
 
-// state
-#define MIDI_STREAM_BYTE_IDLE 0
-#define MIDI_STREAM_BYTE_DATA0 1
-#define MIDI_STREAM_BYTE_DATA1 2
-#define MIDI_STREAM_BYTE_SYSEX_DATA0 3
-#define MIDI_STREAM_BYTE_SYSEX_DATA1 4
-uint8_t midi_stream_send_byte_state[MIDI_MAX_PORTS];  // byte stream state
+// byte parser status types - upper nibble of the status table
+#define MIDI_STREAM_ST_CHAN 0x10  // channel message - sets running status
+#define MIDI_STREAM_ST_COMMON 0x20  // system common - clears running status
+#define MIDI_STREAM_ST_SYSEX_START 0x30
+#define MIDI_STREAM_ST_SYSEX_END 0x40
+#define MIDI_STREAM_ST_REALTIME 0x50  // can occur anywhere - no state change
+#define MIDI_STREAM_ST_RESET 0x60  // realtime that also resets the parser
+#define MIDI_STREAM_ST_UNDEF 0x70  // undefined - clears running status
+#define MIDI_STREAM_ST_RT_UNDEF 0x80  // undefined realtime - ignored
+#define MIDI_STREAM_ST_TYPE_MASK 0xf0
+#define MIDI_STREAM_ST_LEN_MASK 0x0f  // number of data bytes
+
+// status byte table - type and data length
+// index 0-6 is channel status 0x80-0xe0 by upper nibble
+// index 7-22 is system status 0xf0-0xff
+#define MIDI_STREAM_STATUS_INDEX(b) ((b) < 0xf0 ? (((b) >> 4) - 8) : ((b) - 0xf0 + 7))
+static const uint8_t midi_stream_status_table[23] = {
+    MIDI_STREAM_ST_CHAN | 2,  // 0x80 note off
+    MIDI_STREAM_ST_CHAN | 2,  // 0x90 note on
+    MIDI_STREAM_ST_CHAN | 2,  // 0xa0 poly key pressure
+    MIDI_STREAM_ST_CHAN | 2,  // 0xb0 control change
+    MIDI_STREAM_ST_CHAN | 1,  // 0xc0 program change
+    MIDI_STREAM_ST_CHAN | 1,  // 0xd0 channel pressure
+    MIDI_STREAM_ST_CHAN | 2,  // 0xe0 pitch bend
+    MIDI_STREAM_ST_SYSEX_START,  // 0xf0 SYSEX start
+    MIDI_STREAM_ST_COMMON | 1,  // 0xf1 MTC quarter frame
+    MIDI_STREAM_ST_COMMON | 2,  // 0xf2 song position
+    MIDI_STREAM_ST_COMMON | 1,  // 0xf3 song select
+    MIDI_STREAM_ST_UNDEF,  // 0xf4
+    MIDI_STREAM_ST_UNDEF,  // 0xf5
+    MIDI_STREAM_ST_COMMON,  // 0xf6 tune request
+    MIDI_STREAM_ST_SYSEX_END,  // 0xf7 SYSEX end
+    MIDI_STREAM_ST_REALTIME,  // 0xf8 timing tick
+    MIDI_STREAM_ST_RT_UNDEF,  // 0xf9
+    MIDI_STREAM_ST_REALTIME,  // 0xfa clock start
+    MIDI_STREAM_ST_REALTIME,  // 0xfb clock continue
+    MIDI_STREAM_ST_REALTIME,  // 0xfc clock stop
+    MIDI_STREAM_ST_RT_UNDEF,  // 0xfd
+    MIDI_STREAM_ST_REALTIME,  // 0xfe active sensing
+    MIDI_STREAM_ST_RESET  // 0xff system reset
+};
+
+// byte parser state for a port
+struct midi_stream_parser {
+    uint8_t status;  // current status byte - 0 = none
+    uint8_t data_len;  // number of data bytes for status
+    uint8_t count;  // number of data bytes received
+    uint8_t data[3];  // data bytes or SYSEX chunk
+    uint8_t sysex;  // 1 = SYSEX message in progress
+    uint8_t timed;  // 1 = time is set for the message in progress
+    uint32_t time;  // time of the first byte of the message in progress
+};
+struct midi_stream_parser midi_stream_parsers[MIDI_MAX_PORTS];
 
 // message queues
 // put data into CCMRAM instead of regular RAM
 struct midi_msg midi_stream_queue[MIDI_MAX_PORTS][MIDI_STREAM_BUFSIZE] __attribute__ ((section (".ccm")));
-int midi_stream_queue_inp[MIDI_MAX_PORTS];
-int midi_stream_queue_outp[MIDI_MAX_PORTS];
+volatile int midi_stream_queue_inp[MIDI_MAX_PORTS];  // written by the producer only
+volatile int midi_stream_queue_outp[MIDI_MAX_PORTS];  // written by the consumer only
+
+// orders queue data accesses against index updates - DMB on Cortex-M4
+#define MIDI_STREAM_BARRIER() __sync_synchronize()
+
+// local functions
+int midi_stream_parse_byte(int port, uint8_t send_byte, uint32_t time);
+void midi_stream_parser_reset(struct midi_stream_parser *parser);
+int midi_stream_parser_end_sysex(int port, struct midi_stream_parser *parser,
+    uint32_t time);
+int midi_stream_parser_send(int port, int len, uint8_t status,
+    uint8_t data0, uint8_t data1, uint32_t time);
 
 // init the MIDI streams
 void midi_stream_init(void) {
     int i;
     for(i = 0; i < MIDI_MAX_PORTS; i ++) {
-        midi_stream_send_byte_state[i] = MIDI_STREAM_BYTE_IDLE;
+        midi_stream_parser_reset(&midi_stream_parsers[i]);
         midi_stream_queue_inp[i] = 0;
         midi_stream_queue_outp[i] = 0;
     }
@@ -72,18 +159,56 @@ void midi_stream_init(void) {
 // put a message into a stream - the msg will be copied
 // returns 0 on success and -1 if the stream is full, -2 if the port is invalid
 int midi_stream_send_msg(struct midi_msg *msg) {
+    int inp;
     if(msg->port < 0 || msg->port >= MIDI_MAX_PORTS) {
         log_error("mssm - port invalid: %d", msg->port);
         return -2;
     }
+    inp = midi_stream_queue_inp[msg->port];
     // check if the buffer is full
-    if(((midi_stream_queue_inp[msg->port] - midi_stream_queue_outp[msg->port]) &
+    if(((inp - midi_stream_queue_outp[msg->port]) &
             MIDI_STREAM_BUFMASK) == (MIDI_STREAM_BUFSIZE - 1)) {
         return -1;
     }
-    midi_utils_copy_msg(&midi_stream_queue[msg->port][midi_stream_queue_inp[msg->port]], msg);
-    midi_stream_queue_inp[msg->port] = 
-        (midi_stream_queue_inp[msg->port] + 1) & MIDI_STREAM_BUFMASK;      
+    midi_utils_copy_msg(&midi_stream_queue[msg->port][inp], msg);
+    MIDI_STREAM_BARRIER();  // data must be written before it is published
+    midi_stream_queue_inp[msg->port] = (inp + 1) & MIDI_STREAM_BUFMASK;
+    return 0;
+}
+
+// reserve a contiguous span of free slots in a stream for writing in place
+// msgs is set to the first free slot - the port of each msg must be set
+// returns the number of slots available, -2 if the port is invalid
+int midi_stream_reserve(int port, struct midi_msg **msgs) {
+    int inp, space;
+    if(port < 0 || port >= MIDI_MAX_PORTS) {
+        log_error("msr - port invalid: %d", port);
+        return -2;
+    }
+    inp = midi_stream_queue_inp[port];
+    space = (midi_stream_queue_outp[port] - inp - 1) & MIDI_STREAM_BUFMASK;
+    if(space > (MIDI_STREAM_BUFSIZE - inp)) {
+        space = MIDI_STREAM_BUFSIZE - inp;  // stop at the end of the ring
+    }
+    *msgs = &midi_stream_queue[port][inp];
+    return space;
+}
+
+// commit messages written to a span returned by midi_stream_reserve()
+// returns 0 on success and -1 if count is more than is free, -2 if port is invalid
+int midi_stream_commit(int port, int count) {
+    int inp;
+    if(port < 0 || port >= MIDI_MAX_PORTS) {
+        log_error("msc - port invalid: %d", port);
+        return -2;
+    }
+    inp = midi_stream_queue_inp[port];
+    if(count < 0 || count > ((midi_stream_queue_outp[port] - inp - 1) & MIDI_STREAM_BUFMASK)) {
+        log_error("msc - count invalid: %d", count);
+        return -1;
+    }
+    MIDI_STREAM_BARRIER();  // data must be written before it is published
+    midi_stream_queue_inp[port] = (inp + count) & MIDI_STREAM_BUFMASK;
     return 0;
 }
 
@@ -107,11 +232,12 @@ int midi_stream_send_sysex_msg(int port, uint8_t *buf, int len) {
     if(len % 3) {
         num_msg ++;
     }
-    if(((midi_stream_queue_inp[port] - midi_stream_queue_outp[port]) &&
+    if(((midi_stream_queue_inp[port] - midi_stream_queue_outp[port]) &
             MIDI_STREAM_BUFMASK) >= (MIDI_STREAM_BUFSIZE - num_msg)) {
         return -1;
     }
     msg.port = port;
+    msg.timestamp = 0;  // sent messages have no receive time
     for(i = 0; i < len; i += 3) {
         if(len - i >= 3) {
             msg.len = 3;
@@ -119,9 +245,10 @@ int midi_stream_send_sysex_msg(int port, uint8_t *buf, int len) {
         else {
             msg.len = (len - i);
         }
+        // the last chunk may be short - don't read past the end of buf
         msg.status = buf[i];
-        msg.data0 = buf[i+1];
-        msg.data1 = buf[i+2];
+        msg.data0 = (msg.len > 1) ? buf[i+1] : 0;
+        msg.data1 = (msg.len > 2) ? buf[i+2] : 0;
         midi_stream_send_msg(&msg);
     }
     return 0;
@@ -131,229 +258,47 @@ int midi_stream_send_sysex_msg(int port, uint8_t *buf, int len) {
 // the stream as complete messages based on their contents
 // returns 0 on success and -1 if the stream is full, -2 if the port is invalid
 int midi_stream_send_byte(int port, uint8_t send_byte) {
-    struct midi_msg msg;
-    int stat, chan;
-    static uint8_t rx_chan[MIDI_MAX_PORTS];  // current message channel
-    static uint8_t rx_status[MIDI_MAX_PORTS];  // current status byte
-    static uint8_t rx_data0[MIDI_MAX_PORTS];  // data0 byte
-    static uint8_t rx_data1[MIDI_MAX_PORTS];  // data1 byte
-   
     if(port < 0 || port >= MIDI_MAX_PORTS) {
         log_error("mssb - port invalid: %d", port);
         return -2;
     }
-   
-    // XXX fix to work with running status properly
-    // status byte received
-    if(send_byte & 0x80) {
-        stat = (send_byte & 0xf0);
-        chan = (send_byte & 0x0f);
-        
-        // system messages
-        if(stat == 0xf0) {
-            switch(send_byte) {
-                //
-                // system common messages (non-SYSEX)
-                //
-                case MIDI_MTC_QFRAME:
-                    // not supported on receive
-                    break;
-                case MIDI_SONG_POSITION:
-                case MIDI_SONG_SELECT:
-                    rx_chan[port] = 255;  // clear running status channel
-                    rx_status[port] = send_byte;
-                    midi_stream_send_byte_state[port] = MIDI_STREAM_BYTE_DATA0;
-                    break;
-                case MIDI_TUNE_REQUEST:
-                    midi_utils_enc_tune_request(&msg, port);
-                    break;            
-                //
-                // system realtime messages - does not reset running status
-                //
-                case MIDI_TIMING_TICK:
-                    midi_utils_enc_timing_tick(&msg, port);
-                    midi_stream_send_msg(&msg);
-                    break;
-                case MIDI_CLOCK_START:
-                    midi_utils_enc_clock_start(&msg, port);
-                    midi_stream_send_msg(&msg);
-                    break;
-                case MIDI_CLOCK_CONTINUE:
-                    midi_utils_enc_clock_continue(&msg, port);
-                    midi_stream_send_msg(&msg);
-                    break;
-                case MIDI_CLOCK_STOP:
-                    midi_utils_enc_clock_stop(&msg, port);
-                    midi_stream_send_msg(&msg);
-                    break;
-                case MIDI_ACTIVE_SENSING:
-                    midi_utils_enc_active_sensing(&msg, port);
-                    midi_stream_send_msg(&msg);
-                    break;
-                case MIDI_SYSTEM_RESET:
-                    rx_chan[port] = 255;  // clear running status channel
-                    rx_status[port] = 0;  // clear running status
-                    midi_stream_send_byte_state[port] = MIDI_STREAM_BYTE_IDLE;
-                    midi_utils_enc_system_reset(&msg, port);
-                    midi_stream_send_msg(&msg);
-                    break;
-                //
-                // SYSEX messages
-                //
-                case MIDI_SYSEX_START:                    
-                    rx_chan[port] = 255;  // clear running status channel
-                    rx_status[port] = send_byte;
-                    midi_stream_send_byte_state[port] = MIDI_STREAM_BYTE_SYSEX_DATA0;
-                    break;                    
-                case MIDI_SYSEX_END:
-                    // 0xf7 received while waiting for 3rd byte
-                    if(midi_stream_send_byte_state[port] == MIDI_STREAM_BYTE_SYSEX_DATA1) {
-                        midi_utils_enc_3byte(&msg, port, rx_status[port], 
-                            rx_data0[port], send_byte);
-                    }
-                    // 0xf7 received while waiting for 2nd byte
-                    else if(midi_stream_send_byte_state[port] == MIDI_STREAM_BYTE_SYSEX_DATA0) {
-                        midi_utils_enc_2byte(&msg, port, rx_status[port], send_byte);
-                    }
-                    // 0xf7 received when no bytes are waiting
-                    else {
-                        midi_utils_enc_1byte(&msg, port, send_byte);
-                    }
-                    midi_stream_send_byte_state[port] = MIDI_STREAM_BYTE_IDLE;
-                    midi_stream_send_msg(&msg);                     
-                    break;
-                default:
-                    // undefined system realtime or common message
-                    rx_chan[port] = 255;  // clear running status channel
-                    rx_status[port] = 0;  // clear running status
-                    midi_stream_send_byte_state[port] = MIDI_STREAM_BYTE_IDLE;
-                    break;
-            }
-        }
-        // channel messages
-        else {
-            // do we have a sysex message current receiving?
-            if(midi_stream_send_byte_state[port] == MIDI_STREAM_BYTE_SYSEX_DATA0 ||
-                    midi_stream_send_byte_state[port] == MIDI_STREAM_BYTE_SYSEX_DATA1) {
-                msg.port = port;
-                msg.len = 1;
-                msg.status = MIDI_SYSEX_END;
-                midi_stream_send_msg(&msg);
-            }
-            // deal with channel messages
-            switch(stat) {
-                case MIDI_NOTE_OFF:
-                case MIDI_NOTE_ON:
-                case MIDI_POLY_KEY_PRESSURE:
-                case MIDI_CONTROL_CHANGE:
-                case MIDI_PROGRAM_CHANGE:
-                case MIDI_CHANNEL_PRESSURE:
-                case MIDI_PITCH_BEND:
-                    rx_chan[port] = chan;
-                    rx_status[port] = stat;
-                    midi_stream_send_byte_state[port] = MIDI_STREAM_BYTE_DATA0;
-                    break;
-                default:
-                    break;
-            }
+    return midi_stream_parse_byte(port, send_byte, 0);
+}
+
+// put a buffer of bytes into a stream - same as calling midi_stream_send_byte()
+// for each byte but the port is only checked once
+// returns 0 on success and -1 if the stream filled up, -2 if the port is invalid
+int midi_stream_send_bytes(int port, uint8_t *buf, int len) {
+    int i, ret = 0;
+    if(port < 0 || port >= MIDI_MAX_PORTS) {
+        log_error("mssbs - port invalid: %d", port);
+        return -2;
+    }
+    for(i = 0; i < len; i ++) {
+        if(midi_stream_parse_byte(port, buf[i], 0) == -1) {
+            ret = -1;  // keep parsing so the state stays in sync
         }
-        return 0;
     }
+    return ret;
+}
 
-    // non-status byte received
-    // deal with states
-    switch(midi_stream_send_byte_state[port]) {
-        case MIDI_STREAM_BYTE_DATA0:  // waiting on first data byte
-            rx_data0[port] = send_byte;
-            // figure out what action to do next based on status
-            switch(rx_status[port]) {
-                case MIDI_SONG_SELECT:
-                    midi_utils_enc_song_select(&msg, port, send_byte);
-                    midi_stream_send_msg(&msg);
-                    rx_chan[port] = 255;  // clear running status channel
-                    rx_status[port] = 0;  // clear running status
-                    midi_stream_send_byte_state[port] = MIDI_STREAM_BYTE_IDLE;
-                    break;
-                case MIDI_PROGRAM_CHANGE:
-                    midi_utils_enc_program_change(&msg, port, rx_chan[port], send_byte);
-                    midi_stream_send_msg(&msg);
-                    // stay in this state for running status
-                    break;
-                case MIDI_CHANNEL_PRESSURE:
-                    midi_utils_enc_channel_pressure(&msg, port, rx_chan[port], send_byte);
-                    midi_stream_send_msg(&msg);
-                    // stay in this state for running status
-                    break;
-                default:
-                    // must be a 3 byte message
-                    midi_stream_send_byte_state[port] = MIDI_STREAM_BYTE_DATA1;
-                    break;
-            }
-            break;
-        case MIDI_STREAM_BYTE_DATA1:  // waiting on second data byte
-            rx_data1[port] = send_byte;
-            // figure out what action to do next based on status
-            switch(rx_status[port]) {
-                case MIDI_NOTE_OFF:
-                    midi_utils_enc_note_off(&msg, port, rx_chan[port], 
-                        rx_data0[port], rx_data1[port]);
-                    midi_stream_send_msg(&msg);                    
-                    break;
-                case MIDI_NOTE_ON:
-                    // note off encoded as note on with velocity 0
-                    if(rx_data1[port] == 0x00) {
-                        midi_utils_enc_note_off(&msg, port, rx_chan[port], 
-                            rx_data0[port], 0x40);
-                    }
-                    else {
-                        midi_utils_enc_note_on(&msg, port, rx_chan[port], 
-                            rx_data0[port], rx_data1[port]);
-                    }
-                    midi_stream_send_msg(&msg);                    
-                    break;
-                case MIDI_POLY_KEY_PRESSURE:
-                    midi_utils_enc_key_pressure(&msg, port, rx_chan[port], 
-                        rx_data0[port], rx_data1[port]);
-                    midi_stream_send_msg(&msg); 
-                    break;
-                case MIDI_CONTROL_CHANGE:
-                    midi_utils_enc_control_change(&msg, port, rx_chan[port], 
-                        rx_data0[port], rx_data1[port]);
-                    midi_stream_send_msg(&msg); 
-                    break;
-                case MIDI_PITCH_BEND:
-                    midi_utils_enc_pitch_bend(&msg, port, rx_chan[port], 
-                        ((rx_data1[port] << 7) | rx_data0[port]) - 8192);
-                    midi_stream_send_msg(&msg); 
-                    break;
-                case MIDI_SONG_POSITION:
-                    midi_utils_enc_song_position(&msg, port, 
-                        rx_data1[port] << 7 | rx_data0[port]);
-                    rx_chan[port] = 255;  // clear running status channel
-                    rx_status[port] = 0;  // clear running status
-                    midi_stream_send_byte_state[port] = MIDI_STREAM_BYTE_IDLE;
-                    return 0;  // avoid changing running status state back
-            }
-            midi_stream_send_byte_state[port] = MIDI_STREAM_BYTE_DATA0;  // running status
-            break;
-        case MIDI_STREAM_BYTE_SYSEX_DATA0:  // waiting on first sysex byte
-            rx_data0[port] = send_byte;
-            midi_stream_send_byte_state[port] = MIDI_STREAM_BYTE_SYSEX_DATA1;
-            break;
-        case MIDI_STREAM_BYTE_SYSEX_DATA1:  // waiting on second sysex byte
-            rx_data1[port] = send_byte;
-            midi_utils_enc_3byte(&msg, port, rx_status[port], 
-                rx_data0[port], rx_data1[port]);
-            midi_stream_send_msg(&msg); 
-            midi_stream_send_byte_state[port] = MIDI_STREAM_BYTE_IDLE;
-            break;
-        case MIDI_STREAM_BYTE_IDLE:
-        default:  // non-status byte received - probably sysex continuation
-            rx_status[port] = send_byte;
-            midi_stream_send_byte_state[port] = MIDI_STREAM_BYTE_SYSEX_DATA0;
-            break;
+// put a buffer of timed bytes into a stream - the first byte arrived at
+// time and each following byte arrived byte_time later - times are in us
+// returns 0 on success and -1 if the stream filled up, -2 if the port is invalid
+int midi_stream_send_timed_bytes(int port, uint8_t *buf, int len,
+        uint32_t time, uint32_t byte_time) {
+    int i, ret = 0;
+    if(port < 0 || port >= MIDI_MAX_PORTS) {
+        log_error("mssbt - port invalid: %d", port);
+        return -2;
     }
-    return 0;
+    for(i = 0; i < len; i ++) {
+        if(midi_stream_parse_byte(port, buf[i], time) == -1) {
+            ret = -1;  // keep parsing so the state stays in sync
+        }
+        time += byte_time;
+    }
+    return ret;
 }
 
 // check if there are messages in the stream
@@ -372,16 +317,214 @@ int midi_stream_data_available(int port) {
 // get a message from a stream - the msg will be copied
 // returns 0 on success and -1 if there is no data to get, -2 if port is invalid
 int midi_stream_receive_msg(int port, struct midi_msg *msg) {
+    int outp;
     if(port < 0 || port >= MIDI_MAX_PORTS) {
         log_error("msda - port invalid: %d", port);
         return -2;
     }
-    if(midi_stream_queue_inp[port] == midi_stream_queue_outp[port]) {
+    outp = midi_stream_queue_outp[port];
+    if(midi_stream_queue_inp[port] == outp) {
         return -1;
     }
-    midi_utils_copy_msg(msg, &midi_stream_queue[port][midi_stream_queue_outp[port]]);
-    midi_stream_queue_outp[port] = (midi_stream_queue_outp[port] + 1) & MIDI_STREAM_BUFMASK;
+    MIDI_STREAM_BARRIER();  // data must be read after it is published
+    midi_utils_copy_msg(msg, &midi_stream_queue[port][outp]);
+    MIDI_STREAM_BARRIER();  // data must be read before the slot is freed
+    midi_stream_queue_outp[port] = (outp + 1) & MIDI_STREAM_BUFMASK;
     return 0;
 }
 
+// get a contiguous span of messages from a stream without removing them
+// msgs is set to the first message - call midi_stream_consume() when done
+// returns the number of messages in the span, -2 if the port is invalid
+int midi_stream_peek(int port, struct midi_msg **msgs) {
+    int inp, outp;
+    if(port < 0 || port >= MIDI_MAX_PORTS) {
+        log_error("msp - port invalid: %d", port);
+        return -2;
+    }
+    inp = midi_stream_queue_inp[port];
+    outp = midi_stream_queue_outp[port];
+    if(inp == outp) {
+        return 0;
+    }
+    MIDI_STREAM_BARRIER();  // data must be read after it is published
+    *msgs = &midi_stream_queue[port][outp];
+    if(inp > outp) {
+        return inp - outp;
+    }
+    return MIDI_STREAM_BUFSIZE - outp;  // stop at the end of the ring
+}
+
+// remove messages from a stream after they have been processed
+// returns 0 on success and -1 if count is more than is queued, -2 if port is invalid
+int midi_stream_consume(int port, int count) {
+    int outp;
+    if(port < 0 || port >= MIDI_MAX_PORTS) {
+        log_error("msco - port invalid: %d", port);
+        return -2;
+    }
+    outp = midi_stream_queue_outp[port];
+    if(count < 0 || count > ((midi_stream_queue_inp[port] - outp) & MIDI_STREAM_BUFMASK)) {
+        log_error("msco - count invalid: %d", count);
+        return -1;
+    }
+    MIDI_STREAM_BARRIER();  // data must be read before the slots are freed
+    midi_stream_queue_outp[port] = (outp + count) & MIDI_STREAM_BUFMASK;
+    return 0;
+}
+
+//
+// local functions
+//
+// parse a byte into a stream - the port must be valid
+// returns 0 on success and -1 if the stream is full
+int midi_stream_parse_byte(int port, uint8_t send_byte, uint32_t time) {
+    struct midi_stream_parser *parser = &midi_stream_parsers[port];
+    int entry, ret = 0;
+
+    // data byte
+    if(!(send_byte & 0x80)) {
+        // SYSEX data is sent in chunks of 3 bytes
+        if(parser->sysex) {
+            if(!parser->timed) {
+                parser->time = time;
+                parser->timed = 1;
+            }
+            parser->data[parser->count++] = send_byte;
+            if(parser->count == 3) {
+                parser->count = 0;
+                parser->timed = 0;
+                return midi_stream_parser_send(port, 3, parser->data[0],
+                    parser->data[1], parser->data[2], parser->time);
+            }
+            return 0;
+        }
+        // no status - stray data is dropped
+        if(parser->status == 0) {
+            return 0;
+        }
+        // running status - the message starts with this byte
+        if(!parser->timed) {
+            parser->time = time;
+            parser->timed = 1;
+        }
+        parser->data[parser->count++] = send_byte;
+        if(parser->count < parser->data_len) {
+            return 0;
+        }
+        // message complete
+        parser->count = 0;
+        parser->timed = 0;
+        // note on with velocity 0 is sent as note off
+        if((parser->status & 0xf0) == MIDI_NOTE_ON && parser->data[1] == 0x00) {
+            ret = midi_stream_parser_send(port, 3,
+                MIDI_NOTE_OFF | (parser->status & 0x0f), parser->data[0], 0x40,
+                parser->time);
+        }
+        else {
+            ret = midi_stream_parser_send(port, parser->data_len + 1,
+                parser->status, parser->data[0], parser->data[1], parser->time);
+        }
+        // only channel messages keep running status
+        if(parser->status >= 0xf0) {
+            parser->status = 0;
+        }
+        return ret;
+    }
+
+    // status byte
+    entry = midi_stream_status_table[MIDI_STREAM_STATUS_INDEX(send_byte)];
+    switch(entry & MIDI_STREAM_ST_TYPE_MASK) {
+        case MIDI_STREAM_ST_REALTIME:
+            return midi_stream_parser_send(port, 1, send_byte, 0, 0, time);
+        case MIDI_STREAM_ST_RT_UNDEF:
+            return 0;
+        case MIDI_STREAM_ST_RESET:
+            midi_stream_parser_reset(parser);
+            return midi_stream_parser_send(port, 1, send_byte, 0, 0, time);
+        case MIDI_STREAM_ST_SYSEX_END:
+            parser->status = 0;
+            if(!parser->sysex) {
+                return 0;  // stray end
+            }
+            return midi_stream_parser_end_sysex(port, parser, time);
+        default:
+            break;
+    }
+
+    // any other status byte ends a SYSEX message in progress
+    if(parser->sysex) {
+        ret = midi_stream_parser_end_sysex(port, parser, time);
+    }
+    parser->status = 0;
+    parser->count = 0;
+    parser->time = time;
+    parser->timed = 1;
+    switch(entry & MIDI_STREAM_ST_TYPE_MASK) {
+        case MIDI_STREAM_ST_SYSEX_START:
+            parser->sysex = 1;
+            parser->data[0] = send_byte;
+            parser->count = 1;
+            break;
+        case MIDI_STREAM_ST_CHAN:
+        case MIDI_STREAM_ST_COMMON:
+            if((entry & MIDI_STREAM_ST_LEN_MASK) == 0) {
+                // single byte common message
+                if(midi_stream_parser_send(port, 1, send_byte, 0, 0, time) == -1) {
+                    ret = -1;
+                }
+                parser->timed = 0;
+                break;
+            }
+            parser->status = send_byte;
+            parser->data_len = entry & MIDI_STREAM_ST_LEN_MASK;
+            break;
+        case MIDI_STREAM_ST_UNDEF:
+        default:
+            parser->timed = 0;
+            break;
+    }
+    return ret;
+}
+
+// reset a parser
+void midi_stream_parser_reset(struct midi_stream_parser *parser) {
+    parser->status = 0;
+    parser->data_len = 0;
+    parser->count = 0;
+    parser->sysex = 0;
+    parser->timed = 0;
+    parser->time = 0;
+}
 
+// end a SYSEX message - sends the remaining bytes with 0xf7 appended
+// time is the time of the byte that ended the message
+// returns 0 on success and -1 if the stream is full
+int midi_stream_parser_end_sysex(int port, struct midi_stream_parser *parser,
+        uint32_t time) {
+    int ret;
+    if(!parser->timed) {
+        parser->time = time;
+    }
+    parser->data[parser->count++] = MIDI_SYSEX_END;
+    ret = midi_stream_parser_send(port, parser->count, parser->data[0],
+        parser->data[1], parser->data[2], parser->time);
+    parser->count = 0;
+    parser->sysex = 0;
+    parser->timed = 0;
+    return ret;
+}
+
+// send a parsed message into a stream
+// returns 0 on success and -1 if the stream is full
+int midi_stream_parser_send(int port, int len, uint8_t status,
+        uint8_t data0, uint8_t data1, uint32_t time) {
+    struct midi_msg msg;
+    msg.port = port;
+    msg.len = len;
+    msg.status = status;
+    msg.data0 = data0;
+    msg.data1 = data1;
+    msg.timestamp = time;
+    return midi_stream_send_msg(&msg);
+}
@@ -36,6 +36,15 @@ void midi_stream_init(void);
 // returns 0 on success and -1 if the stream is full, -2 if the port is invalid
 int midi_stream_send_msg(struct midi_msg *msg);
 
+// reserve a contiguous span of free slots in a stream for writing in place
+// msgs is set to the first free slot - the port of each msg must be set
+// returns the number of slots available, -2 if the port is invalid
+int midi_stream_reserve(int port, struct midi_msg **msgs);
+
+// commit messages written to a span returned by midi_stream_reserve()
+// returns 0 on success and -1 if count is more than is free, -2 if port is invalid
+int midi_stream_commit(int port, int count);
+
 // put a SYSEX message into a stream - the data will be copied
 // data is converted in 1-3 byte chunks and sent in midi_message structs
 // returns 0 on success and -1 if the stream is full or msg too long
@@ -47,6 +56,18 @@ int midi_stream_send_sysex_msg(int port, uint8_t *buf, int len);
 // returns 0 on success and -1 if the stream is full, -2 if the port is invalid
 int midi_stream_send_byte(int port, uint8_t send_byte);
 
+// put a buffer of bytes into a stream - same as calling midi_stream_send_byte()
+// for each byte but the port is only checked once
+// returns 0 on success and -1 if the stream filled up, -2 if the port is invalid
+int midi_stream_send_bytes(int port, uint8_t *buf, int len);
+
+// put a buffer of timed bytes into a stream - the first byte arrived at
+// time and each following byte arrived byte_time later - times are in us
+// each message is stamped with the time of its first byte
+// returns 0 on success and -1 if the stream filled up, -2 if the port is invalid
+int midi_stream_send_timed_bytes(int port, uint8_t *buf, int len,
+    uint32_t time, uint32_t byte_time);
+
 // check if there are messages in the stream
 // returns 1 if there is data available, -1 if port is invalid, otherwise returns 0
 int midi_stream_data_available(int port);
@@ -55,5 +76,14 @@ int midi_stream_data_available(int port);
 // returns 0 on success and -1 if there is no data to get, -2 if port is invalid
 int midi_stream_receive_msg(int port, struct midi_msg *msg);
 
+// get a contiguous span of messages from a stream without removing them
+// msgs is set to the first message - call midi_stream_consume() when done
+// returns the number of messages in the span, -2 if the port is invalid
+int midi_stream_peek(int port, struct midi_msg **msgs);
+
+// remove messages from a stream after they have been processed
+// returns 0 on success and -1 if count is more than is queued, -2 if port is invalid
+int midi_stream_consume(int port, int count);
+
 #endif
 
@@ -0,0 +1,397 @@
+/*
+ * USB MIDI Event Packets
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "midi_usb.h"
+#include "midi_protocol.h"
+#include "midi_stream.h"
+#include "../util/log.h"
+#include <string.h>
+
+// number of bytes in an event for each CIN - 0 = reserved
+static const uint8_t midi_usb_cin_len[16] = {
+    0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1
+};
+
+// local functions
+int midi_usb_rx_realtime(struct midi_usb_rx *rx, int port, uint8_t status,
+    uint32_t time);
+int midi_usb_rx_sysex_byte(struct midi_usb_rx *rx, int port, uint8_t rx_byte,
+    uint32_t time);
+int midi_usb_rx_end_sysex(struct midi_usb_rx *rx, int port, uint32_t time);
+int midi_usb_rx_send(int port, int len, uint8_t status, uint8_t data0,
+    uint8_t data1, uint32_t time);
+
+// get the CIN for a message
+// returns -1 if the message length is invalid
+int midi_usb_get_cin(struct midi_msg *msg) {
+    if(msg->len < 1 || msg->len > 3) {
+        return -1;
+    }
+    // check voice messages (upper nibble only)
+    switch(msg->status & 0xf0) {
+        case MIDI_NOTE_OFF:
+            return MIDI_CIN_NOTE_OFF;
+        case MIDI_NOTE_ON:
+            return MIDI_CIN_NOTE_ON;
+        case MIDI_POLY_KEY_PRESSURE:
+            return MIDI_CIN_POLY_KEY_PRESSURE;
+        case MIDI_CONTROL_CHANGE:
+            return MIDI_CIN_CONTROL_CHANGE;
+        case MIDI_PROGRAM_CHANGE:
+            return MIDI_CIN_PROGRAM_CHANGE;
+        case MIDI_CHANNEL_PRESSURE:
+            return MIDI_CIN_CHANNEL_PRESSURE;
+        case MIDI_PITCH_BEND:
+            return MIDI_CIN_PITCH_BEND;
+    }
+    // system common messages
+    switch(msg->status) {
+        case MIDI_MTC_QFRAME:
+            return MIDI_CIN_MTC;
+        case MIDI_SONG_POSITION:
+            return MIDI_CIN_SONG_POSITION;
+        case MIDI_SONG_SELECT:
+            return MIDI_CIN_SONG_SELECT;
+        case MIDI_TUNE_REQUEST:
+            return MIDI_CIN_1_BYTE_MESSAGE;
+    }
+    // realtime messages
+    if(msg->status >= MIDI_TIMING_TICK) {
+        return MIDI_CIN_SINGLE_BYTE;
+    }
+    // SYSEX chunk - start, data or end - the last byte says if it ends here
+    switch(msg->len) {
+        case 1:
+            if(msg->status == MIDI_SYSEX_END) {
+                return MIDI_CIN_SYSEX_ENDS_1;
+            }
+            return MIDI_CIN_SINGLE_BYTE;
+        case 2:
+            if(msg->data0 == MIDI_SYSEX_END) {
+                return MIDI_CIN_SYSEX_ENDS_2;
+            }
+            return MIDI_CIN_2_BYTE_MESSAGE;
+        default:
+            if(msg->data1 == MIDI_SYSEX_END) {
+                return MIDI_CIN_SYSEX_ENDS_3;
+            }
+            return MIDI_CIN_SYSEX_CONTINUE;
+    }
+}
+
+// encode a message into a USB MIDI event packet for a cable
+// returns 0 on success or -1 if the message or cable is invalid
+int midi_usb_encode_event(struct midi_msg *msg, int cable, uint8_t *event) {
+    int cin;
+    if(cable < 0 || cable >= MIDI_USB_NUM_CABLES) {
+        log_error("mue - cable invalid: %d", cable);
+        return -1;
+    }
+    cin = midi_usb_get_cin(msg);
+    if(cin == -1) {
+        return -1;
+    }
+    event[0] = (cable << 4) | cin;
+    event[1] = msg->status;
+    if(msg->len > 1) {
+        event[2] = msg->data0;
+    }
+    else {
+        event[2] = 0;
+    }
+    if(msg->len > 2) {
+        event[3] = msg->data1;
+    }
+    else {
+        event[3] = 0;
+    }
+    return 0;
+}
+
+//
+// outgoing event queues
+//
+// reset the event queues
+void midi_usb_tx_init(struct midi_usb_tx *tx) {
+    tx->q_inp = 0;
+    tx->q_outp = 0;
+    tx->rt_q_inp = 0;
+    tx->rt_q_outp = 0;
+}
+
+// queue a message as an event for a cable - realtime messages use the fast lane
+// returns 0 on success, -1 if the queue is full, -2 if the message is invalid
+int midi_usb_tx_queue_msg(struct midi_usb_tx *tx, struct midi_msg *msg, int cable) {
+    if(midi_utils_is_realtime_msg(msg)) {
+        if(((tx->rt_q_inp - tx->rt_q_outp) & MIDI_USB_TX_RT_QUEUE_BUFMASK) ==
+                MIDI_USB_TX_RT_QUEUE_BUFMASK) {
+            return -1;
+        }
+        if(midi_usb_encode_event(msg, cable, tx->rt_q[tx->rt_q_inp]) == -1) {
+            return -2;
+        }
+        tx->rt_q_inp = (tx->rt_q_inp + 1) & MIDI_USB_TX_RT_QUEUE_BUFMASK;
+        return 0;
+    }
+    if(((tx->q_inp - tx->q_outp) & MIDI_USB_TX_QUEUE_BUFMASK) ==
+            MIDI_USB_TX_QUEUE_BUFMASK) {
+        return -1;
+    }
+    if(midi_usb_encode_event(msg, cable, tx->q[tx->q_inp]) == -1) {
+        return -2;
+    }
+    tx->q_inp = (tx->q_inp + 1) & MIDI_USB_TX_QUEUE_BUFMASK;
+    return 0;
+}
+
+// queue all the messages waiting in a MIDI stream as events for a cable
+// messages that don't fit stay in the stream to be queued next time
+// returns the number of messages taken from the stream, -2 if the port is invalid
+int midi_usb_tx_queue_stream(struct midi_usb_tx *tx, int port, int cable) {
+    struct midi_msg *msgs;
+    int i, num, total = 0;
+    while((num = midi_stream_peek(port, &msgs)) > 0) {
+        for(i = 0; i < num; i ++) {
+            // invalid messages are dropped
+            if(midi_usb_tx_queue_msg(tx, &msgs[i], cable) == -1) {
+                break;
+            }
+        }
+        midi_stream_consume(port, i);
+        total += i;
+        if(i < num) {
+            break;  // queue is full
+        }
+    }
+    if(num == -2) {
+        return -2;
+    }
+    return total;
+}
+
+// get the number of events waiting in the event queue - not including realtime
+int midi_usb_tx_get_queued(struct midi_usb_tx *tx) {
+    return (tx->q_inp - tx->q_outp) & MIDI_USB_TX_QUEUE_BUFMASK;
+}
+
+// get the number of realtime events waiting in the fast lane
+int midi_usb_tx_get_rt_queued(struct midi_usb_tx *tx) {
+    return (tx->rt_q_inp - tx->rt_q_outp) & MIDI_USB_TX_RT_QUEUE_BUFMASK;
+}
+
+// fill a transfer buffer - waiting realtime events go first and then queued events
+// returns the number of events put in buf - rt_events is set to the number of realtime events
+int midi_usb_tx_fill(struct midi_usb_tx *tx, uint8_t *buf, int max_events,
+        int *rt_events) {
+    int count = 0;
+    while(tx->rt_q_inp != tx->rt_q_outp && count < max_events) {
+        memcpy(&buf[count * MIDI_USB_EVENT_LEN], tx->rt_q[tx->rt_q_outp],
+            MIDI_USB_EVENT_LEN);
+        tx->rt_q_outp = (tx->rt_q_outp + 1) & MIDI_USB_TX_RT_QUEUE_BUFMASK;
+        count ++;
+    }
+    *rt_events = count;
+    while(tx->q_inp != tx->q_outp && count < max_events) {
+        memcpy(&buf[count * MIDI_USB_EVENT_LEN], tx->q[tx->q_outp],
+            MIDI_USB_EVENT_LEN);
+        tx->q_outp = (tx->q_outp + 1) & MIDI_USB_TX_QUEUE_BUFMASK;
+        count ++;
+    }
+    return count;
+}
+
+//
+// incoming events
+//
+// reset the incoming SYSEX state for a cable
+void midi_usb_rx_init(struct midi_usb_rx *rx) {
+    rx->sysex = 0;
+    rx->count = 0;
+    rx->time = 0;
+}
+
+// decode an incoming event and put the message into a stream - time is in us
+// invalid events are dropped and SYSEX data is put in when a chunk is complete
+// returns 0 on success and -1 if the stream is full, -2 if the port is invalid
+int midi_usb_rx_event(struct midi_usb_rx *rx, int port, uint8_t *event,
+        uint32_t time) {
+    int i, len, msg_len, ret = 0;
+    uint8_t status = event[1];
+    uint8_t data1 = event[3];
+
+    len = midi_usb_cin_len[event[0] & 0x0f];
+    if(len == 0) {
+        return 0;  // reserved CIN
+    }
+    // realtime - can be sent in the middle of a SYSEX message
+    if(status >= MIDI_TIMING_TICK) {
+        return midi_usb_rx_realtime(rx, port, status, time);
+    }
+    // single bytes can be any part of a message - the stream byte parser
+    // for the port puts them together so each cable has its own parser
+    if((event[0] & 0x0f) == MIDI_CIN_SINGLE_BYTE) {
+        return midi_stream_send_timed_bytes(port, &event[1], 1, time, 0);
+    }
+    // SYSEX start, data or end
+    if(status < 0x80 || status == MIDI_SYSEX_START || status == MIDI_SYSEX_END) {
+        for(i = 1; i <= len; i ++) {
+            if(midi_usb_rx_sysex_byte(rx, port, event[i], time) == -1) {
+                ret = -1;
+            }
+        }
+        return ret;
+    }
+
+    // any other message ends a SYSEX message in progress
+    if(rx->sysex) {
+        ret = midi_usb_rx_end_sysex(rx, port, time);
+    }
+    // get the message length from the status
+    switch(status & 0xf0) {
+        case MIDI_PROGRAM_CHANGE:
+        case MIDI_CHANNEL_PRESSURE:
+            msg_len = 2;
+            break;
+        case 0xf0:
+            switch(status) {
+                case MIDI_MTC_QFRAME:
+                case MIDI_SONG_SELECT:
+                    msg_len = 2;
+                    break;
+                case MIDI_SONG_POSITION:
+                    msg_len = 3;
+                    break;
+                case MIDI_TUNE_REQUEST:
+                    msg_len = 1;
+                    break;
+                default:
+                    return ret;  // undefined
+            }
+            break;
+        default:
+            msg_len = 3;
+            break;
+    }
+    // the event must hold the whole message with valid data bytes
+    if(len < msg_len) {
+        return ret;
+    }
+    if((msg_len > 1 && (event[2] & 0x80)) || (msg_len > 2 && (data1 & 0x80))) {
+        return ret;
+    }
+    // note on with velocity 0 is sent as note off
+    if((status & 0xf0) == MIDI_NOTE_ON && data1 == 0x00) {
+        status = MIDI_NOTE_OFF | (status & 0x0f);
+        data1 = 0x40;
+    }
+    if(midi_usb_rx_send(port, msg_len, status, (msg_len > 1) ? event[2] : 0,
+            (msg_len > 2) ? data1 : 0, time) == -1) {
+        ret = -1;
+    }
+    return ret;
+}
+
+//
+// local functions
+//
+// put a realtime message into a stream - undefined messages are dropped
+// returns 0 on success and -1 if the stream is full
+int midi_usb_rx_realtime(struct midi_usb_rx *rx, int port, uint8_t status,
+        uint32_t time) {
+    switch(status) {
+        case 0xf9:
+        case 0xfd:
+            return 0;
+        case MIDI_SYSTEM_RESET:
+            midi_usb_rx_init(rx);
+            break;
+        default:
+            break;
+    }
+    return midi_usb_rx_send(port, 1, status, 0, 0, time);
+}
+
+// add a byte from a SYSEX event - data is sent in chunks of 3 bytes
+// returns 0 on success and -1 if the stream is full
+int midi_usb_rx_sysex_byte(struct midi_usb_rx *rx, int port, uint8_t rx_byte,
+        uint32_t time) {
+    int ret = 0;
+    // data byte - stray data is dropped
+    if(!(rx_byte & 0x80)) {
+        if(!rx->sysex) {
+            return 0;
+        }
+        if(rx->count == 0) {
+            rx->time = time;
+        }
+        rx->data[rx->count++] = rx_byte;
+        if(rx->count == 3) {
+            rx->count = 0;
+            return midi_usb_rx_send(port, 3, rx->data[0], rx->data[1],
+                rx->data[2], rx->time);
+        }
+        return 0;
+    }
+    if(rx_byte >= MIDI_TIMING_TICK) {
+        return midi_usb_rx_realtime(rx, port, rx_byte, time);
+    }
+    // any other status byte ends a SYSEX message in progress
+    if(rx->sysex) {
+        ret = midi_usb_rx_end_sysex(rx, port, time);
+    }
+    if(rx_byte == MIDI_SYSEX_START) {
+        rx->sysex = 1;
+        rx->data[0] = rx_byte;
+        rx->count = 1;
+        rx->time = time;
+    }
+    return ret;
+}
+
+// end a SYSEX message - sends the remaining bytes with 0xf7 appended
+// returns 0 on success and -1 if the stream is full
+int midi_usb_rx_end_sysex(struct midi_usb_rx *rx, int port, uint32_t time) {
+    int ret;
+    if(rx->count == 0) {
+        rx->time = time;
+    }
+    rx->data[rx->count++] = MIDI_SYSEX_END;
+    ret = midi_usb_rx_send(port, rx->count, rx->data[0], rx->data[1],
+        rx->data[2], rx->time);
+    rx->count = 0;
+    rx->sysex = 0;
+    return ret;
+}
+
+// send a decoded message into a stream
+// returns 0 on success and -1 if the stream is full, -2 if the port is invalid
+int midi_usb_rx_send(int port, int len, uint8_t status, uint8_t data0,
+        uint8_t data1, uint32_t time) {
+    struct midi_msg msg;
+    msg.port = port;
+    msg.len = len;
+    msg.status = status;
+    msg.data0 = data0;
+    msg.data1 = data1;
+    msg.timestamp = time;
+    return midi_stream_send_msg(&msg);
+}
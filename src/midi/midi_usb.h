@@ -0,0 +1,152 @@
+/*
+ * USB MIDI Event Packets
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * USB MIDI carries each message in a 4 byte event packet. The first byte
+ * holds the cable number in the upper nibble and the code index number
+ * (CIN) in the lower nibble. The CIN gives the type and length of the
+ * message in the other 3 bytes, which are padded with zeros.
+ *
+ * SYSEX chunks from the MIDI stream are sent with the SYSEX start /
+ * continue CIN unless they end with 0xf7, in which case the SYSEX ends
+ * CIN for the chunk length is used. Realtime messages use the single
+ * byte CIN.
+ *
+ * Outgoing events are queued for bulk transfers with realtime messages in
+ * a separate fast lane. Each transfer is filled with the waiting realtime
+ * events first and then as many queued events as fit. Realtime messages
+ * may be sent ahead of other messages, even in the middle of a SYSEX
+ * message, so this keeps the order that matters. The queues have one
+ * producer and one consumer so that they can be filled from a task and
+ * emptied from an interrupt.
+ *
+ * Incoming events are decoded by CIN straight into messages. Voice, system
+ * common and realtime messages are complete in a single event so they are
+ * put into the stream as they are. Only SYSEX data goes through a small
+ * accumulator per cable which makes the same 3 byte chunks that the byte
+ * parser in midi_stream does. Events with realtime bytes on the 1 byte CIN
+ * and SYSEX data on the 2 or 3 byte CINs are also accepted since some
+ * devices send them that way. Other bytes on the single byte CIN can be
+ * any part of a message, so they go through the midi_stream byte parser
+ * of the port for the cable.
+ *
+ */
+#ifndef MIDI_USB_H
+#define MIDI_USB_H
+
+#include <inttypes.h>
+#include "midi_utils.h"
+
+// code index numbers
+#define MIDI_CIN_MISC_FUNCTION_RESERVED         0x00
+#define MIDI_CIN_CABLE_EVENTS_RESERVED          0x01
+#define MIDI_CIN_2_BYTE_MESSAGE                 0x02
+#define MIDI_CIN_MTC                            0x02
+#define MIDI_CIN_SONG_SELECT                    0x02
+#define MIDI_CIN_3_BYTE_MESSAGE                 0x03
+#define MIDI_CIN_SONG_POSITION                  0x03
+#define MIDI_CIN_SYSEX_START                    0x04
+#define MIDI_CIN_SYSEX_CONTINUE                 0x04
+#define MIDI_CIN_1_BYTE_MESSAGE                 0x05
+#define MIDI_CIN_SYSEX_ENDS_1                   0x05
+#define MIDI_CIN_SYSEX_ENDS_2                   0x06
+#define MIDI_CIN_SYSEX_ENDS_3                   0x07
+#define MIDI_CIN_NOTE_OFF                       0x08
+#define MIDI_CIN_NOTE_ON                        0x09
+#define MIDI_CIN_POLY_KEY_PRESSURE              0x0a
+#define MIDI_CIN_CONTROL_CHANGE                 0x0b
+#define MIDI_CIN_PROGRAM_CHANGE                 0x0c
+#define MIDI_CIN_CHANNEL_PRESSURE               0x0d
+#define MIDI_CIN_PITCH_BEND                     0x0e
+#define MIDI_CIN_SINGLE_BYTE                    0x0f
+
+// sizes
+#define MIDI_USB_EVENT_LEN 4  // bytes per event packet
+#define MIDI_USB_NUM_CABLES 16
+#define MIDI_USB_TX_QUEUE_BUFSIZE 256  // events (must be a power of 2)
+#define MIDI_USB_TX_QUEUE_BUFMASK (MIDI_USB_TX_QUEUE_BUFSIZE - 1)
+#define MIDI_USB_TX_RT_QUEUE_BUFSIZE 16  // realtime events (must be a power of 2)
+#define MIDI_USB_TX_RT_QUEUE_BUFMASK (MIDI_USB_TX_RT_QUEUE_BUFSIZE - 1)
+
+// outgoing event queues
+struct midi_usb_tx {
+    uint8_t q[MIDI_USB_TX_QUEUE_BUFSIZE][MIDI_USB_EVENT_LEN];  // event queue
+    volatile uint32_t q_inp;  // event queue in pointer
+    volatile uint32_t q_outp;  // event queue out pointer
+    uint8_t rt_q[MIDI_USB_TX_RT_QUEUE_BUFSIZE][MIDI_USB_EVENT_LEN];  // realtime queue
+    volatile uint32_t rt_q_inp;  // realtime queue in pointer
+    volatile uint32_t rt_q_outp;  // realtime queue out pointer
+};
+
+// incoming SYSEX state for a cable
+struct midi_usb_rx {
+    uint8_t sysex;  // 1 = SYSEX message in progress
+    uint8_t count;  // number of bytes in the chunk
+    uint8_t data[3];  // SYSEX chunk
+    uint32_t time;  // time of the first byte in the chunk
+};
+
+// get the CIN for a message
+// returns -1 if the message length is invalid
+int midi_usb_get_cin(struct midi_msg *msg);
+
+// encode a message into a USB MIDI event packet for a cable
+// returns 0 on success or -1 if the message or cable is invalid
+int midi_usb_encode_event(struct midi_msg *msg, int cable, uint8_t *event);
+
+//
+// outgoing event queues
+//
+// reset the event queues
+void midi_usb_tx_init(struct midi_usb_tx *tx);
+
+// queue a message as an event for a cable - realtime messages use the fast lane
+// returns 0 on success, -1 if the queue is full, -2 if the message is invalid
+int midi_usb_tx_queue_msg(struct midi_usb_tx *tx, struct midi_msg *msg, int cable);
+
+// queue all the messages waiting in a MIDI stream as events for a cable
+// messages that don't fit stay in the stream to be queued next time
+// returns the number of messages taken from the stream, -2 if the port is invalid
+int midi_usb_tx_queue_stream(struct midi_usb_tx *tx, int port, int cable);
+
+// get the number of events waiting in the event queue - not including realtime
+int midi_usb_tx_get_queued(struct midi_usb_tx *tx);
+
+// get the number of realtime events waiting in the fast lane
+int midi_usb_tx_get_rt_queued(struct midi_usb_tx *tx);
+
+// fill a transfer buffer - waiting realtime events go first and then queued events
+// returns the number of events put in buf - rt_events is set to the number of realtime events
+int midi_usb_tx_fill(struct midi_usb_tx *tx, uint8_t *buf, int max_events,
+    int *rt_events);
+
+//
+// incoming events
+//
+// reset the incoming SYSEX state for a cable
+void midi_usb_rx_init(struct midi_usb_rx *rx);
+
+// decode an incoming event and put the message into a stream - time is in us
+// invalid events are dropped and SYSEX data is put in when a chunk is complete
+// returns 0 on success and -1 if the stream is full, -2 if the port is invalid
+int midi_usb_rx_event(struct midi_usb_rx *rx, int port, uint8_t *event,
+    uint32_t time);
+
+#endif
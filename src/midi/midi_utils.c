@@ -69,6 +69,7 @@ void midi_utils_copy_msg(struct midi_msg *dest, struct midi_msg *src) {
     dest->status = src->status;
     dest->data0 = src->data0;
     dest->data1 = src->data1;
+    dest->timestamp = src->timestamp;
 }
 
 // compare two messages to see if the contents match
@@ -167,6 +168,16 @@ int midi_utils_is_clock_msg(struct midi_msg *msg) {
     return 0;
 }
 
+// check if a message is a realtime message
+// - if the message is a single byte with a status byte of 0xf8 or above
+// returns 1 if the message is a realtime message, or 0 otherwise
+int midi_utils_is_realtime_msg(struct midi_msg *msg) {
+    if(msg->len == 1 && msg->status >= MIDI_TIMING_TICK) {
+        return 1;
+    }
+    return 0;
+}
+
 
 //
 // MIDI event helpers
@@ -193,6 +204,7 @@ void midi_utils_enc_note_on(struct midi_msg *msg, int port, int channel,
     msg->status = MIDI_NOTE_ON | (channel & 0x0f);
     msg->data0 = note & 0x7f;
     msg->data1 = velocity & 0x7f;
+    msg->timestamp = 0;
 }
 
 // encode note off
@@ -203,6 +215,7 @@ void midi_utils_enc_note_off(struct midi_msg *msg, int port, int channel,
     msg->status = MIDI_NOTE_OFF | (channel & 0x0f);
     msg->data0 = note & 0x7f;
     msg->data1 = velocity & 0x7f;
+    msg->timestamp = 0;
 }
 
 // encode poly key pressure
@@ -213,6 +226,7 @@ void midi_utils_enc_key_pressure(struct midi_msg *msg, int port, int channel,
     msg->status = MIDI_POLY_KEY_PRESSURE | (channel & 0x0f);
     msg->data0 = note & 0x7f;
     msg->data1 = pressure & 0x7f;
+    msg->timestamp = 0;
 }
 
 // encode control change
@@ -223,6 +237,7 @@ void midi_utils_enc_control_change(struct midi_msg *msg, int port, int channel,
     msg->status = MIDI_CONTROL_CHANGE | (channel & 0x0f);
     msg->data0 = controller & 0x7f;
     msg->data1 = value & 0x7f;
+    msg->timestamp = 0;
 }
 
 // encode program change
@@ -232,6 +247,7 @@ void midi_utils_enc_program_change(struct midi_msg *msg, int port, int channel,
     msg->len = 2;
     msg->status = MIDI_PROGRAM_CHANGE | (channel & 0x0f);
     msg->data0 = program & 0x7f;
+    msg->timestamp = 0;
 }
 
 // encode channel pressure
@@ -241,6 +257,7 @@ void midi_utils_enc_channel_pressure(struct midi_msg *msg, int port, int channel
     msg->len = 2;
     msg->status = MIDI_CHANNEL_PRESSURE | (channel & 0x0f);
     msg->data0 = pressure & 0x7f;
+    msg->timestamp = 0;
 }
 
 // encode pitch bend
@@ -251,6 +268,7 @@ void midi_utils_enc_pitch_bend(struct midi_msg *msg, int port, int channel,
     msg->status = MIDI_PITCH_BEND | (channel & 0x0f);
     msg->data0 = (bend + 8192) & 0x7f;
     msg->data1 = ((bend + 8192) >> 7) & 0x7f;
+    msg->timestamp = 0;
 }
 
 // encode mtc qframe
@@ -258,6 +276,7 @@ void midi_utils_enc_mtc_qframe(struct midi_msg *msg, int port) {
     msg->port = port;
     msg->len = 1;
     msg->status = MIDI_MTC_QFRAME;
+    msg->timestamp = 0;
 }
 
 // encode song position
@@ -267,6 +286,7 @@ void midi_utils_enc_song_position(struct midi_msg *msg, int port, int pos) {
     msg->status = MIDI_SONG_POSITION;
     msg->data0 = pos & 0x7f;
     msg->data1 = (pos >> 7) & 0x7f;
+    msg->timestamp = 0;
 }
 
 // encode song select
@@ -275,6 +295,7 @@ void midi_utils_enc_song_select(struct midi_msg *msg, int port, int song) {
     msg->len = 2;
     msg->status = MIDI_SONG_SELECT;
     msg->data0 = song & 0x7f;
+    msg->timestamp = 0;
 }
 
 // encode tune request
@@ -282,6 +303,7 @@ void midi_utils_enc_tune_request(struct midi_msg *msg, int port) {
     msg->port = port;
     msg->len = 1;
     msg->status = MIDI_TUNE_REQUEST;
+    msg->timestamp = 0;
 }
 
 // encode timing tick
@@ -289,6 +311,7 @@ void midi_utils_enc_timing_tick(struct midi_msg *msg, int port) {
     msg->port = port;
     msg->len = 1;
     msg->status = MIDI_TIMING_TICK;
+    msg->timestamp = 0;
 }
 
 // encode clock start
@@ -296,6 +319,7 @@ void midi_utils_enc_clock_start(struct midi_msg *msg, int port) {
     msg->port = port;
     msg->len = 1;
     msg->status = MIDI_CLOCK_START;
+    msg->timestamp = 0;
 }
 
 // encode clock continue
@@ -303,6 +327,7 @@ void midi_utils_enc_clock_continue(struct midi_msg *msg, int port) {
     msg->port = port;
     msg->len = 1;
     msg->status = MIDI_CLOCK_CONTINUE;
+    msg->timestamp = 0;
 }
 
 // encode clock stop
@@ -310,6 +335,7 @@ void midi_utils_enc_clock_stop(struct midi_msg *msg, int port) {
     msg->port = port;
     msg->len = 1;
     msg->status = MIDI_CLOCK_STOP;
+    msg->timestamp = 0;
 }
 
 // encode active sensing
@@ -317,6 +343,7 @@ void midi_utils_enc_active_sensing(struct midi_msg *msg, int port) {
     msg->port = port;
     msg->len = 1;
     msg->status = MIDI_ACTIVE_SENSING;
+    msg->timestamp = 0;
 }
 
 // encode system reset
@@ -324,6 +351,7 @@ void midi_utils_enc_system_reset(struct midi_msg *msg, int port) {
     msg->port = port;
     msg->len = 1;
     msg->status = MIDI_SYSTEM_RESET;
+    msg->timestamp = 0;
 }
 
 // encode an arbitrary message with 1 byte
@@ -331,6 +359,7 @@ void midi_utils_enc_1byte(struct midi_msg *msg, int port, int status) {
     msg->port = port;
     msg->len = 1;
     msg->status = status;
+    msg->timestamp = 0;
 }
 
 // encode an arbitrary message with 2 bytes
@@ -340,6 +369,7 @@ void midi_utils_enc_2byte(struct midi_msg *msg, int port, int status,
     msg->len = 2;
     msg->status = status;
     msg->data0 = data0;
+    msg->timestamp = 0;
 }
 
 // encode an arbitrary message with 3 bytes
@@ -350,4 +380,5 @@ void midi_utils_enc_3byte(struct midi_msg *msg, int port, int status,
     msg->status = status;
     msg->data0 = data0;
     msg->data1 = data1;
+    msg->timestamp = 0;
 }
@@ -32,6 +32,7 @@ struct midi_msg {
     uint8_t status;  // status byte
     uint8_t data0;  // data0 byte
     uint8_t data1;  // data1 byte
+    uint32_t timestamp;  // receive time in us - 0 if not known
 };
 
 // MIDI event data
@@ -88,6 +89,11 @@ int midi_utils_is_sysex_msg(struct midi_msg *msg);
 // returns 1 if the message is a clock message, or 0 otherwise
 int midi_utils_is_clock_msg(struct midi_msg *msg);
 
+// check if a message is a realtime message
+// - if the message is a single byte with a status byte of 0xf8 or above
+// returns 1 if the message is a realtime message, or 0 otherwise
+int midi_utils_is_realtime_msg(struct midi_msg *msg);
+
 //
 // MIDI event helpers
 //
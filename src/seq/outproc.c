@@ -29,42 +29,98 @@
 
 // macros
 #define PROCESS_NOTE(track, send_msg) \
-    temp = scale_quantize(send_msg.data0, opstate.current_tonality[track]); \
-    temp = temp + opstate.current_transpose[track];
+    temp = opstate.note_map[track][send_msg.data0 & 0x7f];
 
 // internal settings
-#define OUTPROC_MAX_NOTES 16  // active notes per track
+#define OUTPROC_NOTE_POLICY OUTPROC_NOTE_RETRIGGER  // default overlapping note policy
+#define OUTPROC_NOTE_COUNT_MAX 255  // max holds on a single port note
+// max holds on a single track note - all track outputs on one port channel can't saturate it
+#define OUTPROC_TRACK_NOTE_COUNT_MAX (OUTPROC_NOTE_COUNT_MAX / (SEQ_NUM_TRACKS * SEQ_NUM_TRACK_OUTPUTS))
+
+// an enabled track output and where it goes
+struct outproc_route {
+    int out;  // track output (mapnum)
+    int port;  // output port
+    int channel;  // output channel
+};
+
+// notes that are sounding on an output port channel
+struct outproc_port_notes {
+    uint32_t note_on[4];  // bitmap of sounding notes
+    uint8_t count[128];  // number of note ons holding each note
+};
+
+// notes that are held on a track - by input note before processing
+struct outproc_track_notes {
+    uint32_t note_on[4];  // bitmap of held input notes
+    uint8_t count[128];  // number of note ons holding each input note
+    uint8_t out_note[128];  // processed note that was sent for each input note
+    uint8_t velocity[128];  // note on velocity for each input note
+};
 
 // outproc state
 struct outproc_state {
-    struct midi_msg output_notes[SEQ_NUM_TRACKS][OUTPROC_MAX_NOTES];  // stores note on msgs
+    struct outproc_track_notes track_notes[SEQ_NUM_TRACKS];  // held track notes
+    struct outproc_port_notes port_notes[MIDI_PORT_NUM_TRACK_OUTPUTS][16];  // sounding notes
+    struct outproc_route routes[SEQ_NUM_TRACKS][SEQ_NUM_TRACK_OUTPUTS];  // enabled outputs
+    int num_routes[SEQ_NUM_TRACKS];  // number of enabled outputs
+    int note_policy;  // overlapping note policy
     int current_transpose[SEQ_NUM_TRACKS];
     int current_tonality[SEQ_NUM_TRACKS];
+    uint8_t note_map[SEQ_NUM_TRACKS][128];  // current tonality and transpose applied to each note
 };
 struct outproc_state opstate;
 
 // local functions
-int outproc_enqueue_note(int track, struct midi_msg *on_msg);
-void outproc_dequeue_note(int track, struct midi_msg *off_msg);
+int outproc_track_note_on(int track, struct midi_msg *on_msg);
+int outproc_track_note_off(int track, struct midi_msg *off_msg);
+void outproc_track_release_note(int track, int note);
+void outproc_port_note_on(int port, int channel, int note, int velocity, int count);
+void outproc_port_note_off(int port, int channel, int note, int velocity, int count);
+void outproc_port_clear_channel(int port, int channel);
 int outproc_get_num_notes(int track);
+void outproc_update_note_map(int track);
 
 // init the output processor
 void outproc_init(void) {
     int i, j;
     // reset the state
+    for(j = 0; j < MIDI_PORT_NUM_TRACK_OUTPUTS; j ++) {
+        for(i = 0; i < 16; i ++) {
+            outproc_port_clear_channel(j, i);
+        }
+    }
     for(j = 0; j < SEQ_NUM_TRACKS; j ++) {
-        for(i = 0; i < OUTPROC_MAX_NOTES; i ++) {
-            opstate.output_notes[j][i].status = 0;
+        for(i = 0; i < 4; i ++) {
+            opstate.track_notes[j].note_on[i] = 0;
+        }
+        for(i = 0; i < 128; i ++) {
+            opstate.track_notes[j].count[i] = 0;
         }
+        opstate.num_routes[j] = 0;
         opstate.current_transpose[j] = 0;
         opstate.current_tonality[j] = SCALE_CHROMATIC;
+        outproc_update_note_map(j);
+        outproc_midi_map_changed(j);
     }
+    opstate.note_policy = OUTPROC_NOTE_POLICY;
+}
+
+// set the policy for a note on to a note that is already sounding
+void outproc_set_note_policy(int policy) {
+    if(policy != OUTPROC_NOTE_RETRIGGER && policy != OUTPROC_NOTE_MERGE) {
+        log_error("osnp - policy invalid: %d", policy);
+        return;
+    }
+    opstate.note_policy = policy;
 }
 
 // the transpose changed on a track
 void outproc_transpose_changed(int scene, int track) {
-    int i, new_transpose, temp;
-    struct midi_msg send_msg;    
+    struct outproc_track_notes *tn;
+    struct outproc_route *route;
+    int i, j, note, new_transpose, temp;
+    uint32_t held;
     if(track < 0 || track >= SEQ_NUM_TRACKS) {
         log_error("otrc - track invalid: %d", track);
         return;
@@ -75,47 +131,49 @@ void outproc_transpose_changed(int scene, int track) {
     new_transpose = song_get_transpose(scene, track);
     if(outproc_get_num_notes(track) == 0) {
         opstate.current_transpose[track] = new_transpose;
+        outproc_update_note_map(track);
         return;
     }    
     if(new_transpose == opstate.current_transpose[track]) {
         return;
     }
+    opstate.current_transpose[track] = new_transpose;
+    outproc_update_note_map(track);
 
-    // search for the notes that need to be transposed
-    for(i = 0; i < OUTPROC_MAX_NOTES; i ++) {
-        if(opstate.output_notes[track][i].status != 0) {
+    // move the held notes to the new transpose
+    tn = &opstate.track_notes[track];
+    for(i = 0; i < 4; i ++) {
+        held = tn->note_on[i];
+        while(held) {
+            note = (i << 5) + __builtin_ctz(held);
+            held &= held - 1;
             // turn off existing note
-            midi_utils_copy_msg(&send_msg, 
-                &opstate.output_notes[track][i]);  // copy so we can modify
-            // no need to do range checking here
-            send_msg.data0 = scale_quantize(send_msg.data0, opstate.current_tonality[track]);
-            midi_utils_note_on_to_off(&send_msg);
-            send_msg.data0 = send_msg.data0 + opstate.current_transpose[track];
-            outproc_deliver_msg(scene, track, &send_msg, 
-                OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_RAW);
-
-            // transpose note
-            midi_utils_copy_msg(&send_msg, 
-                &opstate.output_notes[track][i]);  // copy so we can modify
-            temp = scale_quantize(send_msg.data0, opstate.current_tonality[track]);
-            temp = temp + new_transpose;
+            for(j = 0; j < opstate.num_routes[track]; j ++) {
+                route = &opstate.routes[track][j];
+                outproc_port_note_off(route->port, route->channel,
+                    tn->out_note[note], 0x40, tn->count[note]);
+            }
             // note became invalid
-            if(!seq_utils_check_note_range(temp)) {
-                opstate.output_notes[track][i].status = 0;  // free the slot
+            temp = opstate.note_map[track][note];
+            if(temp == SCALE_NOTE_INVALID) {
+                tn->note_on[i] &= ~(1 << (note & 0x1f));
+                tn->count[note] = 0;
                 continue;
             }
-            send_msg.data0 = temp;
-            outproc_deliver_msg(scene, track, &send_msg, 
-                OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_RAW);
+            // transpose note
+            for(j = 0; j < opstate.num_routes[track]; j ++) {
+                route = &opstate.routes[track][j];
+                outproc_port_note_on(route->port, route->channel,
+                    temp, tn->velocity[note], tn->count[note]);
+            }
+            tn->out_note[note] = temp;
         }
     }
-    opstate.current_transpose[track] = new_transpose;
 }
 
 // the tonality changed on a track
 void outproc_tonality_changed(int scene, int track) {
-    int i, new_tonality, temp;
-    struct midi_msg send_msg;    
+    int new_tonality;
     if(track < 0 || track >= SEQ_NUM_TRACKS) {
         log_error("otoc - track invalid: %d", track);
         return;
@@ -126,93 +184,98 @@ void outproc_tonality_changed(int scene, int track) {
     new_tonality = song_get_tonality(scene, track);
     if(outproc_get_num_notes(track) == 0) {
         opstate.current_tonality[track] = new_tonality;
+        outproc_update_note_map(track);
         return;
     }    
     if(new_tonality == opstate.current_tonality[track]) {
         return;
     }
-    
-    // search for the notes that need to be turned off
-    for(i = 0; i < OUTPROC_MAX_NOTES; i ++) {
-        if(opstate.output_notes[track][i].status != 0) {
-            // turn off existing note
-            midi_utils_copy_msg(&send_msg, 
-                &opstate.output_notes[track][i]);  // copy so we can modify
-            // XXX check this
-            send_msg.data0 = scale_quantize(send_msg.data0, opstate.current_tonality[track]);
-            midi_utils_note_on_to_off(&send_msg);
-            temp = send_msg.data0 + opstate.current_transpose[track];
-            // note became invalid
-            if(!seq_utils_check_note_range(temp)) {
-                continue;
-            }
-            send_msg.data0 = temp;
-            outproc_deliver_msg(scene, track, &send_msg, 
-                OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_RAW);
+    // turn off the held notes - they are not played again
+    outproc_stop_all_notes(track);
+    opstate.current_tonality[track] = new_tonality;
+    outproc_update_note_map(track);
+}
+
+// the MIDI port or channel mapping changed on a track
+void outproc_midi_map_changed(int track) {
+    int out, port;
+    if(track < 0 || track >= SEQ_NUM_TRACKS) {
+        log_error("ommc - track invalid: %d", track);
+        return;
+    }
+    // turn off held notes on the old outputs
+    outproc_stop_all_notes(track);
+    // make a list of the outputs that are assigned
+    opstate.num_routes[track] = 0;
+    for(out = 0; out < SEQ_NUM_TRACK_OUTPUTS; out ++) {
+        port = song_get_midi_port_map(track, out);
+        if(port == SONG_PORT_DISABLE) {
+            continue;  // port not assigned
         }
+        if(port < 0 || port >= MIDI_PORT_NUM_TRACK_OUTPUTS) {
+            log_error("ommc - port invalid: %d", port);
+            continue;
+        }
+        opstate.routes[track][opstate.num_routes[track]].out = out;
+        opstate.routes[track][opstate.num_routes[track]].port = port;
+        opstate.routes[track][opstate.num_routes[track]].channel =
+            song_get_midi_channel_map(track, out) & 0x0f;
+        opstate.num_routes[track] ++;
     }
-    opstate.current_tonality[track] = new_tonality;    
 }
 
 // deliver a track message to assigned outputs
 void outproc_deliver_msg(int scene, int track, struct midi_msg *msg, 
         int deliver, int process) {
     struct midi_msg send_msg;
-    int out, port, channel, temp;
+    struct outproc_route *route;
+    int i, port, channel, note, temp;
+    if(track < 0 || track >= SEQ_NUM_TRACKS) {
+        log_error("odm - track invalid: %d", track);
+        return;
+    }
+
+    // track the note once for all outputs
+    note = msg->data0 & 0x7f;
+    if(process == OUTPROC_OUTPUT_PROCESSED) {
+        switch(msg->status & 0xf0) {
+            case MIDI_NOTE_OFF:
+                note = outproc_track_note_off(track, msg);
+                if(note == -1) {
+                    return;  // note is not held
+                }
+                break;
+            case MIDI_NOTE_ON:
+                note = outproc_track_note_on(track, msg);
+                if(note == -1) {
+                    return;  // note became invalid or is held too many times
+                }
+                break;
+            default:
+                break;
+        }
+    }
 
     // generate message for each output port for this track
-    for(out = 0; out < SEQ_NUM_TRACK_OUTPUTS; out ++) {
+    for(i = 0; i < opstate.num_routes[track]; i ++) {
+        route = &opstate.routes[track][i];
         // skip ports that we don't want
-        if(deliver == OUTPROC_DELIVER_A && out == 1) {
+        if(deliver == OUTPROC_DELIVER_A && route->out == 1) {
             continue;
         }
-        else if(deliver == OUTPROC_DELIVER_B && out == 0) {
+        else if(deliver == OUTPROC_DELIVER_B && route->out == 0) {
             continue;
         }
-    
-        // get port mapping
-        port = song_get_midi_port_map(track, out);
-        if(port == SONG_PORT_DISABLE) {
-            continue;  // port not assigned
-        }
-        // get channel mapping
-        channel = song_get_midi_channel_map(track, out);
-        
+        port = route->port;
+        channel = route->channel;
+
         // handle event types    
         switch(msg->status & 0xf0) {
             case MIDI_NOTE_OFF:
-                midi_utils_enc_note_off(&send_msg, port, channel, msg->data0, msg->data1);
-                // do note processing / queue
-                if(process == OUTPROC_OUTPUT_PROCESSED) {
-                    // dequeue note before processing
-                    outproc_dequeue_note(track, &send_msg);
-                    // process note
-                    PROCESS_NOTE(track, send_msg);
-                    // note became invalid
-                    if(!seq_utils_check_note_range(temp)) {
-                        continue;
-                    }
-                    send_msg.data0 = temp;
-                }
-                midi_stream_send_msg(&send_msg);
+                outproc_port_note_off(port, channel, note, msg->data1, 1);
                 break;
             case MIDI_NOTE_ON:
-                midi_utils_enc_note_on(&send_msg, port, channel, msg->data0, msg->data1);
-                // do note processing / queue
-                if(process == OUTPROC_OUTPUT_PROCESSED) {
-                    // enqueue note before processing
-                    if(outproc_enqueue_note(track, &send_msg) == -1) {
-                        continue;  // no free slots
-                    }
-                    // process note
-                    PROCESS_NOTE(track, send_msg);
-                    // note became invalid
-                    if(!seq_utils_check_note_range(temp)) {
-                        continue;
-                    }
-                    send_msg.data0 = temp;
-                }
-                midi_stream_send_msg(&send_msg);
+                outproc_port_note_on(port, channel, note, msg->data1, 1);
                 break;
             case MIDI_POLY_KEY_PRESSURE:
                 midi_utils_enc_key_pressure(&send_msg, port, channel, msg->data0, msg->data1);
@@ -231,6 +294,10 @@ void outproc_deliver_msg(int scene, int track, struct midi_msg *msg,
             case MIDI_CONTROL_CHANGE:
                 midi_utils_enc_control_change(&send_msg, port, channel, msg->data0, msg->data1);
                 midi_stream_send_msg(&send_msg);
+                // the channel is silent now
+                if(msg->data0 == MIDI_CONTROLLER_ALL_NOTES_OFF) {
+                    outproc_port_clear_channel(port, channel);
+                }
                 break;
             case MIDI_PROGRAM_CHANGE:
                 midi_utils_enc_program_change(&send_msg, port, channel, msg->data0);
@@ -253,18 +320,19 @@ void outproc_deliver_msg(int scene, int track, struct midi_msg *msg,
 
 // stop all notes on a track
 void outproc_stop_all_notes(int track) {
-    int i;
+    int i, note;
+    uint32_t held;
     if(track < 0 || track >= SEQ_NUM_TRACKS) {
         log_error("osan - track invalid: %d", track);
         return;
     }
-    // search for the notes that need to be turned off
-    for(i = 0; i < OUTPROC_MAX_NOTES; i ++) {
-        if(opstate.output_notes[track][i].status != 0) {
-            // turn off existing note
-            outproc_deliver_msg(0, track, &opstate.output_notes[track][i], 
-                OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_RAW);
-            opstate.output_notes[track][i].status = 0;  // free slot
+    // turn off only the notes that are held
+    for(i = 0; i < 4; i ++) {
+        held = opstate.track_notes[track].note_on[i];
+        while(held) {
+            note = (i << 5) + __builtin_ctz(held);
+            held &= held - 1;
+            outproc_track_release_note(track, note);
         }
     }
 }
@@ -272,47 +340,115 @@ void outproc_stop_all_notes(int track) {
 //
 // local functions
 //
-// queue note that is currently playing so we can modify it later
-// returns -1 if there are no more slots to queue the note
-int outproc_enqueue_note(int track, struct midi_msg *on_msg) {
-    int i, free_slot = -1;
-    // search for a free slot to put the note
-    for(i = 0; i < OUTPROC_MAX_NOTES; i ++) {
-        if(opstate.output_notes[track][i].status == 0) {
-            free_slot = i;
-            break;
-        }
+// hold a processed note on a track
+// returns the note to send or -1 if the note became invalid or is held too many times
+int outproc_track_note_on(int track, struct midi_msg *on_msg) {
+    struct outproc_track_notes *tn = &opstate.track_notes[track];
+    int note = on_msg->data0 & 0x7f;
+    int out_note = opstate.note_map[track][note];
+    if(out_note == SCALE_NOTE_INVALID) {
+        return -1;
     }
-    // no free slots - return error
-    if(free_slot == -1) {
+    // drop the note on so it has no hold that is never released
+    if(tn->count[note] >= OUTPROC_TRACK_NOTE_COUNT_MAX) {
         return -1;
     }
-    midi_utils_copy_msg(&opstate.output_notes[track][free_slot], on_msg);
-    return 0;
+    tn->count[note] ++;
+    tn->note_on[note >> 5] |= (1 << (note & 0x1f));
+    tn->out_note[note] = out_note;
+    tn->velocity[note] = on_msg->data1;
+    return out_note;
 }
 
-// dequeue note that is currently playing so we can modify it later
-void outproc_dequeue_note(int track, struct midi_msg *off_msg) {
+// release a processed note on a track
+// returns the note to send or -1 if the note is not held
+int outproc_track_note_off(int track, struct midi_msg *off_msg) {
+    struct outproc_track_notes *tn = &opstate.track_notes[track];
+    int note = off_msg->data0 & 0x7f;
+    if(tn->count[note] == 0) {
+        return -1;
+    }
+    tn->count[note] --;
+    if(tn->count[note] == 0) {
+        tn->note_on[note >> 5] &= ~(1 << (note & 0x1f));
+    }
+    return tn->out_note[note];
+}
+
+// release all holds on a track note and turn it off on the outputs
+void outproc_track_release_note(int track, int note) {
+    struct outproc_track_notes *tn = &opstate.track_notes[track];
+    struct outproc_route *route;
     int i;
-    // search for the note on that corresponds to our note off
-    for(i = 0; i < OUTPROC_MAX_NOTES; i ++) {
-        // check if the note on in the queue corresponds to our note off
-        if(opstate.output_notes[track][i].status != 0 &&
-                midi_utils_compare_note_msg(&opstate.output_notes[track][i], off_msg)) {
-            opstate.output_notes[track][i].status = 0;  // free the slot
-            break;
+    for(i = 0; i < opstate.num_routes[track]; i ++) {
+        route = &opstate.routes[track][i];
+        outproc_port_note_off(route->port, route->channel,
+            tn->out_note[note], 0x40, tn->count[note]);
+    }
+    tn->count[note] = 0;
+    tn->note_on[note >> 5] &= ~(1 << (note & 0x1f));
+}
+
+// add holds to a note on an output port channel
+// a note that is already sounding is retriggered or merged
+void outproc_port_note_on(int port, int channel, int note, int velocity, int count) {
+    struct outproc_port_notes *pn = &opstate.port_notes[port][channel];
+    struct midi_msg send_msg;
+    if(pn->count[note]) {
+        if(opstate.note_policy == OUTPROC_NOTE_MERGE) {
+            count += pn->count[note];
+            pn->count[note] = (count < OUTPROC_NOTE_COUNT_MAX) ? count : OUTPROC_NOTE_COUNT_MAX;
+            return;
         }
+        // retrigger - end the sounding note so the synth only has one voice
+        midi_utils_enc_note_off(&send_msg, port, channel, note, 0x40);
+        midi_stream_send_msg(&send_msg);
+        count += pn->count[note];
+    }
+    pn->count[note] = (count < OUTPROC_NOTE_COUNT_MAX) ? count : OUTPROC_NOTE_COUNT_MAX;
+    pn->note_on[note >> 5] |= (1 << (note & 0x1f));
+    midi_utils_enc_note_on(&send_msg, port, channel, note, velocity);
+    midi_stream_send_msg(&send_msg);
+}
+
+// remove holds from a note on an output port channel
+// the note off is sent when the last hold is removed
+void outproc_port_note_off(int port, int channel, int note, int velocity, int count) {
+    struct outproc_port_notes *pn = &opstate.port_notes[port][channel];
+    struct midi_msg send_msg;
+    if(pn->count[note] > count) {
+        pn->count[note] -= count;
+        return;
     }
-} 
+    // notes that are not held are still sent in case they are stuck
+    pn->count[note] = 0;
+    pn->note_on[note >> 5] &= ~(1 << (note & 0x1f));
+    midi_utils_enc_note_off(&send_msg, port, channel, note, velocity);
+    midi_stream_send_msg(&send_msg);
+}
+
+// forget the sounding notes on an output port channel
+void outproc_port_clear_channel(int port, int channel) {
+    int i;
+    for(i = 0; i < 4; i ++) {
+        opstate.port_notes[port][channel].note_on[i] = 0;
+    }
+    for(i = 0; i < 128; i ++) {
+        opstate.port_notes[port][channel].count[i] = 0;
+    }
+}
 
 // get the number of currently held live notes on a track
 int outproc_get_num_notes(int track) {
     int i, count = 0;
-    // search for live notes
-    for(i = 0; i < OUTPROC_MAX_NOTES; i ++) {
-        if(opstate.output_notes[track][i].status != 0) {
-            count ++;
-        }
+    for(i = 0; i < 4; i ++) {
+        count += __builtin_popcount(opstate.track_notes[track].note_on[i]);
     }
     return count;
 }
+
+// rebuild the note map for a track after the tonality or transpose changed
+void outproc_update_note_map(int track) {
+    scale_build_note_map(opstate.note_map[track], opstate.current_tonality[track],
+        opstate.current_transpose[track]);
+}
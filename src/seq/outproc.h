@@ -30,16 +30,25 @@
 // outproc processing state
 #define OUTPROC_OUTPUT_RAW 0
 #define OUTPROC_OUTPUT_PROCESSED 1
+// overlapping note policy - a note on to a note that is already sounding
+#define OUTPROC_NOTE_RETRIGGER 0  // send a note off before the note on
+#define OUTPROC_NOTE_MERGE 1  // only count the note on
 
 // init the output processor
 void outproc_init(void);
 
+// set the policy for a note on to a note that is already sounding
+void outproc_set_note_policy(int policy);
+
 // the transpose changed on a track
 void outproc_transpose_changed(int scene, int track);
 
 // the tonality changed on a track
 void outproc_tonality_changed(int scene, int track);
 
+// the MIDI port or channel mapping changed on a track
+void outproc_midi_map_changed(int track);
+
 // deliver a track message to assigned outputs
 void outproc_deliver_msg(int scene, int track, 
     struct midi_msg *msg, int deliver, int process);
@@ -82,133 +82,23 @@ void scale_type_to_name(char *str, unsigned char scale) {
 
 // quantize a note to the current scale
 unsigned char scale_quantize(unsigned char note, unsigned char scale) {
-	unsigned char nt;
-	int i, shift;
-	shift = (note / 12) * 12;
-	nt = note - shift;
-	switch(scale) {
-        case SCALE_MAJOR:
-			for(i = SCALE_LEN_MAJOR - 1; i >= 0; i --) {
-				if(scale_major[i] <= nt) {
-					nt = scale_major[i];
-					break;
-				}
-			}
-		    break;
-		case SCALE_NAT_MINOR:
-			for(i = SCALE_LEN_NAT_MINOR - 1; i >= 0; i --) {
-				if(scale_nat_minor[i] <= nt) {
-					nt = scale_nat_minor[i];
-					break;
-				}
-			}
-		    break;
-		case SCALE_HAR_MINOR:
-			for(i = SCALE_LEN_HAR_MINOR - 1; i >= 0; i --) {
-				if(scale_har_minor[i] <= nt) {
-					nt = scale_har_minor[i];
-					break;
-				}
-			}
-		    break;
-		case SCALE_DORIAN:
-			for(i = SCALE_LEN_DORIAN - 1; i >= 0; i --) {
-				if(scale_dorian[i] <= nt) {
-					nt = scale_dorian[i];
-					break;
-				}
-			}		
-		    break;
-		case SCALE_WHOLE:
-			for(i = SCALE_LEN_WHOLE - 1; i >= 0; i --) {
-				if(scale_whole[i] <= nt) {
-					nt = scale_whole[i];
-					break;
-				}
-			}
-		    break;
-		case SCALE_PENT:
-			for(i = SCALE_LEN_PENT - 1; i >= 0; i --) {
-				if(scale_pent[i] <= nt) {
-					nt = scale_pent[i];
-					break;
-				}
-			}
-		    break;
-		case SCALE_DIM:
-			for(i = SCALE_LEN_DIM - 1; i >= 0; i --) {
-				if(scale_dim[i] <= nt) {
-					nt = scale_dim[i];
-					break;
-				}
-			}
-		    break;
-        // new scales added in ver. 1.12
-        case SCALE_PHRYGIAN:
-			for(i = SCALE_LEN_PHRYGIAN - 1; i >= 0; i --) {
-				if(scale_phrygian[i] <= nt) {
-					nt = scale_phrygian[i];
-					break;
-				}
-			}
-            break;
-        case SCALE_LYDIAN:
-			for(i = SCALE_LEN_LYDIAN - 1; i >= 0; i --) {
-				if(scale_lydian[i] <= nt) {
-					nt = scale_lydian[i];
-					break;
-				}
-			}
-            break;
-        case SCALE_MIXOLYDIAN:
-			for(i = SCALE_LEN_MIXOLYDIAN - 1; i >= 0; i --) {
-				if(scale_mixolydian[i] <= nt) {
-					nt = scale_mixolydian[i];
-					break;
-				}
-			}
-            break;
-        case SCALE_LOCRIAN:
-			for(i = SCALE_LEN_LOCRIAN - 1; i >= 0; i --) {
-				if(scale_locrian[i] <= nt) {
-					nt = scale_locrian[i];
-					break;
-				}
-			}
-            break;
-        case SCALE_PENT_MINOR:
-			for(i = SCALE_LEN_PENT_MINOR - 1; i >= 0; i --) {
-				if(scale_pent_minor[i] <= nt) {
-					nt = scale_pent_minor[i];
-					break;
-				}
-			}
-            break;
-        case SCALE_BLUES:
-			for(i = SCALE_LEN_BLUES - 1; i >= 0; i --) {
-				if(scale_blues[i] <= nt) {
-					nt = scale_blues[i];
-					break;
-				}
-			}
-            break;
-        case SCALE_HALF_DIM:
-			for(i = SCALE_LEN_HALF_DIM - 1; i >= 0; i --) {
-				if(scale_half_dim[i] <= nt) {
-					nt = scale_half_dim[i];
-					break;
-				}
-			}
-            break;
-        case SCALE_SEVEN_CHORD:
-			for(i = SCALE_LEN_SEVEN_CHORD - 1; i >= 0; i --) {
-				if(scale_seven_chord[i] <= nt) {
-					nt = scale_seven_chord[i];
-					break;
-				}
-			}
-            break;
-	}
-	return nt + shift;
+    if(note > 127 || scale >= SCALE_NUM_TONALITIES) {
+        return note;
+    }
+    return scale_quantize_map[scale][note];
 }
 
+// build a map of all notes quantized to a scale and transposed
+// notes that go out of range are set to SCALE_NOTE_INVALID
+void scale_build_note_map(uint8_t *map, int scale, int transpose) {
+    int note, temp;
+    for(note = 0; note < 128; note ++) {
+        temp = scale_quantize(note, scale) + transpose;
+        if(temp < 0 || temp > 127) {
+            map[note] = SCALE_NOTE_INVALID;
+        }
+        else {
+            map[note] = temp;
+        }
+    }
+}
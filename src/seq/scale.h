@@ -22,7 +22,9 @@
  */
 #ifndef SCALE_H
 #define SCALE_H
- 
+
+#include <inttypes.h>
+
  // tonalities
 #define SCALE_NUM_TONALITIES 16
 #define SCALE_CHROMATIC 0
@@ -44,10 +46,17 @@
 #define SCALE_HALF_DIM 14
 #define SCALE_SEVEN_CHORD 15
 
+// note map value for notes that are out of range after transposing
+#define SCALE_NOTE_INVALID 0xff
+
 // convert a scale type to a name
 void scale_type_to_name(char *str, unsigned char scale);
 
 // quantize a note to the selectec scale
 unsigned char scale_quantize(unsigned char note, unsigned char scale);
 
+// build a map of all notes quantized to a scale and transposed
+// notes that go out of range are set to SCALE_NOTE_INVALID
+void scale_build_note_map(uint8_t *map, int scale, int transpose);
+
 #endif
@@ -42,6 +42,7 @@
 #include "../iface/iface_midi_router.h"
 #include "../midi/midi_clock.h"
 #include "../util/log.h"
+#include "../util/rt_prof.h"
 #include "../util/seq_utils.h"
 #include "../util/state_change.h"
 #include "../util/state_change_events.h"
@@ -97,9 +98,12 @@ void seq_ctrl_init(void) {
 
 // run the sequencer control realtime task - run on RT interrupt at 1000us interval
 void seq_ctrl_rt_task(void) {
+    uint32_t task_start;
     switch(power_ctrl_get_power_state()) {
         case POWER_CTRL_STATE_ON:
+            task_start = rt_prof_start();
             midi_clock_timer_task();  // all music timing starts here
+            rt_prof_end(RT_PROF_TASK_MIDI_CLOCK, task_start);
             seq_engine_timer_task();  // must run after clock for correct timing
             clock_out_timer_task();  // runs separately from sequencer due to straight time
             pattern_edit_timer_task();  // handle timeout of pattern edit mode
@@ -116,12 +120,33 @@ void seq_ctrl_rt_task(void) {
     }
 }
 
+#ifdef MIDI_CLOCK_TICK_TIMER
+// run the sequencer clock ticks that are due - run on the clock timer interrupt
+// time is the clock timer time in us - returns the time when the next tick is due
+uint32_t seq_ctrl_tick_task(uint32_t time) {
+    uint32_t task_start, next_time;
+    // the clock only runs in sequencer mode - check again later
+    if(power_ctrl_get_power_state() != POWER_CTRL_STATE_ON) {
+        return time + SEQ_TASK_INTERVAL_US;
+    }
+    task_start = rt_prof_start();
+    next_time = midi_clock_tick_task(time);  // all music timing starts here
+    rt_prof_end(RT_PROF_TASK_MIDI_CLOCK, task_start);
+    return next_time;
+}
+#endif
+
 // run the sequencer control UI task - run on main loop
 void seq_ctrl_ui_task(void) {
+#ifdef SONG_PRELOAD
+    song_swap_task();  // announce a song switched in by the sequencer
+#endif
     // block GUI updates during load or save
+    // - events that don't fit in the queue meanwhile become a resync
     if(sstate.run_lockout) {
         return;
     }
+    state_change_drain_deferred();
     gui_refresh_task();
 }
 
@@ -151,7 +176,10 @@ void seq_ctrl_handle_state_change(int event_type, int *data, int data_len) {
             seq_ctrl_set_run_lockout(0);  // enable the UI and MIDI
             seq_ctrl_set_current_song(data[0]);
             seq_ctrl_refresh_modules();  // make sure all song data is updatd in the system
-            midi_clock_request_reset_pos();  // reset the clock position
+            // a preloaded song is switched in while running and keeps its position
+            if(!midi_clock_get_running()) {
+                midi_clock_request_reset_pos();  // reset the clock position
+            }
             // turn off modes
             seq_ctrl_set_live_mode(SEQ_CTRL_LIVE_OFF);
             pattern_edit_set_enable(0);
@@ -272,6 +300,12 @@ int seq_ctrl_load_song(int song) {
         return -1;
     }
     seq_ctrl_set_record_mode(SEQ_CTRL_RECORD_IDLE);  // stop recording
+#ifdef SONG_PRELOAD
+    // keep playing and switch to the new song when it is loaded
+    if(seq_ctrl_get_run_state()) {
+        return song_preload(song);
+    }
+#endif
     seq_ctrl_set_run_lockout(1);  // lock out UI and MIDI
     seq_ctrl_set_run_state(0);
     // start the loading process
@@ -287,9 +321,12 @@ int seq_ctrl_save_song(int song) {
         log_error("scss - song invalid: %d", song);
         return -1;
     }
+#ifndef SONG_SAVE_SNAPSHOT
+    // the song is saved from RAM so it can't change until the save is done
     seq_ctrl_set_record_mode(SEQ_CTRL_RECORD_IDLE);  // stop recording
     seq_ctrl_set_run_lockout(0);  // lock out UI and MIDI
     seq_ctrl_set_run_state(0);
+#endif
     song_save(song);  // start the saving process
     return 0;
 }
@@ -1371,6 +1408,12 @@ void midi_clock_run_state_changed(int running) {
         if(sstate.record_mode != SEQ_CTRL_RECORD_IDLE) {
             seq_ctrl_set_record_mode(SEQ_CTRL_RECORD_IDLE);
         }
+#ifdef SONG_PRELOAD
+        // a song that wasn't switched to yet is loaded normally instead
+        if(song_preload_finish() == 0) {
+            seq_ctrl_set_run_lockout(1);  // lock out UI and MIDI
+        }
+#endif
     }
     // fire event
     state_change_fire1(SCE_CTRL_RUN_STATE, running);
@@ -1383,8 +1426,10 @@ void midi_clock_tap_locked(void) {
 
 // the clock ticked for a swing count
 void midi_clock_ticked_swing(uint32_t tick_count) {
+    uint32_t task_start = rt_prof_start();
     // do all sequencer music processing
     seq_engine_run(tick_count);
+    rt_prof_end(RT_PROF_TASK_SEQ_ENGINE_RUN, task_start);
 }
 
 // the clock ticked for a straight count
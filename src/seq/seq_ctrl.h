@@ -47,6 +47,12 @@ void seq_ctrl_init(void);
 // run the sequencer control realtime task
 void seq_ctrl_rt_task(void);
 
+#ifdef MIDI_CLOCK_TICK_TIMER
+// run the sequencer clock ticks that are due - run on the clock timer interrupt
+// time is the clock timer time in us - returns the time when the next tick is due
+uint32_t seq_ctrl_tick_task(uint32_t time);
+#endif
+
 // run the sequencer control UI task
 void seq_ctrl_ui_task(void);
 
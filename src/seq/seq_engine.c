@@ -37,28 +37,46 @@
 #include "../midi/midi_stream.h"
 #include "../midi/midi_utils.h"
 #include "../util/log.h"
+#include "../util/rt_prof.h"
 #include "../util/seq_utils.h"
 #include "../util/state_change.h"
 #include "../util/state_change_events.h"
+#include <stdlib.h>
 #include <limits.h>
 
 // internal settings
-#define SEQ_ENGINE_MAX_NOTES 16  // active notes per track
+#define SEQ_ENGINE_MAX_NOTES 16  // active notes per track - max 16 for the slot bitmasks
+#define SEQ_ENGINE_WHEEL_LEN 64  // note timing wheel buckets per track - must be a power of 2
 #define SEQ_ENGINE_KEYBOARD_Q_LEN 16  // number of events in the keyboard queue
 
 // setting
 #define SEQ_ENGINE_RECORD_EVENTS_MAX (SEQ_NUM_STEPS * SEQ_TRACK_POLY)  // number of events for recording
+#define SEQ_ENGINE_BIAS_NOTE_NONE 0xff  // no note on a compiled step
+
+// active note actions - what to do when a note comes due on the timing wheel
+#define SEQ_ENGINE_NOTE_START 0  // start a delayed note
+#define SEQ_ENGINE_NOTE_GATE_END 1  // end the gate of a ratchet note
+#define SEQ_ENGINE_NOTE_REPEAT 2  // play the next ratchet note or free the slot
+#define SEQ_ENGINE_NOTE_END 3  // end the note and free the slot
 
 // active note state
 struct seq_engine_active_note {
     struct midi_event note;  // active note
-    int16_t start_delay_countdown;  // number of ticks before event start
+    uint32_t due_tick;  // track note tick when the next action is due
+    uint32_t repeat_tick;  // track note tick when the next ratchet note starts
+    int8_t action;  // next action to run when due
     int8_t ratchet_note_count;  // number of notes to play
     int8_t ratchet_note_countdown;  // number of remaining ratchets remaining
     int16_t ratchet_note_length;  // length of each ratchet part (based on total note len)
-    int16_t ratchet_note_length_countdown;  // tick countdown for each ratchet repeat time
     int16_t ratchet_gate_length;  // gate time for each ratchet note (must be <= note length)
-    int16_t ratchet_gate_length_countdown;  // tick countdown for each ratchet gate
+};
+
+// compiled step - the non-blank event slots on a step packed together
+struct seq_engine_step {
+    struct track_event *events;  // event slots in the song
+    uint8_t num_events;  // number of non-blank slots
+    uint8_t bias_note;  // first note on the step for bias tracks
+    uint8_t slot[SEQ_TRACK_POLY];  // non-blank slot numbers in order
 };
 
 //
@@ -86,6 +104,7 @@ struct seq_engine_state {
     int clock_div_count[SEQ_NUM_TRACKS];  // clock divider count
     int step_pos[SEQ_NUM_TRACKS];  // current step position
     int bias_track_output[SEQ_NUM_TRACKS];  // bias track output
+    struct seq_engine_step steps[SEQ_NUM_TRACKS][SEQ_NUM_STEPS];  // compiled steps for current scene
     int kbtrans;  // keyboard transpose state for tracks (no effect during song mode)
     int autolive;  // the autolive state
     // song mode
@@ -99,6 +118,9 @@ struct seq_engine_state {
     uint8_t live_active_bend[SEQ_NUM_TRACKS];  // pitch bend activated on this track
     // note timeouts and event queues
     struct seq_engine_active_note track_active_notes[SEQ_NUM_TRACKS][SEQ_ENGINE_MAX_NOTES];  // active play notes
+    uint16_t track_free_notes[SEQ_NUM_TRACKS];  // bitmask of free active note slots
+    uint16_t track_note_wheel[SEQ_NUM_TRACKS][SEQ_ENGINE_WHEEL_LEN];  // bitmask of slots due in each bucket
+    uint32_t track_note_tick[SEQ_NUM_TRACKS];  // note manager tick count
     struct midi_msg live_active_notes[SEQ_NUM_TRACKS][SEQ_ENGINE_MAX_NOTES];  // stores note on msgs
     struct midi_event record_events[SEQ_ENGINE_RECORD_EVENTS_MAX];  // recording temp notes
 };
@@ -119,6 +141,10 @@ void seq_engine_track_play_step(int track, int step);
 void seq_engine_track_start_note(int track, int step, int length, struct midi_msg *on_msg);
 void seq_engine_track_manage_notes(int track);
 void seq_engine_track_stop_all_notes(int track);
+void seq_engine_track_note_started(int track, int note);
+void seq_engine_track_schedule_note(int track, int note, int action, int ticks);
+void seq_engine_track_unschedule_note(int track, int note);
+void seq_engine_track_free_note(int track, int note);
 void seq_engine_track_set_bias_output(int track, int bias_note);
 // live input handling
 void seq_engine_live_send_msg(int track, struct midi_msg *msg);
@@ -145,11 +171,16 @@ void seq_engine_arp_gate_time_changed(int scene, int track, int time);
 void seq_engine_arp_enable_changed(int scene, int track, int enable);
 // misc
 void seq_engine_song_loaded(int song);
+void seq_engine_compile_step(int track, int step);
+void seq_engine_compile_all_steps(void);
 void seq_engine_recalc_params(void);
 int seq_engine_is_first_step(int track);
 int seq_engine_move_to_next_step(int track);
 int seq_engine_compute_next_pos(int track, int *pos, int change);
 int seq_engine_change_scene_synced(void);
+#ifdef SONG_PRELOAD
+int seq_engine_change_song_synced(void);
+#endif
 void seq_engine_cancel_pending_scene_change(void);
 void seq_engine_reset_all_tracks_pos(void);
 void seq_engine_send_program(int track, int mapnum);
@@ -173,6 +204,11 @@ void seq_engine_init(void) {
             sestate.track_active_notes[j][i].note.msg.status = 0;
             sestate.live_active_notes[j][i].status = 0;
         }
+        sestate.track_free_notes[j] = (1 << SEQ_ENGINE_MAX_NOTES) - 1;
+        for(i = 0; i < SEQ_ENGINE_WHEEL_LEN; i ++) {
+            sestate.track_note_wheel[j][i] = 0;
+        }
+        sestate.track_note_tick[j] = 0;
         sestate.live_active_bend[j] = 0;
     }
 
@@ -207,6 +243,7 @@ void seq_engine_init(void) {
 
     // build the cache
     seq_engine_recalc_params();
+    seq_engine_compile_all_steps();
 
     // register for events
     state_change_register(seq_engine_handle_state_change, SCEC_SONG);
@@ -215,7 +252,8 @@ void seq_engine_init(void) {
 
 // realtime tasks for the engine - handling keyboard input
 void seq_engine_timer_task(void) {
-    struct midi_msg msg;
+    struct midi_msg *msgs;
+    int i, num;
     static int count = 0;
 #ifdef GFX_REMLCD_MODE
     int tx_byte, tx_count;
@@ -227,40 +265,46 @@ void seq_engine_timer_task(void) {
     // make sure we're not in a locked out situation
     if(!seq_ctrl_is_run_lockout()) {
         // DIN 1 IN - performance and clock input
-        while(midi_stream_data_available(MIDI_PORT_DIN1_IN)) {
-            midi_stream_receive_msg(MIDI_PORT_DIN1_IN, &msg);
-            // performance
-            seq_engine_handle_midi_msg(&msg);
+        while((num = midi_stream_peek(MIDI_PORT_DIN1_IN, &msgs)) > 0) {
+            for(i = 0; i < num; i ++) {
+                // performance
+                seq_engine_handle_midi_msg(&msgs[i]);
+            }
+            midi_stream_consume(MIDI_PORT_DIN1_IN, num);
         }
         // USB device IN1 (from PC) - performance, clock and SYSEX input
-        while(midi_stream_data_available(MIDI_PORT_USB_DEV_IN1)) {
-            midi_stream_receive_msg(MIDI_PORT_USB_DEV_IN1, &msg);
-            // SYSEX
-            if(midi_utils_is_sysex_msg(&msg) && msg.port == MIDI_PORT_SYSEX_IN) {
-                sysex_handle_msg(&msg);
-            }
-            // performance
-            else {
-                seq_engine_handle_midi_msg(&msg);
+        while((num = midi_stream_peek(MIDI_PORT_USB_DEV_IN1, &msgs)) > 0) {
+            for(i = 0; i < num; i ++) {
+                // SYSEX
+                if(midi_utils_is_sysex_msg(&msgs[i]) && msgs[i].port == MIDI_PORT_SYSEX_IN) {
+                    sysex_handle_msg(&msgs[i]);
+                }
+                // performance
+                else {
+                    seq_engine_handle_midi_msg(&msgs[i]);
+                }
             }
+            midi_stream_consume(MIDI_PORT_USB_DEV_IN1, num);
         }
         // USB device IN2 (from PC) - unused in normal mode
-        while(midi_stream_data_available(MIDI_PORT_USB_DEV_IN2)) {
-            midi_stream_receive_msg(MIDI_PORT_USB_DEV_IN2, &msg);
+        while((num = midi_stream_peek(MIDI_PORT_USB_DEV_IN2, &msgs)) > 0) {
+            midi_stream_consume(MIDI_PORT_USB_DEV_IN2, num);
         }
         // USB device IN3 (from PC) - unused in normal mode
-        while(midi_stream_data_available(MIDI_PORT_USB_DEV_IN3)) {
-            midi_stream_receive_msg(MIDI_PORT_USB_DEV_IN3, &msg);
+        while((num = midi_stream_peek(MIDI_PORT_USB_DEV_IN3, &msgs)) > 0) {
+            midi_stream_consume(MIDI_PORT_USB_DEV_IN3, num);
         }
         // USB device IN4 (from PC) - unused in normal mode
-        while(midi_stream_data_available(MIDI_PORT_USB_DEV_IN4)) {
-            midi_stream_receive_msg(MIDI_PORT_USB_DEV_IN4, &msg);
+        while((num = midi_stream_peek(MIDI_PORT_USB_DEV_IN4, &msgs)) > 0) {
+            midi_stream_consume(MIDI_PORT_USB_DEV_IN4, num);
         }
         // USB host IN (USB device) - performance and clock input
-        while(midi_stream_data_available(MIDI_PORT_USB_HOST_IN)) {
-            midi_stream_receive_msg(MIDI_PORT_USB_HOST_IN, &msg);
-            // performance
-            seq_engine_handle_midi_msg(&msg);
+        while((num = midi_stream_peek(MIDI_PORT_USB_HOST_IN, &msgs)) > 0) {
+            for(i = 0; i < num; i ++) {
+                // performance
+                seq_engine_handle_midi_msg(&msgs[i]);
+            }
+            midi_stream_consume(MIDI_PORT_USB_HOST_IN, num);
         }
     }
 
@@ -287,8 +331,7 @@ void seq_engine_timer_task(void) {
 
 // run the sequencer - called on each clock tick
 void seq_engine_run(uint32_t tick_count) {
-    struct track_event event;
-    int i, track, live_active;
+    int track, live_active, bias_note;
 
     // position was reset
     if(tick_count == 0) {
@@ -305,6 +348,13 @@ void seq_engine_run(uint32_t tick_count) {
         // if we crossed a beat it might be time to change scenes
         if(sestate.beat_cross) {
             sestate.beat_cross = 0;
+#ifdef SONG_PRELOAD
+            // switch to a preloaded song on the beat
+            if(sestate.sngmode.enable ||
+                    song_get_scene_sync() == SONG_SCENE_SYNC_BEAT) {
+                seq_engine_change_song_synced();
+            }
+#endif
             // recording and playback processing of song mode
             if(sestate.sngmode.enable) {
                 seq_engine_song_mode_process();
@@ -324,6 +374,10 @@ void seq_engine_run(uint32_t tick_count) {
                 song_get_scene_sync() == SONG_SCENE_SYNC_TRACK1 &&
                 sestate.clock_div_count[0] == 0 &&
                 sestate.step_pos[0] == sestate.motion_start[0]) {
+#ifdef SONG_PRELOAD
+            // switch to a preloaded song at the end of track 1
+            seq_engine_change_song_synced();
+#endif
             seq_engine_change_scene_synced();
         }
 
@@ -336,14 +390,9 @@ void seq_engine_run(uint32_t tick_count) {
                         song_get_pattern_type(sestate.scene_current, track),
                         sestate.step_pos[track])) {
                     // use first note on a step as the bias track value
-                    for(i = 0; i < SEQ_TRACK_POLY; i ++) {
-                        if(song_get_step_event(sestate.scene_current, track,
-                                sestate.step_pos[track], i, &event) != -1) {
-                            if(event.type == SONG_EVENT_NOTE) {
-                                seq_engine_track_set_bias_output(track, event.data0);
-                                break;
-                            }
-                        }
+                    bias_note = sestate.steps[track][sestate.step_pos[track]].bias_note;
+                    if(bias_note != SEQ_ENGINE_BIAS_NOTE_NONE) {
+                        seq_engine_track_set_bias_output(track, bias_note);
                     }
                 }
             }
@@ -533,14 +582,36 @@ void seq_engine_change_scene(int scene) {
 void seq_engine_handle_state_change(int event_type, int *data, int data_len) {
     switch(event_type) {
         case SCE_SONG_LOADED:
+            // a song switched in while running was set up by the switch
+            if(data_len > 1 && data[1]) {
+                break;
+            }
             seq_engine_song_loaded(data[0]);
             break;
+        case SCE_SONG_CLEARED:
+            seq_engine_compile_all_steps();
+            break;
+        case SCE_SONG_CLEAR_STEP:
+        case SCE_SONG_CLEAR_STEP_EVENT:
+        case SCE_SONG_ADD_STEP_EVENT:
+        case SCE_SONG_SET_STEP_EVENT:
+#ifdef SONG_NOTES_PER_SCENE
+            if(data[0] != sestate.scene_current) {
+                break;
+            }
+#endif
+            seq_engine_compile_step(data[1], data[2]);
+            break;
         case SCE_SONG_TONALITY:
             outproc_tonality_changed(data[0], data[1]);
             break;
         case SCE_SONG_TRANSPOSE:
             outproc_transpose_changed(data[0], data[1]);
             break;
+        case SCE_SONG_MIDI_PORT_MAP:
+        case SCE_SONG_MIDI_CHANNEL_MAP:
+            outproc_midi_map_changed(data[0]);
+            break;
         case SCE_SONG_MUTE:
             seq_engine_mute_select_changed(data[0], data[1], data[2]);
             break;
@@ -918,74 +989,80 @@ int seq_engine_song_mode_load_entry(int entry) {
 //
 void seq_engine_track_play_step(int track, int step) {
     int i, bias, temp;
-    struct track_event event;
+    struct seq_engine_step *cstep = &sestate.steps[track][step];
+    struct track_event *event;
     struct midi_msg msg;
 
     // play each event on the step
-    for(i = 0; i < SEQ_TRACK_POLY; i ++) {
-        // get the event and make sure it's valid
-        if(song_get_step_event(sestate.scene_current, track, step, i, &event) != -1) {
-            // handle event types
-            switch(event.type) {
-                case SONG_EVENT_NOTE:
-                    bias = 0;
-                    // if bias track is enabled and not our own track
-                    if(sestate.bias_track_map[track] != track &&
-                            sestate.bias_track_map[track] != SONG_TRACK_BIAS_NULL) {
-                        bias = sestate.bias_track_output[sestate.bias_track_map[track]];
-                    }
+    for(i = 0; i < cstep->num_events; i ++) {
+        event = &cstep->events[cstep->slot[i]];
+        // handle event types
+        switch(event->type) {
+            case SONG_EVENT_NOTE:
+                bias = 0;
+                // if bias track is enabled and not our own track
+                if(sestate.bias_track_map[track] != track &&
+                        sestate.bias_track_map[track] != SONG_TRACK_BIAS_NULL) {
+                    bias = sestate.bias_track_output[sestate.bias_track_map[track]];
+                }
 
-                    // drum track - bias / no kbtrans
-                    if(sestate.track_type[track] == SONG_TRACK_TYPE_DRUM) {
-                        midi_utils_enc_note_on(&msg, 0, 0,
-                            seq_utils_clamp(event.data0 + bias, 0, 127),
-                            event.data1);
-                    }
-                    // voice track - bias + kbtrans + songmode.kbtrans
-                    else {
-                        // scale by keyboard transpose
-                        temp = event.data0 + sestate.kbtrans + bias;
-                        if(!seq_utils_check_note_range(temp)) {
-                            return;
-                        }
-                        midi_utils_enc_note_on(&msg, 0, 0, temp, event.data1);
+                // drum track - bias / no kbtrans
+                if(sestate.track_type[track] == SONG_TRACK_TYPE_DRUM) {
+                    midi_utils_enc_note_on(&msg, 0, 0,
+                        seq_utils_clamp(event->data0 + bias, 0, 127),
+                        event->data1);
+                }
+                // voice track - bias + kbtrans + songmode.kbtrans
+                else {
+                    // scale by keyboard transpose
+                    temp = event->data0 + sestate.kbtrans + bias;
+                    if(!seq_utils_check_note_range(temp)) {
+                        return;
                     }
-                    seq_engine_track_start_note(track, step, event.length, &msg);
-                    break;
-                case SONG_EVENT_CC:
-                    // send event directly
-                    midi_utils_enc_control_change(&msg, 0, 0, event.data0, event.data1);
-                    outproc_deliver_msg(sestate.scene_current, track, &msg,
-                        OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_PROCESSED);
-                    break;
-                case SONG_EVENT_NULL:
-                default:
-                    log_warn("sese - unknown event type: %d", event.type);
-                    return;
-            }
+                    midi_utils_enc_note_on(&msg, 0, 0, temp, event->data1);
+                }
+                seq_engine_track_start_note(track, step, event->length, &msg);
+                break;
+            case SONG_EVENT_CC:
+                // send event directly
+                midi_utils_enc_control_change(&msg, 0, 0, event->data0, event->data1);
+                outproc_deliver_msg(sestate.scene_current, track, &msg,
+                    OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_PROCESSED);
+                break;
+            case SONG_EVENT_NULL:
+            default:
+                log_warn("sese - unknown event type: %d", event->type);
+                return;
         }
     }
 }
 
 // start a note on a track playback - also figures out ratcheting and start delay
 void seq_engine_track_start_note(int track, int step, int length, struct midi_msg *on_msg) {
-    int i, free_slot = -1, total_len;
+    struct seq_engine_active_note *active;
+    int i, free_slot, total_len, delay, time_remain;
     int min_time_remain = 0xffff;
-    int min_time_remain_slot = -1;
-    // search for a free slot to put this event
-    for(i = 0; i < SEQ_ENGINE_MAX_NOTES; i ++) {
-        // slot is free
-        if(sestate.track_active_notes[track][i].note.msg.status == 0) {
-            free_slot = i;
-        }
-        // slot is in use
-        else if(sestate.track_active_notes[track][i].note.tick_len < min_time_remain) {
-            min_time_remain = sestate.track_active_notes[track][i].note.tick_len;
-            min_time_remain_slot = i;
-        }
+    int min_time_remain_slot = 0;
+    // take the highest free slot
+    if(sestate.track_free_notes[track]) {
+        free_slot = 31 - __builtin_clz(sestate.track_free_notes[track]);
     }
     // if there are no free slots, kill the shortest note and free the slot
-    if(free_slot == -1) {
+    else {
+        for(i = 0; i < SEQ_ENGINE_MAX_NOTES; i ++) {
+            active = &sestate.track_active_notes[track][i];
+            // only notes that are playing without ratcheting are counting down
+            if(active->action == SEQ_ENGINE_NOTE_END) {
+                time_remain = active->due_tick - sestate.track_note_tick[track];
+            }
+            else {
+                time_remain = active->note.tick_len;
+            }
+            if(time_remain < min_time_remain) {
+                min_time_remain = time_remain;
+                min_time_remain_slot = i;
+            }
+        }
         // arp input
         if(sestate.arp_enable[track]) {
             arp_handle_input(track,
@@ -998,135 +1075,137 @@ void seq_engine_track_start_note(int track, int step, int length, struct midi_ms
                 OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_PROCESSED);
         }
         free_slot = min_time_remain_slot;
+        seq_engine_track_free_note(track, free_slot);
     }
+    sestate.track_free_notes[track] &= ~(1 << free_slot);
+    active = &sestate.track_active_notes[track][free_slot];
+
     // now we have a slot we can use for this new note
     // put the note data into the slot and ensure it has a valid length
-    midi_utils_copy_msg(&sestate.track_active_notes[track][free_slot].note.msg, on_msg);
+    midi_utils_copy_msg(&active->note.msg, on_msg);
     // figure out the total length scaled by gate override (for non-ratchet mode)
     // gate time of 0x80 is 100%
     total_len = (length * sestate.gate_time[track]) >> 7;
     if(total_len < 1) {
-        sestate.track_active_notes[track][free_slot].note.tick_len = 1;
+        active->note.tick_len = 1;
     }
     else {
-        sestate.track_active_notes[track][free_slot].note.tick_len = total_len;
+        active->note.tick_len = total_len;
     }
     // get the track params for the step
-    sestate.track_active_notes[track][free_slot].start_delay_countdown =
-        song_get_start_delay(sestate.scene_current, track, step);
-    sestate.track_active_notes[track][free_slot].ratchet_note_count =
-        song_get_ratchet_mode(sestate.scene_current, track, step);
+    delay = song_get_start_delay(sestate.scene_current, track, step);
+    active->ratchet_note_count = song_get_ratchet_mode(sestate.scene_current, track, step);
 
     // calculate ratchet stuff if we are making more than 1 note
-    if(sestate.track_active_notes[track][free_slot].ratchet_note_count > 1) {
+    if(active->ratchet_note_count > 1) {
         // ratchet countdown
-        sestate.track_active_notes[track][free_slot].ratchet_note_countdown =
-            sestate.track_active_notes[track][free_slot].ratchet_note_count;
+        active->ratchet_note_countdown = active->ratchet_note_count;
         // note length - based on step len not including gate time override
-        sestate.track_active_notes[track][free_slot].ratchet_note_length =
-            length / sestate.track_active_notes[track][free_slot].ratchet_note_count;
-        sestate.track_active_notes[track][free_slot].ratchet_note_length_countdown =
-            sestate.track_active_notes[track][free_slot].ratchet_note_length;
+        active->ratchet_note_length = length / active->ratchet_note_count;
         // gate length - based on the note length scaled by the gate time
         // made to be 50% duty cycle by default (at 100% gate length override)
-        sestate.track_active_notes[track][free_slot].ratchet_gate_length =
-            (sestate.track_active_notes[track][free_slot].ratchet_note_length *
+        active->ratchet_gate_length = (active->ratchet_note_length *
             sestate.gate_time[track]) >> 8;
         // make sure gate length is not longer than note length
-        if(sestate.track_active_notes[track][free_slot].ratchet_gate_length >
-                sestate.track_active_notes[track][free_slot].ratchet_note_length) {
-            sestate.track_active_notes[track][free_slot].ratchet_gate_length =
-                sestate.track_active_notes[track][free_slot].ratchet_note_length;
+        if(active->ratchet_gate_length > active->ratchet_note_length) {
+            active->ratchet_gate_length = active->ratchet_note_length;
         }
-        sestate.track_active_notes[track][free_slot].ratchet_gate_length_countdown =
-            sestate.track_active_notes[track][free_slot].ratchet_gate_length;
     }
 
     // arp tracks always play immediately regardless of start delay
     if(sestate.arp_enable[track]) {
         arp_handle_input(track, on_msg);
-        // reset delay countdown so we don't start the note again in the manager
-        sestate.track_active_notes[track][free_slot].start_delay_countdown = 0;
+        // reset delay so we don't start the note again in the manager
+        delay = 0;
         // we can't use ratcheting for arp tracks so let's just reset it so we don't use it
-        sestate.track_active_notes[track][free_slot].ratchet_note_count = 1;
+        active->ratchet_note_count = 1;
     }
     // normal notes play now if the start delay is zero
-    else if(sestate.track_active_notes[track][free_slot].start_delay_countdown == 0) {
+    else if(delay <= 0) {
         outproc_deliver_msg(sestate.scene_current, track, on_msg,
             OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_PROCESSED);
     }
+
+    // wait for the start delay or start timing the note now
+    if(delay > 0) {
+        seq_engine_track_schedule_note(track, free_slot, SEQ_ENGINE_NOTE_START, delay);
+    }
+    else {
+        seq_engine_track_note_started(track, free_slot);
+    }
 }
 
 // manage notes - do ratcheting, delayed start and timeout
+// only the notes in the timing wheel bucket for this tick are visited
 void seq_engine_track_manage_notes(int track) {
+    struct seq_engine_active_note *active;
     struct midi_msg msg;
+    uint32_t now, due;
     int note;
-    // find notes that are in use
-    for(note = 0; note < SEQ_ENGINE_MAX_NOTES; note ++) {
-        // check if the slot is in use
-        if(sestate.track_active_notes[track][note].note.msg.status != 0) {
-            // see if we are still waiting to start the note
-            if(sestate.track_active_notes[track][note].start_delay_countdown) {
-                sestate.track_active_notes[track][note].start_delay_countdown --;
-                // time to start the note for reals - everything else is set up
-                if(sestate.track_active_notes[track][note].start_delay_countdown == 0) {
-                    outproc_deliver_msg(sestate.scene_current, track,
-                        &sestate.track_active_notes[track][note].note.msg,
-                        OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_PROCESSED);
+    now = ++ sestate.track_note_tick[track];
+    due = sestate.track_note_wheel[track][now & (SEQ_ENGINE_WHEEL_LEN - 1)];
+    // visit the bucket in slot order
+    while(due) {
+        note = __builtin_ctz(due);
+        due &= due - 1;
+        active = &sestate.track_active_notes[track][note];
+        // note is due on a later trip around the wheel
+        if(active->due_tick != now) {
+            continue;
+        }
+        seq_engine_track_unschedule_note(track, note);
+        switch(active->action) {
+            // time to start the note for reals - everything else is set up
+            case SEQ_ENGINE_NOTE_START:
+                outproc_deliver_msg(sestate.scene_current, track, &active->note.msg,
+                    OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_PROCESSED);
+                seq_engine_track_note_started(track, note);
+                break;
+            // ratchet gate timed out
+            case SEQ_ENGINE_NOTE_GATE_END:
+                // make a copy and convert to note off
+                midi_utils_copy_msg(&msg, &active->note.msg);
+                midi_utils_note_on_to_off(&msg);
+                outproc_deliver_msg(sestate.scene_current, track, &msg,
+                    OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_PROCESSED);
+                // wait for the next ratchet note unless it's due now
+                if(active->repeat_tick != now) {
+                    seq_engine_track_schedule_note(track, note, SEQ_ENGINE_NOTE_REPEAT,
+                        active->repeat_tick - now);
+                    break;
                 }
-            }
-            // ratcheting is enabled so let's deal with that
-            else if(sestate.track_active_notes[track][note].ratchet_note_count > 1) {
-                sestate.track_active_notes[track][note].ratchet_gate_length_countdown --;
-                // gate timed out
-                if(sestate.track_active_notes[track][note].ratchet_gate_length_countdown <= 0) {
-                    // make a copy and convert to note off
-                    midi_utils_copy_msg(&msg, &sestate.track_active_notes[track][note].note.msg);
-                    midi_utils_note_on_to_off(&msg);
-                    outproc_deliver_msg(sestate.scene_current, track, &msg,
+                // fall through
+            // ratchet note timed out - see if we should start the note again
+            case SEQ_ENGINE_NOTE_REPEAT:
+                active->ratchet_note_countdown --;
+                if(active->ratchet_note_countdown > 0) {
+                    outproc_deliver_msg(sestate.scene_current, track, &active->note.msg,
                         OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_PROCESSED);
+                    // reset stuff for the next note
+                    seq_engine_track_note_started(track, note);
                 }
-                sestate.track_active_notes[track][note].ratchet_note_length_countdown --;
-                // note timed out
-                if(sestate.track_active_notes[track][note].ratchet_note_length_countdown <= 0) {
-                    // see if we should start the note again
-                    sestate.track_active_notes[track][note].ratchet_note_countdown --;
-                    if(sestate.track_active_notes[track][note].ratchet_note_countdown > 0) {
-                        outproc_deliver_msg(sestate.scene_current, track,
-                            &sestate.track_active_notes[track][note].note.msg,
-                            OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_PROCESSED);
-                        // reset stuff for the next note
-                        sestate.track_active_notes[track][note].ratchet_note_length_countdown =
-                            sestate.track_active_notes[track][note].ratchet_note_length;
-                        sestate.track_active_notes[track][note].ratchet_gate_length_countdown =
-                            sestate.track_active_notes[track][note].ratchet_gate_length;
-                    }
-                    // no more ratchet notes to play - just free the slot
-                    else {
-                        sestate.track_active_notes[track][note].note.msg.status = 0;  // free slot
-                    }
+                // no more ratchet notes to play - just free the slot
+                else {
+                    seq_engine_track_free_note(track, note);
                 }
-            }
-            // the note is playing without ratcheting so let's just time it out
-            else {
-                sestate.track_active_notes[track][note].note.tick_len --;
-                // time to kill the note and free the slot
-                if(sestate.track_active_notes[track][note].note.tick_len == 0) {
-                    // make a copy and convert to note off
-                    midi_utils_copy_msg(&msg, &sestate.track_active_notes[track][note].note.msg);
-                    midi_utils_note_on_to_off(&msg);
-                    // arp input
-                    if(sestate.arp_enable[track]) {
-                        arp_handle_input(track, &msg);
-                    }
-                    // normal playback
-                    else {
-                        outproc_deliver_msg(sestate.scene_current, track, &msg,
-                            OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_PROCESSED);
-                    }
-                    sestate.track_active_notes[track][note].note.msg.status = 0;  // free slot
+                break;
+            // time to kill the note and free the slot
+            case SEQ_ENGINE_NOTE_END:
+            default:
+                // make a copy and convert to note off
+                midi_utils_copy_msg(&msg, &active->note.msg);
+                midi_utils_note_on_to_off(&msg);
+                // arp input
+                if(sestate.arp_enable[track]) {
+                    arp_handle_input(track, &msg);
                 }
-            }
+                // normal playback
+                else {
+                    outproc_deliver_msg(sestate.scene_current, track, &msg,
+                        OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_PROCESSED);
+                }
+                seq_engine_track_free_note(track, note);
+                break;
         }
     }
 }
@@ -1151,11 +1230,57 @@ void seq_engine_track_stop_all_notes(int track) {
                 outproc_deliver_msg(sestate.scene_current, track, &msg,
                     OUTPROC_DELIVER_BOTH, OUTPROC_OUTPUT_PROCESSED);
             }
-            sestate.track_active_notes[track][note].note.msg.status = 0;  // free note
+            seq_engine_track_free_note(track, note);  // free note
+        }
+    }
+}
+
+// a note has started playing - schedule the end of the note or ratchet gate
+void seq_engine_track_note_started(int track, int note) {
+    struct seq_engine_active_note *active = &sestate.track_active_notes[track][note];
+    int note_len, gate_len;
+    // ratcheting is enabled - time the gate and the next repeat
+    if(active->ratchet_note_count > 1) {
+        note_len = active->ratchet_note_length;
+        if(note_len < 1) {
+            note_len = 1;
+        }
+        gate_len = active->ratchet_gate_length;
+        if(gate_len < 1) {
+            gate_len = 1;
         }
+        active->repeat_tick = sestate.track_note_tick[track] + note_len;
+        seq_engine_track_schedule_note(track, note, SEQ_ENGINE_NOTE_GATE_END, gate_len);
+    }
+    // the note is playing without ratcheting so let's just time it out
+    else {
+        seq_engine_track_schedule_note(track, note, SEQ_ENGINE_NOTE_END,
+            active->note.tick_len);
     }
 }
 
+// put a note on the timing wheel to run an action a number of ticks from now
+void seq_engine_track_schedule_note(int track, int note, int action, int ticks) {
+    struct seq_engine_active_note *active = &sestate.track_active_notes[track][note];
+    active->action = action;
+    active->due_tick = sestate.track_note_tick[track] + ticks;
+    sestate.track_note_wheel[track][active->due_tick & (SEQ_ENGINE_WHEEL_LEN - 1)] |=
+        (1 << note);
+}
+
+// take a note off the timing wheel
+void seq_engine_track_unschedule_note(int track, int note) {
+    sestate.track_note_wheel[track][sestate.track_active_notes[track][note].due_tick &
+        (SEQ_ENGINE_WHEEL_LEN - 1)] &= ~(1 << note);
+}
+
+// free an active note slot
+void seq_engine_track_free_note(int track, int note) {
+    seq_engine_track_unschedule_note(track, note);
+    sestate.track_active_notes[track][note].note.msg.status = 0;
+    sestate.track_free_notes[track] |= (1 << note);
+}
+
 // set the track bias output
 void seq_engine_track_set_bias_output(int track, int bias_note) {
     int val = bias_note;
@@ -1368,7 +1493,8 @@ void seq_engine_live_passthrough(int track, struct midi_msg *msg) {
 //
 // record the event
 void seq_engine_record_event(struct midi_msg *msg) {
-    int i;
+    int i, offset;
+    uint32_t tick_pos;
     struct track_event trkevent;
 
     // see if we need to start recording mode
@@ -1464,6 +1590,9 @@ void seq_engine_record_event(struct midi_msg *msg) {
         if(sestate.record_event_count == SEQ_ENGINE_RECORD_EVENTS_MAX) {
             return;
         }
+        // place the event at the tick it arrived on instead of the tick it
+        // is being processed on - the offset within the tick is not used
+        tick_pos = midi_clock_get_tick_pos_at(msg->timestamp, &offset);
         // handle different message types
         switch(msg->status & 0xf0) {
             case MIDI_NOTE_OFF:
@@ -1474,15 +1603,19 @@ void seq_engine_record_event(struct midi_msg *msg) {
                             sestate.record_events[i].msg.status == MIDI_NOTE_ON &&
                             sestate.record_events[i].msg.data0 == msg->data0) {
                         // record the note length to the existing data
-                        sestate.record_events[i].tick_len = midi_clock_get_tick_pos() -
+                        sestate.record_events[i].tick_len = tick_pos -
                             sestate.record_events[i].tick_pos;
+                        // 0 is for notes held past the end
+                        if((int32_t)sestate.record_events[i].tick_len < 1) {
+                            sestate.record_events[i].tick_len = 1;
+                        }
                         break;
                     }
                 }
                 break;
             case MIDI_NOTE_ON:
                 // add note to recording list
-                sestate.record_events[sestate.record_event_count].tick_pos = midi_clock_get_tick_pos();
+                sestate.record_events[sestate.record_event_count].tick_pos = tick_pos;
                 sestate.record_events[sestate.record_event_count].tick_len = 0;
                 sestate.record_events[sestate.record_event_count].msg.port = 0;
                 sestate.record_events[sestate.record_event_count].msg.len = 3;
@@ -1493,7 +1626,7 @@ void seq_engine_record_event(struct midi_msg *msg) {
                 break;
             case MIDI_CONTROL_CHANGE:
                 // add CC to recording list
-                sestate.record_events[sestate.record_event_count].tick_pos = midi_clock_get_tick_pos();
+                sestate.record_events[sestate.record_event_count].tick_pos = tick_pos;
                 sestate.record_events[sestate.record_event_count].tick_len = 0;  // unused
                 sestate.record_events[sestate.record_event_count].msg.port = 0;
                 sestate.record_events[sestate.record_event_count].msg.len = 3;
@@ -1874,12 +2007,57 @@ void seq_engine_song_loaded(int song) {
     seq_engine_set_kbtrans(0);  // reset kbtrans
     // load stuff from song
     for(track = 0; track < SEQ_NUM_TRACKS; track ++) {
+        outproc_midi_map_changed(track);
         for(mapnum = 0; mapnum < SEQ_NUM_TRACK_OUTPUTS; mapnum ++) {
             seq_engine_send_program(track, mapnum);
         }
     }
     sestate.autolive = song_get_midi_autolive();
     seq_engine_recalc_params();
+    seq_engine_compile_all_steps();
+}
+
+// compile the events on a step of the current scene into a packed list
+void seq_engine_compile_step(int track, int step) {
+    struct seq_engine_step *cstep;
+    int slot;
+    if(track < 0 || track >= SEQ_NUM_TRACKS) {
+        log_error("secs - track invalid: %d", track);
+        return;
+    }
+    if(step < 0 || step >= SEQ_NUM_STEPS) {
+        log_error("secs - step invalid: %d", step);
+        return;
+    }
+    cstep = &sestate.steps[track][step];
+    cstep->num_events = 0;
+    cstep->bias_note = SEQ_ENGINE_BIAS_NOTE_NONE;
+    cstep->events = song_get_step_event_slots(sestate.scene_current, track, step);
+    if(cstep->events == NULL) {
+        return;
+    }
+    for(slot = 0; slot < SEQ_TRACK_POLY; slot ++) {
+        if(cstep->events[slot].type == SONG_EVENT_NULL) {
+            continue;
+        }
+        // use first note on a step as the bias track value
+        if(cstep->events[slot].type == SONG_EVENT_NOTE &&
+                cstep->bias_note == SEQ_ENGINE_BIAS_NOTE_NONE) {
+            cstep->bias_note = cstep->events[slot].data0;
+        }
+        cstep->slot[cstep->num_events] = slot;
+        cstep->num_events ++;
+    }
+}
+
+// compile all steps of the current scene
+void seq_engine_compile_all_steps(void) {
+    int track, step;
+    for(track = 0; track < SEQ_NUM_TRACKS; track ++) {
+        for(step = 0; step < SEQ_NUM_STEPS; step ++) {
+            seq_engine_compile_step(track, step);
+        }
+    }
 }
 
 // recalculate the running parameters from the song
@@ -1993,6 +2171,27 @@ int seq_engine_compute_next_pos(int track, int *pos, int change) {
     return 0;  // didn't wrap
 }
 
+#ifdef SONG_PRELOAD
+// change to a preloaded song since we are now synchronized
+// - only the engine is set up here - the rest of the system gets
+//   SCE_SONG_LOADED from the UI task
+// returns 1 if the song was changed
+int seq_engine_change_song_synced(void) {
+    int song;
+    uint32_t start = rt_prof_start();
+    song = song_swap_preloaded();
+    if(song == -1) {
+        return 0;
+    }
+    seq_engine_song_loaded(song);  // compile the steps of the new song
+    seq_engine_change_scene_synced();  // start the first scene of the new song
+    rt_prof_end(RT_PROF_TASK_SONG_SWITCH, start);
+    log_debug("secss - song %d switched in %d counts", song,
+        (int)(rt_prof_start() - start));
+    return 1;
+}
+#endif
+
 // chance scenes since we are now synchronized
 // returns 1 if the song was stopped by this function
 int seq_engine_change_scene_synced(void) {
@@ -2010,6 +2209,9 @@ int seq_engine_change_scene_synced(void) {
 
     sestate.scene_current = sestate.scene_next;
     seq_engine_recalc_params();
+#ifdef SONG_NOTES_PER_SCENE
+    seq_engine_compile_all_steps();  // events are different for each scene
+#endif
     seq_engine_reset_all_tracks_pos();
 
     // fire event
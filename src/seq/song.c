@@ -26,9 +26,14 @@
 #include "../config.h"
 #include "../ext_flash.h"
 #include "../util/log.h"
+#include "../util/rt_prof.h"
 #include "../util/seq_utils.h"
 #include "../util/state_change.h"
 #include "../util/state_change_events.h"
+#include "sysex_bulk.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
 // list of notes to reset steps to on init
 uint8_t song_reset_scale[] = {
@@ -144,65 +149,276 @@ struct song_data {
     // token to identify correct loading of file
     uint32_t magic_num;
 };
-struct song_data song;
+// song images - the current song and a spare used for the save snapshot,
+// the encoded song and for preloading the next song
+#if defined(SONG_SAVE_SNAPSHOT) || defined(SONG_PRELOAD) || defined(SONG_FLASH_ENCODED)
+#define SONG_NUM_IMAGES 2
+#else
+#define SONG_NUM_IMAGES 1
+#endif
+struct song_data song_images[SONG_NUM_IMAGES];
+struct song_data *songp = &song_images[0];  // the current song
+
+// song image sectors
+#define SONG_NUM_SECTORS (EXT_FLASH_SONG_SIZE / EXT_FLASH_SECTOR_SIZE)
+// song image blocks - dirty blocks are tracked so saves only rewrite changes
+// - encoded chunks don't line up with sectors so smaller blocks are used
+#ifdef SONG_FLASH_ENCODED
+#define SONG_BLOCK_SIZE 512
+#else
+#define SONG_BLOCK_SIZE EXT_FLASH_SECTOR_SIZE
+#endif
+#define SONG_NUM_BLOCKS (EXT_FLASH_SONG_SIZE / SONG_BLOCK_SIZE)
+#if SONG_NUM_BLOCKS > 64
+#error song has too many blocks to track
+#endif
+#define SONG_DIRTY_ALL (0xffffffffffffffffULL >> (64 - SONG_NUM_BLOCKS))
+
+// song table - maps each song to the flash sectors holding it
+// - songs are written to free sectors and the table is written last so a
+//   save is only committed once the new table is in flash
+// - each chunk of a song has its own length so encoded chunks don't have
+//   to fill their sector and can be kept when other chunks change
+// - the two banks are written alternately and the valid bank with the
+//   highest sequence number is used
+// - this must fit in one bank
+#define SONG_TABLE_MAGIC 0x534e4754
+#define SONG_TABLE_NUM_BANKS 2
+#define SONG_FORMAT_RAW 0  // song image stored as is
+#define SONG_FORMAT_ENCODED 1  // steps stored sparse - see song_encode()
+#define SONG_FLASH_SECTORS (EXT_FLASH_MEMORY_SIZE / EXT_FLASH_SECTOR_SIZE)
+struct song_table_entry {
+    uint32_t len;  // bytes stored - 0 = no song
+    uint8_t format;  // storage format
+    uint8_t chunks;  // number of chunks stored
+    uint16_t sector[SONG_NUM_SECTORS];  // flash sector of each chunk of the song
+    uint16_t chunk_len[SONG_NUM_SECTORS];  // bytes stored in each chunk
+};
+struct song_table {
+    uint32_t magic;  // token to identify the table
+    uint32_t seq;  // sequence number - incremented on each write
+    struct song_table_entry entry[SEQ_NUM_SONGS];
+    uint32_t crc;  // CRC of everything above
+};
+struct song_table songt;
+
+#ifdef SONG_FLASH_ENCODED
+// encoded song layout
+// - raw copy of everything up to the step events
+// - step events for each track and step in order:
+//   - 0x80 + (n - 1) - n empty steps (1-128)
+//   - 0x01 to 0x3f - bitmap of used slots followed by each used event
+//     as type, data0, data1, length LSB, length MSB
+// - raw copy of the additional data after the step events
+// - magic number
+// no item takes more space encoded than it does decoded so a song loaded
+// to the end of the image can be decoded in place from the start
+// the head is split across chunks as needed but step items and the tail
+// with the magic number never cross a chunk so a chunk only depends on
+// its own steps and can be kept as long as they are not changed
+#define SONG_ENC_RUN 0x80  // run of empty steps
+#define SONG_ENC_RUN_MAX 128  // max steps in a run
+#define SONG_ENC_EVENT_LEN 5  // bytes per event
+#ifdef SONG_NOTES_PER_SCENE
+#define SONG_ENC_TOTAL_STEPS (SEQ_NUM_TRACKS * SEQ_NUM_SCENES * SEQ_NUM_STEPS)
+#else
+#define SONG_ENC_TOTAL_STEPS (SEQ_NUM_TRACKS * SEQ_NUM_STEPS)
+#endif
+#define SONG_ENC_HEAD_LEN (offsetof(struct song_data, trkevents))
+#define SONG_ENC_TAIL_START (offsetof(struct song_data, midi_remote_ctrl))
+#define SONG_ENC_TAIL_LEN (offsetof(struct song_data, dummy0) - SONG_ENC_TAIL_START)
+#define SONG_ENC_STEP_LEN (sizeof(struct track_event) * SEQ_TRACK_POLY)
+#define SONG_ENC_ITEM_MAX (1 + (SEQ_TRACK_POLY * SONG_ENC_EVENT_LEN))  // largest step item
+#define SONG_ENC_TASK_STEPS 64  // steps encoded each time the task runs
+#endif
 
 // state for stuff that isn't saved in the song
 #define SONG_IO_STATE_IDLE 0
 #define SONG_IO_STATE_LOAD 1
 #define SONG_IO_STATE_SAVE 2
+#define SONG_IO_STATE_PRELOAD 3
+#define SONG_IO_STATE_TABLE_LOAD 4
+#define SONG_IO_STATE_TABLE_SAVE 5
+#define SONG_IO_STATE_ENCODE 6  // encoding the next chunk of a save
+#define SONG_TABLE_STATE_STALE 0  // table needs to be loaded
+#define SONG_TABLE_STATE_READY 1  // table is loaded
+// song table load steps
+#define SONG_TABLE_LOAD_BANK0 0
+#define SONG_TABLE_LOAD_HEADER1 1
+#define SONG_TABLE_LOAD_BANK1 2
+#define SONG_TABLE_LOAD_BANK0_AGAIN 3
+#define SONG_TABLE_LOAD_SCAN 4  // checking legacy slots
 struct song_state {
     int state;  // flag to indicate if we are loading or saving
     int loadsave_song;  // which song number is loading or saving
+    uint64_t dirty;  // bitmap of blocks changed since the last load or save
+    int flash_song;  // song in flash that matches RAM except dirty blocks - -1 = none
+    int table_state;  // song table state
+    int table_bank;  // bank holding the current table
+    int table_step;  // song table load step
+    int table_valid0;  // bank 0 was valid when loading the table
+    uint32_t table_seq0;  // sequence of bank 0 when loading the table
+    uint32_t table_header[2];  // magic and sequence of bank 1 or a legacy magic number
+    int table_scan;  // legacy slot being checked
+    int alloc_next;  // next sector to try when allocating
+    int load_next;  // song to load when the flash is free - -1 = none
+    int load_song;  // song being loaded or preloaded
+    struct song_data *load_dest;  // song image being loaded
+    int load_chunk;  // next chunk to load
+    int load_pos;  // offset of the next chunk in the stored song
+    int32_t load_time;  // time for all runs of a load
+    uint32_t save_chunks;  // bitmap of chunks left to write in the current save
+    uint64_t save_dirty;  // dirty blocks when the save started
+    struct song_table_entry save_old;  // table entry replaced by the save
+    uint8_t *save_src;  // song image the save is written from
+    struct ext_flash_save_timing save_timing;  // timing for all runs of a save
+#if SONG_NUM_IMAGES > 1
+    struct song_data *spare;  // spare song image
+#endif
+#ifdef SONG_PRELOAD
+    int preload_next;  // song to preload when the flash is free - -1 = none
+    int preload_loading;  // song being preloaded - -1 = none or cancelled
+    int preload_song;  // song ready in the spare image - -1 = none
+    int swap_song;  // song switched in but not announced yet - -1 = none
+    int swap_running;  // 1 = the song was switched in by the running sequencer
+#endif
+#ifdef SONG_FLASH_ENCODED
+    uint16_t chunk_step[SONG_NUM_SECTORS];  // first step in each chunk of flash_song
+#ifdef SONG_PRELOAD
+    uint16_t preload_step[SONG_NUM_SECTORS];  // first step in each chunk of preload_song
+#endif
+    struct song_table_entry save_entry;  // table entry being built by the save
+    uint16_t save_step[SONG_NUM_SECTORS];  // first step in each chunk of the save
+    uint8_t save_used[SONG_FLASH_SECTORS / 8];  // sectors used by the table and the save
+    int save_free;  // free sectors left
+    uint32_t save_encode;  // bitmap of old chunks to encode again
+    int save_full;  // 1 = encode the whole song
+    int save_old_chunk;  // next old chunk to keep or encode
+    int save_kept;  // old chunks kept
+    int save_pending;  // 1 = a chunk is encoded but not written yet
+    int enc_head;  // next head byte to encode
+    int enc_head_end;  // end of the head bytes in the run
+    int enc_step;  // next step to encode
+    int enc_end;  // step the run ends at - -1 = no run
+    int enc_tail;  // 1 = the run ends with the tail
+    int enc_out;  // offset in the spare of the next encoded byte
+    int enc_chunk;  // offset in the spare of the chunk being encoded
+    int enc_chunk_step;  // first step in the chunk being encoded
+#endif
 };
 struct song_state songs;
 
+// local functions
+void song_io_start(void);
+int song_table_load_start(int bank, int len, uint8_t *dest);
+void song_table_load_task(int flash_state);
+void song_table_load_done(int bank);
+int song_table_check(void);
+void song_table_legacy(void);
+void song_table_scan_next(void);
+int song_load_start(int song_num, int state);
+int song_load_next(void);
+void song_load_task(int flash_state);
+void song_load_done(int error);
+#ifndef SONG_FLASH_ENCODED
+int song_save_alloc(int song_num, int len, int format, uint32_t reuse);
+int song_save_continue(void);
+int song_save_next(void);
+#endif
+int song_save_table(void);
+void song_save_task(int flash_state);
+void song_save_revert(void);
+int song_entry_chunks(struct song_table_entry *entry);
+int song_entry_overlaps(int song_num, int32_t addr, int len);
+int song_sector_usable(int sector);
+int song_sectors_used(uint8_t *used);
+int song_sector_alloc(uint8_t *used);
+#ifdef SONG_FLASH_ENCODED
+uint64_t song_encode_start(int song_num);
+void song_encode_task(void);
+int song_encode_next(void);
+void song_encode_run(int head, int head_end, int step, int step_end, int tail);
+int song_encode_add(int sector, int len, int step);
+int song_encode_chunk(void);
+void song_encode_write(void);
+int song_encode_done(void);
+void song_chunk_range(struct song_table_entry *entry, uint16_t *chunk_step,
+    int chunk, int *head, int *head_end, int *step, int *step_end);
+uint64_t song_chunk_blocks(struct song_table_entry *entry, uint16_t *chunk_step, int chunk);
+uint64_t song_range_blocks(int32_t start, int32_t end);
+int song_decode(struct song_data *dest, struct song_table_entry *entry,
+    uint16_t *chunk_step);
+#endif
+#if defined(SONG_SAVE_SNAPSHOT) || defined(SONG_FLASH_ENCODED)
+void song_snapshot(uint64_t blocks);
+#endif
+#ifdef SONG_PRELOAD
+void song_preload_cancel(void);
+int song_swap_images(void);
+#endif
+void song_mark_dirty(void *p, int len);
+void song_mark_step_dirty(int scene, int track, int step);
+void song_mark_step_param_dirty(int scene, int track, int step);
+
 // init the song
 void song_init(void) {
     songs.state = SONG_IO_STATE_IDLE;
     songs.loadsave_song = 0;
+    songs.flash_song = -1;
+    songs.table_state = SONG_TABLE_STATE_STALE;  // load before the first song
+    songs.table_bank = 0;
+    songs.alloc_next = 0;
+    songs.load_next = -1;
+    songs.save_chunks = 0;
+#ifdef SONG_FLASH_ENCODED
+    songs.save_pending = 0;
+    songs.enc_end = -1;
+#endif
+    songp = &song_images[0];
+#if SONG_NUM_IMAGES > 1
+    songs.spare = &song_images[1];
+#endif
+#ifdef SONG_PRELOAD
+    songs.preload_next = -1;
+    songs.preload_loading = -1;
+    songs.preload_song = -1;
+    songs.swap_song = -1;
+    songs.swap_running = 0;
+#endif
     song_clear();
 }
 
 // run the task to take care of loading or saving
 void song_timer_task(void) {
+    int flash_state;
     if(songs.state == SONG_IO_STATE_IDLE) {
+        song_io_start();
+        return;
+    }
+#ifdef SONG_FLASH_ENCODED
+    // the flash is not ours while encoding - its state belongs to someone else
+    if(songs.state == SONG_IO_STATE_ENCODE) {
+        song_encode_task();
         return;
     }
+#endif
     // check the flash to see if we're done
-    switch(ext_flash_get_state()) {
-        case EXT_FLASH_STATE_LOAD:
-            // load in progress
+    flash_state = ext_flash_get_state();
+    switch(songs.state) {
+        case SONG_IO_STATE_TABLE_LOAD:
+            song_table_load_task(flash_state);
             break;
-        case EXT_FLASH_STATE_LOAD_ERROR:
-            songs.state = SONG_IO_STATE_IDLE;
-            state_change_fire1(SCE_SONG_LOAD_ERROR, songs.loadsave_song);
-            song_clear();  // clear the song instead
-            break;
-        case EXT_FLASH_STATE_LOAD_DONE:
-            songs.state = SONG_IO_STATE_IDLE;
-            // check magic number to make sure we loaded correctly
-            if(song.magic_num != SONG_MAGIC_NUM) {
-                song_clear();  // clear the song instead
-                state_change_fire1(SCE_SONG_LOAD_ERROR, songs.loadsave_song);
-            }
-            else {
-                state_change_fire1(SCE_SONG_LOADED, songs.loadsave_song);
-            }
-            break;
-        case EXT_FLASH_STATE_SAVE:
-            // save in progress
+        case SONG_IO_STATE_LOAD:
+        case SONG_IO_STATE_PRELOAD:
+            song_load_task(flash_state);
             break;
-        case EXT_FLASH_STATE_SAVE_ERROR:
-            songs.state = SONG_IO_STATE_IDLE;
-            state_change_fire1(SCE_SONG_SAVE_ERROR, songs.loadsave_song);
-            break;
-        case EXT_FLASH_STATE_SAVE_DONE:
-            songs.state = SONG_IO_STATE_IDLE;
-            state_change_fire1(SCE_SONG_SAVED, songs.loadsave_song);
+        case SONG_IO_STATE_SAVE:
+        case SONG_IO_STATE_TABLE_SAVE:
+            song_save_task(flash_state);
             break;
         default:
             songs.state = SONG_IO_STATE_IDLE;
-            log_error("stt - idle state found");
+            log_error("stt - unknown state");
             break;
     }
 }
@@ -251,9 +467,9 @@ void song_clear(void) {
     // song list
     for(i = 0; i < SEQ_SONG_LIST_ENTRIES; i ++) {
         // default stuff to null
-        song.snglist[i].scene = SONG_LIST_SCENE_NULL;
-        song.snglist[i].length_beats = SEQ_SONG_LIST_DEFAULT_LENGTH;
-        song.snglist[i].kbtrans = SEQ_SONG_LIST_DEFAULT_KBTRANS;
+        songp->snglist[i].scene = SONG_LIST_SCENE_NULL;
+        songp->snglist[i].length_beats = SEQ_SONG_LIST_DEFAULT_LENGTH;
+        songp->snglist[i].kbtrans = SEQ_SONG_LIST_DEFAULT_KBTRANS;
     }
 
     // track params (per track)
@@ -310,11 +526,12 @@ void song_clear(void) {
         }
     }
     song_set_version_to_current();
-    song.magic_num = SONG_MAGIC_NUM;
+    songp->magic_num = SONG_MAGIC_NUM;
 
     // XXX debug
 //    log_debug("sc - song len: %d", sizeof(struct song_data));
 
+    songs.dirty = SONG_DIRTY_ALL;  // everything changed
     // fire event
     state_change_fire1(SCE_SONG_CLEARED, songs.loadsave_song);
 }
@@ -323,37 +540,247 @@ void song_clear(void) {
 // change events are not generated for each item loaded
 // it is up to the system to use the SCE_SONG_LOADED event
 // to update whatever state they may need
+// - the load starts once the song table is loaded and the flash is free
 int song_load(int song_num) {
     if(song_num < 0 || song_num > (SEQ_NUM_SONGS - 1)) {
         log_error("sl - song_num invalid: %d", song_num);
         return -1;
     }
-    if(ext_flash_load(EXT_FLASH_SONG_OFFSET + (EXT_FLASH_SONG_SIZE * song_num),
-            EXT_FLASH_SONG_SIZE, (uint8_t *)&song) == -1) {
-        log_error("sl - song load start error");
+    if(songs.state == SONG_IO_STATE_SAVE ||
+            songs.state == SONG_IO_STATE_TABLE_SAVE ||
+            songs.state == SONG_IO_STATE_ENCODE) {
+        log_error("sl - song save in progress");
         return -1;
     }
-    songs.loadsave_song = song_num;  // which song we are loading
-    songs.state = SONG_IO_STATE_LOAD;
+#ifdef SONG_PRELOAD
+    song_preload_cancel();  // the spare is not needed anymore
+    songs.swap_song = -1;  // a switched song not announced yet is replaced
+#endif
+    songs.load_next = song_num;
+    song_io_start();
     return 0;
 }
 
 // save the current song to flash mem from RAM - returns -1 on error
+// the song is written to free sectors and then the song table is updated
+// only chunks holding parts changed since the song was loaded or saved to
+// the same slot are written
+// - with SONG_FLASH_ENCODED the changed parts are copied first and encoded
+//   by the task a chunk at a time so the song can change during the save
+// - with SONG_SAVE_SNAPSHOT the song is copied first and can change during the save
 int song_save(int song_num) {
+#ifndef SONG_FLASH_ENCODED
+    uint32_t reuse = 0;
+#endif
     if(song_num < 0 || song_num > (SEQ_NUM_SONGS - 1)) {
         log_error("ss - song_num invalid: %d", song_num);
         return -1;
     }
-    if(ext_flash_save(EXT_FLASH_SONG_OFFSET + (EXT_FLASH_SONG_SIZE * song_num),
-            EXT_FLASH_SONG_SIZE, (uint8_t *)&song) == -1) {
+    if(songs.state != SONG_IO_STATE_IDLE || songs.load_next != -1 ||
+            songs.table_state != SONG_TABLE_STATE_READY) {
+        log_error("ss - song load/save in progress");
+        return -1;
+    }
+    songs.loadsave_song = song_num;  // which song we are saving
+    songs.save_timing.erase_time = 0;
+    songs.save_timing.program_time = 0;
+    songs.save_timing.total_time = 0;
+    // nothing changed - flash is already up to date
+    if(songs.flash_song == song_num && songs.dirty == 0) {
+        log_debug("ss - song %d unchanged", song_num);
+        state_change_fire1(SCE_SONG_SAVED, song_num);
+        return 0;
+    }
+#ifdef SONG_FLASH_ENCODED
+#ifdef SONG_PRELOAD
+    // the encoding uses the spare - load the preloaded song again after the save
+    if(songs.preload_song != -1) {
+        songs.preload_next = songs.preload_song;
+        songs.preload_song = -1;
+    }
+#endif
+    // only the blocks the changed chunks are encoded from are copied
+    song_snapshot(song_encode_start(song_num));
+    songs.state = SONG_IO_STATE_ENCODE;
+#else
+    songs.save_src = (uint8_t *)songp;
+    // clean sectors are the same as the stored song
+    if(songs.flash_song == song_num &&
+            songt.entry[song_num].format == SONG_FORMAT_RAW) {
+        reuse = (uint32_t)(~songs.dirty & SONG_DIRTY_ALL);
+    }
+    if(song_save_alloc(song_num, EXT_FLASH_SONG_SIZE, SONG_FORMAT_RAW, reuse) == -1) {
+        log_error("ss - flash full");
+        state_change_fire1(SCE_SONG_SAVE_ERROR, song_num);
+        return -1;
+    }
+#ifdef SONG_SAVE_SNAPSHOT
+    song_snapshot(songs.save_chunks);
+    songs.save_src = (uint8_t *)songs.spare;
+#endif
+#endif
+    // the flash is unknown until the save finishes
+    songs.flash_song = -1;
+    songs.save_dirty = songs.dirty;
+    // changes made after the start of the save are marked for the next one
+    songs.dirty = 0;
+#ifndef SONG_FLASH_ENCODED
+    if(song_save_continue() == -1) {
+        song_save_revert();
         log_error("ss - song save start error");
         return -1;
     }
-    songs.loadsave_song = song_num;  // which song we are loading
-    songs.state = SONG_IO_STATE_SAVE;
+#endif
+    return 0;
+}
+
+// notify the song that part of the flash was written by someone else
+void song_flash_changed(int32_t addr, int len) {
+    // the table was written over - load it again before the next load or save
+    if(addr < (EXT_FLASH_SONG_TABLE_OFFSET +
+            (EXT_FLASH_SONG_TABLE_SIZE * SONG_TABLE_NUM_BANKS)) &&
+            (addr + len) > EXT_FLASH_SONG_TABLE_OFFSET) {
+        songs.table_state = SONG_TABLE_STATE_STALE;
+        songs.flash_song = -1;
+#ifdef SONG_PRELOAD
+        if(songs.preload_song != -1) {
+            songs.preload_next = songs.preload_song;
+            songs.preload_song = -1;
+        }
+#endif
+        return;
+    }
+#ifdef SONG_PRELOAD
+    // a preloaded song that was written over needs to be loaded again
+    if(songs.preload_song != -1 &&
+            song_entry_overlaps(songs.preload_song, addr, len)) {
+        songs.preload_next = songs.preload_song;
+        songs.preload_song = -1;
+    }
+#endif
+    if(songs.flash_song != -1 && song_entry_overlaps(songs.flash_song, addr, len)) {
+        songs.flash_song = -1;
+    }
+}
+
+// get the number of bytes a song takes in flash
+// returns 0 if no song is stored or -1 if the song table is not loaded
+int song_get_flash_size(int song_num) {
+    if(song_num < 0 || song_num > (SEQ_NUM_SONGS - 1)) {
+        log_error("sgfs - song_num invalid: %d", song_num);
+        return -1;
+    }
+    if(songs.table_state != SONG_TABLE_STATE_READY) {
+        return -1;
+    }
+    return songt.entry[song_num].len;
+}
+
+// get the flash address of a byte of a stored song
+// returns -1 if the song is not that long
+int32_t song_get_flash_addr(int song_num, int offset) {
+    struct song_table_entry *entry;
+    int chunk;
+    if(song_num < 0 || song_num > (SEQ_NUM_SONGS - 1)) {
+        log_error("sgfa - song_num invalid: %d", song_num);
+        return -1;
+    }
+    if(songs.table_state != SONG_TABLE_STATE_READY || offset < 0) {
+        return -1;
+    }
+    entry = &songt.entry[song_num];
+    for(chunk = 0; chunk < song_entry_chunks(entry); chunk ++) {
+        if(offset < entry->chunk_len[chunk]) {
+            return (entry->sector[chunk] * EXT_FLASH_SECTOR_SIZE) + offset;
+        }
+        offset -= entry->chunk_len[chunk];
+    }
+    return -1;
+}
+
+// get the number of flash sectors free for songs
+// returns -1 if the song table is not loaded
+int song_get_flash_free(void) {
+    int song, chunk, count = 0;
+    if(songs.table_state != SONG_TABLE_STATE_READY) {
+        return -1;
+    }
+    for(chunk = 0; chunk < SONG_FLASH_SECTORS; chunk ++) {
+        if(song_sector_usable(chunk)) {
+            count ++;
+        }
+    }
+    for(song = 0; song < SEQ_NUM_SONGS; song ++) {
+        count -= song_entry_chunks(&songt.entry[song]);
+    }
+    return count;
+}
+
+#ifdef SONG_PRELOAD
+// preload a song into the spare image so it can be switched to without a gap
+// - the song is loaded in the background when the flash is free
+// - returns -1 on error
+int song_preload(int song_num) {
+    if(song_num < 0 || song_num > (SEQ_NUM_SONGS - 1)) {
+        log_error("sp - song_num invalid: %d", song_num);
+        return -1;
+    }
+    song_preload_cancel();
+    songs.preload_next = song_num;
     return 0;
 }
 
+// switch to the preloaded song by swapping the current and spare images
+// - safe to run in the sequencer - only the images are swapped and
+//   SCE_SONG_LOADED is fired later by song_swap_task() with arg1 = 1
+// returns the song number or -1 if no song is ready
+int song_swap_preloaded(void) {
+    int song = song_swap_images();
+    if(song == -1) {
+        return -1;
+    }
+    songs.swap_running = 1;
+    songs.swap_song = song;
+    return song;
+}
+
+// finish a preload as a normal load since the sequencer stopped before switching
+// - a song that is ready is switched in and a song that isn't is loaded again
+// - SCE_SONG_LOADED is fired once the song is in place
+// returns -1 if no preload was requested or the load could not be started
+int song_preload_finish(void) {
+    int song;
+    if(songs.preload_song != -1) {
+        songs.swap_running = 0;
+        songs.swap_song = song_swap_images();
+        return 0;
+    }
+    song = songs.preload_next;
+    if(song == -1) {
+        song = songs.preload_loading;
+    }
+    if(song == -1) {
+        return -1;
+    }
+    if(song_load(song) == -1) {
+        song_preload_cancel();  // don't leave it armed for the next start
+        return -1;
+    }
+    return 0;
+}
+
+// fire SCE_SONG_LOADED for a song switched in from the preload
+// - run from the UI task so the handlers don't run in the sequencer
+void song_swap_task(void) {
+    int song = songs.swap_song;
+    if(song == -1) {
+        return;
+    }
+    songs.swap_song = -1;
+    state_change_fire2(SCE_SONG_LOADED, song, songs.swap_running);
+}
+#endif
+
 // copy a scene to another scene replacing all data
 void song_copy_scene(int dest, int src) {
     int track;
@@ -394,17 +821,18 @@ void song_copy_scene(int dest, int src) {
 // - version major: upper 16 bits
 // - version minor: lower 16 bits
 uint32_t song_get_song_version(void) {
-    return song.song_version;
+    return songp->song_version;
 }
 
 // reset the song version to current version
 void song_set_version_to_current(void) {
-    song.song_version = CARBON_VERSION_MAJMIN;
+    songp->song_version = CARBON_VERSION_MAJMIN;
+    song_mark_dirty(&songp->song_version, sizeof(songp->song_version));
 }
 
 // get the song tempo
 float song_get_tempo(void) {
-    return song.tempo;
+    return songp->tempo;
 }
 
 // set the song tempo
@@ -413,14 +841,15 @@ void song_set_tempo(float tempo) {
         log_error("sst - tempo invalid: %f", tempo);
         return;
     }
-    song.tempo = tempo;
+    songp->tempo = tempo;
+    song_mark_dirty(&songp->tempo, sizeof(songp->tempo));
     // fire event
     state_change_fire0(SCE_SONG_TEMPO);
 }
 
 // get the swing
 int song_get_swing(void) {
-    return song.swing;
+    return songp->swing;
 }
 
 // set the swing
@@ -429,14 +858,15 @@ void song_set_swing(int swing) {
         log_error("ssw - swing invalid: %d", swing);
         return;
     }
-    song.swing = swing;
+    songp->swing = swing;
+    song_mark_dirty(&songp->swing, sizeof(songp->swing));
     // fire event
     state_change_fire1(SCE_SONG_SWING, swing);
 }
 
 // get the metronome mode
 int song_get_metronome_mode(void) {
-    return song.metronome;
+    return songp->metronome;
 }
 
 // set the metronome mode
@@ -446,14 +876,15 @@ void song_set_metronome_mode(int mode) {
         log_error("ssm - mode invalid: %d", mode);
         return;
     }
-    song.metronome = mode;
+    songp->metronome = mode;
+    song_mark_dirty(&songp->metronome, sizeof(songp->metronome));
     // fire event
     state_change_fire1(SCE_SONG_METRONOME_MODE, mode);
 }
 
 // get the metronome sound length
 int song_get_metronome_sound_len(void) {
-    return song.metronome_sound_len;
+    return songp->metronome_sound_len;
 }
 
 // set the metronome sound length
@@ -462,14 +893,15 @@ void song_set_metronome_sound_len(int len) {
         log_error("ssmsl - len invalid: %d", len);
         return;
     }
-    song.metronome_sound_len = len;
+    songp->metronome_sound_len = len;
+    song_mark_dirty(&songp->metronome_sound_len, sizeof(songp->metronome_sound_len));
     // fire event
     state_change_fire1(SCE_SONG_METRONOME_SOUND_LEN, len);
 }
 
 // get the MIDI input key velocity scaling
 int song_get_key_velocity_scale(void) {
-    return song.midi_key_vel_scale;
+    return songp->midi_key_vel_scale;
 }
 
 // set the MIDI input key velocity scaling
@@ -479,14 +911,15 @@ void song_set_key_velocity_scale(int velocity) {
         log_error("sskv - velocity invalid: %d", velocity);
         return;
     }
-    song.midi_key_vel_scale = velocity;
+    songp->midi_key_vel_scale = velocity;
+    song_mark_dirty(&songp->midi_key_vel_scale, sizeof(songp->midi_key_vel_scale));
     // fire event
     state_change_fire1(SCE_SONG_KEY_VELOCITY_SCALE, velocity);
 }
 
 // get the CV bend range
 int song_get_cv_bend_range(void) {
-    return song.cv_bend_range;
+    return songp->cv_bend_range;
 }
 
 // set the CV bend range
@@ -495,14 +928,15 @@ void song_set_cv_bend_range(int semis) {
         log_error("sscbr - semis invalid: %d", semis);
         return;
     }
-    song.cv_bend_range = semis;
+    songp->cv_bend_range = semis;
+    song_mark_dirty(&songp->cv_bend_range, sizeof(songp->cv_bend_range));
     // fire event
     state_change_fire1(SCE_SONG_CV_BEND_RANGE, semis);
 }
 
 // get the CV/gate channel pairings
 int song_get_cvgate_pairs(void) {
-    return song.cvgate_pairs;
+    return songp->cvgate_pairs;
 }
 
 // set the CV/gate channel pairings
@@ -511,7 +945,8 @@ void song_set_cvgate_pairs(int pairs) {
         log_error("ssccp - pairs invalid: %d", pairs);
         return;
     }
-    song.cvgate_pairs = pairs;
+    songp->cvgate_pairs = pairs;
+    song_mark_dirty(&songp->cvgate_pairs, sizeof(songp->cvgate_pairs));
     // fire event
     state_change_fire1(SCE_SONG_CV_GATE_PAIRS, pairs);
 }
@@ -522,7 +957,7 @@ int song_get_cvgate_pair_mode(int pair) {
         log_error("sgcpm - pair invalid: %d", pair);
         return -2;  // -1 is reserved for note
     }
-    return song.cvgate_pair_mode[pair];
+    return songp->cvgate_pair_mode[pair];
 }
 
 // set the CV/gate pair mode for an output (0-3 = A-D)
@@ -535,7 +970,9 @@ void song_set_cvgate_pair_mode(int pair, int mode) {
         log_error("sscpm - mode invalid: %d", mode);
         return;
     }
-    song.cvgate_pair_mode[pair] = mode;
+    songp->cvgate_pair_mode[pair] = mode;
+    song_mark_dirty(&songp->cvgate_pair_mode[pair],
+        sizeof(songp->cvgate_pair_mode[pair]));
     // fire event
     state_change_fire2(SCE_SONG_CV_GATE_PAIR_MODE, pair, mode);
 }
@@ -546,7 +983,7 @@ int song_get_cv_output_scaling(int out) {
         log_error("sgcos - out invalid: %d", out);
         return -1;
     }
-    return song.cv_output_scaling[out];
+    return songp->cv_output_scaling[out];
 }
 
 // set the CV output scaling for an output
@@ -559,7 +996,9 @@ void song_set_cv_output_scaling(int out, int mode) {
         log_error("sscos - mode invalid: %d", mode);
         return;
     }
-    song.cv_output_scaling[out] = mode;
+    songp->cv_output_scaling[out] = mode;
+    song_mark_dirty(&songp->cv_output_scaling[out],
+        sizeof(songp->cv_output_scaling[out]));
     // fire event
     state_change_fire2(SCE_SONG_CV_OUTPUT_SCALING, out, mode);
 }
@@ -570,7 +1009,7 @@ int song_get_cvcal(int out) {
         log_error("sgcc - out invalid: %d", out);
         return -1;
     }
-    return song.cvcal[out];
+    return songp->cvcal[out];
 }
 
 // set the CV calibration value for an output
@@ -583,7 +1022,8 @@ void song_set_cvcal(int out, int val) {
         log_error("sscc - val invalid: %d", val);
         return;
     }
-    song.cvcal[out] = val;
+    songp->cvcal[out] = val;
+    song_mark_dirty(&songp->cvcal[out], sizeof(songp->cvcal[out]));
     // fire event
     state_change_fire2(SCE_SONG_CVCAL, out, val);
 }
@@ -594,7 +1034,7 @@ int song_get_cvoffset(int out) {
         log_error("sgco - out invalid: %d", out);
         return -1;
     }
-    return song.cvoffset[out];
+    return songp->cvoffset[out];
 }
 
 // set the CV offset for an output
@@ -607,7 +1047,8 @@ void song_set_cvoffset(int out, int offset) {
         log_error("ssco - offset invalid: %d", offset);
         return;
     }
-    song.cvoffset[out] = offset;
+    songp->cvoffset[out] = offset;
+    song_mark_dirty(&songp->cvoffset[out], sizeof(songp->cvoffset[out]));
     // fire event
     state_change_fire2(SCE_SONG_CVOFFSET, out, offset);
 }
@@ -618,7 +1059,7 @@ int song_get_midi_port_clock_out(int port) {
         log_error("sgmpco - port invalid: %d", port);
         return -1;
     }
-    return song.midi_clock_out[port];
+    return songp->midi_clock_out[port];
 }
 
 // set a MIDI port clock out enable setting
@@ -631,14 +1072,15 @@ void song_set_midi_port_clock_out(int port, int ppq) {
         log_error("ssmpco - ppq invalid: %d", ppq);
         return;
     }
-    song.midi_clock_out[port] = ppq;
+    songp->midi_clock_out[port] = ppq;
+    song_mark_dirty(&songp->midi_clock_out[port], sizeof(songp->midi_clock_out[port]));
     // fire event
     state_change_fire2(SCE_SONG_MIDI_PORT_CLOCK_OUT, port, ppq);
 }
 
 // get the MIDI clock source - see lookup in song.h
 int song_get_midi_clock_source(void) {
-    return song.midi_clock_source;
+    return songp->midi_clock_source;
 }
 
 // set the MIDI clock source - see lookup in song.h
@@ -648,48 +1090,51 @@ void song_set_midi_clock_source(int source) {
         log_error("ssmcs - source invalid: %d", source);
         return;
     }
-    song.midi_clock_source = source;
+    songp->midi_clock_source = source;
+    song_mark_dirty(&songp->midi_clock_source, sizeof(songp->midi_clock_source));
     // fire event
-    state_change_fire1(SCE_SONG_MIDI_CLOCK_SOURCE, song.midi_clock_source);
+    state_change_fire1(SCE_SONG_MIDI_CLOCK_SOURCE, songp->midi_clock_source);
 }
 
 // get whether MIDI remote control is enabled
 int song_get_midi_remote_ctrl(void) {
-    return song.midi_remote_ctrl;
+    return songp->midi_remote_ctrl;
 }
 
 // set whether MIDI remote control is enabled
 void song_set_midi_remote_ctrl(int enable) {
     if(enable) {
-        song.midi_remote_ctrl = 1;
+        songp->midi_remote_ctrl = 1;
     }
     else {
-        song.midi_remote_ctrl = 0;
+        songp->midi_remote_ctrl = 0;
     }
+    song_mark_dirty(&songp->midi_remote_ctrl, sizeof(songp->midi_remote_ctrl));
     // fire event
-    state_change_fire1(SCE_SONG_MIDI_REMOTE_CTRL, song.midi_remote_ctrl);
+    state_change_fire1(SCE_SONG_MIDI_REMOTE_CTRL, songp->midi_remote_ctrl);
 }
 
 // get whether autolive is enabled
 int song_get_midi_autolive(void) {
-    return song.midi_autolive;
+    return songp->midi_autolive;
 }
 
 // set whether autolive is enable
 void song_set_midi_autolive(int enable) {
     if(enable) {
-        song.midi_autolive = 1;
+        songp->midi_autolive = 1;
     }
     else {
-        song.midi_autolive = 0;
+        songp->midi_autolive = 0;
     }
+    song_mark_dirty(&songp->midi_autolive, sizeof(songp->midi_autolive));
     // fire event
-    state_change_fire1(SCE_SONG_MIDI_AUTOLIVE, song.midi_autolive);
+    state_change_fire1(SCE_SONG_MIDI_AUTOLIVE, songp->midi_autolive);
 }
 
 // get the scene sync mode
 int song_get_scene_sync(void) {
-    return song.scene_sync;
+    return songp->scene_sync;
 }
 
 // set the scene sync mode
@@ -698,14 +1143,15 @@ void song_set_scene_sync(int mode) {
         log_error("ssss - mode invalid: %d", mode);
         return;
     }
-    song.scene_sync = mode;
+    songp->scene_sync = mode;
+    song_mark_dirty(&songp->scene_sync, sizeof(songp->scene_sync));
     // fire event
-    state_change_fire1(SCE_SONG_SCENE_SYNC, song.scene_sync);
+    state_change_fire1(SCE_SONG_SCENE_SYNC, songp->scene_sync);
 }
 
 // get the magic range
 int song_get_magic_range(void) {
-    return song.magic_range;
+    return songp->magic_range;
 }
 
 // set the magic range
@@ -714,14 +1160,15 @@ void song_set_magic_range(int range) {
         log_error("ssmr - range invalid: %d", range);
         return;
     }
-    song.magic_range = range;
+    songp->magic_range = range;
+    song_mark_dirty(&songp->magic_range, sizeof(songp->magic_range));
     // fire event
-    state_change_fire1(SCE_SONG_MAGIC_RANGE, song.magic_range);
+    state_change_fire1(SCE_SONG_MAGIC_RANGE, songp->magic_range);
 }
 
 // get the magic chance
 int song_get_magic_chance(void) {
-    return song.magic_chance;
+    return songp->magic_chance;
 }
 
 // set the magic chance
@@ -730,9 +1177,10 @@ void song_set_magic_chance(int chance) {
         log_error("ssmc - chance invalid: %d", chance);
         return;
     }
-    song.magic_chance = chance;
+    songp->magic_chance = chance;
+    song_mark_dirty(&songp->magic_chance, sizeof(songp->magic_chance));
     // fire event
-    state_change_fire1(SCE_SONG_MAGIC_CHANCE, song.magic_chance);
+    state_change_fire1(SCE_SONG_MAGIC_CHANCE, songp->magic_chance);
 }
 
 //
@@ -745,29 +1193,30 @@ void song_add_song_list_entry(int entry) {
         log_error("sasle - entry invalid: %d", entry);
         return;
     }
+    song_mark_dirty(songp->snglist, sizeof(songp->snglist));
     // move all entries backward from this point onward
     for(i = (SEQ_SONG_LIST_ENTRIES - 1); i >= entry; i --) {
         // detect whether the overwrite will produce any change to the current entry
-        if(song.snglist[i].scene != song.snglist[i - 1].scene ||
-                song.snglist[i].length_beats != song.snglist[i - 1].length_beats ||
-                song.snglist[i].kbtrans != song.snglist[i - 1].kbtrans) {
+        if(songp->snglist[i].scene != songp->snglist[i - 1].scene ||
+                songp->snglist[i].length_beats != songp->snglist[i - 1].length_beats ||
+                songp->snglist[i].kbtrans != songp->snglist[i - 1].kbtrans) {
             // overwrite the next entry with the previous entry
-            song.snglist[i].scene = song.snglist[i - 1].scene;
-            song.snglist[i].length_beats = song.snglist[i - 1].length_beats;
-            song.snglist[i].kbtrans = song.snglist[i - 1].kbtrans;
+            songp->snglist[i].scene = songp->snglist[i - 1].scene;
+            songp->snglist[i].length_beats = songp->snglist[i - 1].length_beats;
+            songp->snglist[i].kbtrans = songp->snglist[i - 1].kbtrans;
             // notify listeners that our slot has changed
-            state_change_fire2(SCE_SONG_LIST_SCENE, i, song.snglist[i].scene);
-            state_change_fire2(SCE_SONG_LIST_LENGTH, i, song.snglist[i].length_beats);
-            state_change_fire2(SCE_SONG_LIST_KBTRANS, i, song.snglist[i].kbtrans);
+            state_change_fire2(SCE_SONG_LIST_SCENE, i, songp->snglist[i].scene);
+            state_change_fire2(SCE_SONG_LIST_LENGTH, i, songp->snglist[i].length_beats);
+            state_change_fire2(SCE_SONG_LIST_KBTRANS, i, songp->snglist[i].kbtrans);
         }
     }
-    song.snglist[entry].scene = SONG_LIST_SCENE_NULL;
-    song.snglist[entry].length_beats = SEQ_SONG_LIST_DEFAULT_LENGTH;
-    song.snglist[entry].kbtrans = SEQ_SONG_LIST_DEFAULT_KBTRANS;
+    songp->snglist[entry].scene = SONG_LIST_SCENE_NULL;
+    songp->snglist[entry].length_beats = SEQ_SONG_LIST_DEFAULT_LENGTH;
+    songp->snglist[entry].kbtrans = SEQ_SONG_LIST_DEFAULT_KBTRANS;
     // notify listeners that our slot has changed
-    state_change_fire2(SCE_SONG_LIST_SCENE, entry, song.snglist[entry].scene);
-    state_change_fire2(SCE_SONG_LIST_LENGTH, entry, song.snglist[entry].length_beats);
-    state_change_fire2(SCE_SONG_LIST_KBTRANS, entry, song.snglist[entry].kbtrans);
+    state_change_fire2(SCE_SONG_LIST_SCENE, entry, songp->snglist[entry].scene);
+    state_change_fire2(SCE_SONG_LIST_LENGTH, entry, songp->snglist[entry].length_beats);
+    state_change_fire2(SCE_SONG_LIST_KBTRANS, entry, songp->snglist[entry].kbtrans);
 }
 
 // remove an entry in the song list
@@ -777,20 +1226,21 @@ void song_remove_song_list_entry(int entry) {
         log_error("srsle - entry invalid: %d", entry);
         return;
     }
+    song_mark_dirty(songp->snglist, sizeof(songp->snglist));
     // move all entries forward from this point onward
     for(i = entry; i < (SEQ_SONG_LIST_ENTRIES - 1); i ++) {
         // detect whether the overwrite will produce any change to the current entry
-        if(song.snglist[i].scene != song.snglist[i + 1].scene ||
-                song.snglist[i].length_beats != song.snglist[i + 1].length_beats ||
-                song.snglist[i].kbtrans != song.snglist[i + 1].kbtrans) {
+        if(songp->snglist[i].scene != songp->snglist[i + 1].scene ||
+                songp->snglist[i].length_beats != songp->snglist[i + 1].length_beats ||
+                songp->snglist[i].kbtrans != songp->snglist[i + 1].kbtrans) {
             // overwrite this entry with the next entry
-            song.snglist[i].scene = song.snglist[i + 1].scene;
-            song.snglist[i].length_beats = song.snglist[i + 1].length_beats;
-            song.snglist[i].kbtrans = song.snglist[i + 1].kbtrans;
+            songp->snglist[i].scene = songp->snglist[i + 1].scene;
+            songp->snglist[i].length_beats = songp->snglist[i + 1].length_beats;
+            songp->snglist[i].kbtrans = songp->snglist[i + 1].kbtrans;
             // notify listeners that our slot has changed
-            state_change_fire2(SCE_SONG_LIST_SCENE, i, song.snglist[i].scene);
-            state_change_fire2(SCE_SONG_LIST_LENGTH, i, song.snglist[i].length_beats);
-            state_change_fire2(SCE_SONG_LIST_KBTRANS, i, song.snglist[i].kbtrans);
+            state_change_fire2(SCE_SONG_LIST_SCENE, i, songp->snglist[i].scene);
+            state_change_fire2(SCE_SONG_LIST_LENGTH, i, songp->snglist[i].length_beats);
+            state_change_fire2(SCE_SONG_LIST_KBTRANS, i, songp->snglist[i].kbtrans);
         }
     }
 }
@@ -801,7 +1251,7 @@ int song_get_song_list_scene(int entry) {
         log_error("sgsls - entry invalid: %d", entry);
         return SONG_LIST_SCENE_NULL;
     }
-    return song.snglist[entry].scene;
+    return songp->snglist[entry].scene;
 }
 
 // set the scene for an entry in the song list
@@ -816,10 +1266,11 @@ void song_set_song_list_scene(int entry, int scene) {
         return;
     }
     // see if we should load defaults into the slot (if it was null before)
-    if(song.snglist[entry].scene == SONG_LIST_SCENE_NULL) {
+    if(songp->snglist[entry].scene == SONG_LIST_SCENE_NULL) {
         init = 1;
     }
-    song.snglist[entry].scene = scene;
+    songp->snglist[entry].scene = scene;
+    song_mark_dirty(&songp->snglist[entry].scene, sizeof(songp->snglist[entry].scene));
     // fire event
     state_change_fire2(SCE_SONG_LIST_SCENE, entry, scene);
     // if this slot was unused before then populate with defaults
@@ -835,7 +1286,7 @@ int song_get_song_list_length(int entry) {
         log_error("sgsll - entry invalid: %d", entry);
         return 0;
     }
-    return song.snglist[entry].length_beats;
+    return songp->snglist[entry].length_beats;
 }
 
 // set the length of the entry in beats
@@ -850,15 +1301,17 @@ void song_set_song_list_length(int entry, int length) {
         return;
     }
     // see if we should load defaults into the slot (if it was null before)
-    if(song.snglist[entry].scene == SONG_LIST_SCENE_NULL) {
+    if(songp->snglist[entry].scene == SONG_LIST_SCENE_NULL) {
         init = 1;
     }
-    song.snglist[entry].length_beats = length;
+    songp->snglist[entry].length_beats = length;
     // if this slot was unused before then populate with defaults
     if(init) {
         song_set_song_list_scene(entry, SEQ_SONG_LIST_DEFAULT_SCENE);  // first
         song_set_song_list_kbtrans(entry, SEQ_SONG_LIST_DEFAULT_KBTRANS);
     }
+    song_mark_dirty(&songp->snglist[entry].length_beats,
+        sizeof(songp->snglist[entry].length_beats));
     // fire event
     state_change_fire2(SCE_SONG_LIST_LENGTH, entry, length);
 }
@@ -869,7 +1322,7 @@ int song_get_song_list_kbtrans(int entry) {
         log_error("sgslkt - entry invalid: %d", entry);
         return 0;
     }
-    return song.snglist[entry].kbtrans;
+    return songp->snglist[entry].kbtrans;
 }
 
 // set the KB trans
@@ -885,15 +1338,17 @@ void song_set_song_list_kbtrans(int entry, int kbtrans) {
         return;
     }
     // see if we should load defaults into the slot (if it was null before)
-    if(song.snglist[entry].scene == SONG_LIST_SCENE_NULL) {
+    if(songp->snglist[entry].scene == SONG_LIST_SCENE_NULL) {
         init = 1;
     }
-    song.snglist[entry].kbtrans = kbtrans;
+    songp->snglist[entry].kbtrans = kbtrans;
     // if this slot was unused before then populate with defaults
     if(init) {
         song_set_song_list_scene(entry, SEQ_SONG_LIST_DEFAULT_SCENE);  // first
         song_set_song_list_length(entry, SEQ_SONG_LIST_DEFAULT_LENGTH);
     }
+    song_mark_dirty(&songp->snglist[entry].kbtrans,
+        sizeof(songp->snglist[entry].kbtrans));
     // fire event
     state_change_fire2(SCE_SONG_LIST_KBTRANS, entry, kbtrans);
 }
@@ -911,7 +1366,7 @@ int song_get_midi_program(int track, int mapnum) {
         log_error("sgmp - mapnum invalid: %d", mapnum);
         return -1;
     }
-    return song.trkparam[track].midi_program[mapnum];
+    return songp->trkparam[track].midi_program[mapnum];
 }
 
 // set the MIDI program for a track output
@@ -928,7 +1383,9 @@ void song_set_midi_program(int track, int mapnum, int program) {
         log_error("ssmp - program invalid: %d", program);
         return;
     }
-    song.trkparam[track].midi_program[mapnum] = program;
+    songp->trkparam[track].midi_program[mapnum] = program;
+    song_mark_dirty(&songp->trkparam[track].midi_program[mapnum],
+        sizeof(songp->trkparam[track].midi_program[mapnum]));
     // fire event
     state_change_fire3(SCE_SONG_MIDI_PROGRAM, track, mapnum, program);
 }
@@ -943,7 +1400,7 @@ int song_get_midi_port_map(int track, int mapnum) {
         log_error("sgmpm - mapnum invalid: %d", mapnum);
         return -2;
     }
-    return song.trkparam[track].midi_output_port[mapnum];
+    return songp->trkparam[track].midi_output_port[mapnum];
 }
 
 // set a MIDI port mapping for a track
@@ -960,7 +1417,9 @@ void song_set_midi_port_map(int track, int mapnum, int port) {
         log_error("ssmpm - port invalid: %d", port);
         return;
     }
-    song.trkparam[track].midi_output_port[mapnum] = port;
+    songp->trkparam[track].midi_output_port[mapnum] = port;
+    song_mark_dirty(&songp->trkparam[track].midi_output_port[mapnum],
+        sizeof(songp->trkparam[track].midi_output_port[mapnum]));
     // fire event
     state_change_fire3(SCE_SONG_MIDI_PORT_MAP, track, mapnum, port);
 }
@@ -975,7 +1434,7 @@ int song_get_midi_channel_map(int track, int mapnum) {
         log_error("ssgmcm - mapnum invalid: %d", mapnum);
         return -1;
     }
-    return song.trkparam[track].midi_output_chan[mapnum];
+    return songp->trkparam[track].midi_output_chan[mapnum];
 }
 
 // set a MIDI port mapping for a track
@@ -992,7 +1451,9 @@ void song_set_midi_channel_map(int track, int mapnum, int channel) {
         log_error("ssmcm - channel invalid: %d", channel);
         return;
     }
-    song.trkparam[track].midi_output_chan[mapnum] = channel;
+    songp->trkparam[track].midi_output_chan[mapnum] = channel;
+    song_mark_dirty(&songp->trkparam[track].midi_output_chan[mapnum],
+        sizeof(songp->trkparam[track].midi_output_chan[mapnum]));
     // fire event
     state_change_fire3(SCE_SONG_MIDI_CHANNEL_MAP, track, mapnum, channel);
 }
@@ -1003,7 +1464,7 @@ int song_get_key_split(int track) {
         log_error("sgks - track invalid: %d", track);
         return -1;
     }
-    return song.trkparam[track].midi_key_split;
+    return songp->trkparam[track].midi_key_split;
 }
 
 // set the MIDI input key split mode
@@ -1016,7 +1477,9 @@ void song_set_key_split(int track, int mode) {
         log_error("ssks - mode invalid: %d", mode);
         return;
     }
-    song.trkparam[track].midi_key_split = mode;
+    songp->trkparam[track].midi_key_split = mode;
+    song_mark_dirty(&songp->trkparam[track].midi_key_split,
+        sizeof(songp->trkparam[track].midi_key_split));
     // fire event
     state_change_fire2(SCE_SONG_KEY_SPLIT, track, mode);
 }
@@ -1027,7 +1490,7 @@ int song_get_track_type(int track) {
         log_error("sgtt - track invalid: %d", track);
         return -1;
     }
-    return song.trkparam[track].track_type;
+    return songp->trkparam[track].track_type;
 }
 
 // set the track type
@@ -1038,15 +1501,17 @@ void song_set_track_type(int track, int mode) {
     }
     switch(mode) {
         case SONG_TRACK_TYPE_DRUM:
-            song.trkparam[track].track_type = SONG_TRACK_TYPE_DRUM;
+            songp->trkparam[track].track_type = SONG_TRACK_TYPE_DRUM;
             break;
         case SONG_TRACK_TYPE_VOICE:
         default:
-            song.trkparam[track].track_type = SONG_TRACK_TYPE_VOICE;
+            songp->trkparam[track].track_type = SONG_TRACK_TYPE_VOICE;
             break;
     }
+    song_mark_dirty(&songp->trkparam[track].track_type,
+        sizeof(songp->trkparam[track].track_type));
     // fire event
-    state_change_fire2(SCE_SONG_TRACK_TYPE, track, song.trkparam[track].track_type);
+    state_change_fire2(SCE_SONG_TRACK_TYPE, track, songp->trkparam[track].track_type);
 }
 
 //
@@ -1062,7 +1527,7 @@ int song_get_step_length(int scene, int track) {
         log_error("sgsl - track invalid: %d", track);
         return -1;
     }
-    return song.trkscene[scene][track].step_len;
+    return songp->trkscene[scene][track].step_len;
 }
 
 // set the step length
@@ -1079,7 +1544,9 @@ void song_set_step_length(int scene, int track, int length) {
         log_error("sssl - length invalid: %d", length);
         return;
     }
-    song.trkscene[scene][track].step_len = length;
+    songp->trkscene[scene][track].step_len = length;
+    song_mark_dirty(&songp->trkscene[scene][track].step_len,
+        sizeof(songp->trkscene[scene][track].step_len));
     // fire event
     state_change_fire3(SCE_SONG_STEP_LEN, scene, track, length);
 }
@@ -1094,7 +1561,7 @@ int song_get_tonality(int scene, int track) {
         log_error("sgt - track invalid: %d", track);
         return -1;
     }
-    return song.trkscene[scene][track].tonality;
+    return songp->trkscene[scene][track].tonality;
 }
 
 // set the tonality on a track
@@ -1111,7 +1578,9 @@ void song_set_tonality(int scene, int track, int tonality) {
         log_error("sst - tonality invalid: %d", tonality);
         return;
     }
-    song.trkscene[scene][track].tonality = tonality;
+    songp->trkscene[scene][track].tonality = tonality;
+    song_mark_dirty(&songp->trkscene[scene][track].tonality,
+        sizeof(songp->trkscene[scene][track].tonality));
     // fire event
     state_change_fire3(SCE_SONG_TONALITY, scene, track, tonality);
 }
@@ -1126,7 +1595,7 @@ int song_get_transpose(int scene, int track) {
         log_error("sgt - track invalid: %d", track);
         return -1;
     }
-    return song.trkscene[scene][track].transpose;
+    return songp->trkscene[scene][track].transpose;
 }
 
 // set the transpose on a track
@@ -1143,7 +1612,9 @@ void song_set_transpose(int scene, int track, int transpose) {
         log_error("sst - transpose invalid: %d", transpose);
         return;
     }
-    song.trkscene[scene][track].transpose = transpose;
+    songp->trkscene[scene][track].transpose = transpose;
+    song_mark_dirty(&songp->trkscene[scene][track].transpose,
+        sizeof(songp->trkscene[scene][track].transpose));
     // fire event
     state_change_fire3(SCE_SONG_TRANSPOSE, scene, track, transpose);
 }
@@ -1158,7 +1629,7 @@ int song_get_bias_track(int scene, int track) {
         log_error("sgbt - track invalid: %d", track);
         return -1;
     }
-    return song.trkscene[scene][track].bias_track;
+    return songp->trkscene[scene][track].bias_track;
 }
 
 // set the bias track for this track
@@ -1175,7 +1646,9 @@ void song_set_bias_track(int scene, int track, int bias_track) {
         log_error("ssbt - bias track invalid: %d", bias_track);
         return;
     }
-    song.trkscene[scene][track].bias_track = bias_track;
+    songp->trkscene[scene][track].bias_track = bias_track;
+    song_mark_dirty(&songp->trkscene[scene][track].bias_track,
+        sizeof(songp->trkscene[scene][track].bias_track));
     // fire event
     state_change_fire3(SCE_SONG_BIAS_TRACK, scene, track, bias_track);
 }
@@ -1190,7 +1663,7 @@ int song_get_motion_start(int scene, int track) {
         log_error("sgms - track invalid: %d", track);
         return -1;
     }
-    return song.trkscene[scene][track].motion_start;
+    return songp->trkscene[scene][track].motion_start;
 }
 
 // set the motion start on a track
@@ -1207,7 +1680,9 @@ void song_set_motion_start(int scene, int track, int start) {
         log_error("ssms - start invalid: %d", start);
         return;
     }
-    song.trkscene[scene][track].motion_start = start;
+    songp->trkscene[scene][track].motion_start = start;
+    song_mark_dirty(&songp->trkscene[scene][track].motion_start,
+        sizeof(songp->trkscene[scene][track].motion_start));
     // fire event
     state_change_fire3(SCE_SONG_MOTION_START, scene, track, start);
 }
@@ -1222,7 +1697,7 @@ int song_get_motion_length(int scene, int track) {
         log_error("sgml - track invalid: %d", track);
         return -1;
     }
-    return song.trkscene[scene][track].motion_len;
+    return songp->trkscene[scene][track].motion_len;
 }
 
 // set the motion length on a track
@@ -1239,7 +1714,9 @@ void song_set_motion_length(int scene, int track, int length) {
         log_error("ssml - length invalid: %d", length);
         return;
     }
-    song.trkscene[scene][track].motion_len = length;
+    songp->trkscene[scene][track].motion_len = length;
+    song_mark_dirty(&songp->trkscene[scene][track].motion_len,
+        sizeof(songp->trkscene[scene][track].motion_len));
     // fire event
     state_change_fire3(SCE_SONG_MOTION_LENGTH, scene, track, length);
 }
@@ -1254,7 +1731,7 @@ int song_get_gate_time(int scene, int track) {
         log_error("sggt - track invalid: %d", track);
         return -1;
     }
-    return song.trkscene[scene][track].gate_time;
+    return songp->trkscene[scene][track].gate_time;
 }
 
 // set the gate time on a track in ticks
@@ -1271,7 +1748,9 @@ void song_set_gate_time(int scene, int track, int time) {
         log_error("ssgt - time invalid: %d", time);
         return;
     }
-    song.trkscene[scene][track].gate_time = time;
+    songp->trkscene[scene][track].gate_time = time;
+    song_mark_dirty(&songp->trkscene[scene][track].gate_time,
+        sizeof(songp->trkscene[scene][track].gate_time));
     // fire event
     state_change_fire3(SCE_SONG_GATE_TIME, scene, track, time);
 }
@@ -1286,7 +1765,7 @@ int song_get_pattern_type(int scene, int track) {
         log_error("sgpt - track invalid: %d", track);
         return -1;
     }
-    return song.trkscene[scene][track].pattern_type;
+    return songp->trkscene[scene][track].pattern_type;
 }
 
 // set the pattern type on a track
@@ -1303,7 +1782,9 @@ void song_set_pattern_type(int scene, int track, int pattern) {
         log_error("sspt - pattern invalid: %d", pattern);
         return;
     }
-    song.trkscene[scene][track].pattern_type = pattern;
+    songp->trkscene[scene][track].pattern_type = pattern;
+    song_mark_dirty(&songp->trkscene[scene][track].pattern_type,
+        sizeof(songp->trkscene[scene][track].pattern_type));
     // fire event
     state_change_fire3(SCE_SONG_PATTERN_TYPE, scene, track, pattern);
 }
@@ -1318,7 +1799,7 @@ int song_get_motion_dir(int scene, int track) {
         log_error("sgmd - track invalid: %d", track);
         return -1;
     }
-    return song.trkscene[scene][track].dir_reverse;
+    return songp->trkscene[scene][track].dir_reverse;
 }
 
 // set the playback direction on a track
@@ -1332,14 +1813,16 @@ void song_set_motion_dir(int scene, int track, int reverse) {
         return;
     }
     if(reverse) {
-        song.trkscene[scene][track].dir_reverse = 1;
+        songp->trkscene[scene][track].dir_reverse = 1;
     }
     else {
-        song.trkscene[scene][track].dir_reverse = 0;
+        songp->trkscene[scene][track].dir_reverse = 0;
     }
+    song_mark_dirty(&songp->trkscene[scene][track].dir_reverse,
+        sizeof(songp->trkscene[scene][track].dir_reverse));
     // fire event
     state_change_fire3(SCE_SONG_MOTION_DIR, scene, track,
-        song.trkscene[scene][track].dir_reverse);
+        songp->trkscene[scene][track].dir_reverse);
 }
 
 // get the mute state of a track - returns -1 on error
@@ -1352,7 +1835,7 @@ int song_get_mute(int scene, int track) {
         log_error("sgm - track invalid: %d", track);
         return -1;
     }
-    return song.trkscene[scene][track].mute;
+    return songp->trkscene[scene][track].mute;
 }
 
 // sets the mute state of a track
@@ -1366,14 +1849,16 @@ void song_set_mute(int scene, int track, int mute) {
         return;
     }
     if(mute) {
-        song.trkscene[scene][track].mute = 1;
+        songp->trkscene[scene][track].mute = 1;
     }
     else {
-        song.trkscene[scene][track].mute = 0;
+        songp->trkscene[scene][track].mute = 0;
     }
+    song_mark_dirty(&songp->trkscene[scene][track].mute,
+        sizeof(songp->trkscene[scene][track].mute));
     // fire event
     state_change_fire3(SCE_SONG_MUTE, scene, track,
-        song.trkscene[scene][track].mute);
+        songp->trkscene[scene][track].mute);
 }
 
 // get the arp type on a track - returns -1 on error
@@ -1386,7 +1871,7 @@ int song_get_arp_type(int scene, int track) {
         log_error("sgat - track invalid: %d", track);
         return -1;
     }
-    return song.trkscene[scene][track].arp_type;
+    return songp->trkscene[scene][track].arp_type;
 }
 
 // set the arp type on a track
@@ -1403,7 +1888,9 @@ void song_set_arp_type(int scene, int track, int type) {
         log_error("ssat - arp type invalid: %d", type);
         return;
     }
-    song.trkscene[scene][track].arp_type = type;
+    songp->trkscene[scene][track].arp_type = type;
+    song_mark_dirty(&songp->trkscene[scene][track].arp_type,
+        sizeof(songp->trkscene[scene][track].arp_type));
     // fire event
     state_change_fire3(SCE_SONG_ARP_TYPE, scene, track, type);
 }
@@ -1418,7 +1905,7 @@ int song_get_arp_speed(int scene, int track) {
         log_error("sgas - track invalid: %d", track);
         return -1;
     }
-    return song.trkscene[scene][track].arp_speed;
+    return songp->trkscene[scene][track].arp_speed;
 }
 
 // set the arp speed on a track
@@ -1435,7 +1922,9 @@ void song_set_arp_speed(int scene, int track, int speed) {
         log_error("ssas - speed invalid: %d", speed);
         return;
     }
-    song.trkscene[scene][track].arp_speed = speed;
+    songp->trkscene[scene][track].arp_speed = speed;
+    song_mark_dirty(&songp->trkscene[scene][track].arp_speed,
+        sizeof(songp->trkscene[scene][track].arp_speed));
     // fire event
     state_change_fire3(SCE_SONG_ARP_SPEED, scene, track, speed);
 }
@@ -1450,7 +1939,7 @@ int song_get_arp_gate_time(int scene, int track) {
         log_error("sgagt - track invalid: %d", track);
         return 0;
     }
-    return song.trkscene[scene][track].arp_gate_time;
+    return songp->trkscene[scene][track].arp_gate_time;
 }
 
 // set the arp gate time on a track
@@ -1467,7 +1956,9 @@ void song_set_arp_gate_time(int scene, int track, int time) {
         log_error("ssagt - time invalid: %d", time);
         return;
     }
-    song.trkscene[scene][track].arp_gate_time = time;
+    songp->trkscene[scene][track].arp_gate_time = time;
+    song_mark_dirty(&songp->trkscene[scene][track].arp_gate_time,
+        sizeof(songp->trkscene[scene][track].arp_gate_time));
     // fire event
     state_change_fire3(SCE_SONG_ARP_GATE_TIME, scene, track, time);
 }
@@ -1482,7 +1973,7 @@ int song_get_arp_enable(int scene, int track) {
         log_error("sgae - track invalid: %d", track);
         return 0;
     }
-    return song.trkscene[scene][track].arp_enable;
+    return songp->trkscene[scene][track].arp_enable;
 }
 
 // set if the arp is enabled on a track
@@ -1496,14 +1987,16 @@ void song_set_arp_enable(int scene, int track, int enable) {
         return;
     }
     if(enable) {
-        song.trkscene[scene][track].arp_enable = 1;
+        songp->trkscene[scene][track].arp_enable = 1;
     }
     else {
-        song.trkscene[scene][track].arp_enable = 0;
+        songp->trkscene[scene][track].arp_enable = 0;
     }
+    song_mark_dirty(&songp->trkscene[scene][track].arp_enable,
+        sizeof(songp->trkscene[scene][track].arp_enable));
     // fire event
     state_change_fire3(SCE_SONG_ARP_ENABLE, scene, track,
-        song.trkscene[scene][track].arp_enable);
+        songp->trkscene[scene][track].arp_enable);
 }
 
 //
@@ -1526,13 +2019,14 @@ void song_clear_step(int scene, int track, int step) {
     }
     for(poly = 0; poly < SEQ_TRACK_POLY; poly ++) {
 #ifdef SONG_NOTES_PER_SCENE
-        song.trkevents[scene][track][step][poly].type = SONG_EVENT_NULL;
+        songp->trkevents[scene][track][step][poly].type = SONG_EVENT_NULL;
 #else
-        song.trkevents[track][step][poly].type = SONG_EVENT_NULL;
+        songp->trkevents[track][step][poly].type = SONG_EVENT_NULL;
 #endif
     }
     song_set_ratchet_mode(scene, track, step, SEQ_RATCHET_MIN);
     song_set_start_delay(scene, track, step, SEQ_START_DELAY_MIN);
+    song_mark_step_dirty(scene, track, step);
     // fire event
     state_change_fire3(SCE_SONG_CLEAR_STEP, scene, track, step);
 }
@@ -1556,10 +2050,11 @@ void song_clear_step_event(int scene, int track, int step, int slot) {
         return;
     }
 #ifdef SONG_NOTES_PER_SCENE
-    song.trkevents[scene][track][step][slot].type = SONG_EVENT_NULL;
+    songp->trkevents[scene][track][step][slot].type = SONG_EVENT_NULL;
 #else
-    song.trkevents[track][step][slot].type = SONG_EVENT_NULL;
+    songp->trkevents[track][step][slot].type = SONG_EVENT_NULL;
 #endif
+    song_mark_step_dirty(scene, track, step);
     // fire event
     state_change_fire3(SCE_SONG_CLEAR_STEP_EVENT, scene, track, step);
 }
@@ -1583,9 +2078,9 @@ int song_get_num_step_events(int scene, int track, int step) {
     num_events = 0;
     for(poly = 0; poly < SEQ_TRACK_POLY; poly ++) {
 #ifdef SONG_NOTES_PER_SCENE
-        if(song.trkevents[scene][track][step][poly].type != SONG_EVENT_NULL) {
+        if(songp->trkevents[scene][track][step][poly].type != SONG_EVENT_NULL) {
 #else
-        if(song.trkevents[track][step][poly].type != SONG_EVENT_NULL) {
+        if(songp->trkevents[track][step][poly].type != SONG_EVENT_NULL) {
 #endif
             num_events ++;
         }
@@ -1616,20 +2111,20 @@ int song_add_step_event(int scene, int track, int step,
     for(poly = 0; poly < SEQ_TRACK_POLY; poly ++) {
         // a blank slot was found
 #ifdef SONG_NOTES_PER_SCENE
-        if(song.trkevents[scene][track][step][poly].type == SONG_EVENT_NULL &&
+        if(songp->trkevents[scene][track][step][poly].type == SONG_EVENT_NULL &&
 #else
-        if(song.trkevents[track][step][poly].type == SONG_EVENT_NULL &&
+        if(songp->trkevents[track][step][poly].type == SONG_EVENT_NULL &&
 #endif
                 blank_slot == -1) {
             blank_slot = poly;
         }
         // an existing slot was found with the same note or CC
 #ifdef SONG_NOTES_PER_SCENE
-        if(song.trkevents[scene][track][step][poly].type == event->type &&
-                song.trkevents[scene][track][step][poly].data0 == event->data0) {
+        if(songp->trkevents[scene][track][step][poly].type == event->type &&
+                songp->trkevents[scene][track][step][poly].data0 == event->data0) {
 #else
-        if(song.trkevents[track][step][poly].type == event->type &&
-                song.trkevents[track][step][poly].data0 == event->data0) {
+        if(songp->trkevents[track][step][poly].type == event->type &&
+                songp->trkevents[track][step][poly].data0 == event->data0) {
 #endif
             existing_slot = poly;
             break;  // this is all we need
@@ -1649,16 +2144,17 @@ int song_add_step_event(int scene, int track, int step,
     }
     // copy the data to the song
 #ifdef SONG_NOTES_PER_SCENE
-    song.trkevents[scene][track][step][slot].type = event->type;
-    song.trkevents[scene][track][step][slot].data0 = event->data0;
-    song.trkevents[scene][track][step][slot].data1 = event->data1;
-    song.trkevents[scene][track][step][slot].length = event->length;
+    songp->trkevents[scene][track][step][slot].type = event->type;
+    songp->trkevents[scene][track][step][slot].data0 = event->data0;
+    songp->trkevents[scene][track][step][slot].data1 = event->data1;
+    songp->trkevents[scene][track][step][slot].length = event->length;
 #else
-    song.trkevents[track][step][slot].type = event->type;
-    song.trkevents[track][step][slot].data0 = event->data0;
-    song.trkevents[track][step][slot].data1 = event->data1;
-    song.trkevents[track][step][slot].length = event->length;
+    songp->trkevents[track][step][slot].type = event->type;
+    songp->trkevents[track][step][slot].data0 = event->data0;
+    songp->trkevents[track][step][slot].data1 = event->data1;
+    songp->trkevents[track][step][slot].length = event->length;
 #endif
+    song_mark_step_dirty(scene, track, step);
     // fire event
     state_change_fire3(SCE_SONG_ADD_STEP_EVENT, scene, track, step);
     return 0;
@@ -1684,16 +2180,17 @@ int song_set_step_event(int scene, int track, int step,
         return -1;
     }
 #ifdef SONG_NOTES_PER_SCENE
-    song.trkevents[scene][track][step][slot].type = event->type;
-    song.trkevents[scene][track][step][slot].data0 = event->data0;
-    song.trkevents[scene][track][step][slot].data1 = event->data1;
-    song.trkevents[scene][track][step][slot].length = event->length;
+    songp->trkevents[scene][track][step][slot].type = event->type;
+    songp->trkevents[scene][track][step][slot].data0 = event->data0;
+    songp->trkevents[scene][track][step][slot].data1 = event->data1;
+    songp->trkevents[scene][track][step][slot].length = event->length;
 #else
-    song.trkevents[track][step][slot].type = event->type;
-    song.trkevents[track][step][slot].data0 = event->data0;
-    song.trkevents[track][step][slot].data1 = event->data1;
-    song.trkevents[track][step][slot].length = event->length;
+    songp->trkevents[track][step][slot].type = event->type;
+    songp->trkevents[track][step][slot].data0 = event->data0;
+    songp->trkevents[track][step][slot].data1 = event->data1;
+    songp->trkevents[track][step][slot].length = event->length;
 #endif
+    song_mark_step_dirty(scene, track, step);
     // fire event
     state_change_fire3(SCE_SONG_SET_STEP_EVENT, scene, track, step);
     return 0;
@@ -1721,15 +2218,15 @@ int song_get_step_event(int scene, int track, int step, int slot,
     }
     // copy the data from the song
 #ifdef SONG_NOTES_PER_SCENE
-    event->type = song.trkevents[scene][track][step][slot].type;
-    event->data0 = song.trkevents[scene][track][step][slot].data0;
-    event->data1 = song.trkevents[scene][track][step][slot].data1;
-    event->length = song.trkevents[scene][track][step][slot].length;
+    event->type = songp->trkevents[scene][track][step][slot].type;
+    event->data0 = songp->trkevents[scene][track][step][slot].data0;
+    event->data1 = songp->trkevents[scene][track][step][slot].data1;
+    event->length = songp->trkevents[scene][track][step][slot].length;
 #else
-    event->type = song.trkevents[track][step][slot].type;
-    event->data0 = song.trkevents[track][step][slot].data0;
-    event->data1 = song.trkevents[track][step][slot].data1;
-    event->length = song.trkevents[track][step][slot].length;
+    event->type = songp->trkevents[track][step][slot].type;
+    event->data0 = songp->trkevents[track][step][slot].data0;
+    event->data1 = songp->trkevents[track][step][slot].data1;
+    event->length = songp->trkevents[track][step][slot].length;
 #endif
     // blank slot
     if(event->type == SONG_EVENT_NULL) {
@@ -1738,6 +2235,28 @@ int song_get_step_event(int scene, int track, int step, int slot,
     return 0;
 }
 
+// get a pointer to the SEQ_TRACK_POLY event slots on a step - returns NULL on error
+// the slots might be blank or fragmented
+struct track_event *song_get_step_event_slots(int scene, int track, int step) {
+    if(scene < 0 || scene >= SEQ_NUM_SCENES) {
+        log_error("sgses - scene invalid: %d", scene);
+        return NULL;
+    }
+    if(track < 0 || track >= SEQ_NUM_TRACKS) {
+        log_error("sgses - track invalid: %d", track);
+        return NULL;
+    }
+    if(step < 0 || step >= SEQ_NUM_STEPS) {
+        log_error("sgses - step invalid: %d", step);
+        return NULL;
+    }
+#ifdef SONG_NOTES_PER_SCENE
+    return songp->trkevents[scene][track][step];
+#else
+    return songp->trkevents[track][step];
+#endif
+}
+
 // get the start delay for a step - returns -1 on error
 int song_get_start_delay(int scene, int track, int step) {
     if(scene < 0 || scene >= SEQ_NUM_SCENES) {
@@ -1753,9 +2272,9 @@ int song_get_start_delay(int scene, int track, int step) {
         return -1;
     }
 #ifdef SONG_NOTES_PER_SCENE
-    return song.trkstepparam[scene][track][step].start_delay;
+    return songp->trkstepparam[scene][track][step].start_delay;
 #else
-    return song.trkstepparam[track][step].start_delay;
+    return songp->trkstepparam[track][step].start_delay;
 #endif
 }
 
@@ -1778,10 +2297,11 @@ void song_set_start_delay(int scene, int track, int step, int delay) {
         return;
     }
 #ifdef SONG_NOTES_PER_SCENE
-    song.trkstepparam[scene][track][step].start_delay = delay;
+    songp->trkstepparam[scene][track][step].start_delay = delay;
 #else
-    song.trkstepparam[track][step].start_delay = delay;
+    songp->trkstepparam[track][step].start_delay = delay;
 #endif
+    song_mark_step_param_dirty(scene, track, step);
     // fire event
     state_change_fire3(SCE_SONG_START_DELAY, scene, track, step);
 }
@@ -1801,9 +2321,9 @@ int song_get_ratchet_mode(int scene, int track, int step) {
         return -1;
     }
 #ifdef SONG_NOTES_PER_SCENE
-    return song.trkstepparam[scene][track][step].ratchet;
+    return songp->trkstepparam[scene][track][step].ratchet;
 #else
-    return song.trkstepparam[track][step].ratchet;
+    return songp->trkstepparam[track][step].ratchet;
 #endif
 }
 
@@ -1826,10 +2346,1149 @@ void song_set_ratchet_mode(int scene, int track, int step, int ratchet) {
         return;
     }
 #ifdef SONG_NOTES_PER_SCENE
-    song.trkstepparam[scene][track][step].ratchet = ratchet;
+    songp->trkstepparam[scene][track][step].ratchet = ratchet;
 #else
-    song.trkstepparam[track][step].ratchet = ratchet;
+    songp->trkstepparam[track][step].ratchet = ratchet;
 #endif
+    song_mark_step_param_dirty(scene, track, step);
     // fire event
     state_change_fire3(SCE_SONG_RATCHET_MODE, scene, track, step);
 }
+
+//
+// local functions
+//
+// start the next queued flash operation once the flash is free
+// - the song table is loaded first, then a song load and then a preload
+void song_io_start(void) {
+    if(songs.state != SONG_IO_STATE_IDLE) {
+        return;
+    }
+    if(songs.table_state != SONG_TABLE_STATE_READY) {
+        if(song_table_load_start(0, sizeof(songt), (uint8_t *)&songt) == -1) {
+            return;  // flash is busy - try again next time
+        }
+        songs.table_step = SONG_TABLE_LOAD_BANK0;
+        return;
+    }
+    if(songs.load_next != -1) {
+        if(song_load_start(songs.load_next, SONG_IO_STATE_LOAD) == -1) {
+            return;  // flash is busy - try again next time
+        }
+        songs.load_next = -1;
+        return;
+    }
+#ifdef SONG_PRELOAD
+    if(songs.preload_next != -1) {
+        if(song_load_start(songs.preload_next, SONG_IO_STATE_PRELOAD) == -1) {
+            return;  // flash is busy - try again next time
+        }
+        songs.preload_next = -1;
+    }
+#endif
+}
+
+// start loading part of a song table bank - returns -1 on error
+int song_table_load_start(int bank, int len, uint8_t *dest) {
+    if(ext_flash_load(EXT_FLASH_SONG_TABLE_OFFSET +
+            (EXT_FLASH_SONG_TABLE_SIZE * bank), len, dest) == -1) {
+        return -1;
+    }
+    songs.state = SONG_IO_STATE_TABLE_LOAD;
+    return 0;
+}
+
+// check if a step of the song table load has finished
+// - bank 0 is loaded and then the header of bank 1 is checked to see if it is newer
+// - if a step can't be started the load starts over the next time
+void song_table_load_task(int flash_state) {
+    switch(flash_state) {
+        case EXT_FLASH_STATE_LOAD:
+            // load in progress
+            break;
+        case EXT_FLASH_STATE_LOAD_ERROR:
+            // the load starts over when the flash is free
+            songs.state = SONG_IO_STATE_IDLE;
+            log_error("stlt - song table load error");
+            break;
+        case EXT_FLASH_STATE_LOAD_DONE:
+            songs.state = SONG_IO_STATE_IDLE;
+            switch(songs.table_step) {
+                case SONG_TABLE_LOAD_BANK0:
+                    songs.table_valid0 = song_table_check();
+                    songs.table_seq0 = songt.seq;
+                    if(song_table_load_start(1, sizeof(songs.table_header),
+                            (uint8_t *)songs.table_header) == 0) {
+                        songs.table_step = SONG_TABLE_LOAD_HEADER1;
+                    }
+                    break;
+                case SONG_TABLE_LOAD_HEADER1:
+                    if(songs.table_header[0] == SONG_TABLE_MAGIC &&
+                            (!songs.table_valid0 ||
+                            (int32_t)(songs.table_header[1] - songs.table_seq0) > 0)) {
+                        if(song_table_load_start(1, sizeof(songt),
+                                (uint8_t *)&songt) == 0) {
+                            songs.table_step = SONG_TABLE_LOAD_BANK1;
+                        }
+                    }
+                    else if(songs.table_valid0) {
+                        song_table_load_done(0);
+                    }
+                    else {
+                        song_table_legacy();
+                    }
+                    break;
+                case SONG_TABLE_LOAD_BANK1:
+                    if(song_table_check()) {
+                        song_table_load_done(1);
+                    }
+                    // bank 1 was not written completely - use bank 0 again
+                    else if(songs.table_valid0) {
+                        if(song_table_load_start(0, sizeof(songt),
+                                (uint8_t *)&songt) == 0) {
+                            songs.table_step = SONG_TABLE_LOAD_BANK0_AGAIN;
+                        }
+                    }
+                    else {
+                        song_table_legacy();
+                    }
+                    break;
+                case SONG_TABLE_LOAD_BANK0_AGAIN:
+                    if(song_table_check()) {
+                        song_table_load_done(0);
+                    }
+                    break;
+                case SONG_TABLE_LOAD_SCAN:
+                    // legacy slots without a song are free
+                    if(songs.table_header[0] != SONG_MAGIC_NUM) {
+                        songt.entry[songs.table_scan].len = 0;
+                        songt.entry[songs.table_scan].chunks = 0;
+                    }
+                    songs.table_scan ++;
+                    song_table_scan_next();
+                    break;
+                default:
+                    break;
+            }
+            break;
+        default:
+            songs.state = SONG_IO_STATE_IDLE;
+            log_error("stlt - idle state found");
+            break;
+    }
+}
+
+// use the song table that was loaded from a bank
+void song_table_load_done(int bank) {
+    songs.table_bank = bank;
+    songs.table_state = SONG_TABLE_STATE_READY;
+    // start allocating in a different place each time to spread the wear
+    songs.alloc_next = (songt.seq * SONG_NUM_SECTORS) % SONG_FLASH_SECTORS;
+    log_debug("stld - song table bank %d loaded - seq: %d - free sectors: %d",
+        bank, (int)songt.seq, song_get_flash_free());
+}
+
+// check the song table after loading - returns 1 if it is valid
+int song_table_check(void) {
+    struct song_table_entry *entry;
+    uint32_t len;
+    int song, chunk;
+    if(songt.magic != SONG_TABLE_MAGIC || songt.crc != sysex_bulk_crc(0,
+            (uint8_t *)&songt, offsetof(struct song_table, crc))) {
+        return 0;
+    }
+    for(song = 0; song < SEQ_NUM_SONGS; song ++) {
+        entry = &songt.entry[song];
+        if(entry->len > EXT_FLASH_SONG_SIZE || entry->chunks > SONG_NUM_SECTORS) {
+            return 0;
+        }
+        len = 0;
+        for(chunk = 0; chunk < song_entry_chunks(entry); chunk ++) {
+            if(!song_sector_usable(entry->sector[chunk]) ||
+                    entry->chunk_len[chunk] == 0 ||
+                    entry->chunk_len[chunk] > EXT_FLASH_SECTOR_SIZE) {
+                return 0;
+            }
+            len += entry->chunk_len[chunk];
+        }
+        if(len != entry->len) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// make a song table for songs stored in fixed slots by older firmware
+// - the first table write goes to bank 0
+// - each slot is checked for a song so empty slots can be used
+void song_table_legacy(void) {
+    struct song_table_entry *entry;
+    int song, chunk;
+    log_debug("stl - no song table - using legacy slots");
+    memset(&songt, 0, sizeof(songt));
+    songt.magic = SONG_TABLE_MAGIC;
+    for(song = 0; song < SEQ_NUM_LEGACY_SONGS; song ++) {
+        entry = &songt.entry[song];
+        entry->len = EXT_FLASH_SONG_SIZE;
+        entry->format = SONG_FORMAT_RAW;
+        entry->chunks = SONG_NUM_SECTORS;
+        for(chunk = 0; chunk < SONG_NUM_SECTORS; chunk ++) {
+            entry->sector[chunk] = ((EXT_FLASH_SONG_OFFSET +
+                (EXT_FLASH_SONG_SIZE * song)) / EXT_FLASH_SECTOR_SIZE) + chunk;
+            entry->chunk_len[chunk] = EXT_FLASH_SECTOR_SIZE;
+        }
+    }
+    songs.table_scan = 0;
+    song_table_scan_next();
+}
+
+// check the magic number of the next legacy slot
+// - the table is ready once all slots are checked
+void song_table_scan_next(void) {
+    if(songs.table_scan >= SEQ_NUM_LEGACY_SONGS) {
+        song_table_load_done(1);
+        return;
+    }
+    if(ext_flash_load(EXT_FLASH_SONG_OFFSET +
+            (EXT_FLASH_SONG_SIZE * songs.table_scan) +
+            offsetof(struct song_data, magic_num), sizeof(uint32_t),
+            (uint8_t *)songs.table_header) == -1) {
+        return;  // the table load starts over
+    }
+    songs.state = SONG_IO_STATE_TABLE_LOAD;
+    songs.table_step = SONG_TABLE_LOAD_SCAN;
+}
+
+// start loading a song into the current or spare image
+// returns -1 if the flash is busy
+int song_load_start(int song_num, int state) {
+    if(state == SONG_IO_STATE_LOAD) {
+        songs.loadsave_song = song_num;  // which song we are loading
+        songs.load_dest = songp;
+    }
+#ifdef SONG_PRELOAD
+    else {
+        songs.preload_loading = song_num;
+        songs.load_dest = songs.spare;
+    }
+#endif
+    songs.load_song = song_num;
+    songs.load_chunk = 0;
+    songs.load_pos = 0;
+    songs.load_time = 0;
+    songs.state = state;
+    // nothing stored for this song
+    if(songt.entry[song_num].len == 0) {
+        song_load_done(1);
+        return 0;
+    }
+    if(song_load_next() == -1) {
+        songs.state = SONG_IO_STATE_IDLE;
+#ifdef SONG_PRELOAD
+        if(state == SONG_IO_STATE_PRELOAD) {
+            songs.preload_loading = -1;
+        }
+#endif
+        return -1;
+    }
+    return 0;
+}
+
+// start loading the next run of contiguous sectors - returns -1 on error
+// - the song is loaded to the end of the image so it can be decoded in place
+// - chunks are packed together so a run ends after a chunk that is not full
+int song_load_next(void) {
+    struct song_table_entry *entry = &songt.entry[songs.load_song];
+    int start, end, len;
+    start = songs.load_chunk;
+    len = entry->chunk_len[start];
+    for(end = start + 1; end < song_entry_chunks(entry); end ++) {
+        if(entry->chunk_len[end - 1] != EXT_FLASH_SECTOR_SIZE ||
+                entry->sector[end] != (entry->sector[end - 1] + 1)) {
+            break;
+        }
+        len += entry->chunk_len[end];
+    }
+    if(ext_flash_load(entry->sector[start] * EXT_FLASH_SECTOR_SIZE, len,
+            (uint8_t *)songs.load_dest + EXT_FLASH_SONG_SIZE - entry->len +
+            songs.load_pos) == -1) {
+        return -1;
+    }
+    songs.load_chunk = end;
+    songs.load_pos += len;
+    return 0;
+}
+
+// check if a run of a song load or preload has finished
+void song_load_task(int flash_state) {
+    switch(flash_state) {
+        case EXT_FLASH_STATE_LOAD:
+            // load in progress
+            break;
+        case EXT_FLASH_STATE_LOAD_ERROR:
+            song_load_done(1);
+            break;
+        case EXT_FLASH_STATE_LOAD_DONE:
+            songs.load_time += ext_flash_get_last_time();
+            // load the next run of sectors
+            if(songs.load_chunk < song_entry_chunks(&songt.entry[songs.load_song])) {
+                if(song_load_next() == -1) {
+                    song_load_done(1);
+                }
+                break;
+            }
+            song_load_done(0);
+            break;
+        default:
+            log_error("slt - idle state found");
+            song_load_done(1);
+            break;
+    }
+}
+
+// finish a song load or preload
+void song_load_done(int error) {
+    struct song_table_entry *entry = &songt.entry[songs.load_song];
+    int state = songs.state;
+#ifdef SONG_FLASH_ENCODED
+    uint16_t *chunk_step = songs.chunk_step;
+#endif
+    songs.state = SONG_IO_STATE_IDLE;
+    if(!error && entry->format == SONG_FORMAT_ENCODED) {
+#ifdef SONG_FLASH_ENCODED
+#ifdef SONG_PRELOAD
+        if(state == SONG_IO_STATE_PRELOAD) {
+            chunk_step = songs.preload_step;
+        }
+#endif
+        error = (song_decode(songs.load_dest, entry, chunk_step) == -1);
+#else
+        error = 1;  // this build can't decode songs
+#endif
+    }
+    // check magic number to make sure we loaded correctly
+    if(!error && songs.load_dest->magic_num != SONG_MAGIC_NUM) {
+        error = 1;
+    }
+#ifdef SONG_PRELOAD
+    if(state == SONG_IO_STATE_PRELOAD) {
+        // the preload was cancelled or replaced
+        if(songs.preload_loading == -1) {
+            return;
+        }
+        if(error) {
+            log_error("sld - song %d preload error", songs.preload_loading);
+        }
+        else {
+            songs.preload_song = songs.preload_loading;
+            log_debug("sld - song %d preloaded in %d us", songs.preload_song,
+                (int)songs.load_time);
+        }
+        songs.preload_loading = -1;
+        return;
+    }
+#else
+    (void)state;
+#endif
+    if(error) {
+        songs.flash_song = -1;
+        song_clear();  // clear the song instead
+        state_change_fire1(SCE_SONG_LOAD_ERROR, songs.loadsave_song);
+        return;
+    }
+    // RAM matches the flash now
+    songs.dirty = 0;
+    songs.flash_song = songs.loadsave_song;
+    log_debug("sld - song %d loaded in %d us - %d bytes", songs.loadsave_song,
+        (int)songs.load_time, (int)entry->len);
+    state_change_fire1(SCE_SONG_LOADED, songs.loadsave_song);
+}
+
+#ifndef SONG_FLASH_ENCODED
+// set up the table entry for a song being saved
+// - chunks in reuse keep their sectors and the others get free sectors
+// - the old sectors are kept until the new table is written
+// - a full song of sectors is kept free so a changed song can always be saved
+// - returns -1 if there are not enough free sectors
+int song_save_alloc(int song_num, int len, int format, uint32_t reuse) {
+    struct song_table_entry *entry = &songt.entry[song_num];
+    uint8_t used[SONG_FLASH_SECTORS / 8];
+    int chunk, chunks, sector, remain;
+    remain = song_sectors_used(used);
+    songs.save_old = *entry;
+    reuse &= (1 << song_entry_chunks(entry)) - 1;
+    chunks = (len + EXT_FLASH_SECTOR_SIZE - 1) / EXT_FLASH_SECTOR_SIZE;
+    // sectors left once the old sectors that are not reused are released
+    for(chunk = 0; chunk < song_entry_chunks(entry); chunk ++) {
+        if(!(reuse & (1 << chunk))) {
+            remain ++;
+        }
+    }
+    for(chunk = 0; chunk < chunks; chunk ++) {
+        if(!(reuse & (1 << chunk))) {
+            remain --;
+        }
+    }
+    if(remain < SONG_NUM_SECTORS) {
+        return -1;
+    }
+    songs.save_chunks = 0;
+    for(chunk = 0; chunk < chunks; chunk ++) {
+        entry->chunk_len[chunk] = EXT_FLASH_SECTOR_SIZE;
+        if(reuse & (1 << chunk)) {
+            continue;
+        }
+        sector = song_sector_alloc(used);
+        if(sector == -1) {
+            *entry = songs.save_old;
+            songs.save_chunks = 0;
+            return -1;
+        }
+        entry->sector[chunk] = sector;
+        songs.save_chunks |= (1 << chunk);
+    }
+    entry->chunk_len[chunks - 1] = len - ((chunks - 1) * EXT_FLASH_SECTOR_SIZE);
+    entry->len = len;
+    entry->format = format;
+    entry->chunks = chunks;
+    return 0;
+}
+
+// write the next run of chunks or the song table once all chunks are written
+// returns -1 on error
+int song_save_continue(void) {
+    if(songs.save_chunks) {
+        if(song_save_next() == -1) {
+            return -1;
+        }
+        songs.state = SONG_IO_STATE_SAVE;
+        return 0;
+    }
+    return song_save_table();
+}
+
+// start saving the next run of chunks in contiguous sectors - returns -1 on error
+int song_save_next(void) {
+    struct song_table_entry *entry = &songt.entry[songs.loadsave_song];
+    int start, end, chunks, len;
+    chunks = song_entry_chunks(entry);
+    for(start = 0; start < chunks; start ++) {
+        if(songs.save_chunks & (1 << start)) {
+            break;
+        }
+    }
+    for(end = start + 1; end < chunks; end ++) {
+        if(!(songs.save_chunks & (1 << end)) ||
+                entry->sector[end] != (entry->sector[end - 1] + 1)) {
+            break;
+        }
+    }
+    len = (end - start) * EXT_FLASH_SECTOR_SIZE;
+    if(end == chunks) {
+        len = entry->len - (start * EXT_FLASH_SECTOR_SIZE);
+    }
+    if(ext_flash_save(entry->sector[start] * EXT_FLASH_SECTOR_SIZE, len,
+            songs.save_src + (start * EXT_FLASH_SECTOR_SIZE)) == -1) {
+        return -1;
+    }
+    for(; start < end; start ++) {
+        songs.save_chunks &= ~(1 << start);
+    }
+    return 0;
+}
+#endif
+
+// start writing the song table once all chunks are written - returns -1 on error
+// - the new table goes in the other bank so a failed write leaves the old one
+int song_save_table(void) {
+    songt.seq ++;
+    songt.crc = sysex_bulk_crc(0, (uint8_t *)&songt, offsetof(struct song_table, crc));
+    if(ext_flash_save(EXT_FLASH_SONG_TABLE_OFFSET +
+            (EXT_FLASH_SONG_TABLE_SIZE * (songs.table_bank ^ 1)),
+            sizeof(songt), (uint8_t *)&songt) == -1) {
+        songt.seq --;
+        return -1;
+    }
+    songs.state = SONG_IO_STATE_TABLE_SAVE;
+    return 0;
+}
+
+// check if a run of a song save or the table write has finished
+void song_save_task(int flash_state) {
+    struct ext_flash_save_timing timing;
+    switch(flash_state) {
+        case EXT_FLASH_STATE_SAVE:
+            // save in progress
+            break;
+        case EXT_FLASH_STATE_SAVE_ERROR:
+            song_save_revert();
+            state_change_fire1(SCE_SONG_SAVE_ERROR, songs.loadsave_song);
+            break;
+        case EXT_FLASH_STATE_SAVE_DONE:
+            ext_flash_get_save_timing(&timing);
+            songs.save_timing.erase_time += timing.erase_time;
+            songs.save_timing.program_time += timing.program_time;
+            songs.save_timing.total_time += timing.total_time;
+            // write the next run of chunks or the table
+            if(songs.state == SONG_IO_STATE_SAVE) {
+#ifdef SONG_FLASH_ENCODED
+                songs.state = SONG_IO_STATE_ENCODE;
+#else
+                if(song_save_continue() == -1) {
+                    song_save_revert();
+                    state_change_fire1(SCE_SONG_SAVE_ERROR, songs.loadsave_song);
+                }
+#endif
+                break;
+            }
+            songs.state = SONG_IO_STATE_IDLE;
+            songs.table_bank ^= 1;
+            songs.flash_song = songs.loadsave_song;
+#ifdef SONG_FLASH_ENCODED
+            memcpy(songs.chunk_step, songs.save_step, sizeof(songs.chunk_step));
+#endif
+            log_debug("sst - song %d saved in %d us - %d bytes - erase: %d us - "
+                "program: %d us", songs.loadsave_song, (int)songs.save_timing.total_time,
+                (int)songt.entry[songs.loadsave_song].len,
+                (int)songs.save_timing.erase_time,
+                (int)songs.save_timing.program_time);
+            state_change_fire1(SCE_SONG_SAVED, songs.loadsave_song);
+            break;
+        default:
+            song_save_revert();
+            log_error("sst - idle state found");
+            state_change_fire1(SCE_SONG_SAVE_ERROR, songs.loadsave_song);
+            break;
+    }
+}
+
+// put the song table back the way it was after a save fails
+void song_save_revert(void) {
+    if(songs.state == SONG_IO_STATE_TABLE_SAVE) {
+        songt.seq --;
+    }
+    songt.entry[songs.loadsave_song] = songs.save_old;
+    songs.state = SONG_IO_STATE_IDLE;
+    songs.save_chunks = 0;
+#ifdef SONG_FLASH_ENCODED
+    songs.save_pending = 0;
+    songs.enc_end = -1;
+#endif
+    // keep the changes so a retry writes them
+    songs.dirty |= songs.save_dirty;
+}
+
+// get the number of sectors used by a table entry
+int song_entry_chunks(struct song_table_entry *entry) {
+    return entry->chunks;
+}
+
+// check if part of the flash overlaps the sectors of a stored song
+// returns 1 if it does or if the song table is not loaded
+int song_entry_overlaps(int song_num, int32_t addr, int len) {
+    struct song_table_entry *entry = &songt.entry[song_num];
+    int32_t sector_addr;
+    int chunk;
+    if(songs.table_state != SONG_TABLE_STATE_READY) {
+        return 1;
+    }
+    for(chunk = 0; chunk < song_entry_chunks(entry); chunk ++) {
+        sector_addr = entry->sector[chunk] * EXT_FLASH_SECTOR_SIZE;
+        if(addr < (sector_addr + EXT_FLASH_SECTOR_SIZE) && (addr + len) > sector_addr) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// check if a flash sector can be used to store songs
+// returns 1 if it can
+int song_sector_usable(int sector) {
+    int32_t addr = sector * EXT_FLASH_SECTOR_SIZE;
+    if(sector < 0 || sector >= SONG_FLASH_SECTORS) {
+        return 0;
+    }
+    if(addr >= EXT_FLASH_CONFIG_OFFSET &&
+            addr < (EXT_FLASH_CONFIG_OFFSET + EXT_FLASH_CONFIG_SIZE)) {
+        return 0;
+    }
+    if(addr >= EXT_FLASH_SONG_TABLE_OFFSET && addr < (EXT_FLASH_SONG_TABLE_OFFSET +
+            (EXT_FLASH_SONG_TABLE_SIZE * SONG_TABLE_NUM_BANKS))) {
+        return 0;
+    }
+    return 1;
+}
+
+// find the sectors used by songs in the table
+// returns the number of usable sectors that are free
+int song_sectors_used(uint8_t *used) {
+    int song, chunk, sector, remain = 0;
+    memset(used, 0, SONG_FLASH_SECTORS / 8);
+    for(sector = 0; sector < SONG_FLASH_SECTORS; sector ++) {
+        if(song_sector_usable(sector)) {
+            remain ++;
+        }
+    }
+    for(song = 0; song < SEQ_NUM_SONGS; song ++) {
+        for(chunk = 0; chunk < song_entry_chunks(&songt.entry[song]); chunk ++) {
+            sector = songt.entry[song].sector[chunk];
+            used[sector >> 3] |= (1 << (sector & 0x07));
+            remain --;
+        }
+    }
+    return remain;
+}
+
+// find the next free sector and mark it as used
+// returns -1 if no sectors are free
+int song_sector_alloc(uint8_t *used) {
+    int count, sector;
+    for(count = 0; count < SONG_FLASH_SECTORS; count ++) {
+        sector = songs.alloc_next;
+        songs.alloc_next = (songs.alloc_next + 1) % SONG_FLASH_SECTORS;
+        if(song_sector_usable(sector) && !(used[sector >> 3] & (1 << (sector & 0x07)))) {
+            used[sector >> 3] |= (1 << (sector & 0x07));
+            return sector;
+        }
+    }
+    return -1;
+}
+
+#ifdef SONG_FLASH_ENCODED
+// plan an encoded save of the current song
+// - chunks of the stored song that are only encoded from clean blocks are
+//   kept and each run of changed chunks is encoded again between the same steps
+// - the whole song is encoded if it is not stored in the slot or if the
+//   changed runs might need more chunks than the table entry has
+// returns the bitmap of blocks the encoding reads
+uint64_t song_encode_start(int song_num) {
+    struct song_table_entry *entry = &songt.entry[song_num];
+    uint64_t copy = 0, blocks;
+    int32_t bytes;
+    int chunk, chunks, head, head_end, step, step_end, first;
+    songs.save_old = *entry;
+    songs.save_encode = 0;
+    songs.save_full = 1;
+    if(songs.flash_song == song_num && entry->format == SONG_FORMAT_ENCODED) {
+        chunks = 0;
+        for(chunk = 0; chunk < song_entry_chunks(entry); chunk ++) {
+            blocks = song_chunk_blocks(entry, songs.chunk_step, chunk);
+            if(blocks & songs.dirty) {
+                songs.save_encode |= (1 << chunk);
+                copy |= blocks;
+            }
+            else {
+                chunks ++;
+            }
+        }
+        // every chunk of a run but the last is filled to within an item of the end
+        chunk = 0;
+        while(chunk < song_entry_chunks(entry)) {
+            if(!(songs.save_encode & (1 << chunk))) {
+                chunk ++;
+                continue;
+            }
+            song_chunk_range(entry, songs.chunk_step, chunk, &head, &head_end,
+                &first, &step_end);
+            bytes = 0;
+            for(; chunk < song_entry_chunks(entry) &&
+                    (songs.save_encode & (1 << chunk)); chunk ++) {
+                song_chunk_range(entry, songs.chunk_step, chunk, &head, &head_end,
+                    &step, &step_end);
+                bytes += head_end - head;
+            }
+            bytes += (step_end - first) * SONG_ENC_ITEM_MAX;
+            if(chunk == song_entry_chunks(entry)) {
+                bytes += SONG_ENC_TAIL_LEN + sizeof(songp->magic_num);
+            }
+            chunks += (bytes / (EXT_FLASH_SECTOR_SIZE - SONG_ENC_ITEM_MAX)) + 1;
+        }
+        songs.save_full = (chunks > SONG_NUM_SECTORS);
+    }
+    if(songs.save_full) {
+        songs.save_encode = 0;
+        copy = song_range_blocks(0, SONG_ENC_TAIL_START + SONG_ENC_TAIL_LEN);
+    }
+    songs.save_free = song_sectors_used(songs.save_used);
+    songs.save_entry.len = 0;
+    songs.save_entry.format = SONG_FORMAT_ENCODED;
+    songs.save_entry.chunks = 0;
+    songs.save_old_chunk = 0;
+    songs.save_kept = 0;
+    songs.save_pending = 0;
+    songs.enc_end = -1;
+    return copy;
+}
+
+// encode the next part of a save from the spare
+// this runs in the sequencer task so only a few steps are encoded each time
+void song_encode_task(void) {
+    uint32_t start = rt_prof_start();
+    int ret = 0;
+    if(songs.save_pending) {
+        song_encode_write();
+    }
+    else {
+        ret = song_encode_next();
+    }
+    rt_prof_end(RT_PROF_TASK_SONG_ENCODE, start);
+    if(ret == -1) {
+        song_save_revert();
+        state_change_fire1(SCE_SONG_SAVE_ERROR, songs.loadsave_song);
+    }
+}
+
+// encode until a chunk is ready to write or enough steps are done
+// - unchanged chunks are added to the new table entry as they are
+// - a chunk is written once the next item does not fit or its run ends
+// - the song table is written once all chunks are written
+// - each run is encoded over its own part of the spare since nothing
+//   takes more space encoded than it does decoded
+// returns -1 on error
+int song_encode_next(void) {
+    struct song_table_entry *old = &songs.save_old;
+    uint8_t *out = (uint8_t *)songs.spare;
+    struct track_event *events = (struct track_event *)(out + SONG_ENC_HEAD_LEN);
+    struct track_event step_events[SEQ_TRACK_POLY];
+    int chunk, head, head_end, step, step_end, last_head, last_step;
+    int len, run, slot, bitmap, steps = 0;
+    while(1) {
+        // start the next run
+        if(songs.enc_end == -1) {
+            if(songs.save_full) {
+                songs.save_full = 0;
+                songs.save_old_chunk = song_entry_chunks(old);
+                song_encode_run(0, SONG_ENC_HEAD_LEN, 0, SONG_ENC_TOTAL_STEPS, 1);
+            }
+            else {
+                // keep unchanged chunks
+                while(songs.save_old_chunk < song_entry_chunks(old) &&
+                        !(songs.save_encode & (1 << songs.save_old_chunk))) {
+                    chunk = songs.save_old_chunk;
+                    if(song_encode_add(old->sector[chunk], old->chunk_len[chunk],
+                            songs.chunk_step[chunk]) == -1) {
+                        return -1;
+                    }
+                    songs.save_old_chunk ++;
+                    songs.save_kept ++;
+                }
+                if(songs.save_old_chunk == song_entry_chunks(old)) {
+                    return song_encode_done();
+                }
+                // run of changed chunks
+                chunk = songs.save_old_chunk;
+                while(songs.save_old_chunk < song_entry_chunks(old) &&
+                        (songs.save_encode & (1 << songs.save_old_chunk))) {
+                    songs.save_old_chunk ++;
+                }
+                song_chunk_range(old, songs.chunk_step, chunk,
+                    &head, &head_end, &step, &step_end);
+                song_chunk_range(old, songs.chunk_step, songs.save_old_chunk - 1,
+                    &last_head, &head_end, &last_step, &step_end);
+                song_encode_run(head, head_end, step, step_end,
+                    songs.save_old_chunk == song_entry_chunks(old));
+            }
+        }
+        // the head is stored as is so it is already in place
+        if(songs.enc_head < songs.enc_head_end) {
+            len = EXT_FLASH_SECTOR_SIZE - (songs.enc_out - songs.enc_chunk);
+            if(len > (songs.enc_head_end - songs.enc_head)) {
+                len = songs.enc_head_end - songs.enc_head;
+            }
+            songs.enc_head += len;
+            songs.enc_out += len;
+            if((songs.enc_out - songs.enc_chunk) == EXT_FLASH_SECTOR_SIZE) {
+                return song_encode_chunk();
+            }
+        }
+        while(songs.enc_step < songs.enc_end) {
+            if(steps >= SONG_ENC_TASK_STEPS) {
+                return 0;  // carry on next time
+            }
+            // count empty steps
+            for(run = 0; run < SONG_ENC_RUN_MAX &&
+                    (songs.enc_step + run) < songs.enc_end; run ++) {
+                for(slot = 0; slot < SEQ_TRACK_POLY; slot ++) {
+                    if(events[((songs.enc_step + run) * SEQ_TRACK_POLY) + slot].type !=
+                            SONG_EVENT_NULL) {
+                        break;
+                    }
+                }
+                if(slot < SEQ_TRACK_POLY) {
+                    break;
+                }
+            }
+            if(run > 0) {
+                if((songs.enc_out - songs.enc_chunk) == EXT_FLASH_SECTOR_SIZE) {
+                    return song_encode_chunk();
+                }
+                out[songs.enc_out++] = SONG_ENC_RUN | (run - 1);
+                songs.enc_step += run;
+                steps += run;
+                continue;
+            }
+            // step with events - read before writing since they can overlap
+            memcpy(step_events, &events[songs.enc_step * SEQ_TRACK_POLY],
+                sizeof(step_events));
+            bitmap = 0;
+            len = 1;
+            for(slot = 0; slot < SEQ_TRACK_POLY; slot ++) {
+                if(step_events[slot].type != SONG_EVENT_NULL) {
+                    bitmap |= (1 << slot);
+                    len += SONG_ENC_EVENT_LEN;
+                }
+            }
+            if((songs.enc_out - songs.enc_chunk + len) > EXT_FLASH_SECTOR_SIZE) {
+                return song_encode_chunk();
+            }
+            out[songs.enc_out++] = bitmap;
+            for(slot = 0; slot < SEQ_TRACK_POLY; slot ++) {
+                if(step_events[slot].type == SONG_EVENT_NULL) {
+                    continue;
+                }
+                out[songs.enc_out++] = step_events[slot].type;
+                out[songs.enc_out++] = step_events[slot].data0;
+                out[songs.enc_out++] = step_events[slot].data1;
+                out[songs.enc_out++] = step_events[slot].length & 0xff;
+                out[songs.enc_out++] = (step_events[slot].length >> 8) & 0xff;
+            }
+            songs.enc_step ++;
+            steps ++;
+        }
+        if(songs.enc_tail) {
+            len = SONG_ENC_TAIL_LEN + sizeof(songp->magic_num);
+            if((songs.enc_out - songs.enc_chunk + len) > EXT_FLASH_SECTOR_SIZE) {
+                return song_encode_chunk();
+            }
+            memmove(out + songs.enc_out, out + SONG_ENC_TAIL_START, SONG_ENC_TAIL_LEN);
+            memcpy(out + songs.enc_out + SONG_ENC_TAIL_LEN, &songp->magic_num,
+                sizeof(songp->magic_num));
+            songs.enc_out += len;
+            songs.enc_tail = 0;
+        }
+        // the run is done - write the rest of its last chunk
+        songs.enc_end = -1;
+        if(songs.enc_out > songs.enc_chunk) {
+            return song_encode_chunk();
+        }
+    }
+}
+
+// set up the encoder for a run of the song
+// - the run is encoded from the start of its head bytes or its first step
+void song_encode_run(int head, int head_end, int step, int step_end, int tail) {
+    songs.enc_head = head;
+    songs.enc_head_end = head_end;
+    songs.enc_step = step;
+    songs.enc_end = step_end;
+    songs.enc_tail = tail;
+    if(head < head_end) {
+        songs.enc_out = head;
+    }
+    else {
+        songs.enc_out = SONG_ENC_HEAD_LEN + (step * SONG_ENC_STEP_LEN);
+    }
+    songs.enc_chunk = songs.enc_out;
+    songs.enc_chunk_step = step;
+}
+
+// add a chunk to the new table entry - returns -1 if the entry is full
+int song_encode_add(int sector, int len, int step) {
+    struct song_table_entry *entry = &songs.save_entry;
+    if(entry->chunks == SONG_NUM_SECTORS) {
+        log_error("sea - too many chunks");
+        return -1;
+    }
+    entry->sector[entry->chunks] = sector;
+    entry->chunk_len[entry->chunks] = len;
+    songs.save_step[entry->chunks] = step;
+    entry->len += len;
+    entry->chunks ++;
+    return 0;
+}
+
+// add the chunk that was encoded to the new table entry and start writing it
+// returns -1 on error
+int song_encode_chunk(void) {
+    int sector = song_sector_alloc(songs.save_used);
+    if(sector == -1) {
+        log_error("sec - flash full");
+        return -1;
+    }
+    songs.save_free --;
+    if(song_encode_add(sector, songs.enc_out - songs.enc_chunk,
+            songs.enc_chunk_step) == -1) {
+        return -1;
+    }
+    songs.save_pending = 1;
+    song_encode_write();
+    return 0;
+}
+
+// start writing the last chunk that was encoded
+// - the encoding carries on after the chunk once it is written
+void song_encode_write(void) {
+    struct song_table_entry *entry = &songs.save_entry;
+    int chunk = entry->chunks - 1;
+    if(ext_flash_save(entry->sector[chunk] * EXT_FLASH_SECTOR_SIZE,
+            entry->chunk_len[chunk], (uint8_t *)songs.spare + songs.enc_chunk) == -1) {
+        return;  // flash is busy - try again next time
+    }
+    songs.save_pending = 0;
+    songs.enc_chunk = songs.enc_out;
+    songs.enc_chunk_step = songs.enc_step;
+    songs.state = SONG_IO_STATE_SAVE;
+}
+
+// use the new table entry and start writing the song table - returns -1 on error
+// - the old sectors that were not kept are free once the table is written
+// - a full song of sectors is kept free so a changed song can always be saved
+int song_encode_done(void) {
+    if((songs.save_free + song_entry_chunks(&songs.save_old) - songs.save_kept) <
+            SONG_NUM_SECTORS) {
+        log_error("sed - flash full");
+        return -1;
+    }
+    songt.entry[songs.loadsave_song] = songs.save_entry;
+    if(song_save_table() == -1) {
+        songt.entry[songs.loadsave_song] = songs.save_old;
+        return 0;  // flash is busy - try again next time
+    }
+    log_debug("sed - song %d encoded to %d bytes - %d chunks kept",
+        songs.loadsave_song, (int)songs.save_entry.len, songs.save_kept);
+    return 0;
+}
+
+// get what a chunk of an encoded song holds
+// - head bytes from head to head_end and steps from step to step_end
+// - the tail is always at the end of the last chunk
+void song_chunk_range(struct song_table_entry *entry, uint16_t *chunk_step,
+        int chunk, int *head, int *head_end, int *step, int *step_end) {
+    int32_t pos = 0;
+    int i;
+    for(i = 0; i < chunk; i ++) {
+        pos += entry->chunk_len[i];
+    }
+    *head = pos;
+    *head_end = pos + entry->chunk_len[chunk];
+    if(*head > (int)SONG_ENC_HEAD_LEN) {
+        *head = SONG_ENC_HEAD_LEN;
+    }
+    if(*head_end > (int)SONG_ENC_HEAD_LEN) {
+        *head_end = SONG_ENC_HEAD_LEN;
+    }
+    *step = chunk_step[chunk];
+    if((chunk + 1) < song_entry_chunks(entry)) {
+        *step_end = chunk_step[chunk + 1];
+    }
+    else {
+        *step_end = SONG_ENC_TOTAL_STEPS;
+    }
+}
+
+// get the bitmap of blocks a chunk of an encoded song is encoded from
+uint64_t song_chunk_blocks(struct song_table_entry *entry, uint16_t *chunk_step, int chunk) {
+    uint64_t blocks;
+    int head, head_end, step, step_end;
+    song_chunk_range(entry, chunk_step, chunk, &head, &head_end, &step, &step_end);
+    blocks = song_range_blocks(head, head_end) |
+        song_range_blocks(SONG_ENC_HEAD_LEN + (step * SONG_ENC_STEP_LEN),
+        SONG_ENC_HEAD_LEN + (step_end * SONG_ENC_STEP_LEN));
+    if(chunk == (song_entry_chunks(entry) - 1)) {
+        blocks |= song_range_blocks(SONG_ENC_TAIL_START,
+            SONG_ENC_TAIL_START + SONG_ENC_TAIL_LEN);
+    }
+    return blocks;
+}
+
+// get the bitmap of blocks covering part of the song image
+uint64_t song_range_blocks(int32_t start, int32_t end) {
+    uint64_t blocks = 0;
+    int block;
+    if(end <= start) {
+        return 0;
+    }
+    for(block = start / SONG_BLOCK_SIZE; block <= ((end - 1) / SONG_BLOCK_SIZE); block ++) {
+        blocks |= (1ULL << block);
+    }
+    return blocks;
+}
+
+// decode a song loaded to the end of an image
+// - every item decodes to at least its encoded size so writing never
+//   passes the part that is still to be read
+// - events are read before the step is written since they overlap
+// - the first step of each chunk is noted so a save can keep chunks
+// returns -1 if the encoding is invalid
+int song_decode(struct song_data *dest, struct song_table_entry *entry,
+        uint16_t *chunk_step) {
+    uint32_t start = rt_prof_start();
+    int len = entry->len;
+    uint8_t *base = (uint8_t *)dest;
+    uint8_t *in = base + EXT_FLASH_SONG_SIZE - len;
+    uint8_t *end = base + EXT_FLASH_SONG_SIZE;
+    struct track_event *out = (struct track_event *)(base + SONG_ENC_HEAD_LEN);
+    struct track_event events[SEQ_TRACK_POLY];
+    uint32_t magic;
+    int32_t pos, chunk_pos = 0;
+    int chunk = 0, step, run, slot, bitmap;
+    if(len < (int)(SONG_ENC_HEAD_LEN + SONG_ENC_TAIL_LEN + sizeof(magic))) {
+        return -1;
+    }
+    memmove(base, in, SONG_ENC_HEAD_LEN);
+    in += SONG_ENC_HEAD_LEN;
+    // chunks that start in the head start before the first step
+    while(chunk < song_entry_chunks(entry) && chunk_pos < (int32_t)SONG_ENC_HEAD_LEN) {
+        chunk_step[chunk] = 0;
+        chunk_pos += entry->chunk_len[chunk];
+        chunk ++;
+    }
+    step = 0;
+    while(1) {
+        // items never cross a chunk so each chunk must start on an item
+        pos = len - (end - in);
+        while(chunk < song_entry_chunks(entry) && chunk_pos <= pos) {
+            if(chunk_pos != pos) {
+                return -1;
+            }
+            chunk_step[chunk] = step;
+            chunk_pos += entry->chunk_len[chunk];
+            chunk ++;
+        }
+        if(step == SONG_ENC_TOTAL_STEPS) {
+            break;
+        }
+        if(in >= end) {
+            return -1;
+        }
+        // run of empty steps
+        if(*in & SONG_ENC_RUN) {
+            run = (*in & ~SONG_ENC_RUN) + 1;
+            in ++;
+            if((step + run) > SONG_ENC_TOTAL_STEPS) {
+                return -1;
+            }
+            memset(out, 0, run * SONG_ENC_STEP_LEN);
+            out += run * SEQ_TRACK_POLY;
+            step += run;
+            continue;
+        }
+        // step with events
+        bitmap = *in++;
+        if(bitmap == 0 || bitmap >= (1 << SEQ_TRACK_POLY)) {
+            return -1;
+        }
+        memset(events, 0, sizeof(events));
+        for(slot = 0; slot < SEQ_TRACK_POLY; slot ++) {
+            if(!(bitmap & (1 << slot))) {
+                continue;
+            }
+            if((end - in) < SONG_ENC_EVENT_LEN) {
+                return -1;
+            }
+            events[slot].type = in[0];
+            events[slot].data0 = in[1];
+            events[slot].data1 = in[2];
+            events[slot].length = in[3] | (in[4] << 8);
+            in += SONG_ENC_EVENT_LEN;
+        }
+        memcpy(out, events, sizeof(events));
+        out += SEQ_TRACK_POLY;
+        step ++;
+    }
+    if((end - in) != (int)(SONG_ENC_TAIL_LEN + sizeof(magic)) ||
+            chunk != song_entry_chunks(entry)) {
+        return -1;
+    }
+    memmove(base + SONG_ENC_TAIL_START, in, SONG_ENC_TAIL_LEN);
+    in += SONG_ENC_TAIL_LEN;
+    memcpy(&magic, in, sizeof(magic));
+    // padding is not stored
+    memset(base + SONG_ENC_TAIL_START + SONG_ENC_TAIL_LEN, 0,
+        offsetof(struct song_data, magic_num) - (SONG_ENC_TAIL_START + SONG_ENC_TAIL_LEN));
+    dest->magic_num = magic;
+    rt_prof_end(RT_PROF_TASK_SONG_DECODE, start);
+    return 0;
+}
+#endif
+
+#if defined(SONG_SAVE_SNAPSHOT) || defined(SONG_FLASH_ENCODED)
+// copy blocks of the song to the spare image for saving
+// this runs in the sequencer task so the copy is the time playback is held up
+void song_snapshot(uint64_t blocks) {
+    uint32_t start = rt_prof_start();
+    int block, bytes = 0;
+    for(block = 0; block < SONG_NUM_BLOCKS; block ++) {
+        if(blocks & (1ULL << block)) {
+            memcpy((uint8_t *)songs.spare + (block * SONG_BLOCK_SIZE),
+                (uint8_t *)songp + (block * SONG_BLOCK_SIZE), SONG_BLOCK_SIZE);
+            bytes += SONG_BLOCK_SIZE;
+        }
+    }
+    rt_prof_end(RT_PROF_TASK_SONG_SNAPSHOT, start);
+    log_debug("ss - song %d snapshot of %d bytes in %d us", songs.loadsave_song,
+        bytes, (int)((rt_prof_start() - start) / rt_prof_get_counts_per_us()));
+}
+#endif
+
+// mark the blocks covering part of the song as dirty
+void song_mark_dirty(void *p, int len) {
+    int first, last;
+    first = ((uint8_t *)p - (uint8_t *)songp) / SONG_BLOCK_SIZE;
+    last = ((uint8_t *)p - (uint8_t *)songp + len - 1) / SONG_BLOCK_SIZE;
+    for(; first <= last; first ++) {
+        songs.dirty |= (1ULL << first);
+    }
+}
+
+// mark the events for a step as dirty
+void song_mark_step_dirty(int scene, int track, int step) {
+#ifdef SONG_NOTES_PER_SCENE
+    song_mark_dirty(songp->trkevents[scene][track][step],
+        sizeof(songp->trkevents[scene][track][step]));
+#else
+    song_mark_dirty(songp->trkevents[track][step],
+        sizeof(songp->trkevents[track][step]));
+#endif
+}
+
+// mark the params for a step as dirty
+void song_mark_step_param_dirty(int scene, int track, int step) {
+#ifdef SONG_NOTES_PER_SCENE
+    song_mark_dirty(&songp->trkstepparam[scene][track][step],
+        sizeof(songp->trkstepparam[scene][track][step]));
+#else
+    song_mark_dirty(&songp->trkstepparam[track][step],
+        sizeof(songp->trkstepparam[track][step]));
+#endif
+}
+
+#ifdef SONG_PRELOAD
+// cancel a queued, running or finished preload
+void song_preload_cancel(void) {
+    songs.preload_next = -1;
+    songs.preload_loading = -1;
+    songs.preload_song = -1;
+}
+
+// swap the current and spare images to switch to the preloaded song
+// returns the song number or -1 if no song is ready
+int song_swap_images(void) {
+    struct song_data *temp;
+    if(songs.preload_song == -1) {
+        return -1;
+    }
+    temp = songp;
+    songp = songs.spare;
+    songs.spare = temp;
+    songs.loadsave_song = songs.preload_song;
+    songs.preload_song = -1;
+    // RAM matches the flash now
+    songs.dirty = 0;
+    songs.flash_song = songs.loadsave_song;
+#ifdef SONG_FLASH_ENCODED
+    memcpy(songs.chunk_step, songs.preload_step, sizeof(songs.chunk_step));
+#endif
+    return songs.loadsave_song;
+}
+#endif
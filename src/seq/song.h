@@ -116,8 +116,50 @@ void song_clear(void);
 int song_load(int song_num);
 
 // save the current song to flash mem from RAM
+// the song is written to free sectors and then the song table is updated
+// only chunks holding parts changed since the song was loaded or saved to the same slot are written
+// - with SONG_FLASH_ENCODED the changed parts are copied first and encoded by the task
+// - with SONG_SAVE_SNAPSHOT the song is copied first and can change during the save
 int song_save(int song_num);
 
+// notify the song that part of the flash was written by someone else
+void song_flash_changed(int32_t addr, int len);
+
+// get the number of bytes a song takes in flash
+// returns 0 if no song is stored or -1 if the song table is not loaded
+int song_get_flash_size(int song_num);
+
+// get the flash address of a byte of a stored song
+// returns -1 if the song is not that long
+int32_t song_get_flash_addr(int song_num, int offset);
+
+// get the number of flash sectors free for songs
+// returns -1 if the song table is not loaded
+int song_get_flash_free(void);
+
+#ifdef SONG_PRELOAD
+// preload a song into the spare image so it can be switched to without a gap
+// - the song is loaded in the background when the flash is free
+// - returns -1 on error
+int song_preload(int song_num);
+
+// switch to the preloaded song by swapping the current and spare images
+// - safe to run in the sequencer - only the images are swapped and
+//   SCE_SONG_LOADED is fired later by song_swap_task() with arg1 = 1
+// returns the song number or -1 if no song is ready
+int song_swap_preloaded(void);
+
+// finish a preload as a normal load since the sequencer stopped before switching
+// - a song that is ready is switched in and a song that isn't is loaded again
+// - SCE_SONG_LOADED is fired once the song is in place
+// returns -1 if no preload was requested or the load could not be started
+int song_preload_finish(void);
+
+// fire SCE_SONG_LOADED for a song switched in from the preload
+// - run from the UI task so the handlers don't run in the sequencer
+void song_swap_task(void);
+#endif
+
 // copy a scene to another scene replacing all data
 void song_copy_scene(int dest, int src);
 
@@ -419,6 +461,10 @@ int song_set_step_event(int scene, int track, int step, int slot,
 int song_get_step_event(int scene, int track, int step, int slot,
     struct track_event *event);
 
+// get a pointer to the SEQ_TRACK_POLY event slots on a step - returns NULL on error
+// the slots might be blank or fragmented
+struct track_event *song_get_step_event_slots(int scene, int track, int step);
+
 // get the start delay for a step - returns -1 on error
 int song_get_start_delay(int scene, int track, int step);
 
@@ -137,6 +137,93 @@
  *   - 0x0l - write len bits 3-0
  *   - 0xf7 - sysex end
  *
+ * - bulk read start            - 0x77  -> to device
+ *   - 0xf0 - sysex start
+ *   - 0x00 - MMA ID
+ *   - 0x01 - MMA ID
+ *   - 0x72 - MMA ID
+ *   - 0x49 - device type
+ *   - 0x77 - bulk read start
+ *   - 0x0a - address bits 27-21
+ *   - 0x0b - address bits 20-14
+ *   - 0x0c - address bits 13-7
+ *   - 0x0d - address bits 6-0
+ *   - 0x0e - length bits 27-21
+ *   - 0x0f - length bits 20-14
+ *   - 0x0g - length bits 13-7
+ *   - 0x0h - length bits 6-0
+ *   - 0xii - window (1-127 blocks the host can take before it acks)
+ *   - 0xf7 - sysex end
+ *   - the device sends bulk data blocks from seq 0 until all are acked
+ *
+ * - bulk write start           - 0x78  -> to device
+ *   - 0xf0 - sysex start
+ *   - 0x00 - MMA ID
+ *   - 0x01 - MMA ID
+ *   - 0x72 - MMA ID
+ *   - 0x49 - device type
+ *   - 0x78 - bulk write start
+ *   - 0x0a - address bits 27-21 (must be on a sector boundary)
+ *   - 0x0b - address bits 20-14
+ *   - 0x0c - address bits 13-7
+ *   - 0x0d - address bits 6-0
+ *   - 0x0e - length bits 27-21
+ *   - 0x0f - length bits 20-14
+ *   - 0x0g - length bits 13-7
+ *   - 0x0h - length bits 6-0
+ *   - 0xf7 - sysex end
+ *   - the device acks with the first window and the host sends bulk data
+ *     blocks - the device acks with the done flag when all are saved
+ *
+ * - bulk data                  - 0x79  <- from / -> to device
+ *   - 0xf0 - sysex start
+ *   - 0x00 - MMA ID
+ *   - 0x01 - MMA ID
+ *   - 0x72 - MMA ID
+ *   - 0x49 - device type
+ *   - 0x79 - bulk data
+ *   - 0x0a - seq bits 20-14 (block offset is seq * 128 bytes)
+ *   - 0x0b - seq bits 13-7
+ *   - 0x0c - seq bits 6-0
+ *   - 0xnn - data length - 1 (only the last block can be short)
+ *   - ...  - 2-147 data bytes (1-128 bytes packed 8-to-7)
+ *   - 0x0d - CRC-32 bits 31-28 (over seq, length and unpacked data)
+ *   - 0x0e - CRC-32 bits 27-21
+ *   - 0x0f - CRC-32 bits 20-14
+ *   - 0x0g - CRC-32 bits 13-7
+ *   - 0x0h - CRC-32 bits 6-0
+ *   - 0xf7 - sysex end
+ *
+ * - bulk ack                   - 0x7a  <- from / -> to device
+ *   - 0xf0 - sysex start
+ *   - 0x00 - MMA ID
+ *   - 0x01 - MMA ID
+ *   - 0x72 - MMA ID
+ *   - 0x49 - device type
+ *   - 0x7a - bulk ack
+ *   - 0x0a - next seq expected bits 20-14 (all blocks before are received)
+ *   - 0x0b - next seq expected bits 13-7
+ *   - 0x0c - next seq expected bits 6-0
+ *   - 0x0d - window end bits 20-14 (blocks before this may be sent)
+ *   - 0x0e - window end bits 13-7
+ *   - 0x0f - window end bits 6-0
+ *   - 0x0g - flags - 0x01 = NAK (resend from next seq) - 0x02 = done
+ *   - 0x0h - CRC-32 bits 31-28 (over next seq, window end and flags)
+ *   - 0x0i - CRC-32 bits 27-21
+ *   - 0x0j - CRC-32 bits 20-14
+ *   - 0x0k - CRC-32 bits 13-7
+ *   - 0x0l - CRC-32 bits 6-0
+ *   - 0xf7 - sysex end
+ *
+ * - bulk abort                 - 0x7b  -> to device
+ *   - 0xf0 - sysex start
+ *   - 0x00 - MMA ID
+ *   - 0x01 - MMA ID
+ *   - 0x72 - MMA ID
+ *   - 0x49 - device type
+ *   - 0x7b - bulk abort
+ *   - 0xf7 - sysex end
+ *
  * - device type query          - 0x7c  -> to device
  *  - 0xf0	- sysex start
  *  - 0x00	- MMA ID
@@ -174,47 +261,42 @@
  * - ERROR_BAD_LENGTH           - 0x03
  */
 #include "sysex.h"
+#include "sysex_bulk.h"
+#include "song.h"
 #include "../config.h"
 #include "../config_store.h"
 #include "../ext_flash.h"
 #include "../midi/midi_stream.h"
 #include "../midi/midi_protocol.h"
 #include "../util/log.h"
+#include "../util/rt_prof.h"
+#ifndef SIM_HOST
 #include "stm32f4xx_hal.h"
+#endif
 #include <inttypes.h>
-
-//
-// SYSEX commands / protocol
-//
-// CARBON commands
-#define SYSEX_CMD_ERROR_CODE 0x01  // from device
-// 0x60, 0x61 and 0x62 are used by the remlcd function
-#define SYSEX_CMD_SET_CONFIG_STORE 0x6d  // to device - no response
-#define SYSEX_CMD_SET_LCD_TYPE 0x6e  // to device
-#define SYSEX_CMD_WIPE_CONFIG_STORE 0x6f  // to device
-#define SYSEX_CMD_READ_EXT_FLASH 0x70  // to device
-#define SYSEX_CMD_READBACK_EXT_FLASH 0x71  // from device
-#define SYSEX_CMD_WRITE_EXT_FLASH_BUF 0x72  // to device
-#define SYSEX_CMD_WRITE_EXT_FLASH_COMMIT 0x73  // to device
-// global commands
-#define SYSEX_CMD_DEV_TYPE 0x7c  // to device
-#define SYSEX_CMD_DEV_RESPONSE 0x7d  // from device
-#define SYSEX_CMD_RESTART 0x7e  // to device
-// error response codes
-#define SYSEX_ERROR_OK 0x01
-#define SYSEX_ERROR_BAD_ADDRESS 0x02
-#define SYSEX_ERROR_BAD_LENGTH 0x03
-#define SYSEX_ERROR_MALFORMED_MSG 0x04
-#define SYSEX_ERROR_EXT_FLASH_ERROR 0x05
+#include <string.h>
 
 // settings
 #define SYSEX_MAX_LEN 200
 #define SYSEX_MAX_READ_LEN 64
+// bulk transfers - io_buf is used as a ring of blocks
+#define SYSEX_BULK_RING_BLOCKS (EXT_FLASH_SECTOR_SIZE / SYSEX_BULK_BLOCK_SIZE)
+#define SYSEX_BULK_HALF_BLOCKS (SYSEX_BULK_RING_BLOCKS / 2)  // blocks saved at once
+#define SYSEX_BULK_HALF_SIZE (EXT_FLASH_SECTOR_SIZE / 2)
+#define SYSEX_BULK_MAX_READ_WINDOW 16  // blocks
+#define SYSEX_BULK_WRITE_WINDOW 3  // blocks - limited by the MIDI input stream size
+#define SYSEX_BULK_LOAD_BLOCKS 8  // max blocks loaded from flash at once
+#define SYSEX_BULK_BLOCKS_PER_TASK 2  // max blocks sent each task
+#define SYSEX_BULK_RESEND_MS 100  // time to wait for an ack before resending
+#define SYSEX_BULK_ABORT_MS 3000  // time without progress before giving up
 
 // processing states
 #define SYSEX_STATE_IDLE 0
 #define SYSEX_STATE_READ_EXT_FLASH 1
 #define SYSEX_STATE_WRITE_EXT_FLASH 2
+#define SYSEX_STATE_BULK_READ 3
+#define SYSEX_STATE_BULK_WRITE 4
+#define SYSEX_STATE_BULK_STOP 5  // waiting for flash after a bulk transfer stopped
 
 // sysex module data
 struct sysex_state {
@@ -224,20 +306,46 @@ struct sysex_state {
     int32_t addr;  // the address of the thing we are reading or writing
     uint8_t io_buf[EXT_FLASH_SECTOR_SIZE];  // buffer for I/O to other modules
     int io_len;  // length of I/O
+    // bulk transfers
+    int32_t bulk_len;  // length of the transfer in bytes - starts at addr
+    uint32_t bulk_blocks;  // number of blocks in the transfer
+    uint32_t bulk_next;  // read: next block to send - write: next block expected
+    uint32_t bulk_acked;  // read: blocks acked by the host - write: blocks acked to the host
+    uint32_t bulk_window_end;  // end of the window last received or sent
+    uint32_t bulk_loaded;  // read: blocks loaded into io_buf
+    int bulk_load_blocks;  // read: blocks being loaded - 0 = none
+    uint32_t bulk_saved;  // write: halves of io_buf saved to flash
+    int bulk_saving;  // write: 1 = a half is being saved
+    int bulk_nak_sent;  // write: 1 = a NAK was sent for the next block
+    int bulk_write_done;  // 1 = the last write is done - repeat the done ack
+    int bulk_timer;  // ms since the last ack was sent or received
+    int bulk_stall_timer;  // ms since the transfer made progress
 };
 struct sysex_state syxs;
 
 // local functions
 void sysex_process(void);
+void sysex_bulk_start(int state, int32_t addr, int32_t len);
+void sysex_bulk_stop(void);
+void sysex_bulk_read_task(void);
+void sysex_bulk_write_task(void);
+void sysex_bulk_handle_data(void);
+void sysex_bulk_handle_ack(void);
+uint32_t sysex_bulk_get_write_window_end(void);
+int sysex_bulk_send_block(uint32_t seq);
+void sysex_bulk_send_ack(uint32_t next, uint32_t window_end, int flags);
 void sysex_send_read_ext_mem_result(void);
 void sysex_send_devtype_response(void);
+void sysex_send_rt_prof_result(int task);
 void sysex_send_error_response(int cmd, int errorcode);
 void sysex_nibbles_to_bytes(uint8_t *inbuf, uint8_t *outbuf, int in_len);
+int sysex_val_to_nibbles(uint32_t val, uint8_t *outbuf, int num_nibbles);
 
 // init the sysex handler
 void sysex_init(void) {
     syxs.rx_len = 0;
     syxs.state = SYSEX_STATE_IDLE;
+    syxs.bulk_write_done = 0;
 }
 
 // handle processing of requests that can take time
@@ -264,11 +372,33 @@ void sysex_timer_task(void) {
                     break;
             }
             break;
+        case SYSEX_STATE_BULK_READ:
+            sysex_bulk_read_task();
+            break;
+        case SYSEX_STATE_BULK_WRITE:
+            sysex_bulk_write_task();
+            break;
+        case SYSEX_STATE_BULK_STOP:
+            switch(ext_flash_get_state()) {
+                case EXT_FLASH_STATE_LOAD:
+                case EXT_FLASH_STATE_SAVE:
+                case EXT_FLASH_STATE_SAVE_NOERASE:
+                    // wait for the flash to finish with io_buf
+                    break;
+                default:
+                    syxs.state = SYSEX_STATE_IDLE;
+                    break;
+            }
+            break;
     }
 }
 
 // handle a portion of SYSEX message received
 void sysex_handle_msg(struct midi_msg *msg) {
+    // a new message drops anything left from a message with no end
+    if(msg->status == MIDI_SYSEX_START) {
+        syxs.rx_len = 0;
+    }
     // receiving this message would make buffer overrun
     if((syxs.rx_len + msg->len) > SYSEX_MAX_LEN) {
         syxs.rx_len = 0;
@@ -346,7 +476,9 @@ void sysex_process(void) {
             if(syxs.rx_buf[7] != 'I') return;
             if(syxs.rx_buf[8] != 'L') return;
             if(syxs.rx_buf[9] != 'L') return;
+#ifndef SIM_HOST
             HAL_NVIC_SystemReset();
+#endif
             break;
         case MIDI_DEV_TYPE:  // CARBON message
             if(syxs.rx_len < 7) {
@@ -478,16 +610,418 @@ void sysex_process(void) {
                                 SYSEX_ERROR_EXT_FLASH_ERROR);
                             return;
                         }
+                        song_flash_changed(addr, len);
                         sysex_send_error_response(syxs.rx_buf[5],
                             SYSEX_ERROR_OK);
                     }
                     break;
+                case SYSEX_CMD_RT_PROF_CTRL:
+                    if(syxs.rx_len != 8) {
+                        sysex_send_error_response(syxs.rx_buf[5],
+                            SYSEX_ERROR_MALFORMED_MSG);
+                        return;
+                    }
+                    switch(syxs.rx_buf[6]) {
+                        case SYSEX_RT_PROF_DISABLE:
+                            rt_prof_set_enable(0);
+                            break;
+                        case SYSEX_RT_PROF_ENABLE:
+                            rt_prof_set_enable(1);
+                            break;
+                        case SYSEX_RT_PROF_RESET:
+                            rt_prof_reset();
+                            break;
+                        default:
+                            sysex_send_error_response(syxs.rx_buf[5],
+                                SYSEX_ERROR_BAD_PARAM);
+                            return;
+                    }
+                    sysex_send_error_response(syxs.rx_buf[5],
+                        SYSEX_ERROR_OK);
+                    break;
+                case SYSEX_CMD_RT_PROF_READ:
+                    if(syxs.rx_len != 8) {
+                        sysex_send_error_response(syxs.rx_buf[5],
+                            SYSEX_ERROR_MALFORMED_MSG);
+                        return;
+                    }
+                    if(syxs.rx_buf[6] >= RT_PROF_NUM_TASKS) {
+                        sysex_send_error_response(syxs.rx_buf[5],
+                            SYSEX_ERROR_BAD_PARAM);
+                        return;
+                    }
+                    sysex_send_rt_prof_result(syxs.rx_buf[6]);
+                    break;
+                case SYSEX_CMD_BULK_READ_START:
+                    if(syxs.rx_len != SYSEX_BULK_READ_START_MSG_LEN) {
+                        sysex_send_error_response(syxs.rx_buf[5],
+                            SYSEX_ERROR_MALFORMED_MSG);
+                        return;
+                    }
+                    if(syxs.state == SYSEX_STATE_BULK_STOP) {
+                        sysex_send_error_response(syxs.rx_buf[5],
+                            SYSEX_ERROR_BUSY);
+                        return;
+                    }
+                    addr = sysex_bulk_7bit_to_val(syxs.rx_buf + 6, SYSEX_BULK_VAL_LEN);
+                    val = sysex_bulk_7bit_to_val(syxs.rx_buf + 10, SYSEX_BULK_VAL_LEN);
+                    if(val < 1 || addr + val > ext_flash_get_mem_size()) {
+                        sysex_send_error_response(syxs.rx_buf[5],
+                            SYSEX_ERROR_BAD_ADDRESS);
+                        return;
+                    }
+                    if(syxs.rx_buf[14] < 1) {
+                        sysex_send_error_response(syxs.rx_buf[5],
+                            SYSEX_ERROR_BAD_PARAM);
+                        return;
+                    }
+                    sysex_bulk_start(SYSEX_STATE_BULK_READ, addr, val);
+                    syxs.bulk_window_end = syxs.rx_buf[14];
+                    if(syxs.bulk_window_end > SYSEX_BULK_MAX_READ_WINDOW) {
+                        syxs.bulk_window_end = SYSEX_BULK_MAX_READ_WINDOW;
+                    }
+                    break;
+                case SYSEX_CMD_BULK_WRITE_START:
+                    if(syxs.rx_len != SYSEX_BULK_WRITE_START_MSG_LEN) {
+                        sysex_send_error_response(syxs.rx_buf[5],
+                            SYSEX_ERROR_MALFORMED_MSG);
+                        return;
+                    }
+                    if(syxs.state == SYSEX_STATE_BULK_STOP) {
+                        sysex_send_error_response(syxs.rx_buf[5],
+                            SYSEX_ERROR_BUSY);
+                        return;
+                    }
+                    addr = sysex_bulk_7bit_to_val(syxs.rx_buf + 6, SYSEX_BULK_VAL_LEN);
+                    val = sysex_bulk_7bit_to_val(syxs.rx_buf + 10, SYSEX_BULK_VAL_LEN);
+                    // sectors are erased as they are written
+                    if(val < 1 || addr + val > ext_flash_get_mem_size() ||
+                            (addr & (EXT_FLASH_SECTOR_SIZE - 1))) {
+                        sysex_send_error_response(syxs.rx_buf[5],
+                            SYSEX_ERROR_BAD_ADDRESS);
+                        return;
+                    }
+                    sysex_bulk_start(SYSEX_STATE_BULK_WRITE, addr, val);
+                    syxs.bulk_window_end = sysex_bulk_get_write_window_end();
+                    sysex_bulk_send_ack(0, syxs.bulk_window_end, 0);
+                    break;
+                case SYSEX_CMD_BULK_DATA:
+                    sysex_bulk_handle_data();
+                    break;
+                case SYSEX_CMD_BULK_ACK:
+                    sysex_bulk_handle_ack();
+                    break;
+                case SYSEX_CMD_BULK_ABORT:
+                    if(syxs.rx_len != SYSEX_BULK_ABORT_MSG_LEN) {
+                        sysex_send_error_response(syxs.rx_buf[5],
+                            SYSEX_ERROR_MALFORMED_MSG);
+                        return;
+                    }
+                    if(syxs.state == SYSEX_STATE_BULK_READ ||
+                            syxs.state == SYSEX_STATE_BULK_WRITE) {
+                        sysex_bulk_stop();
+                    }
+                    sysex_send_error_response(syxs.rx_buf[5],
+                        SYSEX_ERROR_OK);
+                    break;
             }
             break;
     }
 }
 
 
+// start a bulk transfer
+void sysex_bulk_start(int state, int32_t addr, int32_t len) {
+    syxs.state = state;
+    syxs.addr = addr;
+    syxs.bulk_len = len;
+    syxs.bulk_blocks = SYSEX_BULK_NUM_BLOCKS(len);
+    syxs.bulk_next = 0;
+    syxs.bulk_acked = 0;
+    syxs.bulk_window_end = 0;
+    syxs.bulk_loaded = 0;
+    syxs.bulk_load_blocks = 0;
+    syxs.bulk_saved = 0;
+    syxs.bulk_saving = 0;
+    syxs.bulk_nak_sent = 0;
+    syxs.bulk_write_done = 0;
+    syxs.bulk_timer = 0;
+    syxs.bulk_stall_timer = 0;
+}
+
+// stop a bulk transfer before it is done
+void sysex_bulk_stop(void) {
+    // the flash may still be using io_buf
+    if(syxs.bulk_load_blocks || syxs.bulk_saving) {
+        syxs.state = SYSEX_STATE_BULK_STOP;
+    }
+    else {
+        syxs.state = SYSEX_STATE_IDLE;
+    }
+}
+
+// run a bulk read - load blocks into the ring and send them to the host
+void sysex_bulk_read_task(void) {
+    uint32_t slot, num;
+    int len;
+    // check the load in progress
+    if(syxs.bulk_load_blocks) {
+        switch(ext_flash_get_state()) {
+            case EXT_FLASH_STATE_LOAD_ERROR:
+                syxs.bulk_load_blocks = 0;
+                syxs.state = SYSEX_STATE_IDLE;
+                sysex_send_error_response(SYSEX_CMD_BULK_READ_START,
+                    SYSEX_ERROR_EXT_FLASH_ERROR);
+                return;
+            case EXT_FLASH_STATE_LOAD_DONE:
+                syxs.bulk_loaded += syxs.bulk_load_blocks;
+                syxs.bulk_load_blocks = 0;
+                break;
+            default:
+                break;
+        }
+    }
+    // load more blocks into slots that the host has acked
+    if(syxs.bulk_load_blocks == 0 && syxs.bulk_loaded < syxs.bulk_blocks &&
+            syxs.bulk_loaded < (syxs.bulk_acked + SYSEX_BULK_RING_BLOCKS)) {
+        slot = syxs.bulk_loaded % SYSEX_BULK_RING_BLOCKS;
+        num = SYSEX_BULK_LOAD_BLOCKS;
+        if(num > (SYSEX_BULK_RING_BLOCKS - slot)) {
+            num = SYSEX_BULK_RING_BLOCKS - slot;
+        }
+        if(num > (syxs.bulk_blocks - syxs.bulk_loaded)) {
+            num = syxs.bulk_blocks - syxs.bulk_loaded;
+        }
+        if(num > (syxs.bulk_acked + SYSEX_BULK_RING_BLOCKS - syxs.bulk_loaded)) {
+            num = syxs.bulk_acked + SYSEX_BULK_RING_BLOCKS - syxs.bulk_loaded;
+        }
+        len = num * SYSEX_BULK_BLOCK_SIZE;
+        if((syxs.bulk_loaded + num) == syxs.bulk_blocks) {
+            len = syxs.bulk_len - (syxs.bulk_loaded * SYSEX_BULK_BLOCK_SIZE);
+        }
+        // the flash might be busy with something else - try again later
+        if(ext_flash_load(syxs.addr + (syxs.bulk_loaded * SYSEX_BULK_BLOCK_SIZE),
+                len, &syxs.io_buf[slot * SYSEX_BULK_BLOCK_SIZE]) == 0) {
+            syxs.bulk_load_blocks = num;
+        }
+    }
+    // send loaded blocks inside the host's window
+    for(num = 0; num < SYSEX_BULK_BLOCKS_PER_TASK; num ++) {
+        if(syxs.bulk_next >= syxs.bulk_loaded ||
+                syxs.bulk_next >= syxs.bulk_window_end) {
+            break;
+        }
+        // output stream is full
+        if(sysex_bulk_send_block(syxs.bulk_next) == -1) {
+            break;
+        }
+        syxs.bulk_next ++;
+    }
+    // go back to the acked point if the host stops acking
+    syxs.bulk_timer ++;
+    syxs.bulk_stall_timer ++;
+    if(syxs.bulk_stall_timer >= SYSEX_BULK_ABORT_MS) {
+        log_error("sbrt - timeout at block: %d", (int)syxs.bulk_acked);
+        sysex_bulk_stop();
+        sysex_send_error_response(SYSEX_CMD_BULK_READ_START, SYSEX_ERROR_TIMEOUT);
+        return;
+    }
+    if(syxs.bulk_timer >= SYSEX_BULK_RESEND_MS) {
+        syxs.bulk_next = syxs.bulk_acked;
+        syxs.bulk_timer = 0;
+    }
+}
+
+// run a bulk write - save received blocks and ack the host
+void sysex_bulk_write_task(void) {
+    uint32_t first, end;
+    int32_t offset;
+    int len, ret;
+    uint8_t *buf;
+    // check the save in progress
+    if(syxs.bulk_saving) {
+        switch(ext_flash_get_state()) {
+            case EXT_FLASH_STATE_SAVE_ERROR:
+                syxs.bulk_saving = 0;
+                syxs.state = SYSEX_STATE_IDLE;
+                sysex_send_error_response(SYSEX_CMD_BULK_WRITE_START,
+                    SYSEX_ERROR_EXT_FLASH_ERROR);
+                return;
+            case EXT_FLASH_STATE_SAVE_DONE:
+                syxs.bulk_saving = 0;
+                syxs.bulk_saved ++;
+                syxs.bulk_stall_timer = 0;
+                break;
+            default:
+                break;
+        }
+    }
+    // everything is saved
+    if(syxs.bulk_saving == 0 &&
+            (syxs.bulk_saved * SYSEX_BULK_HALF_BLOCKS) >= syxs.bulk_blocks) {
+        syxs.state = SYSEX_STATE_IDLE;
+        syxs.bulk_write_done = 1;
+        sysex_bulk_send_ack(syxs.bulk_blocks, syxs.bulk_blocks,
+            SYSEX_BULK_FLAG_DONE);
+        return;
+    }
+    // save the next half of io_buf once all its blocks are received
+    if(syxs.bulk_saving == 0) {
+        first = syxs.bulk_saved * SYSEX_BULK_HALF_BLOCKS;
+        end = first + SYSEX_BULK_HALF_BLOCKS;
+        if(end > syxs.bulk_blocks) {
+            end = syxs.bulk_blocks;
+        }
+        if(syxs.bulk_next >= end) {
+            offset = first * SYSEX_BULK_BLOCK_SIZE;
+            len = syxs.bulk_len - offset;
+            if(len > SYSEX_BULK_HALF_SIZE) {
+                len = SYSEX_BULK_HALF_SIZE;
+            }
+            buf = &syxs.io_buf[(syxs.bulk_saved & 0x01) * SYSEX_BULK_HALF_SIZE];
+            // the first half of each sector erases it
+            if(syxs.bulk_saved & 0x01) {
+                ret = ext_flash_save_noerase(syxs.addr + offset, len, buf);
+            }
+            else {
+                ret = ext_flash_save(syxs.addr + offset, len, buf);
+            }
+            // the flash might be busy with something else - try again later
+            if(ret == 0) {
+                syxs.bulk_saving = 1;
+                song_flash_changed(syxs.addr + offset, len);
+            }
+        }
+    }
+    // ack new blocks or a new window - resend if the host goes quiet
+    end = sysex_bulk_get_write_window_end();
+    syxs.bulk_timer ++;
+    if(syxs.bulk_next != syxs.bulk_acked || end != syxs.bulk_window_end ||
+            syxs.bulk_timer >= SYSEX_BULK_RESEND_MS) {
+        syxs.bulk_acked = syxs.bulk_next;
+        syxs.bulk_window_end = end;
+        syxs.bulk_timer = 0;
+        sysex_bulk_send_ack(syxs.bulk_next, end, 0);
+    }
+    syxs.bulk_stall_timer ++;
+    if(syxs.bulk_stall_timer >= SYSEX_BULK_ABORT_MS) {
+        log_error("sbwt - timeout at block: %d", (int)syxs.bulk_next);
+        sysex_bulk_stop();
+        sysex_send_error_response(SYSEX_CMD_BULK_WRITE_START, SYSEX_ERROR_TIMEOUT);
+    }
+}
+
+// handle a bulk data message from the host
+void sysex_bulk_handle_data(void) {
+    uint8_t block[SYSEX_BULK_BLOCK_SIZE];
+    uint32_t seq;
+    int len, block_len;
+    if(syxs.state != SYSEX_STATE_BULK_WRITE) {
+        // the done ack might have been lost
+        if(syxs.bulk_write_done) {
+            sysex_bulk_send_ack(syxs.bulk_blocks, syxs.bulk_blocks,
+                SYSEX_BULK_FLAG_DONE);
+        }
+        return;
+    }
+    len = sysex_bulk_decode_data(syxs.rx_buf, syxs.rx_len, &seq, block);
+    // repeat of a block we already have
+    if(len > 0 && seq < syxs.bulk_next) {
+        return;
+    }
+    block_len = syxs.bulk_len - (syxs.bulk_next * SYSEX_BULK_BLOCK_SIZE);
+    if(block_len > SYSEX_BULK_BLOCK_SIZE) {
+        block_len = SYSEX_BULK_BLOCK_SIZE;
+    }
+    // bad or missing block - ask for a resend once until it arrives
+    if(len != block_len || seq != syxs.bulk_next ||
+            seq >= sysex_bulk_get_write_window_end()) {
+        if(!syxs.bulk_nak_sent) {
+            syxs.bulk_nak_sent = 1;
+            sysex_bulk_send_ack(syxs.bulk_next,
+                sysex_bulk_get_write_window_end(), SYSEX_BULK_FLAG_NAK);
+        }
+        return;
+    }
+    memcpy(&syxs.io_buf[(seq % SYSEX_BULK_RING_BLOCKS) * SYSEX_BULK_BLOCK_SIZE],
+        block, len);
+    syxs.bulk_next ++;
+    syxs.bulk_nak_sent = 0;
+    syxs.bulk_stall_timer = 0;
+}
+
+// handle a bulk ack message from the host
+void sysex_bulk_handle_ack(void) {
+    uint32_t next, window_end;
+    int flags;
+    if(syxs.state != SYSEX_STATE_BULK_READ) {
+        return;
+    }
+    if(sysex_bulk_decode_ack(syxs.rx_buf, syxs.rx_len, &next,
+            &window_end, &flags) == -1) {
+        return;
+    }
+    // host can't ack blocks that were never loaded
+    if(next > syxs.bulk_loaded || next < syxs.bulk_acked) {
+        return;
+    }
+    if(next > syxs.bulk_acked) {
+        syxs.bulk_acked = next;
+        syxs.bulk_stall_timer = 0;
+    }
+    // we might have gone back to before the host after losing acks
+    if(syxs.bulk_next < syxs.bulk_acked) {
+        syxs.bulk_next = syxs.bulk_acked;
+    }
+    if(window_end > (syxs.bulk_acked + SYSEX_BULK_MAX_READ_WINDOW)) {
+        window_end = syxs.bulk_acked + SYSEX_BULK_MAX_READ_WINDOW;
+    }
+    syxs.bulk_window_end = window_end;
+    syxs.bulk_timer = 0;
+    if(flags & SYSEX_BULK_FLAG_NAK) {
+        syxs.bulk_next = next;
+    }
+    if(syxs.bulk_acked == syxs.bulk_blocks) {
+        sysex_bulk_stop();
+    }
+}
+
+// get the end of the window of blocks the host can send
+uint32_t sysex_bulk_get_write_window_end(void) {
+    uint32_t end = syxs.bulk_next + SYSEX_BULK_WRITE_WINDOW;
+    // blocks can only go into halves of io_buf that are saved
+    if(end > ((syxs.bulk_saved + 2) * SYSEX_BULK_HALF_BLOCKS)) {
+        end = (syxs.bulk_saved + 2) * SYSEX_BULK_HALF_BLOCKS;
+    }
+    if(end > syxs.bulk_blocks) {
+        end = syxs.bulk_blocks;
+    }
+    return end;
+}
+
+// send a block of a bulk read from the ring
+// returns -1 if the output stream is full
+int sysex_bulk_send_block(uint32_t seq) {
+    uint8_t tx_buf[SYSEX_BULK_DATA_MSG_MAXLEN];
+    int len, tx_count;
+    len = syxs.bulk_len - (seq * SYSEX_BULK_BLOCK_SIZE);
+    if(len > SYSEX_BULK_BLOCK_SIZE) {
+        len = SYSEX_BULK_BLOCK_SIZE;
+    }
+    tx_count = sysex_bulk_encode_data(seq,
+        &syxs.io_buf[(seq % SYSEX_BULK_RING_BLOCKS) * SYSEX_BULK_BLOCK_SIZE],
+        len, tx_buf);
+    return midi_stream_send_sysex_msg(MIDI_PORT_SYSEX_OUT, tx_buf, tx_count);
+}
+
+// send a bulk ack
+void sysex_bulk_send_ack(uint32_t next, uint32_t window_end, int flags) {
+    uint8_t tx_buf[SYSEX_BULK_ACK_MSG_LEN];
+    int tx_count;
+    tx_count = sysex_bulk_encode_ack(next, window_end, flags, tx_buf);
+    midi_stream_send_sysex_msg(MIDI_PORT_SYSEX_OUT, tx_buf, tx_count);
+}
+
 // send a flash read mem result
 void sysex_send_read_ext_mem_result(void) {
     uint8_t tx_buf[SYSEX_MAX_LEN];
@@ -513,6 +1047,38 @@ void sysex_send_read_ext_mem_result(void) {
     midi_stream_send_sysex_msg(MIDI_PORT_SYSEX_OUT, tx_buf, tx_count);
 }
 
+// send the RT profiler stats for a task
+// all values are sent as 4-bit nibbles MSB first:
+// task, enable, counts per us (4), calls (8), min (8), max (8),
+// total (16), histogram bins (8 each)
+void sysex_send_rt_prof_result(int task) {
+    uint8_t tx_buf[SYSEX_MAX_LEN];
+    struct rt_prof_stats stats;
+    int i, tx_count = 0;
+    if(rt_prof_get_stats(task, &stats) == -1) {
+        return;
+    }
+    tx_buf[tx_count++] = MIDI_SYSEX_START;
+    tx_buf[tx_count++] = SYSEX_MMA_ID0;
+    tx_buf[tx_count++] = SYSEX_MMA_ID1;
+    tx_buf[tx_count++] = SYSEX_MMA_ID2;
+    tx_buf[tx_count++] = MIDI_DEV_TYPE;
+    tx_buf[tx_count++] = SYSEX_CMD_RT_PROF_READBACK;
+    tx_buf[tx_count++] = task & 0x7f;
+    tx_buf[tx_count++] = rt_prof_get_enable() & 0x7f;
+    tx_count += sysex_val_to_nibbles(rt_prof_get_counts_per_us(), tx_buf + tx_count, 4);
+    tx_count += sysex_val_to_nibbles(stats.calls, tx_buf + tx_count, 8);
+    tx_count += sysex_val_to_nibbles(stats.min, tx_buf + tx_count, 8);
+    tx_count += sysex_val_to_nibbles(stats.max, tx_buf + tx_count, 8);
+    tx_count += sysex_val_to_nibbles(stats.total >> 32, tx_buf + tx_count, 8);
+    tx_count += sysex_val_to_nibbles(stats.total, tx_buf + tx_count, 8);
+    for(i = 0; i < RT_PROF_NUM_BINS; i ++) {
+        tx_count += sysex_val_to_nibbles(stats.hist[i], tx_buf + tx_count, 8);
+    }
+    tx_buf[tx_count++] = MIDI_SYSEX_END;
+    midi_stream_send_sysex_msg(MIDI_PORT_SYSEX_OUT, tx_buf, tx_count);
+}
+
 // send the devtype response
 void sysex_send_devtype_response(void) {
     uint8_t tx_buf[SYSEX_MAX_LEN];
@@ -557,3 +1123,13 @@ void sysex_nibbles_to_bytes(uint8_t *inbuf, uint8_t *outbuf, int in_len) {
             (inbuf[i+1] & 0x0f);
     }
 }
+
+// convert a value to a number of 4-bit nibbles - MSB first
+// returns the number of nibbles written
+int sysex_val_to_nibbles(uint32_t val, uint8_t *outbuf, int num_nibbles) {
+    int i;
+    for(i = 0; i < num_nibbles; i ++) {
+        outbuf[i] = (val >> ((num_nibbles - 1 - i) * 4)) & 0x0f;
+    }
+    return num_nibbles;
+}
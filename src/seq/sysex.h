@@ -31,6 +31,44 @@
 #define SYSEX_MMA_ID1 0x01
 #define SYSEX_MMA_ID2 0x72
 
+//
+// SYSEX commands / protocol
+//
+// CARBON commands
+#define SYSEX_CMD_ERROR_CODE 0x01  // from device
+// 0x60, 0x61 and 0x62 are used by the remlcd function
+#define SYSEX_CMD_SET_CONFIG_STORE 0x6d  // to device - no response
+#define SYSEX_CMD_SET_LCD_TYPE 0x6e  // to device
+#define SYSEX_CMD_WIPE_CONFIG_STORE 0x6f  // to device
+#define SYSEX_CMD_READ_EXT_FLASH 0x70  // to device
+#define SYSEX_CMD_READBACK_EXT_FLASH 0x71  // from device
+#define SYSEX_CMD_WRITE_EXT_FLASH_BUF 0x72  // to device
+#define SYSEX_CMD_WRITE_EXT_FLASH_COMMIT 0x73  // to device
+#define SYSEX_CMD_RT_PROF_CTRL 0x74  // to device
+#define SYSEX_CMD_RT_PROF_READ 0x75  // to device
+#define SYSEX_CMD_RT_PROF_READBACK 0x76  // from device
+#define SYSEX_CMD_BULK_READ_START 0x77  // to device
+#define SYSEX_CMD_BULK_WRITE_START 0x78  // to device
+#define SYSEX_CMD_BULK_DATA 0x79  // to / from device
+#define SYSEX_CMD_BULK_ACK 0x7a  // to / from device
+#define SYSEX_CMD_BULK_ABORT 0x7b  // to device
+// global commands
+#define SYSEX_CMD_DEV_TYPE 0x7c  // to device
+#define SYSEX_CMD_DEV_RESPONSE 0x7d  // from device
+#define SYSEX_CMD_RESTART 0x7e  // to device
+// error response codes
+#define SYSEX_ERROR_OK 0x01
+#define SYSEX_ERROR_BAD_ADDRESS 0x02
+#define SYSEX_ERROR_BAD_LENGTH 0x03
+#define SYSEX_ERROR_MALFORMED_MSG 0x04
+#define SYSEX_ERROR_EXT_FLASH_ERROR 0x05
+#define SYSEX_ERROR_BAD_PARAM 0x06
+#define SYSEX_ERROR_BUSY 0x07
+#define SYSEX_ERROR_TIMEOUT 0x08
+// RT profiler control modes
+#define SYSEX_RT_PROF_DISABLE 0
+#define SYSEX_RT_PROF_ENABLE 1
+#define SYSEX_RT_PROF_RESET 2
 
 // init the sysex handler
 void sysex_init(void);
@@ -0,0 +1,227 @@
+/*
+ * CARBON Sequencer SYSEX Bulk Transfer Encoding
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "sysex_bulk.h"
+#include "sysex.h"
+#include "../config.h"
+#include "../midi/midi_protocol.h"
+
+// CRC-32 (IEEE 802.3 reflected) table for 4 bits at a time
+static const uint32_t sysex_bulk_crc_table[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+// local functions
+int sysex_bulk_encode_header(int cmd, uint8_t *out);
+int sysex_bulk_check_header(uint8_t *msg, int msg_len, int cmd);
+
+// pack 8 bit data into 7 bit data
+// returns the number of bytes written to out
+int sysex_bulk_pack(uint8_t *in, int len, uint8_t *out) {
+    int i, j, group, count = 0;
+    for(i = 0; i < len; i += 7) {
+        group = len - i;
+        if(group > 7) {
+            group = 7;
+        }
+        out[count] = 0;
+        for(j = 0; j < group; j ++) {
+            out[count] |= ((in[i + j] >> 7) & 0x01) << j;
+            out[count + 1 + j] = in[i + j] & 0x7f;
+        }
+        count += group + 1;
+    }
+    return count;
+}
+
+// unpack 7 bit data into 8 bit data
+// returns the number of bytes written to out or -1 if the data is invalid
+int sysex_bulk_unpack(uint8_t *in, int len, uint8_t *out) {
+    int i, j, group, count = 0;
+    for(i = 0; i < len; i += 8) {
+        group = len - i - 1;
+        if(group > 7) {
+            group = 7;
+        }
+        // a group needs the top bits and at least one data byte
+        if(group < 1) {
+            return -1;
+        }
+        for(j = 0; j < group; j ++) {
+            out[count++] = (in[i + 1 + j] & 0x7f) | (((in[i] >> j) & 0x01) << 7);
+        }
+    }
+    return count;
+}
+
+// update a CRC-32 with a buffer - start with 0
+uint32_t sysex_bulk_crc(uint32_t crc, uint8_t *buf, int len) {
+    int i;
+    crc = ~crc;
+    for(i = 0; i < len; i ++) {
+        crc ^= buf[i];
+        crc = (crc >> 4) ^ sysex_bulk_crc_table[crc & 0x0f];
+        crc = (crc >> 4) ^ sysex_bulk_crc_table[crc & 0x0f];
+    }
+    return ~crc;
+}
+
+// convert a value to a number of 7 bit bytes - MSB first
+// returns the number of bytes written
+int sysex_bulk_val_to_7bit(uint32_t val, uint8_t *out, int num_bytes) {
+    int i;
+    for(i = 0; i < num_bytes; i ++) {
+        out[i] = (val >> ((num_bytes - 1 - i) * 7)) & 0x7f;
+    }
+    return num_bytes;
+}
+
+// convert a number of 7 bit bytes to a value - MSB first
+uint32_t sysex_bulk_7bit_to_val(uint8_t *in, int num_bytes) {
+    int i;
+    uint32_t val = 0;
+    for(i = 0; i < num_bytes; i ++) {
+        val = (val << 7) | (in[i] & 0x7f);
+    }
+    return val;
+}
+
+// encode a data message for a block
+// returns the message length
+int sysex_bulk_encode_data(uint32_t seq, uint8_t *data, int len, uint8_t *out) {
+    uint32_t crc;
+    int count, head;
+    count = sysex_bulk_encode_header(SYSEX_CMD_BULK_DATA, out);
+    head = count;
+    count += sysex_bulk_val_to_7bit(seq, out + count, SYSEX_BULK_SEQ_LEN);
+    out[count++] = (len - 1) & 0x7f;
+    // the CRC covers the sequence number, length and data
+    crc = sysex_bulk_crc(0, out + head, count - head);
+    crc = sysex_bulk_crc(crc, data, len);
+    count += sysex_bulk_pack(data, len, out + count);
+    count += sysex_bulk_val_to_7bit(crc, out + count, SYSEX_BULK_CRC_LEN);
+    out[count++] = MIDI_SYSEX_END;
+    return count;
+}
+
+// decode a data message - data must have room for a full block
+// returns the data length, -1 if the message is malformed or -2 on a CRC error
+int sysex_bulk_decode_data(uint8_t *msg, int msg_len, uint32_t *seq,
+        uint8_t *data) {
+    uint32_t crc;
+    int pos, len;
+    if(msg_len < SYSEX_BULK_DATA_MSG_LEN(1) ||
+            sysex_bulk_check_header(msg, msg_len, SYSEX_CMD_BULK_DATA) == -1) {
+        return -1;
+    }
+    pos = SYSEX_BULK_HEADER_LEN;
+    len = msg[pos + SYSEX_BULK_SEQ_LEN] + 1;
+    if(msg_len != SYSEX_BULK_DATA_MSG_LEN(len)) {
+        return -1;
+    }
+    *seq = sysex_bulk_7bit_to_val(msg + pos, SYSEX_BULK_SEQ_LEN);
+    crc = sysex_bulk_crc(0, msg + pos, SYSEX_BULK_SEQ_LEN + 1);
+    pos += SYSEX_BULK_SEQ_LEN + 1;
+    if(sysex_bulk_unpack(msg + pos, SYSEX_BULK_PACKED_LEN(len), data) != len) {
+        return -1;
+    }
+    pos += SYSEX_BULK_PACKED_LEN(len);
+    crc = sysex_bulk_crc(crc, data, len);
+    // the top byte only holds the top 4 bits of the CRC
+    if(msg[pos] != (crc >> 28) ||
+            sysex_bulk_7bit_to_val(msg + pos, SYSEX_BULK_CRC_LEN) != crc) {
+        return -2;
+    }
+    return len;
+}
+
+// encode an ack message
+// returns the message length
+int sysex_bulk_encode_ack(uint32_t next, uint32_t window_end, int flags,
+        uint8_t *out) {
+    uint32_t crc;
+    int count;
+    count = sysex_bulk_encode_header(SYSEX_CMD_BULK_ACK, out);
+    count += sysex_bulk_val_to_7bit(next, out + count, SYSEX_BULK_SEQ_LEN);
+    count += sysex_bulk_val_to_7bit(window_end, out + count, SYSEX_BULK_SEQ_LEN);
+    out[count++] = flags & 0x7f;
+    // a corrupt ack could skip blocks so it has a CRC too
+    crc = sysex_bulk_crc(0, out + SYSEX_BULK_HEADER_LEN,
+        count - SYSEX_BULK_HEADER_LEN);
+    count += sysex_bulk_val_to_7bit(crc, out + count, SYSEX_BULK_CRC_LEN);
+    out[count++] = MIDI_SYSEX_END;
+    return count;
+}
+
+// decode an ack message
+// returns 0 on success or -1 if the message is malformed or corrupt
+int sysex_bulk_decode_ack(uint8_t *msg, int msg_len, uint32_t *next,
+        uint32_t *window_end, int *flags) {
+    uint32_t crc;
+    int pos = SYSEX_BULK_HEADER_LEN;
+    if(msg_len != SYSEX_BULK_ACK_MSG_LEN ||
+            sysex_bulk_check_header(msg, msg_len, SYSEX_CMD_BULK_ACK) == -1) {
+        return -1;
+    }
+    crc = sysex_bulk_crc(0, msg + pos, (SYSEX_BULK_SEQ_LEN * 2) + 1);
+    if(msg[msg_len - 1 - SYSEX_BULK_CRC_LEN] != (crc >> 28) ||
+            sysex_bulk_7bit_to_val(msg + msg_len - 1 - SYSEX_BULK_CRC_LEN,
+            SYSEX_BULK_CRC_LEN) != crc) {
+        return -1;
+    }
+    *next = sysex_bulk_7bit_to_val(msg + pos, SYSEX_BULK_SEQ_LEN);
+    pos += SYSEX_BULK_SEQ_LEN;
+    *window_end = sysex_bulk_7bit_to_val(msg + pos, SYSEX_BULK_SEQ_LEN);
+    pos += SYSEX_BULK_SEQ_LEN;
+    *flags = msg[pos];
+    return 0;
+}
+
+//
+// local functions
+//
+// encode the start of a message with a command
+// returns the number of bytes written
+int sysex_bulk_encode_header(int cmd, uint8_t *out) {
+    out[0] = MIDI_SYSEX_START;
+    out[1] = SYSEX_MMA_ID0;
+    out[2] = SYSEX_MMA_ID1;
+    out[3] = SYSEX_MMA_ID2;
+    out[4] = MIDI_DEV_TYPE;
+    out[5] = cmd;
+    return SYSEX_BULK_HEADER_LEN;
+}
+
+// check the start and end of a message with a command
+// returns 0 if the message matches or -1 if it does not
+int sysex_bulk_check_header(uint8_t *msg, int msg_len, int cmd) {
+    if(msg[0] != MIDI_SYSEX_START || msg[1] != SYSEX_MMA_ID0 ||
+            msg[2] != SYSEX_MMA_ID1 || msg[3] != SYSEX_MMA_ID2 ||
+            msg[4] != MIDI_DEV_TYPE || msg[5] != cmd ||
+            msg[msg_len - 1] != MIDI_SYSEX_END) {
+        return -1;
+    }
+    return 0;
+}
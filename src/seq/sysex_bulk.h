@@ -0,0 +1,106 @@
+/*
+ * CARBON Sequencer SYSEX Bulk Transfer Encoding
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Bulk transfers move ext flash data in numbered blocks of up to 128
+ * bytes. Each block is packed 8-to-7: every group of up to 7 data bytes
+ * is sent as a byte holding the top bits (bit 0 = first byte) followed by
+ * the low 7 bits of each byte. Each block carries a CRC-32 over its
+ * sequence number, length and unpacked data.
+ *
+ * The receiver acks with the next sequence number it expects and the end
+ * of the window it can take. Acks have a CRC-32 as well. The sender may send any block below the
+ * window end and goes back to the acked point if it gets a NAK or times
+ * out. This is used by sysex.c on the device and by the librarian on the
+ * host so it must only use standard C.
+ *
+ */
+#ifndef SYSEX_BULK_H
+#define SYSEX_BULK_H
+
+#include <inttypes.h>
+
+// settings
+#define SYSEX_BULK_BLOCK_SIZE 128  // max data bytes in a block
+#define SYSEX_BULK_SEQ_LEN 3  // 7 bit bytes in a sequence number
+#define SYSEX_BULK_VAL_LEN 4  // 7 bit bytes in an address or length
+#define SYSEX_BULK_CRC_LEN 5  // 7 bit bytes in a CRC
+#define SYSEX_BULK_HEADER_LEN 6  // start, MMA ID, device type and command
+// packed length of data
+#define SYSEX_BULK_PACKED_LEN(len) ((len) + (((len) + 6) / 7))
+// full length of a data message
+#define SYSEX_BULK_DATA_MSG_LEN(len) (SYSEX_BULK_HEADER_LEN + \
+    SYSEX_BULK_SEQ_LEN + 1 + SYSEX_BULK_PACKED_LEN(len) + \
+    SYSEX_BULK_CRC_LEN + 1)
+#define SYSEX_BULK_DATA_MSG_MAXLEN (SYSEX_BULK_DATA_MSG_LEN(SYSEX_BULK_BLOCK_SIZE))
+#define SYSEX_BULK_ACK_MSG_LEN (SYSEX_BULK_HEADER_LEN + \
+    (SYSEX_BULK_SEQ_LEN * 2) + 1 + SYSEX_BULK_CRC_LEN + 1)
+#define SYSEX_BULK_READ_START_MSG_LEN (SYSEX_BULK_HEADER_LEN + \
+    (SYSEX_BULK_VAL_LEN * 2) + 2)
+#define SYSEX_BULK_WRITE_START_MSG_LEN (SYSEX_BULK_HEADER_LEN + \
+    (SYSEX_BULK_VAL_LEN * 2) + 1)
+#define SYSEX_BULK_ABORT_MSG_LEN (SYSEX_BULK_HEADER_LEN + 1)
+
+// ack flags
+#define SYSEX_BULK_FLAG_NAK 0x01  // resend from the next block now
+#define SYSEX_BULK_FLAG_DONE 0x02  // transfer is complete
+
+// get the number of blocks for a length in bytes
+#define SYSEX_BULK_NUM_BLOCKS(len) (((len) + SYSEX_BULK_BLOCK_SIZE - 1) / \
+    SYSEX_BULK_BLOCK_SIZE)
+
+// pack 8 bit data into 7 bit data
+// returns the number of bytes written to out
+int sysex_bulk_pack(uint8_t *in, int len, uint8_t *out);
+
+// unpack 7 bit data into 8 bit data
+// returns the number of bytes written to out or -1 if the data is invalid
+int sysex_bulk_unpack(uint8_t *in, int len, uint8_t *out);
+
+// update a CRC-32 with a buffer - start with 0
+uint32_t sysex_bulk_crc(uint32_t crc, uint8_t *buf, int len);
+
+// convert a value to a number of 7 bit bytes - MSB first
+// returns the number of bytes written
+int sysex_bulk_val_to_7bit(uint32_t val, uint8_t *out, int num_bytes);
+
+// convert a number of 7 bit bytes to a value - MSB first
+uint32_t sysex_bulk_7bit_to_val(uint8_t *in, int num_bytes);
+
+// encode a data message for a block
+// returns the message length
+int sysex_bulk_encode_data(uint32_t seq, uint8_t *data, int len, uint8_t *out);
+
+// decode a data message - data must have room for a full block
+// returns the data length, -1 if the message is malformed or -2 on a CRC error
+int sysex_bulk_decode_data(uint8_t *msg, int msg_len, uint32_t *seq,
+    uint8_t *data);
+
+// encode an ack message
+// returns the message length
+int sysex_bulk_encode_ack(uint32_t next, uint32_t window_end, int flags,
+    uint8_t *out);
+
+// decode an ack message
+// returns 0 on success or -1 if the message is malformed or corrupt
+int sysex_bulk_decode_ack(uint8_t *msg, int msg_len, uint32_t *next,
+    uint32_t *window_end, int *flags);
+
+#endif
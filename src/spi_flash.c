@@ -34,13 +34,23 @@
 #define SPI_FLASH_PAYLOAD_LEN 256  // max len of TX or RX payload
 #define SPI_FLASH_HEADER_LEN 32  // max len of SPI protocol header
 #define SPI_FLASH_IF_BUFSIZE (SPI_FLASH_PAYLOAD_LEN + SPI_FLASH_HEADER_LEN)
+#define SPI_FLASH_FAST_READ_CHUNK 0x8000  // max len of each fast read DMA
+// CCMRAM can't be reached by DMA
+#define SPI_FLASH_CCMRAM_START 0x10000000
+#define SPI_FLASH_CCMRAM_END 0x10010000
 
 // SPI flash state
 struct spi_flash_state {
     int state;  // the flash state
     uint8_t rx_buf[SPI_FLASH_IF_BUFSIZE];  // internal RX buf
     uint8_t tx_buf[SPI_FLASH_IF_BUFSIZE];  // internal TX buf
+    uint8_t prog_buf[SPI_FLASH_IF_BUFSIZE];  // staged page program TX buf
+    int prog_len;  // length of staged page program data
     int xfer_len;  // length of transfer
+    uint8_t *fast_read_p;  // fast read - next place to receive
+    int fast_read_remain;  // fast read - bytes left to receive
+    int fast_read_error;  // fast read - 1 = a DMA could not be started
+    void (*done_cb)(void);  // called when a command completes
 };
 struct spi_flash_state sflashs;
 
@@ -59,6 +69,7 @@ void spi_flash_spi_error_cb(void);
 
 // local functions
 int spi_flash_start_xfer(uint8_t *tx_buf, uint8_t *rx_buf, int len);
+int spi_flash_fast_read_next(void);
 
 // init the SPI flash interface
 void spi_flash_init(void) {
@@ -88,6 +99,13 @@ void spi_flash_init(void) {
     
     // reset stuff
     sflashs.state = SPI_FLASH_STATE_IDLE;
+    sflashs.prog_len = 0;
+}
+
+// set a function to call when a command completes
+// the function is called from the SPI interrupt
+void spi_flash_set_done_cb(void (*done_cb)(void)) {
+    sflashs.done_cb = done_cb;
 }
 
 // get the SPI flash state
@@ -98,7 +116,7 @@ int spi_flash_get_state(void) {
 // starts an SPI flash command
 // cmd = command to execute
 // addr = address in memory to read/write (or 0 if not needed)
-// tx_data = pointer to transmit data (or null if not needed)
+// tx_data = pointer to transmit data (or null if not needed or staged)
 // len = the length of data to read or write (or 0 if not needed)
 // returns error if the module is busy or cmd is invalid
 int spi_flash_start_cmd(int cmd, uint32_t addr, uint8_t *tx_data, int len) {
@@ -187,17 +205,23 @@ int spi_flash_start_cmd(int cmd, uint32_t addr, uint8_t *tx_data, int len) {
             if(len > SPI_FLASH_PAYLOAD_LEN) {
                 return SPI_FLASH_ERROR_INVALID_PARAMS;
             }
+            // copy the data now if it was not staged
+            if(tx_data != NULL) {
+                for(i = 0; i < len; i ++) {
+                    sflashs.prog_buf[4 + i] = tx_data[i];
+                }
+            }
+            else if(len != sflashs.prog_len) {
+                return SPI_FLASH_ERROR_INVALID_PARAMS;
+            }
             // run the write command
-            sflashs.tx_buf[0] = 0x02;  // page program
-            sflashs.tx_buf[1] = (addr & 0xff0000) >> 16;  // addr 23-16
-            sflashs.tx_buf[2] = (addr & 0x00ff00) >> 8;  // addr 15-8
-            sflashs.tx_buf[3] = (addr & 0x0000ff);  // addr 7-0
+            sflashs.prog_buf[0] = 0x02;  // page program
+            sflashs.prog_buf[1] = (addr & 0xff0000) >> 16;  // addr 23-16
+            sflashs.prog_buf[2] = (addr & 0x00ff00) >> 8;  // addr 15-8
+            sflashs.prog_buf[3] = (addr & 0x0000ff);  // addr 7-0
             sflashs.xfer_len = len + 4;
-            for(i = 0; i < len; i ++) {
-                sflashs.tx_buf[4 + i] = tx_data[i];
-            }     
             sflashs.state = SPI_FLASH_STATE_WRITE_MEM;
-            ret = spi_flash_start_xfer(sflashs.tx_buf, sflashs.rx_buf, 
+            ret = spi_flash_start_xfer(sflashs.prog_buf, sflashs.rx_buf, 
                 sflashs.xfer_len);
             if(ret != SPI_FLASH_ERROR_OK) {
                 sflashs.state = SPI_FLASH_STATE_IDLE;
@@ -228,6 +252,56 @@ int spi_flash_start_cmd(int cmd, uint32_t addr, uint8_t *tx_data, int len) {
     return 0;
 }
 
+// copy data for the next page program into the program buffer
+// this can be done while other commands are running
+// returns error if a page program is being sent or len is invalid
+int spi_flash_stage_write(uint8_t *tx_data, int len) {
+    int i;
+    if(sflashs.state == SPI_FLASH_STATE_WRITE_MEM) {
+        return SPI_FLASH_ERROR_BUSY;
+    }
+    if(len > SPI_FLASH_PAYLOAD_LEN) {
+        return SPI_FLASH_ERROR_INVALID_PARAMS;
+    }
+    for(i = 0; i < len; i ++) {
+        sflashs.prog_buf[4 + i] = tx_data[i];
+    }
+    sflashs.prog_len = len;
+    return SPI_FLASH_ERROR_OK;
+}
+
+// starts a fast read of any length straight into rx_data
+// the command and address are sent first and then the data is received
+// with as many DMA transfers as needed while CS is kept low
+// returns error if the module is busy or rx_data can't be used by DMA
+int spi_flash_start_fast_read(uint32_t addr, uint8_t *rx_data, int len) {
+    int ret;
+    if(sflashs.state != SPI_FLASH_STATE_IDLE) {
+        return SPI_FLASH_ERROR_BUSY;
+    }
+    if(len < 1 || (addr + len) > SPI_FLASH_MEMORY_SIZE ||
+            ((uintptr_t)rx_data >= SPI_FLASH_CCMRAM_START &&
+            (uintptr_t)rx_data < SPI_FLASH_CCMRAM_END)) {
+        return SPI_FLASH_ERROR_INVALID_PARAMS;
+    }
+    sflashs.tx_buf[0] = 0x0b;  // fast read
+    sflashs.tx_buf[1] = (addr & 0xff0000) >> 16;  // addr 23-16
+    sflashs.tx_buf[2] = (addr & 0x00ff00) >> 8;  // addr 15-8
+    sflashs.tx_buf[3] = (addr & 0x0000ff);  // addr 7-0
+    sflashs.tx_buf[4] = 0x00;  // dummy
+    sflashs.xfer_len = len;
+    sflashs.fast_read_p = rx_data;
+    sflashs.fast_read_remain = len;
+    sflashs.fast_read_error = 0;
+    sflashs.state = SPI_FLASH_STATE_FAST_READ_MEM;
+    ret = spi_flash_start_xfer(sflashs.tx_buf, sflashs.rx_buf, 5);
+    if(ret != SPI_FLASH_ERROR_OK) {
+        sflashs.state = SPI_FLASH_STATE_IDLE;
+        return ret;
+    }
+    return SPI_FLASH_ERROR_OK;
+}
+
 // get the result of an SPI flash command and reset the state to idle
 // rx_data must be large enough to accommodate expected data
 // returns the length of the resulting data
@@ -280,6 +354,14 @@ int spi_flash_get_result(uint8_t *rx_data) {
             sflashs.state = SPI_FLASH_STATE_IDLE;        
             ret = SPI_FLASH_ERROR_OK;            
             break;
+        case SPI_FLASH_STATE_FAST_READ_MEM_DONE:
+            // data was received straight into the caller's buffer
+            sflashs.state = SPI_FLASH_STATE_IDLE;
+            ret = sflashs.xfer_len;
+            if(sflashs.fast_read_error) {
+                ret = SPI_FLASH_ERROR_START_ERROR;
+            }
+            break;
         default:
             return SPI_FLASH_ERROR_INVALID_STATE;
     }
@@ -385,6 +467,14 @@ void spi_flash_spi_txrx_cplt_cb(void) {
     __HAL_UNLOCK(spi_flash_spi_handle.hdmatx);
     __HAL_UNLOCK(spi_flash_spi_handle.hdmarx);
 
+    // keep CS low while a fast read has more data to receive
+    if(sflashs.state == SPI_FLASH_STATE_FAST_READ_MEM &&
+            sflashs.fast_read_remain > 0) {
+        if(spi_flash_fast_read_next() == SPI_FLASH_ERROR_OK) {
+            return;
+        }
+        sflashs.fast_read_error = 1;
+    }
     HAL_GPIO_WritePin(GPIOD, GPIO_PIN_6, 1);  // raise CS line    
     // switch states when transfer completes
     switch(sflashs.state) {
@@ -409,10 +499,17 @@ void spi_flash_spi_txrx_cplt_cb(void) {
         case SPI_FLASH_STATE_ERASE_MEM:
             sflashs.state = SPI_FLASH_STATE_ERASE_MEM_DONE;
             break;
+        case SPI_FLASH_STATE_FAST_READ_MEM:
+            sflashs.state = SPI_FLASH_STATE_FAST_READ_MEM_DONE;
+            break;
         default:
             sflashs.state = SPI_FLASH_STATE_IDLE;
             break;
     }
+    // let the user start the next command right away
+    if(sflashs.done_cb != NULL) {
+        sflashs.done_cb();
+    }
 }
 
 // start a transfer - returns -1 if the transfer could not be started
@@ -428,3 +525,19 @@ int spi_flash_start_xfer(uint8_t *tx_buf, uint8_t *rx_buf, int len) {
     return SPI_FLASH_ERROR_OK;
 }
 
+// receive the next part of a fast read - CS must still be low
+// the buffer is also sent since the flash ignores MOSI while reading
+// returns -1 if the transfer could not be started
+int spi_flash_fast_read_next(void) {
+    int len = sflashs.fast_read_remain;
+    if(len > SPI_FLASH_FAST_READ_CHUNK) {
+        len = SPI_FLASH_FAST_READ_CHUNK;
+    }
+    if(HAL_SPI_TransmitReceive_DMA(&spi_flash_spi_handle,
+            sflashs.fast_read_p, sflashs.fast_read_p, len) != HAL_OK) {
+        return SPI_FLASH_ERROR_START_ERROR;
+    }
+    sflashs.fast_read_p += len;
+    sflashs.fast_read_remain -= len;
+    return SPI_FLASH_ERROR_OK;
+}
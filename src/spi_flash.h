@@ -57,6 +57,8 @@
 #define SPI_FLASH_STATE_WRITE_MEM_DONE 12  // write flash mem done
 #define SPI_FLASH_STATE_ERASE_MEM 13  // sector erase flash mem - must be write enabled
 #define SPI_FLASH_STATE_ERASE_MEM_DONE 14  // sector erase mem done
+#define SPI_FLASH_STATE_FAST_READ_MEM 15  // fast read flash mem into a buffer
+#define SPI_FLASH_STATE_FAST_READ_MEM_DONE 16  // fast read flash mem done
 
 // SPI flash errors
 #define SPI_FLASH_ERROR_OK 0
@@ -72,10 +74,25 @@ void spi_flash_init(void);
 // get the SPI flash state
 int spi_flash_get_state(void);
 
+// set a function to call when a command completes
+// the function is called from the SPI interrupt
+void spi_flash_set_done_cb(void (*done_cb)(void));
+
 // starts an SPI flash command
+// SPI_FLASH_CMD_WRITE_MEM with tx_data set to NULL writes the staged data
 // returns -1 if the module is busy or cmd is invalid
 int spi_flash_start_cmd(int cmd, uint32_t addr, uint8_t *tx_data, int len);
 
+// copy data for the next page program into the program buffer
+// this can be done while other commands are running
+// returns SPI_FLASH_ERROR_BUSY if a page program is being sent
+int spi_flash_stage_write(uint8_t *tx_data, int len);
+
+// starts a fast read of any length straight into rx_data
+// the data is in rx_data when the state is SPI_FLASH_STATE_FAST_READ_MEM_DONE
+// returns SPI_FLASH_ERROR_INVALID_PARAMS if rx_data can't be used by DMA
+int spi_flash_start_fast_read(uint32_t addr, uint8_t *rx_data, int len);
+
 // get the result of an SPI flash command
 // rx_data must be large enough to accommodate expected data
 // returns the length of the resulting data
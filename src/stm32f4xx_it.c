@@ -41,6 +41,7 @@
 #include "main.h"
 #include "stm32f4xx_it.h"
 #include "debug.h"
+#include "din_midi.h"
 #include "util/log.h"
 #include "usbh_midi/usbh_midi.h"
 
@@ -51,6 +52,7 @@ extern SPI_HandleTypeDef aout_spi_handle;  // SPI1 analog out interface
 extern UART_HandleTypeDef din_midi1_handle;  // DIN1 RX and TX - UART4
 extern UART_HandleTypeDef din_midi2_handle;  // DIN2 TX - USART2
 extern SPI_HandleTypeDef spi_flash_spi_handle;  // SPI3 flash interface
+extern TIM_HandleTypeDef clock_timer_handle;  // TIM5 clock timer
 // USB stuff
 extern PCD_HandleTypeDef usbdev_handle;  // USB device handle
 extern HCD_HandleTypeDef hhcd;  // USB host handle
@@ -191,6 +193,7 @@ void DMA1_Stream2_IRQHandler(void) {
 
 // DIN MIDI UART4
 void UART4_IRQHandler(void) {
+    din_midi_rx_idle_irq();
     HAL_UART_IRQHandler(&din_midi1_handle);
 }
 
@@ -207,6 +210,14 @@ void USART2_IRQHandler(void) {
     HAL_UART_IRQHandler(&din_midi2_handle);
 }
 
+//
+// clock timer
+//
+// clock timer TIM5 compare
+void TIM5_IRQHandler(void) {
+    HAL_TIM_IRQHandler(&clock_timer_handle);
+}
+
 //
 // USB
 //
@@ -22,166 +22,62 @@
  */
 #ifndef SCALE_TABLES_H
 #define SCALE_TABLES_H
- 
-#define SCALE_LEN_MAJOR 7
-#define SCALE_LEN_HAR_MINOR 7
-#define SCALE_LEN_NAT_MINOR 7
-#define SCALE_LEN_DORIAN 7
-#define SCALE_LEN_WHOLE 6
-#define SCALE_LEN_PENT 5
-#define SCALE_LEN_DIM 8
-// new scales added in ver. 1.12
-#define SCALE_LEN_PHRYGIAN 7
-#define SCALE_LEN_LYDIAN 7
-#define SCALE_LEN_MIXOLYDIAN 7
-#define SCALE_LEN_LOCRIAN 7
-#define SCALE_LEN_PENT_MINOR 5
-#define SCALE_LEN_BLUES 6
-#define SCALE_LEN_HALF_DIM 7
-#define SCALE_LEN_SEVEN_CHORD 4
-
-unsigned char scale_major[] = {
-0	,
-2	,
-4	,
-5	,
-7	,
-9	,
-11	
-};
-
-unsigned char scale_har_minor[] = {
-0	,
-2	,
-3	,
-5	,
-7	,
-8	,
-11	
-};
-
-unsigned char scale_nat_minor[] = {
-0	,
-2	,
-3	,
-5	,
-7	,
-8	,
-10	
-};
-
-unsigned char scale_dorian[] = {
-0	,
-2	,
-3	,
-5	,
-7	,
-9	,
-10	
-};
-
-unsigned char scale_whole[] = {
-0	,
-2	,
-4	,
-6	,
-8	,
-10	
-};
-
-unsigned char scale_pent[] = {
-0	,
-2	,
-4	,
-7	,
-9	
-};
-
-unsigned char scale_dim[] = {
-0	,
-2	,
-3	,
-5	,
-6	,
-8	,
-9	,
-11	
-};
 
+#include <inttypes.h>
+
+// each scale is given as a map of the 12 pitch classes to the scale note
+// at or below it - these are expanded at compile time to all 128 notes
+#define SCALE_OCT(o, c, cs, d, ds, e, f, fs, g, gs, a, as, b) \
+    (o)+(c), (o)+(cs), (o)+(d), (o)+(ds), (o)+(e), (o)+(f), \
+    (o)+(fs), (o)+(g), (o)+(gs), (o)+(a), (o)+(as), (o)+(b)
+#define SCALE_MAP(c, cs, d, ds, e, f, fs, g, gs, a, as, b) { \
+    SCALE_OCT(0, c, cs, d, ds, e, f, fs, g, gs, a, as, b), \
+    SCALE_OCT(12, c, cs, d, ds, e, f, fs, g, gs, a, as, b), \
+    SCALE_OCT(24, c, cs, d, ds, e, f, fs, g, gs, a, as, b), \
+    SCALE_OCT(36, c, cs, d, ds, e, f, fs, g, gs, a, as, b), \
+    SCALE_OCT(48, c, cs, d, ds, e, f, fs, g, gs, a, as, b), \
+    SCALE_OCT(60, c, cs, d, ds, e, f, fs, g, gs, a, as, b), \
+    SCALE_OCT(72, c, cs, d, ds, e, f, fs, g, gs, a, as, b), \
+    SCALE_OCT(84, c, cs, d, ds, e, f, fs, g, gs, a, as, b), \
+    SCALE_OCT(96, c, cs, d, ds, e, f, fs, g, gs, a, as, b), \
+    SCALE_OCT(108, c, cs, d, ds, e, f, fs, g, gs, a, as, b), \
+    120+(c), 120+(cs), 120+(d), 120+(ds), 120+(e), 120+(f), 120+(fs), 120+(g) }
+
+// note quantize maps - in the order of the SCALE_ tonality numbers
+const uint8_t scale_quantize_map[SCALE_NUM_TONALITIES][128] = {
+// chromatic - 0 1 2 3 4 5 6 7 8 9 10 11
+SCALE_MAP(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11),
+// major - 0 2 4 5 7 9 11
+SCALE_MAP(0, 0, 2, 2, 4, 5, 5, 7, 7, 9, 9, 11),
+// nat minor - 0 2 3 5 7 8 10
+SCALE_MAP(0, 0, 2, 3, 3, 5, 5, 7, 8, 8, 10, 10),
+// har minor - 0 2 3 5 7 8 11
+SCALE_MAP(0, 0, 2, 3, 3, 5, 5, 7, 8, 8, 8, 11),
+// dorian - 0 2 3 5 7 9 10
+SCALE_MAP(0, 0, 2, 3, 3, 5, 5, 7, 7, 9, 10, 10),
+// whole - 0 2 4 6 8 10
+SCALE_MAP(0, 0, 2, 2, 4, 4, 6, 6, 8, 8, 10, 10),
+// pent - 0 2 4 7 9
+SCALE_MAP(0, 0, 2, 2, 4, 4, 4, 7, 7, 9, 9, 9),
+// dim - 0 2 3 5 6 8 9 11
+SCALE_MAP(0, 0, 2, 3, 3, 5, 6, 6, 8, 9, 9, 11),
 // new scales added in ver. 1.12
-unsigned char scale_phrygian[] = {
-0	,
-1	,
-3	,
-5	,
-7	,
-8	,
-10	
-};
-
-unsigned char scale_lydian[] = {
-0	,
-2	,
-4	,
-6	,
-7	,
-9	,
-11	
-};
-
-unsigned char scale_mixolydian[] = {
-0	,
-2	,
-4	,
-5	,
-7	,
-9	,
-10	
-};
-
-unsigned char scale_locrian[] = {
-0	,
-1	,
-3	,
-5	,
-6	,
-8	,
-10	
-};
-
-unsigned char scale_pent_minor[] = {
-0	,
-3	,
-5	,
-7	,
-10	
-};
-
-unsigned char scale_blues[] = {
-0	,
-3	,
-5	,
-6   ,
-7	,
-10	
-};
-
-unsigned char scale_half_dim[] = {
-0	,
-2	,
-3	,
-5	,
-6	,
-8	,
-10		
-};
-
-unsigned char scale_seven_chord[] = {
-0	,
-4	,
-7	,
-11		
+// phrygian - 0 1 3 5 7 8 10
+SCALE_MAP(0, 1, 1, 3, 3, 5, 5, 7, 8, 8, 10, 10),
+// lydian - 0 2 4 6 7 9 11
+SCALE_MAP(0, 0, 2, 2, 4, 4, 6, 7, 7, 9, 9, 11),
+// mixolydian - 0 2 4 5 7 9 10
+SCALE_MAP(0, 0, 2, 2, 4, 5, 5, 7, 7, 9, 10, 10),
+// locrian - 0 1 3 5 6 8 10
+SCALE_MAP(0, 1, 1, 3, 3, 5, 6, 6, 8, 8, 10, 10),
+// pent minor - 0 3 5 7 10
+SCALE_MAP(0, 0, 0, 3, 3, 5, 5, 7, 7, 7, 10, 10),
+// blues - 0 3 5 6 7 10
+SCALE_MAP(0, 0, 0, 3, 3, 5, 6, 7, 7, 7, 10, 10),
+// half dim - 0 2 3 5 6 8 10
+SCALE_MAP(0, 0, 2, 3, 3, 5, 6, 6, 8, 8, 10, 10),
+// seven chord - 0 4 7 11
+SCALE_MAP(0, 0, 0, 0, 4, 4, 4, 7, 7, 7, 7, 11)
 };
 
 #endif
-
@@ -24,34 +24,14 @@
 #include "usbd_core.h"
 #include "usbd_ctlreq.h"
 #include "usbd_conf.h"
+#include "../clock_timer.h"
 #include "../util/log.h"
+#include "../util/time_utils.h"
 #include "midi/midi_utils.h"
 #include "midi/midi_stream.h"
+#include "midi/midi_usb.h"
 #include "../debug.h"
 
-// code index numbers
-#define MIDI_CIN_MISC_FUNCTION_RESERVED         0x00
-#define MIDI_CIN_CABLE_EVENTS_RESERVED          0x01
-#define MIDI_CIN_2_BYTE_MESSAGE                 0x02
-#define MIDI_CIN_MTC                            0x02
-#define MIDI_CIN_SONG_SELECT                    0x02
-#define MIDI_CIN_3_BYTE_MESSAGE                 0x03
-#define MIDI_CIN_SONG_POSITION                  0x03
-#define MIDI_CIN_SYSEX_START                    0x04
-#define MIDI_CIN_SYSEX_CONTINUE                 0x04
-#define MIDI_CIN_1_BYTE_MESSAGE                 0x05
-#define MIDI_CIN_SYSEX_ENDS_1                   0x05
-#define MIDI_CIN_SYSEX_ENDS_2                   0x06
-#define MIDI_CIN_SYSEX_ENDS_3                   0x07
-#define MIDI_CIN_NOTE_OFF                       0x08
-#define MIDI_CIN_NOTE_ON                        0x09
-#define MIDI_CIN_POLY_KEY_PRESSURE              0x0a
-#define MIDI_CIN_CONTROL_CHANGE                 0x0b
-#define MIDI_CIN_PROGRAM_CHANGE                 0x0c
-#define MIDI_CIN_CHANNEL_PRESSURE               0x0d
-#define MIDI_CIN_PITCH_BEND                     0x0e
-#define MIDI_CIN_SINGLE_BYTE                    0x0f
-
 // class functions
 static uint8_t  USBD_MIDI_Init (USBD_HandleTypeDef *pdev, 
                                uint8_t cfgidx);
@@ -377,7 +357,7 @@ static uint8_t USBD_MIDI_CfgDesc[USBD_MIDI_CONFIG_DESC_SIZE] = {
 // local functions
 static void IntToUnicode (uint32_t value , uint8_t *pbuf , uint8_t len);
 static void Get_SerialNum(void);
-void usbd_midi_prepare_in_ep(USBD_HandleTypeDef *pdev);
+int usbd_midi_prepare_in_ep(USBD_HandleTypeDef *pdev);
 
 // mapping of functions to the class driver
 USBD_ClassTypeDef USBD_MIDI_ClassDriver = {
@@ -431,13 +411,28 @@ USBD_HandleTypeDef USBD_Device;
 //
 #define USBD_MIDI_BUFSIZE 256
 uint8_t usbd_midi_rx_buf[USBD_MIDI_BUFSIZE];  // receive (OUT) endpoint buffer
-uint8_t usbd_midi_tx_buf[USBD_MIDI_BUFSIZE];  // transmit (IN) endpoint
-uint8_t usbd_midi_tx_q[USBD_MIDI_TX_QUEUE_BUFSIZE][4];  // transmit (IN) packet queue
-uint32_t usbd_midi_tx_q_inp;  // transmit (IN) packet queue in pointer
-uint32_t usbd_midi_tx_q_outp;  // transmit (IN) packet queue out pointer
+uint8_t usbd_midi_tx_buf[USBD_MIDI_EP_SIZE];  // transmit (IN) endpoint - one full packet
+// transmit (IN) event queues - filled by the timer task and sent from the USB IRQ
+struct midi_usb_tx usbd_midi_tx;
+int usbd_midi_tx_burst;  // the last transfer was full so keep sending
+// receive (OUT) SYSEX state for each cable
+struct midi_usb_rx usbd_midi_rx[USBD_MIDI_NUM_IN_PORTS];
+
+// transmit stats
+struct usbd_midi_tx_counters {
+    uint32_t events;  // events sent
+    uint32_t rt_events;  // realtime events sent from the fast lane
+    uint32_t transfers;  // transfers sent
+    uint32_t full_transfers;  // transfers sent with a full packet
+    uint32_t sof_transfers;  // partial transfers flushed on SOF
+    uint32_t bytes;  // bytes sent
+};
+struct usbd_midi_tx_counters usbd_midi_tx_count;
+btime usbd_midi_stats_time;  // time the stats were reset
 
 // init the USBD MIDI device
 void usbd_midi_init(void) {
+    int i;
     // init device library
     USBD_Init(&USBD_Device, &USBD_MIDI_Desc, 0);
     // add class support  
@@ -445,119 +440,50 @@ void usbd_midi_init(void) {
     // start device  
     USBD_Start(&USBD_Device);
 
-    // reset transmit packet queue
-    usbd_midi_tx_q_inp = 0;
-    usbd_midi_tx_q_outp = 0;    
+    // reset receive SYSEX state and transmit event queues
+    for(i = 0; i < USBD_MIDI_NUM_IN_PORTS; i ++) {
+        midi_usb_rx_init(&usbd_midi_rx[i]);
+    }
+    midi_usb_tx_init(&usbd_midi_tx);
+    usbd_midi_tx_burst = 0;
+    usbd_midi_reset_tx_stats();
 }
 
 // run the USBD timer task
 void usbd_midi_timer_task(void) {
-    struct midi_msg msg;
-    int cable, cin;
-    // check all ports
+    int cable;
+    // queue events from all ports - the USB IRQ sends them
     for(cable = 0; cable < USBD_MIDI_NUM_OUT_PORTS; cable ++) {
-        // make sure the EP buffer has room for new data
-        if(((usbd_midi_tx_q_inp - usbd_midi_tx_q_outp) & USBD_MIDI_TX_QUEUE_BUFMASK) >
-                (USBD_MIDI_TX_QUEUE_BUFSIZE - 4)) {
-            return;
-        }
-        // process each message for port
-        while(midi_stream_data_available(cable + USBD_MIDI_PORT_OUT)) {
-            midi_stream_receive_msg(cable + USBD_MIDI_PORT_OUT, &msg);                        
-            if(msg.len < 1) {
-                continue;
-            }
-            // check voice messages (upper nibble only)
-            switch(msg.status & 0xf0) {
-	            case MIDI_NOTE_OFF:
-	                cin = MIDI_CIN_NOTE_OFF;
-		            break;
-	            case MIDI_NOTE_ON:
-	                cin = MIDI_CIN_NOTE_ON;
-		            break;
-	            case MIDI_POLY_KEY_PRESSURE:
-	                cin = MIDI_CIN_POLY_KEY_PRESSURE;
-		            break;
-	            case MIDI_CONTROL_CHANGE:
-	                cin = MIDI_CIN_CONTROL_CHANGE;
-		            break;
-	            case MIDI_PROGRAM_CHANGE:
-	                cin = MIDI_CIN_PROGRAM_CHANGE;
-		            break;
-	            case MIDI_CHANNEL_PRESSURE:
-	                cin = MIDI_CIN_CHANNEL_PRESSURE;
-		            break;
-	            case MIDI_PITCH_BEND:
-	                cin = MIDI_CIN_PITCH_BEND;
-		            break;
-	            default:  // system common or realtime messages
-	                switch(msg.status) {
-	                    case MIDI_MTC_QFRAME:
-	                        cin = MIDI_CIN_MTC;
-	                        break;
-	                    case MIDI_SONG_POSITION:
-	                        cin = MIDI_CIN_SONG_POSITION;
-		                    break;
-	                    case MIDI_SONG_SELECT:
-	                        cin = MIDI_CIN_SONG_SELECT;
-		                    break;
-	                    case MIDI_TUNE_REQUEST:
-	                    case MIDI_TIMING_TICK:
-	                    case MIDI_CLOCK_START:
-	                    case MIDI_CLOCK_CONTINUE:
-	                    case MIDI_CLOCK_STOP:
-	                    case MIDI_ACTIVE_SENSING:
-	                    case MIDI_SYSTEM_RESET:
-	                        cin = MIDI_CIN_1_BYTE_MESSAGE;
-		                    break;
-	                    case MIDI_SYSEX_START:
-	                        cin = MIDI_CIN_SYSEX_START;
-	                        break;
-	                    default:  // arbitrary data in status position (could be SYSEX)
-	                        // 2 byte message
-                            if(msg.len == 2) {
-                                if(msg.data0 == MIDI_SYSEX_END) {
-                                    cin = MIDI_CIN_SYSEX_ENDS_2;
-                                }
-                                else {
-                                    cin = MIDI_CIN_2_BYTE_MESSAGE;
-                                }
-                            }
-                            // 3 byte message
-                            else if(msg.len == 3) {
-                                if(msg.data1 == MIDI_SYSEX_END) {
-                                    cin = MIDI_CIN_SYSEX_ENDS_3;
-                                }
-                                else {
-                                    cin = MIDI_CIN_3_BYTE_MESSAGE;
-                                }
-                            }
-                            // 1 byte message
-                            else {
-                                cin = MIDI_CIN_1_BYTE_MESSAGE;  // or SYSEX_ENDS_1
-                            }
-                            break;
-	                }
-	                break;		    
-            };
-            // add the USB MIDI packet            
-            usbd_midi_tx_q[usbd_midi_tx_q_inp][0] = ((cable << 4) & 0xf0) | (cin & 0x0f);
-            usbd_midi_tx_q[usbd_midi_tx_q_inp][1] = msg.status;
-            if(msg.len > 1) {
-                usbd_midi_tx_q[usbd_midi_tx_q_inp][2] = msg.data0;
-            }
-            else {
-                usbd_midi_tx_q[usbd_midi_tx_q_inp][2] = 0;
-            }
-            if(msg.len > 2) {
-                usbd_midi_tx_q[usbd_midi_tx_q_inp][3] = msg.data1;
-            }
-            else {
-                usbd_midi_tx_q[usbd_midi_tx_q_inp][3] = 0;
-            }
-            usbd_midi_tx_q_inp = (usbd_midi_tx_q_inp + 1) & USBD_MIDI_TX_QUEUE_BUFMASK;
-        }
+        midi_usb_tx_queue_stream(&usbd_midi_tx, cable + USBD_MIDI_PORT_OUT, cable);
+    }
+}
+
+// get the USB MIDI IN transfer stats
+void usbd_midi_get_tx_stats(struct usbd_midi_tx_stats *stats) {
+    int32_t elapsed;
+    stats->events = usbd_midi_tx_count.events;
+    stats->rt_events = usbd_midi_tx_count.rt_events;
+    stats->transfers = usbd_midi_tx_count.transfers;
+    stats->full_transfers = usbd_midi_tx_count.full_transfers;
+    stats->sof_transfers = usbd_midi_tx_count.sof_transfers;
+    elapsed = time_utils_get_btime() - usbd_midi_stats_time;
+    if(elapsed > 0) {
+        stats->bytes_per_sec = ((uint64_t)usbd_midi_tx_count.bytes * 1000000) / elapsed;
     }
+    else {
+        stats->bytes_per_sec = 0;
+    }
+}
+
+// reset the USB MIDI IN transfer stats
+void usbd_midi_reset_tx_stats(void) {
+    usbd_midi_tx_count.events = 0;
+    usbd_midi_tx_count.rt_events = 0;
+    usbd_midi_tx_count.transfers = 0;
+    usbd_midi_tx_count.full_transfers = 0;
+    usbd_midi_tx_count.sof_transfers = 0;
+    usbd_midi_tx_count.bytes = 0;
+    usbd_midi_stats_time = time_utils_get_btime();
 }
 
 //
@@ -676,7 +602,12 @@ static uint8_t USBD_MIDI_DataIn(USBD_HandleTypeDef *pdev,
     USBD_MIDI_HandleTypeDef *hmidi = (USBD_MIDI_HandleTypeDef *)pdev->pClassData;
     if(pdev->pClassData != NULL) {
         hmidi->TxState = 0;  // reset TX flag
-        usbd_midi_prepare_in_ep(pdev);  // check if another buffer should be sent
+        // keep going during a burst or if realtime events are waiting
+        // otherwise partial packets wait for the next SOF to fill up more
+        if(usbd_midi_tx_burst || midi_usb_tx_get_rt_queued(&usbd_midi_tx) ||
+                midi_usb_tx_get_queued(&usbd_midi_tx) >= USBD_MIDI_TX_EVENTS) {
+            usbd_midi_prepare_in_ep(pdev);
+        }
         return USBD_OK;
     }
     return USBD_FAIL;
@@ -691,7 +622,8 @@ static uint8_t USBD_MIDI_DataIn(USBD_HandleTypeDef *pdev,
   * @retval status
   */
 static uint8_t USBD_MIDI_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum) {
-    int i, cable, cin;
+    int i, cable;
+    uint32_t time = clock_timer_get_time();  // all events in the transfer arrived together
     USBD_MIDI_HandleTypeDef *hmidi = (USBD_MIDI_HandleTypeDef *)pdev->pClassData;
     
     // get the received data length
@@ -705,46 +637,9 @@ static uint8_t USBD_MIDI_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum) {
             if(cable >= USBD_MIDI_NUM_IN_PORTS) {
                 continue;
             }
-            cin = hmidi->RxBuffer[i] & 0x0f;
-            
-            switch(cin) {
-                case MIDI_CIN_1_BYTE_MESSAGE:  // one byte
-                case MIDI_CIN_SINGLE_BYTE:
-                    midi_stream_send_byte((USBD_MIDI_PORT_IN + cable),
-                        hmidi->RxBuffer[i + 1]);
-                    break;
-                case MIDI_CIN_2_BYTE_MESSAGE:  // two bytes
-                case MIDI_CIN_SYSEX_ENDS_2:
-                case MIDI_CIN_PROGRAM_CHANGE:
-                case MIDI_CIN_CHANNEL_PRESSURE:
-                    // XXX this could be done better
-                    midi_stream_send_byte((USBD_MIDI_PORT_IN + cable),
-                        hmidi->RxBuffer[i + 1]);
-                    midi_stream_send_byte((USBD_MIDI_PORT_IN + cable),
-                        hmidi->RxBuffer[i + 2]);
-                    break;
-                case MIDI_CIN_3_BYTE_MESSAGE:  // three bytes
-                case MIDI_CIN_SYSEX_START:
-                case MIDI_CIN_SYSEX_ENDS_3:
-                case MIDI_CIN_NOTE_OFF:
-                case MIDI_CIN_NOTE_ON:
-                case MIDI_CIN_POLY_KEY_PRESSURE:
-                case MIDI_CIN_CONTROL_CHANGE:
-                case MIDI_CIN_PITCH_BEND:
-                    // XXX this could be done better
-                    midi_stream_send_byte((USBD_MIDI_PORT_IN + cable),
-                        hmidi->RxBuffer[i + 1]);
-                    midi_stream_send_byte((USBD_MIDI_PORT_IN + cable),
-                        hmidi->RxBuffer[i + 2]);
-                    midi_stream_send_byte((USBD_MIDI_PORT_IN + cable),
-                        hmidi->RxBuffer[i + 3]);
-                    break;
-                case MIDI_CIN_CABLE_EVENTS_RESERVED:
-                case MIDI_CIN_MISC_FUNCTION_RESERVED:
-                default:
-                    // we can't do anything with this
-                    break;
-            }
+            // decode the event straight into a message
+            midi_usb_rx_event(&usbd_midi_rx[cable], (USBD_MIDI_PORT_IN + cable),
+                &hmidi->RxBuffer[i], time);
         }
         
         // XXX can we stall here if we can't take the data now?
@@ -765,9 +660,11 @@ static uint8_t USBD_MIDI_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum) {
 static uint8_t USBD_MIDI_SOF(USBD_HandleTypeDef *pdev) {
     USBD_MIDI_HandleTypeDef *hmidi = (USBD_MIDI_HandleTypeDef *)pdev->pClassData;
 
-    // check if another buffer should be sent - the pump has not been primed
+    // flush whatever is queued once per frame - the pump has not been primed
     if(pdev->pClassData != NULL && hmidi->TxState == 0) {
-        usbd_midi_prepare_in_ep(pdev);
+        if(usbd_midi_prepare_in_ep(pdev) > 0 && !usbd_midi_tx_burst) {
+            usbd_midi_tx_count.sof_transfers ++;
+        }
         return USBD_OK;
     }
     return USBD_OK;
@@ -925,26 +822,33 @@ static void IntToUnicode (uint32_t value , uint8_t *pbuf , uint8_t len) {
 }
 
 // prepare the IN EP for a data transfer
-void usbd_midi_prepare_in_ep(USBD_HandleTypeDef *pdev) {
+// realtime events go first and the rest of the packet is filled from the event queue
+// returns the number of events sent
+int usbd_midi_prepare_in_ep(USBD_HandleTypeDef *pdev) {
     USBD_MIDI_HandleTypeDef *hmidi = (USBD_MIDI_HandleTypeDef *)pdev->pClassData;
-    
+    int events, rt_events;
+
     // add data to TX buffer
-    hmidi->TxLength = 0;
-    while(usbd_midi_tx_q_inp != usbd_midi_tx_q_outp) {
-        hmidi->TxBuffer[hmidi->TxLength++] = usbd_midi_tx_q[usbd_midi_tx_q_outp][0];
-        hmidi->TxBuffer[hmidi->TxLength++] = usbd_midi_tx_q[usbd_midi_tx_q_outp][1];
-        hmidi->TxBuffer[hmidi->TxLength++] = usbd_midi_tx_q[usbd_midi_tx_q_outp][2];
-        hmidi->TxBuffer[hmidi->TxLength++] = usbd_midi_tx_q[usbd_midi_tx_q_outp][3];
-        usbd_midi_tx_q_outp = (usbd_midi_tx_q_outp + 1) & USBD_MIDI_TX_QUEUE_BUFMASK;
+    events = midi_usb_tx_fill(&usbd_midi_tx, hmidi->TxBuffer, USBD_MIDI_TX_EVENTS,
+        &rt_events);
+    usbd_midi_tx_burst = (events == USBD_MIDI_TX_EVENTS);
+    if(events == 0) {
+        return 0;
+    }
+    hmidi->TxLength = events * MIDI_USB_EVENT_LEN;
+    usbd_midi_tx_count.events += events;
+    usbd_midi_tx_count.rt_events += rt_events;
+    usbd_midi_tx_count.transfers ++;
+    usbd_midi_tx_count.bytes += hmidi->TxLength;
+    if(usbd_midi_tx_burst) {
+        usbd_midi_tx_count.full_transfers ++;
     }
 
     // start transfer
-    if(hmidi->TxLength) {
-        hmidi->TxState = 1;
-        USBD_LL_Transmit(pdev, 
-            USBD_MIDI_IN_EP, 
-            hmidi->TxBuffer,
-            hmidi->TxLength);    
-    }
+    hmidi->TxState = 1;
+    USBD_LL_Transmit(pdev, 
+        USBD_MIDI_IN_EP, 
+        hmidi->TxBuffer,
+        hmidi->TxLength);
+    return events;
 }
-
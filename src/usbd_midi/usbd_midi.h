@@ -27,13 +27,11 @@
 #include "usbd_def.h"
 #include "../config.h"  // MIDI port settings
 
-// transmit queue
-#define USBD_MIDI_TX_QUEUE_BUFSIZE 64
-#define USBD_MIDI_TX_QUEUE_BUFMASK (USBD_MIDI_TX_QUEUE_BUFSIZE - 1)
 // descriptor / endpoint settings
 #define USBD_MIDI_IN_EP 0x81
 #define USBD_MIDI_OUT_EP 0x01
 #define USBD_MIDI_EP_SIZE 64
+#define USBD_MIDI_TX_EVENTS (USBD_MIDI_EP_SIZE / 4)  // events in a full IN packet
 #define USBD_MAX_STR_DESC_SIZ         0x100
 #define USBD_SUPPORT_USER_STRING      0  // enable not supported
 // device descriptor constants
@@ -53,6 +51,16 @@ typedef struct {
   __IO uint32_t RxState;   
 } USBD_MIDI_HandleTypeDef;
 
+// USB MIDI IN transfer stats
+struct usbd_midi_tx_stats {
+    uint32_t events;  // events sent
+    uint32_t rt_events;  // realtime events sent from the fast lane
+    uint32_t transfers;  // transfers sent
+    uint32_t full_transfers;  // transfers sent with a full packet
+    uint32_t sof_transfers;  // partial transfers flushed on SOF
+    uint32_t bytes_per_sec;  // average rate since the stats were reset
+};
+
 // external variables
 extern USBD_ClassTypeDef  USBD_MIDI_ClassDriver;
 #define USBD_MIDI_CLASS &USBD_MIDI_ClassDriver
@@ -67,4 +75,10 @@ void usbd_midi_init(void);
 // run the USBD timer task
 void usbd_midi_timer_task(void);
 
+// get the USB MIDI IN transfer stats
+void usbd_midi_get_tx_stats(struct usbd_midi_tx_stats *stats);
+
+// reset the USB MIDI IN transfer stats
+void usbd_midi_reset_tx_stats(void);
+
 #endif
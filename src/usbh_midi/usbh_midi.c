@@ -22,34 +22,13 @@
  */
 #include "usbh_midi.h"
 #include "usbh_conf.h"
+#include "../clock_timer.h"
 #include "../midi/midi_stream.h"
+#include "../midi/midi_usb.h"
 #include "../util/log.h"
 #include "../debug.h"
 #include "../system_stm32f4xx.h"
 
-// code index numbers
-#define MIDI_CIN_MISC_FUNCTION_RESERVED         0x00
-#define MIDI_CIN_CABLE_EVENTS_RESERVED          0x01
-#define MIDI_CIN_2_BYTE_MESSAGE                 0x02
-#define MIDI_CIN_MTC                            0x02
-#define MIDI_CIN_SONG_SELECT                    0x02
-#define MIDI_CIN_3_BYTE_MESSAGE                 0x03
-#define MIDI_CIN_SONG_POSITION                  0x03
-#define MIDI_CIN_SYSEX_START                    0x04
-#define MIDI_CIN_SYSEX_CONTINUE                 0x04
-#define MIDI_CIN_1_BYTE_MESSAGE                 0x05
-#define MIDI_CIN_SYSEX_ENDS_1                   0x05
-#define MIDI_CIN_SYSEX_ENDS_2                   0x06
-#define MIDI_CIN_SYSEX_ENDS_3                   0x07
-#define MIDI_CIN_NOTE_OFF                       0x08
-#define MIDI_CIN_NOTE_ON                        0x09
-#define MIDI_CIN_POLY_KEY_PRESSURE              0x0a
-#define MIDI_CIN_CONTROL_CHANGE                 0x0b
-#define MIDI_CIN_PROGRAM_CHANGE                 0x0c
-#define MIDI_CIN_CHANNEL_PRESSURE               0x0d
-#define MIDI_CIN_PITCH_BEND                     0x0e
-#define MIDI_CIN_SINGLE_BYTE                    0x0f
-
 // class functions
 static USBH_StatusTypeDef USBH_MIDI_InterfaceInit(USBH_HandleTypeDef *phost);
 static USBH_StatusTypeDef USBH_MIDI_InterfaceDeInit(USBH_HandleTypeDef *phost);
@@ -79,6 +58,9 @@ uint8_t usbh_txbuf[USBH_MIDI_TX_BUFSIZE];
 // USB host handle
 USBH_HandleTypeDef hUSBHost;
 
+// receive (IN) SYSEX state for each cable
+struct midi_usb_rx usbh_midi_rx[USBH_MIDI_NUM_PORTS];
+
 // init the USB MIDI host
 void usbh_midi_init(void) {
     // init host library
@@ -110,6 +92,7 @@ void usbh_midi_set_vbus(int state) {
   * @retval USBH Status
   */
 static USBH_StatusTypeDef USBH_MIDI_InterfaceInit(USBH_HandleTypeDef *phost) {
+    int i;
     uint8_t interface;
     USBH_MIDI_HandleTypedef *MIDI_handle;
 
@@ -188,6 +171,9 @@ static USBH_StatusTypeDef USBH_MIDI_InterfaceInit(USBH_HandleTypeDef *phost) {
         MIDI_handle->RxDataState = XFER_IDLE;
         MIDI_handle->pRxData = usbh_rxbuf;
         MIDI_handle->pTxData = usbh_txbuf;
+        for(i = 0; i < USBH_MIDI_NUM_PORTS; i ++) {
+            midi_usb_rx_init(&usbh_midi_rx[i]);
+        }
 
         USBH_LL_SetToggle(phost, MIDI_handle->DataItf.OutPipe, 0);
         USBH_LL_SetToggle(phost, MIDI_handle->DataItf.InPipe, 0);
@@ -263,6 +249,7 @@ static USBH_StatusTypeDef USBH_MIDI_Process(USBH_HandleTypeDef *phost) {
     // this only runs when a device is attached
     struct midi_msg msg;
     int length, cable, cin, i;
+    uint32_t time;
     USBH_URBStateTypeDef urb_status = USBH_URB_IDLE;
     USBH_MIDI_HandleTypedef *MIDI_handle =
         (USBH_MIDI_HandleTypedef*)phost->pActiveClass->pData;
@@ -284,49 +271,17 @@ static USBH_StatusTypeDef USBH_MIDI_Process(USBH_HandleTypeDef *phost) {
             if(length < 4) {
                 break;
             }
+            // the transfer is polled so it finished some time since the last task
+            time = clock_timer_get_time();
             // parse each packet within the stream
             for(i = 0; i < length; i += 4) {
                 cable = (MIDI_handle->pRxData[i] >> 4) & 0x0f;
                 if(cable >= USBH_MIDI_NUM_PORTS) {
                     continue;
                 }
-                cin = MIDI_handle->pRxData[i] & 0x0f;
-                switch(cin) {
-                    case MIDI_CIN_1_BYTE_MESSAGE:  // one byte
-                    case MIDI_CIN_SINGLE_BYTE:
-                        midi_stream_send_byte((USBH_MIDI_PORT_IN + cable),
-                            MIDI_handle->pRxData[i + 1]);
-                        break;
-                    case MIDI_CIN_2_BYTE_MESSAGE:  // two bytes
-                    case MIDI_CIN_SYSEX_ENDS_2:
-                    case MIDI_CIN_PROGRAM_CHANGE:
-                    case MIDI_CIN_CHANNEL_PRESSURE:
-                        midi_stream_send_byte((USBH_MIDI_PORT_IN + cable),
-                            MIDI_handle->pRxData[i + 1]);
-                        midi_stream_send_byte((USBH_MIDI_PORT_IN + cable),
-                            MIDI_handle->pRxData[i + 2]);
-                        break;
-                    case MIDI_CIN_3_BYTE_MESSAGE:  // three bytes
-                    case MIDI_CIN_SYSEX_START:
-                    case MIDI_CIN_SYSEX_ENDS_3:
-                    case MIDI_CIN_NOTE_OFF:
-                    case MIDI_CIN_NOTE_ON:
-                    case MIDI_CIN_POLY_KEY_PRESSURE:
-                    case MIDI_CIN_CONTROL_CHANGE:
-                    case MIDI_CIN_PITCH_BEND:
-                        midi_stream_send_byte((USBH_MIDI_PORT_IN + cable),
-                            MIDI_handle->pRxData[i + 1]);
-                        midi_stream_send_byte((USBH_MIDI_PORT_IN + cable),
-                            MIDI_handle->pRxData[i + 2]);
-                        midi_stream_send_byte((USBH_MIDI_PORT_IN + cable),
-                            MIDI_handle->pRxData[i + 3]);
-                        break;
-                    case MIDI_CIN_CABLE_EVENTS_RESERVED:
-                    case MIDI_CIN_MISC_FUNCTION_RESERVED:
-                    default:
-                        // we can't do anything with this
-                        break;
-                }
+                // decode the event straight into a message
+                midi_usb_rx_event(&usbh_midi_rx[cable], (USBH_MIDI_PORT_IN + cable),
+                    &MIDI_handle->pRxData[i], time);
             }
             // start a new reception
             USBH_BulkReceiveData(phost,
@@ -0,0 +1,171 @@
+/*
+ * RT Task Profiler
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "rt_prof.h"
+#include "log.h"
+#ifdef SIM_HOST
+#include <time.h>
+#else
+#include "stm32f4xx_hal.h"
+#endif
+
+// profiler state
+struct rt_prof_state {
+    int enable;  // 0 = disabled, 1 = enabled
+    struct rt_prof_stats stats[RT_PROF_NUM_TASKS];
+};
+struct rt_prof_state rtprof;
+
+// task names for reporting
+static const char *rt_prof_task_names[RT_PROF_NUM_TASKS] = {
+    "main",
+    "panel_if",
+    "seq_ctrl",
+    "midi_clock",
+    "seq_engine_run",
+    "din_midi",
+    "usbd_midi",
+    "usbh_midi",
+    "ext_flash",
+    "cvproc",
+    "song_snapshot",
+    "song_switch",
+    "song_decode",
+    "song_encode"
+};
+
+// init the profiler - profiling is disabled by default
+void rt_prof_init(void) {
+#ifndef SIM_HOST
+    // enable the DWT cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+    rtprof.enable = 0;
+    rt_prof_reset();
+}
+
+// enable or disable profiling at runtime
+void rt_prof_set_enable(int enable) {
+    if(enable) {
+        rtprof.enable = 1;
+    }
+    else {
+        rtprof.enable = 0;
+    }
+}
+
+// get whether profiling is enabled
+int rt_prof_get_enable(void) {
+    return rtprof.enable;
+}
+
+// reset all stats
+void rt_prof_reset(void) {
+    int task, bin;
+    for(task = 0; task < RT_PROF_NUM_TASKS; task ++) {
+        rtprof.stats[task].calls = 0;
+        rtprof.stats[task].min = 0xffffffff;
+        rtprof.stats[task].max = 0;
+        rtprof.stats[task].total = 0;
+        for(bin = 0; bin < RT_PROF_NUM_BINS; bin ++) {
+            rtprof.stats[task].hist[bin] = 0;
+        }
+    }
+}
+
+// get the start count for a task
+uint32_t rt_prof_start(void) {
+#ifdef SIM_HOST
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+#else
+    return DWT->CYCCNT;
+#endif
+}
+
+// record the time for a task since start
+void rt_prof_end(int task, uint32_t start) {
+    struct rt_prof_stats *stats;
+    uint32_t counts;
+    int bin;
+    if(!rtprof.enable) {
+        return;
+    }
+    if(task < 0 || task >= RT_PROF_NUM_TASKS) {
+        log_error("rpe - task invalid: %d", task);
+        return;
+    }
+    counts = rt_prof_start() - start;  // unsigned math handles wrap
+    stats = &rtprof.stats[task];
+    stats->calls ++;
+    stats->total += counts;
+    if(counts < stats->min) {
+        stats->min = counts;
+    }
+    if(counts > stats->max) {
+        stats->max = counts;
+    }
+    // log2 bin
+    if(counts == 0) {
+        bin = 0;
+    }
+    else {
+        bin = (31 - __builtin_clz(counts)) - RT_PROF_BIN_SHIFT;
+    }
+    if(bin < 0) {
+        bin = 0;
+    }
+    else if(bin >= RT_PROF_NUM_BINS) {
+        bin = RT_PROF_NUM_BINS - 1;
+    }
+    stats->hist[bin] ++;
+}
+
+// get the stats for a task - returns -1 on error
+int rt_prof_get_stats(int task, struct rt_prof_stats *stats) {
+    if(task < 0 || task >= RT_PROF_NUM_TASKS) {
+        log_error("rpgs - task invalid: %d", task);
+        return -1;
+    }
+    *stats = rtprof.stats[task];
+    return 0;
+}
+
+// get the name of a task
+const char *rt_prof_get_task_name(int task) {
+    if(task < 0 || task >= RT_PROF_NUM_TASKS) {
+        return "invalid";
+    }
+    return rt_prof_task_names[task];
+}
+
+// get the number of counts per microsecond
+int rt_prof_get_counts_per_us(void) {
+#ifdef SIM_HOST
+    return 1000;  // ns
+#else
+    return SystemCoreClock / 1000000;
+#endif
+}
@@ -0,0 +1,95 @@
+/*
+ * RT Task Profiler
+ *
+ * Written by: Andrew Kilpatrick
+ * Copyright 2018: Kilpatrick Audio
+ *
+ * This file is part of CARBON.
+ *
+ * CARBON is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CARBON is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CARBON.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Per-task execution time histograms for the RT tasks. On the target the
+ * DWT cycle counter is used. On the host (SIM_HOST) clock_gettime is used
+ * and one count is one nanosecond.
+ *
+ * Usage:
+ *  uint32_t start = rt_prof_start();
+ *  do_task();
+ *  rt_prof_end(RT_PROF_TASK_X, start);
+ *
+ */
+#ifndef RT_PROF_H
+#define RT_PROF_H
+
+#include <inttypes.h>
+
+// profiled tasks - nested tasks are included in their parent's time
+#define RT_PROF_TASK_MAIN 0  // whole 1ms task body
+#define RT_PROF_TASK_PANEL_IF 1  // panel_if_timer_task
+#define RT_PROF_TASK_SEQ_CTRL 2  // seq_ctrl_rt_task
+#define RT_PROF_TASK_MIDI_CLOCK 3  // midi_clock_timer_task (inside seq_ctrl)
+#define RT_PROF_TASK_SEQ_ENGINE_RUN 4  // seq_engine_run (inside midi_clock)
+#define RT_PROF_TASK_DIN_MIDI 5  // din_midi_timer_task
+#define RT_PROF_TASK_USBD_MIDI 6  // usbd_midi_timer_task
+#define RT_PROF_TASK_USBH_MIDI 7  // usbh_midi_timer_task
+#define RT_PROF_TASK_EXT_FLASH 8  // ext_flash_timer_task
+#define RT_PROF_TASK_CVPROC 9  // cvproc_timer_task
+#define RT_PROF_TASK_SONG_SNAPSHOT 10  // song_save snapshot copy (inside seq_ctrl)
+#define RT_PROF_TASK_SONG_SWITCH 11  // switch to a preloaded song (inside seq_engine)
+#define RT_PROF_TASK_SONG_DECODE 12  // decode a loaded song (inside seq_ctrl)
+#define RT_PROF_TASK_SONG_ENCODE 13  // encode part of a song save (inside seq_ctrl)
+#define RT_PROF_NUM_TASKS 14
+
+// histogram - bins are powers of 2 counts
+// bin 0 is < 2^(RT_PROF_BIN_SHIFT+1) - last bin is everything above
+#define RT_PROF_NUM_BINS 16
+#define RT_PROF_BIN_SHIFT 5
+
+// stats for a single task
+struct rt_prof_stats {
+    uint32_t calls;  // number of calls recorded
+    uint32_t min;  // min counts per call
+    uint32_t max;  // max counts per call
+    uint64_t total;  // total counts
+    uint32_t hist[RT_PROF_NUM_BINS];  // histogram of counts per call
+};
+
+// init the profiler - profiling is disabled by default
+void rt_prof_init(void);
+
+// enable or disable profiling at runtime
+void rt_prof_set_enable(int enable);
+
+// get whether profiling is enabled
+int rt_prof_get_enable(void);
+
+// reset all stats
+void rt_prof_reset(void);
+
+// get the start count for a task
+uint32_t rt_prof_start(void);
+
+// record the time for a task since start
+void rt_prof_end(int task, uint32_t start);
+
+// get the stats for a task - returns -1 on error
+int rt_prof_get_stats(int task, struct rt_prof_stats *stats);
+
+// get the name of a task
+const char *rt_prof_get_task_name(int task);
+
+// get the number of counts per microsecond
+int rt_prof_get_counts_per_us(void);
+
+#endif
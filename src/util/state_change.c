@@ -21,54 +21,211 @@
  *
  */
 #include "state_change.h"
+#include "state_change_events.h"
 #include "log.h"
+#include "rt_prof.h"
 #include <stdlib.h>
 
 // settings
-#define STATE_CHANGE_NUM_REGISTERS 256
+#define STATE_CHANGE_NUM_CLASSES 8  // event class index is bits 23:16
+#define STATE_CHANGE_HANDLERS_PER_CLASS 16
+#define STATE_CHANGE_EVENTS_PER_CLASS 64  // event index is bits 15:0
+#define STATE_CHANGE_DEFERRED_PER_CLASS 4
+#define STATE_CHANGE_QUEUE_LEN 64  // must be a power of 2
+#define STATE_CHANGE_QUEUE_MASK (STATE_CHANGE_QUEUE_LEN - 1)
+#define STATE_CHANGE_MAX_ARGS 3
+#define STATE_CHANGE_KEY_ALL_BUT_LAST -1  // latest value wins
+#define STATE_CHANGE_CLASS_INDEX(event) (((event) >> 16) & 0xff)
+#define STATE_CHANGE_EVENT_INDEX(event) ((event) & 0xffff)
+
+// handlers for a single event class - kept compact
+struct state_change_class {
+    void (*handler[STATE_CHANGE_HANDLERS_PER_CLASS])(int event_type, int *data, int data_len);
+    int num_handlers;
+    void (*deferred[STATE_CHANGE_DEFERRED_PER_CLASS])(int event_type, int *data, int data_len);
+    int num_deferred;
+    int8_t coalesce_key[STATE_CHANGE_EVENTS_PER_CLASS];  // args that must match to coalesce
+    int resync_event;  // delivered after events were dropped - -1 = none
+    volatile int resync;  // 1 = events were dropped since the last drain
+    // stats
+    uint32_t fire_count[STATE_CHANGE_EVENTS_PER_CLASS];  // times each event was fired
+    uint32_t handler_time[STATE_CHANGE_EVENTS_PER_CLASS];  // rt_prof counts in handlers
+};
+
+// a queued event for deferred handlers
+struct state_change_queued {
+    int event_type;
+    int data[STATE_CHANGE_MAX_ARGS];
+    int data_len;
+};
 
 // state
 struct state_change {
-    void (*handler[STATE_CHANGE_NUM_REGISTERS])(int event_type, int *data, int data_len);
-    int event_class_map[STATE_CHANGE_NUM_REGISTERS];
+    struct state_change_class cls[STATE_CHANGE_NUM_CLASSES];
+    // deferred event queue - filled by fire and emptied by drain
+    struct state_change_queued queue[STATE_CHANGE_QUEUE_LEN];
+    volatile int queue_inp;
+    volatile int queue_outp;
+    // deferred stats
+    uint32_t queued_count;
+    uint32_t coalesced_count;
+    uint32_t dropped_count;
+    uint32_t resync_count;
 };
 struct state_change schstate;
 
+// local functions
+void state_change_enqueue(struct state_change_class *cls, int event,
+    int event_type, int *data, int data_len);
+
 // init the state change system
 void state_change_init(void) {
-    int i;
-    for(i = 0; i < STATE_CHANGE_NUM_REGISTERS; i ++) {
-        schstate.handler[i] = NULL;
-        schstate.event_class_map[i] = -1;
+    int i, j;
+    for(i = 0; i < STATE_CHANGE_NUM_CLASSES; i ++) {
+        schstate.cls[i].num_handlers = 0;
+        schstate.cls[i].num_deferred = 0;
+        schstate.cls[i].resync_event = -1;
+        schstate.cls[i].resync = 0;
+        for(j = 0; j < STATE_CHANGE_EVENTS_PER_CLASS; j ++) {
+            schstate.cls[i].coalesce_key[j] = STATE_CHANGE_KEY_ALL_BUT_LAST;
+        }
     }
+    // step events identify a step rather than carry a value
+    state_change_set_coalesce_key(SCE_SONG_CLEAR_STEP, 3);
+    state_change_set_coalesce_key(SCE_SONG_CLEAR_STEP_EVENT, 3);
+    state_change_set_coalesce_key(SCE_SONG_ADD_STEP_EVENT, 3);
+    state_change_set_coalesce_key(SCE_SONG_SET_STEP_EVENT, 3);
+    state_change_set_coalesce_key(SCE_SONG_START_DELAY, 3);
+    state_change_set_coalesce_key(SCE_SONG_RATCHET_MODE, 3);
+    // bulk changes like a song clear fire more events than the queue holds
+    state_change_set_resync_event(SCE_SONG_RESYNC);
+    state_change_set_resync_event(SCE_CTRL_RESYNC);
+    state_change_set_resync_event(SCE_ENG_RESYNC);
+    schstate.queue_inp = 0;
+    schstate.queue_outp = 0;
+    state_change_reset_stats();
 }
 
 // register a listener
 void state_change_register(void (*handler)(int, int*, int), int event_class) {
-    int i;
-    // search for a free slot and insert it
-    for(i = 0; i < STATE_CHANGE_NUM_REGISTERS; i ++) {
-        if(schstate.handler[i] == NULL) {
-            schstate.handler[i] = (void (*)(int, int*, int))handler;
-            schstate.event_class_map[i] = event_class;
-            return;
-        }
+    struct state_change_class *cls;
+    int index = STATE_CHANGE_CLASS_INDEX(event_class);
+    if(index >= STATE_CHANGE_NUM_CLASSES) {
+        log_error("scr - event_class invalid: %d", event_class);
+        return;
     }
-    log_error("scr - no more handler slots for event_class: %d", event_class);
+    cls = &schstate.cls[index];
+    if(cls->num_handlers >= STATE_CHANGE_HANDLERS_PER_CLASS) {
+        log_error("scr - no more handler slots for event_class: %d", event_class);
+        return;
+    }
+    cls->handler[cls->num_handlers] = handler;
+    cls->num_handlers ++;
+}
+
+// register a deferred listener - called from state_change_drain_deferred()
+void state_change_register_deferred(void (*handler)(int, int*, int), int event_class) {
+    struct state_change_class *cls;
+    int index = STATE_CHANGE_CLASS_INDEX(event_class);
+    if(index >= STATE_CHANGE_NUM_CLASSES) {
+        log_error("scrd - event_class invalid: %d", event_class);
+        return;
+    }
+    cls = &schstate.cls[index];
+    if(cls->num_deferred >= STATE_CHANGE_DEFERRED_PER_CLASS) {
+        log_error("scrd - no more handler slots for event_class: %d", event_class);
+        return;
+    }
+    cls->deferred[cls->num_deferred] = handler;
+    cls->num_deferred ++;
+}
+
+// set how many leading args must match for a queued event to be coalesced
+void state_change_set_coalesce_key(int event_type, int key_len) {
+    int index = STATE_CHANGE_CLASS_INDEX(event_type);
+    int event = STATE_CHANGE_EVENT_INDEX(event_type);
+    if(index >= STATE_CHANGE_NUM_CLASSES || event >= STATE_CHANGE_EVENTS_PER_CLASS) {
+        log_error("scsck - event_type invalid: %d", event_type);
+        return;
+    }
+    if(key_len < 0 || key_len > STATE_CHANGE_MAX_ARGS) {
+        log_error("scsck - key_len invalid: %d", key_len);
+        return;
+    }
+    schstate.cls[index].coalesce_key[event] = key_len;
+}
+
+// set the event delivered to the deferred handlers of a class instead of
+// the events that didn't fit in the queue
+void state_change_set_resync_event(int event_type) {
+    int index = STATE_CHANGE_CLASS_INDEX(event_type);
+    if(index >= STATE_CHANGE_NUM_CLASSES) {
+        log_error("scsre - event_type invalid: %d", event_type);
+        return;
+    }
+    schstate.cls[index].resync_event = event_type;
 }
 
 // fire an event
 void state_change_fire(int event_type, int *data, int data_len) {
-    int i;
-    int cls = event_type & 0xff0000;
+    struct state_change_class *cls;
+    int i, event, prof;
+    uint32_t start = 0;
+    int index = STATE_CHANGE_CLASS_INDEX(event_type);
+    if(index >= STATE_CHANGE_NUM_CLASSES) {
+        log_error("scf - event_type invalid: %d", event_type);
+        return;
+    }
+    cls = &schstate.cls[index];
+    event = STATE_CHANGE_EVENT_INDEX(event_type);
+    if(event >= STATE_CHANGE_EVENTS_PER_CLASS) {
+        event = STATE_CHANGE_EVENTS_PER_CLASS - 1;  // stats share the last slot
+    }
+    cls->fire_count[event] ++;
 
-    // search through registered handlers and fire
-    for(i = 0; i < STATE_CHANGE_NUM_REGISTERS; i ++) {
-        if(schstate.handler[i] == NULL) {
+    // call only the handlers registered for this class
+    prof = rt_prof_get_enable();
+    if(prof) {
+        start = rt_prof_start();
+    }
+    for(i = 0; i < cls->num_handlers; i ++) {
+        (*cls->handler[i])(event_type, data, data_len);  // call the stored callback
+    }
+    if(prof) {
+        cls->handler_time[event] += rt_prof_start() - start;
+    }
+
+    // queue for the deferred handlers
+    if(cls->num_deferred) {
+        state_change_enqueue(cls, event, event_type, data, data_len);
+    }
+}
+
+// deliver queued events to the deferred handlers - run on the main polling loop
+void state_change_drain_deferred(void) {
+    struct state_change_queued q;
+    struct state_change_class *cls;
+    int i, j;
+    while(schstate.queue_outp != schstate.queue_inp) {
+        // the head entry is never touched by fire so it is safe to copy
+        q = schstate.queue[schstate.queue_outp];
+        schstate.queue_outp = (schstate.queue_outp + 1) & STATE_CHANGE_QUEUE_MASK;
+        cls = &schstate.cls[STATE_CHANGE_CLASS_INDEX(q.event_type)];
+        for(i = 0; i < cls->num_deferred; i ++) {
+            (*cls->deferred[i])(q.event_type, q.data, q.data_len);
+        }
+    }
+    // classes that dropped events get refreshed after everything that was queued
+    // - events fired after the flag is cleared are queued for the next drain
+    for(i = 0; i < STATE_CHANGE_NUM_CLASSES; i ++) {
+        cls = &schstate.cls[i];
+        if(!cls->resync) {
             continue;
         }
-        else if(schstate.event_class_map[i] == cls) {
-            (*schstate.handler[i])(event_type, data, data_len);  // call the stored callback
+        cls->resync = 0;
+        schstate.resync_count ++;
+        for(j = 0; j < cls->num_deferred; j ++) {
+            (*cls->deferred[j])(cls->resync_event, NULL, 0);
         }
     }
 }
@@ -102,3 +259,121 @@ void state_change_fire3(int event_type, int data0, int data1, int data2) {
     state_change_fire(event_type, data, 3);
 }
 
+// get the deferred queue stats
+void state_change_get_deferred_stats(uint32_t *queued, uint32_t *coalesced,
+        uint32_t *dropped) {
+    *queued = schstate.queued_count;
+    *coalesced = schstate.coalesced_count;
+    *dropped = schstate.dropped_count;
+}
+
+// get the number of times deferred handlers were sent a resync
+uint32_t state_change_get_resync_count(void) {
+    return schstate.resync_count;
+}
+
+// get the number of times an event has been fired
+uint32_t state_change_get_fire_count(int event_type) {
+    int index = STATE_CHANGE_CLASS_INDEX(event_type);
+    int event = STATE_CHANGE_EVENT_INDEX(event_type);
+    if(index >= STATE_CHANGE_NUM_CLASSES || event >= STATE_CHANGE_EVENTS_PER_CLASS) {
+        return 0;
+    }
+    return schstate.cls[index].fire_count[event];
+}
+
+// get the total time spent in handlers for an event in rt_prof counts
+// this is only collected while rt_prof is enabled
+uint32_t state_change_get_handler_time(int event_type) {
+    int index = STATE_CHANGE_CLASS_INDEX(event_type);
+    int event = STATE_CHANGE_EVENT_INDEX(event_type);
+    if(index >= STATE_CHANGE_NUM_CLASSES || event >= STATE_CHANGE_EVENTS_PER_CLASS) {
+        return 0;
+    }
+    return schstate.cls[index].handler_time[event];
+}
+
+// reset the fire count and handler time stats
+void state_change_reset_stats(void) {
+    int i, j;
+    for(i = 0; i < STATE_CHANGE_NUM_CLASSES; i ++) {
+        for(j = 0; j < STATE_CHANGE_EVENTS_PER_CLASS; j ++) {
+            schstate.cls[i].fire_count[j] = 0;
+            schstate.cls[i].handler_time[j] = 0;
+        }
+    }
+    schstate.queued_count = 0;
+    schstate.coalesced_count = 0;
+    schstate.dropped_count = 0;
+    schstate.resync_count = 0;
+}
+
+//
+// local functions
+//
+// queue an event for the deferred handlers or coalesce it with a pending one
+void state_change_enqueue(struct state_change_class *cls, int event,
+        int event_type, int *data, int data_len) {
+    struct state_change_queued *q;
+    int i, pos, key_len, next;
+    if(data_len > STATE_CHANGE_MAX_ARGS) {
+        log_error("sce - data_len invalid: %d", data_len);
+        return;
+    }
+    key_len = cls->coalesce_key[event];
+    if(key_len == STATE_CHANGE_KEY_ALL_BUT_LAST || key_len > data_len) {
+        key_len = data_len - 1;
+    }
+    if(key_len < 0) {
+        key_len = 0;
+    }
+    // the class is refreshed on the next drain - nothing to queue until then
+    if(cls->resync) {
+        schstate.dropped_count ++;
+        return;
+    }
+
+    // look for a pending event with the same key - skip the head entry
+    // since the drain might be copying it right now
+    pos = (schstate.queue_outp + 1) & STATE_CHANGE_QUEUE_MASK;
+    if(schstate.queue_outp == schstate.queue_inp) {
+        pos = schstate.queue_inp;
+    }
+    for(; pos != schstate.queue_inp; pos = (pos + 1) & STATE_CHANGE_QUEUE_MASK) {
+        q = &schstate.queue[pos];
+        if(q->event_type != event_type || q->data_len != data_len) {
+            continue;
+        }
+        for(i = 0; i < key_len; i ++) {
+            if(q->data[i] != data[i]) {
+                break;
+            }
+        }
+        if(i == key_len) {
+            // latest value wins
+            for(i = key_len; i < data_len; i ++) {
+                q->data[i] = data[i];
+            }
+            schstate.coalesced_count ++;
+            return;
+        }
+    }
+
+    // add a new entry
+    next = (schstate.queue_inp + 1) & STATE_CHANGE_QUEUE_MASK;
+    if(next == schstate.queue_outp) {
+        schstate.dropped_count ++;
+        if(cls->resync_event != -1) {
+            cls->resync = 1;
+        }
+        return;
+    }
+    q = &schstate.queue[schstate.queue_inp];
+    q->event_type = event_type;
+    for(i = 0; i < data_len; i ++) {
+        q->data[i] = data[i];
+    }
+    q->data_len = data_len;
+    schstate.queue_inp = next;
+    schstate.queued_count ++;
+}
@@ -23,12 +23,29 @@
 #ifndef STATE_CHANGE_H
 #define STATE_CHANGE_H
 
+#include <inttypes.h>
+
 // init the state change system
 void state_change_init(void);
 
 // register a listener
 void state_change_register(void (*handler)(int, int*, int), int event_class);
 
+// register a deferred listener - called from state_change_drain_deferred()
+// events for the class are queued by fire and repeated events with the same
+// key are coalesced so that only the latest value is delivered
+// deferred handlers must not fire events themselves
+void state_change_register_deferred(void (*handler)(int, int*, int), int event_class);
+
+// set how many leading args must match for a queued event to be coalesced
+// the default is all args but the last - e.g. the latest active step per track
+void state_change_set_coalesce_key(int event_type, int key_len);
+
+// set the event delivered to the deferred handlers of a class instead of
+// the events that didn't fit in the queue - the handlers must refresh
+// everything they show for the class when they get it
+void state_change_set_resync_event(int event_type);
+
 // fire an event
 void state_change_fire(int event_type, int *data, int data_len);
 
@@ -44,5 +61,26 @@ void state_change_fire2(int event_type, int data0, int data1);
 // fire an event with 3 arguments
 void state_change_fire3(int event_type, int data0, int data1, int data2);
 
+// deliver queued events to the deferred handlers - run on the main polling loop
+void state_change_drain_deferred(void);
+
+// get the deferred queue stats
+// dropped events are the ones that didn't fit and were replaced by a resync
+void state_change_get_deferred_stats(uint32_t *queued, uint32_t *coalesced,
+    uint32_t *dropped);
+
+// get the number of times deferred handlers were sent a resync
+uint32_t state_change_get_resync_count(void);
+
+// get the number of times an event has been fired
+uint32_t state_change_get_fire_count(int event_type);
+
+// get the total time spent in handlers for an event in rt_prof counts
+// this is only collected while rt_prof is enabled
+uint32_t state_change_get_handler_time(int event_type);
+
+// reset the fire count and handler time stats
+void state_change_reset_stats(void);
+
 #endif
 
@@ -36,7 +36,7 @@ enum STATE_CHANGE_EVENT_CLASS {
 enum STATE_CHANGE_EVENT {
     // song events
     SCE_SONG_CLEARED = SCEC_SONG,  // arg0 = song_num
-    SCE_SONG_LOADED,  // arg0 = song_num
+    SCE_SONG_LOADED,  // arg0 = song_num, arg1 = 1 if switched in while running (optional)
     SCE_SONG_LOAD_ERROR,  // arg0 = song_num
     SCE_SONG_SAVED,  // arg0 = song_num
     SCE_SONG_SAVE_ERROR,  // arg0 = song_num
@@ -86,6 +86,7 @@ enum STATE_CHANGE_EVENT {
     SCE_SONG_SET_STEP_EVENT,  // arg0 = scene, arg1 = track, arg2 = step
     SCE_SONG_START_DELAY,  // arg0 = scene, arg1 = track, arg2 = step
     SCE_SONG_RATCHET_MODE,  // arg0 = scene, arg1 = track, arg1 = step
+    SCE_SONG_RESYNC,  // no args - deferred only - song events were dropped
     // control events
     SCE_CTRL_RUN_STATE = SCEC_CTRL,  // arg0 = state
     SCE_CTRL_TRACK_SELECT,  // arg0 = track, arg1 = select
@@ -96,11 +97,13 @@ enum STATE_CHANGE_EVENT {
     SCE_CTRL_CLOCK_BEAT,  // no args
     SCE_CTRL_EXT_TEMPO,  // no args
     SCE_CTRL_EXT_SYNC,  // arg0: ext synced
+    SCE_CTRL_RESYNC,  // no args - deferred only - control events were dropped
     // engine events
     SCE_ENG_CURRENT_SCENE = SCEC_ENG,  // arg0 = scene
     SCE_ENG_ACTIVE_STEP,  // arg0 = track, arg1 = step
     SCE_ENG_SONG_MODE_STATUS,  // arg0 = none
     SCE_ENG_KBTRANS,  // arg0 = trans
+    SCE_ENG_RESYNC,  // no args - deferred only - engine events were dropped
     // config events
     SCE_CONFIG_LOADED = SCEC_CONFIG,  // no args
     SCE_CONFIG_CLEARED,  // no args